@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
 #include <pthread.h>
 
 #include <boost/timer/timer.hpp>
@@ -18,6 +19,7 @@ Agent::Agent() {
     _numWorkers = Config::getInstance().getAgentNumWorkers();
     _containerManager = new ContainerManager();
     _coordinator = new AgentCoordinator(_containerManager);
+    _peers = new PeerConnectionPool(&_cxt, Config::getInstance().getAgentNumPeerConnections());
     pthread_mutex_init(&_stats.lock, NULL);
 
     // init statistics
@@ -31,11 +33,14 @@ Agent::~Agent() {
 
     // stop the proxy for delivering chunk events (so the workers will stop)
     delete _io;
+    // close the idle connections to other agents, which would otherwise block closing the context
+    _peers->close();
     _cxt.close();
 
     // join worker threads
     for (int i = 0; i < _numWorkers; i++)
         pthread_join(_workers[i], NULL);
+    delete _peers;
 
     // wait the workers to end working with the coordinator and container manager
     delete _coordinator;
@@ -214,12 +219,17 @@ void *Agent::handleChunkEvent(void *arg) {
         case Opcode::ENC_CHUNK_REQ:
             {
                 Chunk *encodedChunk = new Chunk[1];
+                bool encoded = false;
                 if (encodedChunk == NULL) {
                     LOG(ERROR) << "Failed to allocate memory for encoded chunk";
+                } else if (event.sliceLength > 0) {
+                    // encode a slice of chunks only, which is empty beyond the end of chunks
+                    encoded = self->encodeChunkSlice(event, *encodedChunk);
                 } else {
                     *encodedChunk = self->_containerManager->getEncodedChunks(event.containerIds, event.chunks, event.numChunks, event.codingMeta.codingState);
+                    encoded = encodedChunk->size > 0;
                 }
-                if (encodedChunk && encodedChunk->size > 0) {
+                if (encoded) {
                     ChunkEvent temp = event; // let the original event be freed
                     LOG(INFO) << "Encode " << event.numChunks << " chunks in containers in " << mytimer.elapsed().wall * 1.0 / 1e9 << " seconds";
                     event.opcode = Opcode::ENC_CHUNK_REP_SUCCESS;
@@ -227,6 +237,8 @@ void *Agent::handleChunkEvent(void *arg) {
                     event.chunks = encodedChunk;     // free the chunk pointer after the event is sent
                     event.chunks[0].freeData = true; // free after the event is sent
                     event.containerIds = 0;
+                    event.chunkGroupMap = 0;
+                    event.containerGroupMap = 0;
                     event.codingMeta = CodingMeta();
                     self->incrementOp();
                 } else {
@@ -248,12 +260,14 @@ void *Agent::handleChunkEvent(void *arg) {
             // start repairing
             bool isCAR = event.repairUsingCAR;
             bool useEncode = isCAR;
+            // repair the chunk slice by slice instead of getting whole partial encoded chunks, if enabled
+            bool useSlices = isCAR && event.numChunks == 1 && Config::getInstance().getAgentRepairSliceSize() > 0;
             int numChunksPerNode = 1;
-            int numReq = isCAR? event.numChunkGroups : event.chunkGroupMap[0];
+            int numReq = useSlices? 0 : isCAR? event.numChunkGroups : event.chunkGroupMap[0];
             // construct the requests for input chunks
             ChunkEvent getInputEvents[numReq * 2];
             IO::RequestMeta meta[numReq];
-            pthread_t rt[numReq];
+            bool received[numReq];
             unsigned char matrix[numReq];
             unsigned char namespaceId = event.chunks[0].getNamespaceId();
             boost::uuids::uuid fileuuid = event.chunks[0].getFileUUID();
@@ -297,30 +311,26 @@ void *Agent::handleChunkEvent(void *arg) {
                 // setup request metadata
                 meta[i].isFromProxy = false;
                 meta[i].containerId = event.containerGroupMap[cpos];
-                meta[i].cxt = &(self->_cxt);
                 epos = event.agents.find(';', spos);
                 meta[i].address = event.agents.substr(spos, epos - spos);
                 spos = epos + 1;
                 meta[i].request = &getInputEvents[i];
                 meta[i].reply = &getInputEvents[numReq + i];
-                // send the request
-                pthread_create(&rt[i], NULL, IO::sendChunkRequestToAgent, (void *) &meta[i]);
                 // increment chunk list position
                 cpos += numChunks;
             }
+            // send the requests to the agents over pooled connections, and wait for all replies
+            self->_peers->request(meta, numReq, received);
             // check the chunk replies
             bool allsuccess = true;
             unsigned char *input[numReq], *output[event.numChunks];
             int chunkSize = 0;
             for (int i = 0; i < numReq; i++) {
-                // wait for the request to complete
-                void *ptr = 0;
-                pthread_join(rt[i], &ptr);
                 // avoid freeing reference to local variables
                 getInputEvents[i].containerIds = 0; 
                 getInputEvents[i].codingMeta.codingState = 0; 
                 Opcode expectedOp = useEncode? ENC_CHUNK_REP_SUCCESS : GET_CHUNK_REP_SUCCESS;
-                if (ptr != 0 || meta[i].reply->opcode != expectedOp) {
+                if (!received[i] || meta[i].reply->opcode != expectedOp) {
                     LOG(ERROR) << "Failed to operate on chunk (" << ENC_CHUNK_REQ << ") due to internal failure, container id = " << meta[i].containerId << ", return opcode =" << meta[i].reply->opcode;
                     allsuccess = false;
                     continue;
@@ -328,8 +338,10 @@ void *Agent::handleChunkEvent(void *arg) {
                 input[i] = meta[i].reply->chunks[0].data;
                 chunkSize = meta[i].reply->chunks[0].size;
             }
+            if (useSlices)
+                allsuccess = self->repairChunkBySlices(event, event.chunks[0]);
             // start repair after getting all required chunks
-            if (allsuccess) {
+            if (allsuccess && !useSlices) {
                 for (int i = 0; i < event.numChunks; i++) {
                     event.chunks[i].data = (unsigned char *) malloc (chunkSize);
                     event.chunks[i].size = chunkSize;
@@ -337,6 +349,8 @@ void *Agent::handleChunkEvent(void *arg) {
                 }
                 // do decoding
                 CodingUtils::encode(input, numReq, output, event.numChunks, chunkSize, isCAR? matrix : event.codingMeta.codingState);
+            }
+            if (allsuccess) {
                 // compute checksum
                 for (int i = 0; i < event.numChunks; i++) {
                     event.chunks[i].computeMD5();
@@ -346,7 +360,9 @@ void *Agent::handleChunkEvent(void *arg) {
                 int numChunkReqsToSend = numChunksToSend / numChunksPerNode;
                 ChunkEvent storeChunkEvents[numChunkReqsToSend * 2];
                 IO::RequestMeta storeChunkMeta[numChunkReqsToSend];
-                pthread_t wt[numChunkReqsToSend];
+                zmq::socket_t *storeSockets[numChunkReqsToSend];
+                bool stored[numChunkReqsToSend];
+                int numStoreReqs = 0;
                 for (int i = 0; i < numChunkReqsToSend; i++) {
                     // setup the request
                     storeChunkEvents[i].id = self->_eventCount.fetch_add(1);
@@ -371,13 +387,13 @@ void *Agent::handleChunkEvent(void *arg) {
                     storeChunkMeta[i].containerId = event.containerIds[i + 1];
                     storeChunkMeta[i].request = &storeChunkEvents[i];
                     storeChunkMeta[i].reply = &storeChunkEvents[i + numChunkReqsToSend];
-                    storeChunkMeta[i].cxt = &(self->_cxt);
                     epos = event.agents.find(';', spos);
                     storeChunkMeta[i].address = event.agents.substr(spos, epos - spos);
                     spos = epos + 1;
-                    // send the request and wait for reply
-                    pthread_create(&wt[i], NULL, IO::sendChunkRequestToAgent, (void *) &storeChunkMeta[i]);
+                    numStoreReqs++;
                 }
+                // send the requests, and collect the replies after storing chunks locally
+                self->_peers->sendRequests(storeChunkMeta, numStoreReqs, storeSockets);
                 int numLocalChunks = isCAR? event.numChunks : numChunksPerNode;
                 int localContainerIds[numLocalChunks];
                 for (int i = 0; i < numLocalChunks; i++)
@@ -389,11 +405,9 @@ void *Agent::handleChunkEvent(void *arg) {
                     LOG(ERROR) << "Failed to put " << numLocalChunks << " repaired chunks into containers";
                     allsuccess = false;
                 }
-                // TODO check if other chunks are stored successfully
-                for (int i = 0; i < numChunkReqsToSend; i++) {
-                    void *ptr = 0;
-                    pthread_join(wt[i], &ptr);
-                    if (ptr != 0 || storeChunkMeta[i].reply->opcode != Opcode::PUT_CHUNK_REP_SUCCESS) {
+                self->_peers->waitForReplies(storeChunkMeta, numStoreReqs, storeSockets, stored);
+                for (int i = 0; i < numStoreReqs; i++) {
+                    if (!stored[i] || storeChunkMeta[i].reply->opcode != Opcode::PUT_CHUNK_REP_SUCCESS) {
                         LOG(ERROR) << "Failed to put " << storeChunkMeta[i].request->numChunks 
                                    << " repaired chunk (" << storeChunkMeta[i].request->chunks[0].getChunkId() << ")"
                                    << " to container " << storeChunkMeta[i].containerId
@@ -499,6 +513,239 @@ void *Agent::handleChunkEvent(void *arg) {
     return NULL;
 }
 
+bool Agent::getChunkGroups(const ChunkEvent &event, int coefficientOffset, std::vector<ChunkGroup> &groups) {
+    if (event.codingMeta.codingStateSize < coefficientOffset + event.numInputChunks) {
+        LOG(ERROR) << "Insufficient coding coefficients for " << event.numInputChunks << " chunks in chunk groups, " << event.codingMeta.codingStateSize << " vs " << coefficientOffset + event.numInputChunks;
+        return false;
+    }
+
+    groups.clear();
+    groups.resize(event.numChunkGroups);
+    int cpos = 0; // chunk list starting position
+    size_t spos = 0, epos = 0; // agent address positions
+    for (int i = 0; i < event.numChunkGroups; i++) {
+        ChunkGroup &group = groups.at(i);
+        int numChunks = event.chunkGroupMap[cpos + i];
+        epos = event.agents.find(';', spos);
+        if (numChunks <= 0 || cpos + numChunks > event.numInputChunks || epos == std::string::npos) {
+            LOG(ERROR) << "Invalid chunk group " << i << " of " << event.numChunkGroups << " with " << numChunks << " chunks";
+            return false;
+        }
+        group.address = event.agents.substr(spos, epos - spos);
+        spos = epos + 1;
+        group.chunkIds.assign(&event.chunkGroupMap[cpos + i + 1], &event.chunkGroupMap[cpos + i + 1 + numChunks]);
+        group.containerIds.assign(&event.containerGroupMap[cpos], &event.containerGroupMap[cpos + numChunks]);
+        group.coefficients.assign(&event.codingMeta.codingState[coefficientOffset + cpos], &event.codingMeta.codingState[coefficientOffset + cpos + numChunks]);
+        cpos += numChunks;
+    }
+    return true;
+}
+
+void Agent::setupEncodeSliceRequest(ChunkEvent &request, const std::vector<ChunkGroup> &groups, size_t first, size_t last, const Chunk &file, unsigned long int offset, int length) {
+    // release any request set up before
+    request.release();
+    request.agents.clear();
+    delete [] request.codingMeta.codingState;
+    request.codingMeta.reset();
+
+    // chunks to encode
+    const ChunkGroup &group = groups.at(first);
+    int numChunks = group.chunkIds.size();
+    request.id = _eventCount.fetch_add(1);
+    request.opcode = Opcode::ENC_CHUNK_REQ;
+    request.numChunks = numChunks;
+    request.containerIds = new int[numChunks];
+    request.chunks = new Chunk[numChunks];
+    for (int j = 0; j < numChunks; j++) {
+        request.containerIds[j] = group.containerIds.at(j);
+        request.chunks[j].setId(file.getNamespaceId(), file.getFileUUID(), group.chunkIds.at(j));
+        request.chunks[j].fileVersion = file.getFileVersion();
+        request.chunks[j].size = 0;
+        request.chunks[j].data = 0;
+    }
+
+    // chunk groups of the rest of the repair chain, with their coefficients after those of the chunks to encode
+    int numChainChunks = 0;
+    for (size_t i = first + 1; i < last; i++)
+        numChainChunks += groups.at(i).chunkIds.size();
+    request.numChunkGroups = last - first - 1;
+    request.numInputChunks = numChainChunks;
+    request.chunkGroupMap = (int *) malloc (sizeof(int) * (request.numChunkGroups + numChainChunks));
+    request.containerGroupMap = (int *) malloc (sizeof(int) * numChainChunks);
+    request.codingMeta.codingStateSize = numChunks + numChainChunks;
+    request.codingMeta.codingState = new unsigned char [request.codingMeta.codingStateSize];
+    request.repairUsingCAR = true;
+    std::copy(group.coefficients.begin(), group.coefficients.end(), request.codingMeta.codingState);
+    int gpos = 0, cpos = 0;
+    for (size_t i = first + 1; i < last; i++) {
+        const ChunkGroup &next = groups.at(i);
+        request.chunkGroupMap[gpos++] = next.chunkIds.size();
+        for (size_t j = 0; j < next.chunkIds.size(); j++, cpos++) {
+            request.chunkGroupMap[gpos++] = next.chunkIds.at(j);
+            request.containerGroupMap[cpos] = next.containerIds.at(j);
+            request.codingMeta.codingState[numChunks + cpos] = next.coefficients.at(j);
+        }
+        request.agents.append(next.address).append(";");
+    }
+
+    // the slice
+    request.sliceOffset = offset;
+    request.sliceLength = length;
+}
+
+bool Agent::encodeChunkSlice(ChunkEvent &event, Chunk &codedChunk) {
+    std::vector<ChunkGroup> chain;
+    if (!getChunkGroups(event, event.numChunks, chain))
+        return false;
+
+    // pass the request on to the rest of the repair chain first, so the agents down the chain work on the slice in parallel
+    ChunkEvent chainEvents[2];
+    IO::RequestMeta meta;
+    zmq::socket_t *socket = NULL;
+    if (!chain.empty()) {
+        setupEncodeSliceRequest(chainEvents[0], chain, 0, chain.size(), event.chunks[0], event.sliceOffset, event.sliceLength);
+        meta.isFromProxy = false;
+        meta.containerId = chain.at(0).containerIds.at(0);
+        meta.address = chain.at(0).address;
+        meta.request = &chainEvents[0];
+        meta.reply = &chainEvents[1];
+        _peers->sendRequests(&meta, 1, &socket);
+    }
+
+    // encode the local slice
+    bool success = _containerManager->getEncodedChunkSlice(event.containerIds, event.chunks, event.numChunks, event.codingMeta.codingState, event.sliceOffset, event.sliceLength, codedChunk);
+    if (chain.empty())
+        return success;
+
+    bool received = false;
+    _peers->waitForReplies(&meta, 1, &socket, &received);
+    Chunk *chainChunk = chainEvents[1].chunks;
+    if (!received || chainEvents[1].opcode != Opcode::ENC_CHUNK_REP_SUCCESS || chainEvents[1].numChunks != 1) {
+        LOG(ERROR) << "Failed to encode the slice at offset " << event.sliceOffset << " on the repair chain at " << meta.address;
+        return false;
+    }
+    if (!success)
+        return false;
+    if (chainChunk[0].size != codedChunk.size) {
+        LOG(ERROR) << "Slice size mismatch on the repair chain at " << meta.address << ", " << chainChunk[0].size << " vs " << codedChunk.size;
+        return false;
+    }
+    if (codedChunk.size == 0)
+        return true;
+
+    // add the partial encoded slice from the rest of the repair chain
+    unsigned char *input[2] = { codedChunk.data, chainChunk[0].data };
+    unsigned char *output = (unsigned char *) malloc (codedChunk.size);
+    unsigned char matrix[2] = { 1, 1 };
+    if (output == NULL) {
+        LOG(ERROR) << "Failed to allocate memory for the encoded slice";
+        return false;
+    }
+    CodingUtils::encode(input, 2, &output, 1, codedChunk.size, matrix);
+    free(codedChunk.data);
+    codedChunk.data = output;
+    return true;
+}
+
+bool Agent::repairChunkBySlices(ChunkEvent &event, Chunk &chunk) {
+    std::vector<ChunkGroup> groups;
+    if (!getChunkGroups(event, 0, groups) || groups.empty())
+        return false;
+
+    // either ask each chunk group for its partial encoded slice, or ask the first group which passes the request along the chain
+    int sliceSize = Config::getInstance().getAgentRepairSliceSize();
+    bool useChain = Config::getInstance().getAgentRepairChain() && groups.size() > 1;
+    int numReqPerSlice = useChain? 1 : groups.size();
+    int numReqs = numReqPerSlice * REPAIR_SLICE_WINDOW;
+
+    // requests of the slices in flight, where slice i uses slot (i % REPAIR_SLICE_WINDOW)
+    ChunkEvent sliceEvents[numReqs * 2];
+    IO::RequestMeta meta[numReqs];
+    zmq::socket_t *sockets[numReqs];
+    bool received[numReqPerSlice];
+    unsigned char *input[numReqPerSlice];
+    unsigned char matrix[numReqPerSlice];
+    for (int i = 0; i < numReqPerSlice; i++)
+        matrix[i] = 1;
+
+    unsigned char *data = NULL;
+    unsigned long int size = 0, capacity = 0;
+    unsigned long int numSent = 0, numDone = 0;
+    bool allsuccess = true, lastSlice = false;
+    // the repair succeeds once all slices up to the last (short) one are assembled
+    while (allsuccess && !lastSlice) {
+        // keep a window of slices in flight, so the reads, encoding, and transfers of consecutive slices overlap
+        for (; !lastSlice && numSent < numDone + REPAIR_SLICE_WINDOW; numSent++) {
+            int base = (numSent % REPAIR_SLICE_WINDOW) * numReqPerSlice;
+            for (int i = 0; i < numReqPerSlice; i++) {
+                setupEncodeSliceRequest(sliceEvents[base + i], groups, i, useChain? groups.size() : i + 1, event.chunks[0], numSent * sliceSize, sliceSize);
+                sliceEvents[numReqs + base + i].release();
+                meta[base + i].isFromProxy = false;
+                meta[base + i].containerId = groups.at(i).containerIds.at(0);
+                meta[base + i].address = groups.at(i).address;
+                meta[base + i].request = &sliceEvents[base + i];
+                meta[base + i].reply = &sliceEvents[numReqs + base + i];
+            }
+            _peers->sendRequests(&meta[base], numReqPerSlice, &sockets[base]);
+        }
+
+        // collect the earliest slice in flight
+        int base = (numDone % REPAIR_SLICE_WINDOW) * numReqPerSlice;
+        _peers->waitForReplies(&meta[base], numReqPerSlice, &sockets[base], received);
+        numDone++;
+        int length = -1;
+        for (int i = 0; i < numReqPerSlice; i++) {
+            ChunkEvent *reply = meta[base + i].reply;
+            if (!received[i] || reply->opcode != Opcode::ENC_CHUNK_REP_SUCCESS || reply->numChunks != 1 || (length != -1 && reply->chunks[0].size != length)) {
+                LOG(ERROR) << "Failed to get the encoded slice at offset " << (numDone - 1) * sliceSize << " from agent at " << meta[base + i].address << ", return opcode = " << reply->opcode;
+                allsuccess = false;
+                break;
+            }
+            input[i] = reply->chunks[0].data;
+            length = reply->chunks[0].size;
+        }
+        if (!allsuccess)
+            continue;
+        if (length > 0) {
+            // the chunk size is unknown until the last slice, so grow the buffer by doubling
+            if (size + length > capacity) {
+                unsigned long int newCapacity = std::max(capacity * 2, size + length);
+                unsigned char *buf = (unsigned char *) realloc (data, newCapacity);
+                if (buf == NULL) {
+                    LOG(ERROR) << "Failed to allocate memory for the repaired chunk of size " << newCapacity;
+                    allsuccess = false;
+                    continue;
+                }
+                data = buf;
+                capacity = newCapacity;
+            }
+            unsigned char *output = data + size;
+            CodingUtils::encode(input, numReqPerSlice, &output, 1, length, matrix);
+            size += length;
+        }
+        lastSlice = length < sliceSize;
+    }
+
+    // drain the slices still in flight after a failure or past the end of the chunk, which do not affect the repaired chunk
+    for (; numDone < numSent; numDone++) {
+        int base = (numDone % REPAIR_SLICE_WINDOW) * numReqPerSlice;
+        _peers->waitForReplies(&meta[base], numReqPerSlice, &sockets[base], received);
+        for (int i = 0; i < numReqPerSlice; i++)
+            DLOG_IF(INFO, !received[i] || meta[base + i].reply->opcode != Opcode::ENC_CHUNK_REP_SUCCESS) << "Ignore the failed request of the encoded slice at offset " << numDone * sliceSize << " to agent at " << meta[base + i].address;
+    }
+
+    if (!allsuccess) {
+        free(data);
+        return false;
+    }
+
+    DLOG(INFO) << "Repaired chunk " << chunk.getChunkName() << " of size " << size << " in " << numSent << " slices";
+    chunk.data = data;
+    chunk.size = size;
+    chunk.freeData = true;
+    return true;
+}
+
 void Agent::addIngressTraffic(unsigned long int traffic) {
     pthread_mutex_lock(&_stats.lock);
     _stats.traffic.in += traffic;
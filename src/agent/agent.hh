@@ -4,6 +4,8 @@
 #define __AGENT_HH__
 
 #include <atomic>
+#include <string>
+#include <vector>
 #include <pthread.h>
 
 #include <zmq.hpp>
@@ -11,6 +13,7 @@
 #include "container_manager.hh"
 #include "coordinator.hh"
 #include "io.hh"
+#include "peer_connection_pool.hh"
 #include "../common/define.hh"
 #include "../ds/chunk_event.hh"
 #include "../common/benchmark/benchmark.hh"
@@ -44,6 +47,60 @@ private:
      **/
     static void *handleChunkEvent(void *arg);
 
+    /**
+     * Chunks of a file on an agent to encode together for repair
+     **/
+    struct ChunkGroup {
+        std::string address;                      /**< address of the agent */
+        std::vector<int> chunkIds;                /**< ids of chunks */
+        std::vector<int> containerIds;            /**< ids of containers storing the chunks */
+        std::vector<unsigned char> coefficients;  /**< coding coefficients of the chunks */
+    };
+
+    /**
+     * Extract the chunk groups from a chunk event
+     *
+     * @param[in] event              event with the chunk groups, i.e., ChunkEvent::numChunkGroups, ChunkEvent::chunkGroupMap, ChunkEvent::containerGroupMap, and ChunkEvent::agents
+     * @param[in] coefficientOffset  position of the coefficients of the first chunk in the group in the coding state of the event
+     * @param[out] groups            chunk groups
+     *
+     * @return whether the chunk groups are valid
+     **/
+    static bool getChunkGroups(const ChunkEvent &event, int coefficientOffset, std::vector<ChunkGroup> &groups);
+
+    /**
+     * Set up a request to encode a slice of chunks in a chunk group, with the following groups as the rest of the repair chain
+     *
+     * @param[out] request           request to set up, any existing content is released
+     * @param[in] groups             chunk groups
+     * @param[in] first              index of the chunk group to encode
+     * @param[in] last               index after the last chunk group in the repair chain
+     * @param[in] file               chunk with the file info (namespace id, file uuid, and file version) of the chunks
+     * @param[in] offset             offset of the slice in the chunks
+     * @param[in] length             length of the slice
+     **/
+    void setupEncodeSliceRequest(ChunkEvent &request, const std::vector<ChunkGroup> &groups, size_t first, size_t last, const Chunk &file, unsigned long int offset, int length);
+
+    /**
+     * Encode a slice of local chunks, and add the partial encoded slice from the rest of the repair chain (if any)
+     *
+     * @param[in] event              encode chunk request with the slice info
+     * @param[out] codedChunk        the partial encoded slice, see ContainerManager::getEncodedChunkSlice()
+     *
+     * @return whether the slice is encoded
+     **/
+    bool encodeChunkSlice(ChunkEvent &event, Chunk &codedChunk);
+
+    /**
+     * Repair a chunk using CAR slice by slice, with a window of slices in flight
+     *
+     * @param[in] event              repair chunk request
+     * @param[out] chunk             chunk to hold the repaired data, Chunk::data and Chunk::size are filled
+     *
+     * @return whether the chunk is repaired
+     **/
+    bool repairChunkBySlices(ChunkEvent &event, Chunk &chunk);
+
     /**
      * Increment the total ingress traffic (chunk and header)
      *
@@ -83,6 +140,7 @@ private:
     AgentIO *_io;                                     /**< IO module */
     ContainerManager *_containerManager;              /**< container manager module */
     AgentCoordinator *_coordinator;                   /**< coordinator */
+    PeerConnectionPool *_peers;                       /**< connections to other agents for repair */
 
     // workers
     int _numWorkers;                                  /**< number of workers for event handling */
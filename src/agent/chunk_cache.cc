@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <functional>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+
+#include "chunk_cache.hh"
+
+#define CHUNK_CACHE_FILE_PREFIX "cache_"
+
+namespace fs = boost::filesystem;
+
+ChunkCache::ChunkCache(unsigned long int capacity, const std::string &dir, unsigned long int dirCapacity) {
+    _memory.size = 0;
+    _memory.capacity = capacity;
+    _disk.size = 0;
+    _disk.capacity = capacity > 0 && !dir.empty()? dirCapacity : 0;
+    _dir = _disk.capacity > 0? dir : "";
+    for (int i = 0; i < CHUNK_CACHE_NUM_GENERATIONS; i++)
+        _generations[i] = 0;
+    _hits = 0;
+    _misses = 0;
+
+    if (_dir.empty())
+        return;
+
+    // chunks left by the previous run may be outdated, start with an empty directory
+    boost::system::error_code ec;
+    fs::create_directories(_dir, ec);
+    if (!fs::is_directory(_dir, ec)) {
+        LOG(ERROR) << "Failed to create the chunk cache directory " << _dir << ", cache chunks in memory only";
+        _dir.clear();
+        _disk.capacity = 0;
+        return;
+    }
+    for (fs::directory_iterator it(_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().filename().string().compare(0, strlen(CHUNK_CACHE_FILE_PREFIX), CHUNK_CACHE_FILE_PREFIX) == 0)
+            fs::remove(it->path(), ec);
+    }
+}
+
+ChunkCache::~ChunkCache() {
+    std::lock_guard<std::mutex> lk(_disk.lock);
+    boost::system::error_code ec;
+    for (auto &entry : _disk.entries)
+        fs::remove(getFilePath(entry.first), ec);
+}
+
+bool ChunkCache::isEnabled() const {
+    return _memory.capacity > 0;
+}
+
+unsigned long int ChunkCache::getGeneration(int containerId, const Chunk &chunk) {
+    return getGeneration(getKey(containerId, chunk));
+}
+
+std::atomic<unsigned long int> &ChunkCache::getGeneration(const std::string &key) {
+    return _generations[std::hash<std::string>()(key) % CHUNK_CACHE_NUM_GENERATIONS];
+}
+
+bool ChunkCache::get(int containerId, Chunk &chunk) {
+    if (!isEnabled())
+        return false;
+
+    std::string key = getKey(containerId, chunk);
+    unsigned long int generation = getGeneration(key);
+    Data data;
+
+    // look up the memory tier
+    {
+        std::lock_guard<std::mutex> lk(_memory.lock);
+        auto it = _memory.entries.find(key);
+        if (it != _memory.entries.end()) {
+            _memory.lru.splice(_memory.lru.begin(), _memory.lru, it->second.lru);
+            data = it->second.data;
+        }
+    }
+
+    // look up the directory tier, and promote the chunk to memory
+    if (data == nullptr && !_dir.empty()) {
+        data = takeFromDir(key);
+        if (data != nullptr)
+            addToMemory(key, data, generation);
+    }
+
+    if (data == nullptr) {
+        _misses++;
+        return false;
+    }
+
+    unsigned char *buf = (unsigned char *) malloc(data->size());
+    if (buf == NULL) {
+        LOG(ERROR) << "Failed to allocate memory for chunk " << key << " from cache";
+        _misses++;
+        return false;
+    }
+    memcpy(buf, data->data(), data->size());
+    if (chunk.freeData)
+        free(chunk.data);
+    chunk.mapping.reset();
+    chunk.data = buf;
+    chunk.size = data->size();
+    chunk.freeData = true;
+    _hits++;
+    return true;
+}
+
+void ChunkCache::put(int containerId, const Chunk &chunk, unsigned long int generation) {
+    if (!isEnabled() || chunk.data == NULL || chunk.size <= 0 || (unsigned long int) chunk.size > _memory.capacity)
+        return;
+
+    std::string key = getKey(containerId, chunk);
+    Data data = std::make_shared<std::vector<unsigned char> >(chunk.data, chunk.data + chunk.size);
+    addToMemory(key, data, generation);
+}
+
+void ChunkCache::invalidate(int containerId, const Chunk &chunk) {
+    if (!isEnabled())
+        return;
+
+    std::string key = getKey(containerId, chunk);
+
+    // advance the generation first, so concurrent reads of the old chunk are not cached
+    getGeneration(key)++;
+
+    {
+        std::lock_guard<std::mutex> lk(_memory.lock);
+        auto it = _memory.entries.find(key);
+        if (it != _memory.entries.end()) {
+            _memory.size -= it->second.size;
+            _memory.lru.erase(it->second.lru);
+            _memory.entries.erase(it);
+        }
+    }
+
+    if (!_dir.empty()) {
+        std::lock_guard<std::mutex> lk(_disk.lock);
+        auto it = _disk.entries.find(key);
+        if (it != _disk.entries.end()) {
+            _disk.size -= it->second.size;
+            _disk.lru.erase(it->second.lru);
+            _disk.entries.erase(it);
+            unlink(getFilePath(key).c_str());
+        }
+    }
+}
+
+void ChunkCache::getStats(CacheStats &stats) {
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.capacity = _memory.capacity;
+    std::lock_guard<std::mutex> lk(_memory.lock);
+    stats.size = _memory.size;
+}
+
+std::string ChunkCache::getKey(int containerId, const Chunk &chunk) {
+    return std::to_string(containerId) + "_" + chunk.getChunkName();
+}
+
+std::string ChunkCache::getFilePath(const std::string &key) const {
+    return _dir + "/" + CHUNK_CACHE_FILE_PREFIX + key;
+}
+
+void ChunkCache::addToMemory(const std::string &key, const Data &data, unsigned long int generation) {
+    std::vector<std::pair<std::string, Data> > evicted;
+
+    std::unique_lock<std::mutex> lk(_memory.lock);
+
+    // skip chunks changed since read; invalidations after this check find the chunk in memory
+    if (getGeneration(key) != generation)
+        return;
+
+    // replace any existing copy
+    auto it = _memory.entries.find(key);
+    if (it != _memory.entries.end()) {
+        _memory.size -= it->second.size;
+        _memory.lru.erase(it->second.lru);
+        _memory.entries.erase(it);
+    }
+
+    // evict the least recently used chunks to make room
+    while (!_memory.lru.empty() && _memory.size + data->size() > _memory.capacity) {
+        auto victim = _memory.entries.find(_memory.lru.back());
+        _memory.size -= victim->second.size;
+        evicted.push_back(std::make_pair(victim->first, victim->second.data));
+        _memory.entries.erase(victim);
+        _memory.lru.pop_back();
+    }
+
+    _memory.lru.push_front(key);
+    Entry &entry = _memory.entries[key];
+    entry.lru = _memory.lru.begin();
+    entry.data = data;
+    entry.size = data->size();
+    _memory.size += entry.size;
+
+    if (evicted.empty() || _dir.empty())
+        return;
+
+    // hand over to the directory tier before releasing the memory tier, so invalidations in between are not missed
+    std::lock_guard<std::mutex> dlk(_disk.lock);
+    lk.unlock();
+    addToDir(evicted);
+}
+
+void ChunkCache::addToDir(const std::vector<std::pair<std::string, Data> > &evicted) {
+    for (size_t i = 0; i < evicted.size(); i++) {
+        const std::string &key = evicted.at(i).first;
+        const Data &data = evicted.at(i).second;
+        if (data->size() > _disk.capacity)
+            continue;
+
+        // evict the least recently used chunks to make room
+        while (!_disk.lru.empty() && _disk.size + data->size() > _disk.capacity) {
+            auto victim = _disk.entries.find(_disk.lru.back());
+            _disk.size -= victim->second.size;
+            unlink(getFilePath(victim->first).c_str());
+            _disk.entries.erase(victim);
+            _disk.lru.pop_back();
+        }
+
+        std::string path = getFilePath(key);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            LOG(ERROR) << "Failed to create chunk cache file " << path << ", " << strerror(errno);
+            continue;
+        }
+        size_t written = 0;
+        while (written < data->size()) {
+            ssize_t ret = write(fd, data->data() + written, data->size() - written);
+            if (ret <= 0)
+                break;
+            written += ret;
+        }
+        close(fd);
+        if (written != data->size()) {
+            LOG(ERROR) << "Failed to write chunk cache file " << path;
+            unlink(path.c_str());
+            continue;
+        }
+
+        auto it = _disk.entries.find(key);
+        if (it != _disk.entries.end()) {
+            _disk.size -= it->second.size;
+            _disk.lru.erase(it->second.lru);
+        }
+        _disk.lru.push_front(key);
+        Entry &entry = _disk.entries[key];
+        entry.lru = _disk.lru.begin();
+        entry.data = nullptr;
+        entry.size = data->size();
+        _disk.size += entry.size;
+    }
+}
+
+ChunkCache::Data ChunkCache::takeFromDir(const std::string &key) {
+    std::lock_guard<std::mutex> lk(_disk.lock);
+
+    auto it = _disk.entries.find(key);
+    if (it == _disk.entries.end())
+        return nullptr;
+
+    std::string path = getFilePath(key);
+    Data data = std::make_shared<std::vector<unsigned char> >(it->second.size);
+    int fd = open(path.c_str(), O_RDONLY);
+    size_t bytesRead = 0;
+    while (fd != -1 && bytesRead < data->size()) {
+        ssize_t ret = read(fd, data->data() + bytesRead, data->size() - bytesRead);
+        if (ret <= 0)
+            break;
+        bytesRead += ret;
+    }
+    if (fd != -1)
+        close(fd);
+
+    // the chunk moves back to memory (or is dropped on failure)
+    _disk.size -= it->second.size;
+    _disk.lru.erase(it->second.lru);
+    _disk.entries.erase(it);
+    unlink(path.c_str());
+
+    if (bytesRead != data->size()) {
+        LOG(ERROR) << "Failed to read chunk cache file " << path;
+        return nullptr;
+    }
+    return data;
+}
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __CHUNK_CACHE_HH__
+#define __CHUNK_CACHE_HH__
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../ds/chunk.hh"
+#include "../ds/coordinator_event.hh"
+
+#define CHUNK_CACHE_NUM_GENERATIONS (1024)
+
+/**
+ * Cache of chunks read from containers, bounded in memory, and optionally backed by a directory (e.g., on SSD) for chunks evicted from memory;
+ * chunks are keyed by container id and chunk name (which includes the file version), and should be invalidated once changed in containers
+ **/
+class ChunkCache {
+public:
+    /**
+     * Constructor
+     *
+     * @param[in] capacity             size of chunks to cache in memory, 0 to disable the cache
+     * @param[in] dir                  directory to keep chunks evicted from memory, empty to cache in memory only
+     * @param[in] dirCapacity          size of chunks to keep in the directory
+     **/
+    ChunkCache(unsigned long int capacity, const std::string &dir, unsigned long int dirCapacity);
+    ~ChunkCache();
+
+    /**
+     * Tell whether the cache is enabled
+     *
+     * @return whether the cache is enabled
+     **/
+    bool isEnabled() const;
+
+    /**
+     * Get the generation of a chunk, which changes once the chunk is invalidated;
+     * take it before reading the chunk from the container, so data read before an invalidation is not cached
+     *
+     * @param[in] containerId          id of the container storing the chunk
+     * @param[in] chunk                chunk
+     *
+     * @return generation of the chunk
+     **/
+    unsigned long int getGeneration(int containerId, const Chunk &chunk);
+
+    /**
+     * Get a chunk from the cache
+     *
+     * @param[in] containerId          id of the container storing the chunk
+     * @param[in,out] chunk            chunk to get; Chunk::data and Chunk::size are filled on hit
+     *
+     * @return whether the chunk is found in cache
+     **/
+    bool get(int containerId, Chunk &chunk);
+
+    /**
+     * Add a chunk read from the container to the cache
+     *
+     * @param[in] containerId          id of the container storing the chunk
+     * @param[in] chunk                chunk with data
+     * @param[in] generation           generation of the chunk before the read, see getGeneration()
+     **/
+    void put(int containerId, const Chunk &chunk, unsigned long int generation);
+
+    /**
+     * Remove a chunk from the cache after it is changed in the container
+     *
+     * @param[in] containerId          id of the container storing the chunk
+     * @param[in] chunk                chunk changed
+     **/
+    void invalidate(int containerId, const Chunk &chunk);
+
+    /**
+     * Get the statistics of the cache
+     *
+     * @param[out] stats               statistics
+     **/
+    void getStats(CacheStats &stats);
+
+private:
+    typedef std::shared_ptr<std::vector<unsigned char> > Data;
+
+    struct Entry {
+        std::list<std::string>::iterator lru;    /**< position in the list of recently used chunks */
+        Data data;                               /**< chunk data (in memory), or NULL (in the directory) */
+        unsigned long int size;                  /**< size of chunk data */
+    };
+
+    /**
+     * Cache tier with chunks in the order of recent use
+     **/
+    struct Tier {
+        std::unordered_map<std::string, Entry> entries; /**< chunks by key */
+        std::list<std::string> lru;              /**< keys of chunks, the most recently used first */
+        unsigned long int size;                  /**< size of chunks cached */
+        unsigned long int capacity;              /**< capacity of the tier */
+        std::mutex lock;                         /**< lock on the tier */
+    };
+
+    static std::string getKey(int containerId, const Chunk &chunk);
+    std::string getFilePath(const std::string &key) const;
+    std::atomic<unsigned long int> &getGeneration(const std::string &key);
+
+    /**
+     * Add a chunk to the memory tier unless it is invalidated since read, and move the chunks evicted to the directory tier
+     *
+     * @param[in] key                  key of the chunk
+     * @param[in] data                 chunk data
+     * @param[in] generation           generation of the chunk before the read
+     **/
+    void addToMemory(const std::string &key, const Data &data, unsigned long int generation);
+
+    /**
+     * Add chunks evicted from memory to the directory tier; callers should hold the lock on the directory tier
+     *
+     * @param[in] evicted              (key, data) of chunks evicted
+     **/
+    void addToDir(const std::vector<std::pair<std::string, Data> > &evicted);
+
+    /**
+     * Read a chunk from the directory tier, and drop it from the tier
+     *
+     * @param[in] key                  key of the chunk
+     *
+     * @return chunk data, or NULL if not found
+     **/
+    Data takeFromDir(const std::string &key);
+
+    Tier _memory;                                /**< chunks in memory */
+    Tier _disk;                                  /**< chunks in the directory */
+    std::string _dir;                            /**< directory for chunks evicted from memory */
+    std::atomic<unsigned long int> _generations[CHUNK_CACHE_NUM_GENERATIONS]; /**< generations of chunks, shared by chunks of the same key hash */
+    std::atomic<unsigned long int> _hits;        /**< number of hits */
+    std::atomic<unsigned long int> _misses;      /**< number of misses */
+};
+
+#endif // define __CHUNK_CACHE_HH__
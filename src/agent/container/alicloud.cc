@@ -51,10 +51,12 @@ AliContainer::AliContainer(int id, std::string bucketName, std::string region, s
     // release resources
     aos_pool_destroy(pool);
 
-    updateUsage();
+    // the usage comes from the bucket statistics in one request, so no counter is saved
+    initUsage();
 }
 
 AliContainer::~AliContainer() {
+    stopUsageUpdate();
 }
 
 void AliContainer::initOptions(oss_request_options_t *&options, aos_pool_t *&pool) {
@@ -144,6 +146,7 @@ bool AliContainer::putChunk(Chunk &chunk) {
         copyChecksum(md5base64, chunk.md5);
 
         LOG(INFO) << "Put chunk " << chunk.getChunkName() << " as object " << opath;
+        addUsage(chunk.size);
     } else {
         LOG(ERROR) << "Failed to put chunk " << chunk.getChunkName() << " as object " << opath << ", " << status->error_msg << ", " << status->error_code << ", " << status->code;
     }
@@ -208,6 +211,59 @@ bool AliContainer::getChunk(Chunk &chunk, bool skipVerification) {
     return success;
 }
 
+bool AliContainer::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    char opath[OBJ_PATH_MAX];
+    if (genObjectPath(opath, chunk.getChunkName()) == false) {
+        LOG(ERROR) << "Failed to get object path name";
+        return false;
+    }
+    // init the memory pool
+    aos_pool_t *pool = 0;
+    oss_request_options_t *options = 0;
+    aos_pool_create(&pool, NULL);
+    // init config options
+    initOptions(options, pool);
+
+    // init the object and bucket name
+    aos_string_t bucket, object;
+    aos_str_set(&bucket, _bucketName.c_str());
+    aos_str_set(&object, opath);
+
+    // ask for the range only, and for a failure (instead of the whole object) on ranges starting after the end of the object
+    std::string range = "bytes=" + std::to_string(offset) + "-" + std::to_string(offset + length - 1);
+    aos_table_t *headers = aos_table_make(pool, 2), *repHeaders;
+    apr_table_set(headers, "Range", range.c_str());
+    apr_table_set(headers, "x-oss-range-behavior", "standard");
+    aos_list_t buffer;
+    aos_list_init(&buffer);
+
+    aos_status_t *status = oss_get_object_to_buffer(options, &bucket, &object, headers, /* params */ NULL, &buffer, &repHeaders);
+
+    // the range is shorter than requested at the end of the chunk, and empty if it starts at or after the end of the chunk
+    bool okay = aos_status_is_ok(status);
+    chunk.size = okay? aos_buf_list_len(&buffer) : 0;
+    bool success = (okay && chunk.size <= length) || status->code == 416;
+    if (success) {
+        chunk.data = (unsigned char *) malloc (chunk.size > 0? chunk.size : 1);
+        unsigned long int pos = 0, len;
+        aos_buf_t *content;
+        if (okay) {
+            aos_list_for_each_entry(aos_buf_t, content, &buffer, node) {
+                len = aos_buf_size(content);
+                memcpy(chunk.data + pos, content->pos, len);
+                pos += len;
+            }
+        }
+        DLOG(INFO) << "Get chunk " << chunk.getChunkName() << " range " << range << " as object " << opath;
+    } else {
+        LOG(ERROR) << "Failed to get chunk " << chunk.getChunkName() << " range " << range << " as object " << opath << ", " << (status->error_msg? status->error_msg : "");
+    }
+
+    // release resources
+    aos_pool_destroy(pool);
+    return success;
+}
+
 bool AliContainer::deleteChunk(const Chunk &chunk) {
     char opath[OBJ_PATH_MAX];
     if (genObjectPath(opath, chunk.getChunkName()) == false) {
@@ -228,11 +284,17 @@ bool AliContainer::deleteChunk(const Chunk &chunk) {
 
     // init a table
     aos_table_t *repHeaders;
+
+    // get the object size for usage accounting
+    aos_status_t *status = oss_head_object(options, &bucket, &object, NULL, &repHeaders);
+    const char *size = aos_status_is_ok(status)? apr_table_get(repHeaders, OSS_CONTENT_LENGTH) : NULL;
     
-    aos_status_t *status = oss_delete_object(options, &bucket, &object, &repHeaders);
+    status = oss_delete_object(options, &bucket, &object, &repHeaders);
 
     if (aos_status_is_ok(status)) {
         LOG(INFO) << "Delete chunk " << chunk.getChunkName() << " as object " << opath;
+        if (size != NULL)
+            addUsage(-atol(size));
     } else {
         LOG(WARNING) << "Chunk " << chunk.getChunkName() << " as object " << opath << " not exist for delete, " << status->error_msg;
     }
@@ -283,6 +345,11 @@ bool AliContainer::copyChunk(const Chunk &src, Chunk &dst) {
 
         const char *md5base64 = okay? apr_table_get(repHeaders, OSS_CONTENT_MD5) : 0;
 
+        // the copied object counts towards the usage until it is removed on failure
+        const char *size = okay? apr_table_get(repHeaders, OSS_CONTENT_LENGTH) : NULL;
+        if (size != NULL)
+            addUsage(atol(size));
+
         // verify checksum
         okay = okay && (!Config::getInstance().verifyChunkChecksum() || compareChecksum(md5base64, src.md5, dst.getChunkName()));
 
@@ -395,9 +462,10 @@ bool AliContainer::getTotalSize(unsigned long int &total) {
 }
 
 void AliContainer::updateUsage() {
+    unsigned long int snapshot = _usage;
     unsigned long int total = 0;
     if (getTotalSize(total))
-        _usage = total;
+        reconcileUsage(total, snapshot);
     else
         LOG(WARNING) << "Failed to update the size of contianer id = " << _id;
 }
@@ -28,6 +28,11 @@ public:
      **/
     bool getChunk(Chunk &chunk, bool skipVerification = false);
 
+    /**
+     * See Container::getChunkRange()
+     **/
+    bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
     /**
      * See Container::deleteChunk()
      **/
@@ -7,6 +7,7 @@
 
 #include <boost/timer/timer.hpp>
 
+#include <aws/core/http/HttpResponse.h>
 #include <aws/s3/model/PutObjectRequest.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/DeleteObjectRequest.h>
@@ -22,6 +23,7 @@
 #include "aws_s3.hh"
 
 #define OBJ_PATH_MAX (128)
+#define USAGE_OBJECT_NAME ".usage"
 
 AwsContainer::AwsContainer(int id, std::string bucketName, std::string region, std::string keyId, std::string key, unsigned long int capacity, std::string endpoint, std::string httpProxyIP, unsigned short httpProxyPort, bool useHttp) :
         Container(id, capacity) {
@@ -110,10 +112,11 @@ AwsContainer::AwsContainer(int id, std::string bucketName, std::string region, s
     )
         LOG(WARNING) << "Failed to enable versioning for bucket " << _bucketName << ", " << voutcome.GetError();
 
-    updateUsage();
+    initUsage();
 }
 
 AwsContainer::~AwsContainer() {
+    stopUsageUpdate();
 }
 
 bool AwsContainer::genObjectPath(char *opath, std::string chunkName) {
@@ -192,6 +195,9 @@ bool AwsContainer::putChunk(Chunk &chunk) {
     } else {
         LOG(ERROR) << "Failed to put chunk " << chunkName << " as object " << opath;
     }
+    // the object is stored once the request is successful (even if the checksum mismatches)
+    if (outcome.IsSuccess())
+        addUsage(chunk.size);
 
     return success;
 }
@@ -240,6 +246,48 @@ bool AwsContainer::getChunk(Chunk &chunk, bool skipVerification) {
     return true;
 }
 
+bool AwsContainer::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    std::string chunkName = chunk.getChunkName();
+
+    char opath[OBJ_PATH_MAX];
+    if (genObjectPath(opath, chunkName) == false) {
+        LOG(ERROR) << "Failed to generate object name";
+        return false;
+    }
+
+    // fill in the request template, and ask for the range only
+    Aws::S3::Model::GetObjectRequest req;
+    std::string range = "bytes=" + std::to_string(offset) + "-" + std::to_string(offset + length - 1);
+    req.WithBucket(_bucketName).WithKey(opath).WithRange(range.c_str());
+
+    // send the request
+    auto outcome = _client.GetObject(req);
+
+    if (!outcome.IsSuccess()) {
+        // the range starts at or after the end of the chunk
+        if (outcome.GetError().GetResponseCode() == Aws::Http::HttpResponseCode::REQUESTED_RANGE_NOT_SATISFIABLE) {
+            chunk.size = 0;
+            chunk.data = (unsigned char *) malloc (1);
+            return true;
+        }
+        LOG(ERROR) << "Failed to get chunk " << chunkName << " range " << range << " as object " << opath;
+        return false;
+    }
+
+    // get the range data, which is shorter than requested at the end of the chunk
+    chunk.size = outcome.GetResult().GetContentLength();
+    if (chunk.size > length) {
+        LOG(ERROR) << "Unexpected size " << chunk.size << " of chunk " << chunkName << " range " << range;
+        return false;
+    }
+    chunk.data = (unsigned char *) malloc (chunk.size > 0? chunk.size : 1);
+    outcome.GetResult().GetBody().read((char *) chunk.data, chunk.size);
+
+    DLOG(INFO) << "Get chunk " << chunkName << " range " << range << " from path " << opath;
+
+    return true;
+}
+
 bool AwsContainer::deleteChunk(const Chunk &chunk) {
     std::string chunkName = chunk.getChunkName();
 
@@ -249,12 +297,15 @@ bool AwsContainer::deleteChunk(const Chunk &chunk) {
         return false;
     }
 
+    unsigned long int size = getObjectSize(opath);
+
     // fill in the request template
     Aws::S3::Model::DeleteObjectRequest req;
     req.WithBucket(_bucketName).WithKey(opath);
 
     // send the request
-    _client.DeleteObject(req);
+    if (_client.DeleteObject(req).IsSuccess())
+        addUsage(-(long int) size);
 
     return true;
 }
@@ -296,6 +347,7 @@ bool AwsContainer::copyChunk(const Chunk &src, Chunk &dst) {
     if (success) {
         // copy resulted chunk size
         dst.size = outcome2.GetResult().GetContentLength();
+        addUsage(dst.size);
         // copy checksum from response
         copyChecksum(outcome2.GetResult().GetETag(), dst.md5);
         // verify chunk checksum
@@ -350,6 +402,8 @@ bool AwsContainer::revertChunk(const Chunk &chunk) {
 
     // reference: https://docs.aws.amazon.com/en_pv/AmazonS3/latest/dev/RestoringPreviousVersions.html
 
+    unsigned long int curSize = getObjectSize(opath);
+
     // fill in the request template
     Aws::S3::Model::DeleteObjectRequest req;
     req.WithBucket(_bucketName).WithKey(opath).WithVersionId(chunk.getChunkVersion());
@@ -358,6 +412,8 @@ bool AwsContainer::revertChunk(const Chunk &chunk) {
 
     if (!outcome.IsSuccess())
         LOG(ERROR) << "Failed to revert chunk " << opath << " by removing version " << chunk.getChunkVersion() << ", " << outcome.GetError();
+    else
+        addUsage((long int) getObjectSize(opath) - (long int) curSize);
 
     return outcome.IsSuccess();
 }
@@ -401,7 +457,8 @@ bool AwsContainer::getTotalSize(unsigned long int &total, bool needsLock) {
             // sum up the size of all objects
             Aws::Vector<Aws::S3::Model::Object> objList = outcome.GetResult().GetContents();
             for (auto const &obj: objList) {
-                total += obj.GetSize();
+                if (obj.GetKey() != USAGE_OBJECT_NAME)
+                    total += obj.GetSize();
             }
             // keep getting next page of objects if list is truncated (use last object key as the marker)
             listAll = !outcome.GetResult().GetIsTruncated();
@@ -421,9 +478,69 @@ bool AwsContainer::getTotalSize(unsigned long int &total, bool needsLock) {
 }
 
 void AwsContainer::updateUsage() {
+    unsigned long int snapshot = _usage;
     unsigned long int total = 0;
     if (getTotalSize(total))
-        _usage = total;
+        reconcileUsage(total, snapshot);
     else
         LOG(WARNING) << "Failed to update the size of container id = " << _id;
 }
+
+unsigned long int AwsContainer::getObjectSize(const char *opath) {
+    Aws::S3::Model::HeadObjectRequest req;
+    req.WithBucket(_bucketName).WithKey(opath);
+
+    auto outcome = _client.HeadObject(req);
+
+    return outcome.IsSuccess()? outcome.GetResult().GetContentLength() : 0;
+}
+
+bool AwsContainer::loadUsage(unsigned long int &usage, bool &clean) {
+    Aws::S3::Model::GetObjectRequest req;
+    req.WithBucket(_bucketName).WithKey(USAGE_OBJECT_NAME);
+
+    auto outcome = _client.GetObject(req);
+    if (!outcome.IsSuccess())
+        return false;
+
+    int isClean = 0;
+    if (!(outcome.GetResult().GetBody() >> usage >> isClean))
+        return false;
+    clean = isClean != 0;
+    _usageCounter = Aws::String(std::to_string(usage).c_str()) + " " + (clean? "1" : "0");
+    _usageVersionId = outcome.GetResult().GetVersionId();
+    return true;
+}
+
+bool AwsContainer::saveUsage(unsigned long int usage, bool clean) {
+    Aws::String counter = Aws::String(std::to_string(usage).c_str()) + " " + (clean? "1" : "0");
+    // each write leaves a version behind in the versioned bucket, so skip writes that change nothing
+    if (counter == _usageCounter)
+        return true;
+
+    Aws::S3::Model::PutObjectRequest req;
+    req.WithBucket(_bucketName).WithKey(USAGE_OBJECT_NAME);
+    req.SetBody(
+        Aws::MakeShared<Aws::StringStream>(
+            "PutObjectInputStream",
+            counter
+        )
+    );
+
+    auto outcome = _client.PutObject(req);
+    if (!outcome.IsSuccess()) {
+        LOG(WARNING) << "Failed to save usage of container id = " << _id << ", " << outcome.GetError();
+        return false;
+    }
+
+    // remove the previous version of the counter
+    if (!_usageVersionId.empty() && _usageVersionId != outcome.GetResult().GetVersionId()) {
+        Aws::S3::Model::DeleteObjectRequest dreq;
+        dreq.WithBucket(_bucketName).WithKey(USAGE_OBJECT_NAME).WithVersionId(_usageVersionId);
+        auto doutcome = _client.DeleteObject(dreq);
+        LOG_IF(WARNING, !doutcome.IsSuccess()) << "Failed to remove the previous usage of container id = " << _id << ", version = " << _usageVersionId << ", " << doutcome.GetError();
+    }
+    _usageCounter = counter;
+    _usageVersionId = outcome.GetResult().GetVersionId();
+    return true;
+}
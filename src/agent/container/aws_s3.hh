@@ -28,6 +28,11 @@ public:
      **/
     bool getChunk(Chunk &chunk, bool skipVerification = false);
 
+    /**
+     * See Container::getChunkRange()
+     **/
+    bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
     /**
      * See Container::deleteChunk()
      **/
@@ -84,6 +89,25 @@ private:
      **/
     bool getTotalSize(unsigned long int &total, bool needsLock = true);
 
+    /**
+     * Get the size of the current version of an object
+     *
+     * @param[in] opath       object path
+     *
+     * @return size of the object, or 0 if the object does not exist
+     **/
+    unsigned long int getObjectSize(const char *opath);
+
+    /**
+     * See Container::loadUsage()
+     **/
+    bool loadUsage(unsigned long int &usage, bool &clean);
+
+    /**
+     * See Container::saveUsage()
+     **/
+    bool saveUsage(unsigned long int usage, bool clean);
+
     /**
      * Compare the MD5 against the checksum in raw etag returned by AWS
      *
@@ -107,6 +131,8 @@ private:
     Aws::Auth::AWSCredentials _cred;     /**< credentials for accessing aws services */
     Aws::S3::S3Client _client;           /**< aws client to reach aws service */
     Aws::String _bucketName;             /**< aws bucket name */
+    Aws::String _usageCounter;           /**< usage counter last loaded or saved */
+    Aws::String _usageVersionId;         /**< version of the usage counter object last loaded or saved */
 };
 
 #endif // define __AWS_CONTAINER_HH__
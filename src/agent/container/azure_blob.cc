@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+
 #include <cpprest/streams.h>
 #include <cpprest/rawptrstream.h>
 #include <glog/logging.h>
@@ -8,6 +10,7 @@
 #include "azure_blob.hh"
 
 #define BPATH_MAX (128)
+#define USAGE_BLOB_NAME ".usage"
 
 AzureContainer::AzureContainer(int id, std::string bucketName, std::string storageConnectionString, unsigned long int capacity, std::string httpProxyIP, unsigned short httpProxyPort) :
         Container(id, capacity) {
@@ -33,10 +36,11 @@ AzureContainer::AzureContainer(int id, std::string bucketName, std::string stora
     // Return value is true if the container did not exist and was successfully created.
     _blobContainer.create_if_not_exists(azure::storage::blob_container_public_access_type(), _reqOpts, _opCxt);
 
-    updateUsage();
+    initUsage();
 }
 
 AzureContainer::~AzureContainer() {
+    stopUsageUpdate();
 }
 
 bool AzureContainer::genBlobPath(char *bpath, std::string chunkName) {
@@ -87,6 +91,7 @@ bool AzureContainer::putChunk(Chunk &chunk) {
 
     // upload the blob
     chunkBlob.upload_from_stream(cdata, _accessCond, _reqOpts, _opCxt);
+    addUsage(chunk.size);
 
     cdata.close().wait();
 
@@ -133,6 +138,36 @@ bool AzureContainer::getChunk(Chunk &chunk, bool skipVerification) {
     return true;
 }
 
+bool AzureContainer::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    char bpath[BPATH_MAX];
+    if (genBlobPath(bpath, chunk.getChunkName()) == false) {
+        LOG(ERROR) << "Failed to get blob path name";
+        return false;
+    }
+
+    azure::storage::cloud_block_blob chunkBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(bpath));
+    try {
+        // get the chunk size, and download only the part of the range within the chunk
+        chunkBlob.download_attributes(_accessCond, _reqOpts, _opCxt);
+        unsigned long int size = chunkBlob.properties().size();
+        chunk.size = offset >= size? 0 : (int) std::min(size - offset, (unsigned long int) length);
+        chunk.data = (unsigned char*) malloc (chunk.size > 0? chunk.size : 1);
+        if (chunk.size > 0) {
+            Concurrency::streams::ostream cdata(Concurrency::streams::rawptr_buffer<char> ((char *) chunk.data, chunk.size));
+            chunkBlob.download_range_to_stream(cdata, offset, chunk.size, _accessCond, _reqOpts, _opCxt);
+        }
+    } catch (azure::storage::storage_exception &e) {
+        LOG(ERROR) << "Failed to get chunk " << chunk.getChunkName() << " range offset " << offset << " as blob " << bpath << ", " << e.what();
+        free(chunk.data);
+        chunk.data = NULL;
+        chunk.size = 0;
+        return false;
+    }
+
+    DLOG(INFO) << "Get chunk " << chunk.getChunkName() << " range offset " << offset << " size " << chunk.size << " as blob " << bpath;
+    return true;
+}
+
 bool AzureContainer::deleteChunk(const Chunk &chunk) {
     char bpath[BPATH_MAX];
     if (genBlobPath(bpath, chunk.getChunkName()) == false) {
@@ -142,12 +177,14 @@ bool AzureContainer::deleteChunk(const Chunk &chunk) {
 
     // delete the blob
     azure::storage::cloud_block_blob chunkBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(bpath));
+    unsigned long int size = getBlobSize(chunkBlob);
     chunkBlob.delete_blob(
         azure::storage::delete_snapshots_option::include_snapshots,
         _accessCond,
         _reqOpts,
         _opCxt
     );
+    addUsage(-(long int) size);
 
     LOG(INFO) << "Delete chunk " << chunk.getChunkName() << " as blob " << bpath;
     return true;
@@ -171,6 +208,7 @@ bool AzureContainer::copyChunk(const Chunk &src, Chunk &dst) {
     copyChunkBlob.start_copy(srcChunkBlob, _accessCond, _accessCond, _reqOpts, _opCxt);
     copyChunkBlob.download_attributes(_accessCond, _reqOpts, _opCxt);
     dst.size = copyChunkBlob.properties().size();
+    addUsage(dst.size);
 
     std::string hash = copyChunkBlob.properties().content_md5();
 
@@ -226,12 +264,14 @@ bool AzureContainer::revertChunk(const Chunk &chunk) {
     azure::storage::cloud_block_blob oldChunkBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(bpath), chunk.chunkVersion);
     azure::storage::cloud_block_blob curChunkBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(bpath));
 
+    unsigned long int curSize = getBlobSize(curChunkBlob);
     try {
         curChunkBlob.start_copy(oldChunkBlob, _accessCond, _accessCond, _reqOpts, _opCxt);
     } catch (std::exception &e) {
         LOG(ERROR) << "Failed to revert chunks, operation not supported" << e.what();
         return false;
     }
+    addUsage((long int) getBlobSize(oldChunkBlob) - (long int) curSize);
 
     LOG(INFO) << "Reverted chunk " << bpath << " to version " << chunk.chunkVersion;
 
@@ -261,12 +301,14 @@ unsigned long int AzureContainer::getTotalSize(bool needsLock) {
                 _opCxt
             );
     azure::storage::list_blob_item_iterator prev;
-    // sum up the size of all objects
+    // sum up the size of all objects, using the properties returned along with the listing
     for (; it != prev; prev = it, it++) {
         try {
-            azure::storage::cloud_block_blob chunkBlob = it->as_blob();
-            chunkBlob.download_attributes(_accessCond, _reqOpts, _opCxt);
-            total += chunkBlob.properties().size();
+            if (!it->is_blob())
+                continue;
+            azure::storage::cloud_blob chunkBlob = it->as_blob();
+            if (chunkBlob.name() != _XPLATSTR(USAGE_BLOB_NAME))
+                total += chunkBlob.properties().size();
         } catch (std::runtime_error &e) {
             // skip non-blobs
         }
@@ -275,5 +317,41 @@ unsigned long int AzureContainer::getTotalSize(bool needsLock) {
 }
 
 void AzureContainer::updateUsage() {
-    _usage = getTotalSize();
+    unsigned long int snapshot = _usage;
+    reconcileUsage(getTotalSize(), snapshot);
+}
+
+unsigned long int AzureContainer::getBlobSize(azure::storage::cloud_block_blob &blob) {
+    try {
+        blob.download_attributes(_accessCond, _reqOpts, _opCxt);
+    } catch (std::exception &e) {
+        return 0;
+    }
+    return blob.properties().size();
+}
+
+bool AzureContainer::loadUsage(unsigned long int &usage, bool &clean) {
+    azure::storage::cloud_block_blob usageBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(USAGE_BLOB_NAME));
+    int isClean = 0;
+    try {
+        std::string counter = utility::conversions::to_utf8string(usageBlob.download_text(_accessCond, _reqOpts, _opCxt));
+        if (sscanf(counter.c_str(), "%lu %d", &usage, &isClean) != 2)
+            return false;
+    } catch (std::exception &e) {
+        return false;
+    }
+    clean = isClean != 0;
+    return true;
+}
+
+bool AzureContainer::saveUsage(unsigned long int usage, bool clean) {
+    azure::storage::cloud_block_blob usageBlob = _blobContainer.get_block_blob_reference(_XPLATSTR(USAGE_BLOB_NAME));
+    std::string counter = std::to_string(usage) + (clean? " 1" : " 0");
+    try {
+        usageBlob.upload_text(utility::conversions::to_string_t(counter), _accessCond, _reqOpts, _opCxt);
+    } catch (std::exception &e) {
+        LOG(WARNING) << "Failed to save usage of container id = " << _id << ", " << e.what();
+        return false;
+    }
+    return true;
 }
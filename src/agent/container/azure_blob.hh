@@ -32,6 +32,11 @@ public:
      **/
     bool getChunk(Chunk &chunk, bool skipVerification = false);
 
+    /**
+     * See Container::getChunkRange()
+     **/
+    bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
     /**
      * See Container::deleteChunk()
      **/
@@ -86,6 +91,25 @@ private:
      **/
     unsigned long int getTotalSize(bool needsLock = true);
 
+    /**
+     * Get the size of a blob
+     *
+     * @param[in] blob        blob to check
+     *
+     * @return size of the blob, or 0 if the blob does not exist
+     **/
+    unsigned long int getBlobSize(azure::storage::cloud_block_blob &blob);
+
+    /**
+     * See Container::loadUsage()
+     **/
+    bool loadUsage(unsigned long int &usage, bool &clean);
+
+    /**
+     * See Container::saveUsage()
+     **/
+    bool saveUsage(unsigned long int usage, bool clean);
+
     /**
      * Compare the provided hash against MD5 checksum
      * 
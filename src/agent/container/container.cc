@@ -1,25 +1,132 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h> // setpriority()
+#include <sys/syscall.h>
+
+#include <glog/logging.h>
+
 #include "container.hh"
 #include "../../common/config.hh"
 
+#define USAGE_SAVE_INTERVAL (60)  // interval (in seconds) to save the usage counter if changed
+
+// I/O scheduling class (see linux/ioprio.h)
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS (1)
+#endif
+#ifndef IOPRIO_CLASS_IDLE
+#define IOPRIO_CLASS_IDLE (3)
+#endif
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_CLASS_SHIFT (13)
+#endif
+
 Container::Container (int id, unsigned long int capacity) {
     _id = id;
     _capacity = capacity;
-    // create thread to update usage in the background
+    _usage = 0;
+    _usageDirty = false;
     _running = true;
     pthread_cond_init(&_usageUpdate.cond, NULL);
     pthread_mutex_init(&_usageUpdate.lock, NULL);
-    pthread_create(&_usageUpdate.t, NULL, Container::backgroundUsageUpdate, (void *) this);
+    _usageUpdate.started = false;
+    _usageUpdate.requested = false;
 }
 
 Container::~Container() {
     // signal the background thread for updating usage to terminate now
+    if (_usageUpdate.started) {
+        pthread_mutex_lock(&_usageUpdate.lock);
+        _running = false;
+        pthread_cond_signal(&_usageUpdate.cond);
+        pthread_mutex_unlock(&_usageUpdate.lock);
+        pthread_join(_usageUpdate.t, NULL);
+    }
+    pthread_cond_destroy(&_usageUpdate.cond);
+    pthread_mutex_destroy(&_usageUpdate.lock);
+}
+
+void Container::initUsage() {
+    unsigned long int usage = 0;
+    bool clean = false;
+    if (loadUsage(usage, clean)) {
+        _usage = usage;
+        // the counter may miss the changes after it is last saved if the agent is not shut down cleanly
+        _usageUpdate.requested = !clean;
+        LOG(INFO) << "Load usage of container id = " << _id << ", usage = " << usage << ", clean = " << clean;
+    } else {
+        updateUsage();
+        _usageDirty = true;
+    }
+    // mark the counter as in use, until it is saved on a clean shutdown
+    saveUsage(_usage, /* clean */ false);
+
+    // create thread to update usage in the background
+    _usageUpdate.started = pthread_create(&_usageUpdate.t, NULL, Container::backgroundUsageUpdate, (void *) this) == 0;
+}
+
+void Container::stopUsageUpdate() {
+    if (!_usageUpdate.started)
+        return;
+    pthread_mutex_lock(&_usageUpdate.lock);
     _running = false;
     pthread_cond_signal(&_usageUpdate.cond);
+    pthread_mutex_unlock(&_usageUpdate.lock);
     pthread_join(_usageUpdate.t, NULL);
-    pthread_cond_destroy(&_usageUpdate.cond);
-    pthread_mutex_destroy(&_usageUpdate.lock);
+    _usageUpdate.started = false;
+    saveUsage(_usage, /* clean */ true);
+}
+
+void Container::addUsage(long int delta) {
+    if (delta == 0)
+        return;
+    // avoid underflow if the usage falls behind
+    unsigned long int usage = _usage;
+    while (!_usage.compare_exchange_weak(usage, delta < 0 && usage < (unsigned long int) -delta? 0 : usage + delta));
+    _usageDirty = true;
+}
+
+void Container::reconcileUsage(unsigned long int total, unsigned long int snapshot) {
+    // apply the difference instead of overwriting the usage, so concurrent adjustments are not lost
+    addUsage((long int) total - (long int) snapshot);
+}
+
+bool Container::putChunks(Chunk *chunks[], int numChunks, bool succeeded[]) {
+    bool allSucceeded = true;
+    for (int i = 0; i < numChunks; i++) {
+        succeeded[i] = putChunk(*chunks[i]);
+        allSucceeded = succeeded[i] && allSucceeded;
+    }
+    return allSucceeded;
+}
+
+bool Container::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    // read the whole chunk, and keep only the range
+    if (!getChunk(chunk, /* skipVerification */ true))
+        return false;
+
+    unsigned long int size = chunk.size;
+    int rangeSize = offset >= size? 0 : (int) std::min(size - offset, (unsigned long int) length);
+    unsigned char *data = (unsigned char *) malloc (rangeSize > 0? rangeSize : 1);
+    if (data != NULL && rangeSize > 0)
+        memcpy(data, chunk.data + offset, rangeSize);
+    // drop the whole chunk, but keep its metadata
+    if (chunk.freeData) free(chunk.data);
+    chunk.mapping.reset();
+    if (data == NULL) {
+        LOG(ERROR) << "Failed to allocate memory for range of chunk " << chunk.getChunkName();
+        chunk.data = NULL;
+        chunk.size = 0;
+        return false;
+    }
+    chunk.data = data;
+    chunk.size = rangeSize;
+    chunk.freeData = true;
+    return true;
 }
 
 int Container::getId() {
@@ -44,16 +151,48 @@ void Container::getUsageAndCapacity(unsigned long int &usage, unsigned long int
 }
 
 void Container::bgUpdateUsage() {
+    pthread_mutex_lock(&_usageUpdate.lock);
+    _usageUpdate.requested = true;
     pthread_cond_signal(&_usageUpdate.cond);
+    pthread_mutex_unlock(&_usageUpdate.lock);
 }
 
 void* Container::backgroundUsageUpdate(void *arg) {
     Container *c = (Container *) arg;
-    while (true) {
-        pthread_cond_wait(&c->_usageUpdate.cond, &c->_usageUpdate.lock);
-        if (!c->_running)
-            break;
-        c->updateUsage();
+
+    // reconcile at the lowest cpu and I/O priority to leave the disks and network to the chunk requests
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    int reconcileInterval = Config::getInstance().getAgentUsageReconcileInterval();
+    time_t lastReconcile = time(NULL);
+
+    pthread_mutex_lock(&c->_usageUpdate.lock);
+    while (c->_running) {
+        if (!c->_usageUpdate.requested) {
+            struct timespec nextSchTime;
+            clock_gettime(CLOCK_REALTIME, &nextSchTime);
+            nextSchTime.tv_sec += USAGE_SAVE_INTERVAL;
+            pthread_cond_timedwait(&c->_usageUpdate.cond, &c->_usageUpdate.lock, &nextSchTime);
+            if (!c->_running)
+                break;
+        }
+        bool reconcile = c->_usageUpdate.requested || (reconcileInterval > 0 && time(NULL) >= lastReconcile + reconcileInterval);
+        c->_usageUpdate.requested = false;
+        pthread_mutex_unlock(&c->_usageUpdate.lock);
+
+        if (reconcile) {
+            unsigned long int tracked = c->_usage;
+            c->updateUsage();
+            LOG_IF(WARNING, tracked != c->_usage) << "Reconcile usage of container id = " << c->_id << " from " << tracked << " to " << c->_usage;
+            lastReconcile = time(NULL);
+        }
+        if (c->_usageDirty.exchange(false))
+            c->saveUsage(c->_usage, /* clean */ false);
+
+        pthread_mutex_lock(&c->_usageUpdate.lock);
     }
+    pthread_mutex_unlock(&c->_usageUpdate.lock);
+
     return 0;
 }
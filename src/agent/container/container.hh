@@ -3,6 +3,7 @@
 #ifndef __CONTAINER_HH__
 #define __CONTAINER_HH__
 
+#include <atomic>
 #include <pthread.h>
 #include "../../common/define.hh"
 #include "../../ds/chunk.hh"
@@ -23,6 +24,18 @@ public:
      **/
     virtual bool putChunk(Chunk &chunk) = 0;
 
+    /**
+     * Store/Overwrite a batch of chunks in the container
+     *
+     * @param[in,out] chunks           chunks to store/overwrite;
+     *                                 should have all fields filled
+     * @param[in] numChunks            number of chunks
+     * @param[out] succeeded           whether each chunk is successfully stored
+     *
+     * @return whether all chunks are successfully stored
+     **/
+    virtual bool putChunks(Chunk *chunks[], int numChunks, bool succeeded[]);
+
     /**
      * Get a chunk from the container
      *
@@ -35,6 +48,20 @@ public:
      **/
     virtual bool getChunk(Chunk &chunk, bool skipVerification = false) = 0;
 
+    /**
+     * Get a range of a chunk from the container, without checksum verification
+     *
+     * @param[in,out] chunk            chunk to get;
+     *                                 should have all fields filled, except Chunk::data and Chunk::size, and Chunk::freeData should be set to true;
+     *                                 Chunk::data, Chunk::size would be filled with the range if get is successful;
+     *                                 Chunk::size is less than the length for a range beyond the end of the chunk, and 0 for a range starting at or after the end
+     * @param[in] offset               offset of the range in the chunk
+     * @param[in] length               length of the range
+     *
+     * @return whether the chunk is found and the range is read
+     **/
+    virtual bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
     /**
      * Delete a chunk from the container
      *
@@ -102,12 +129,12 @@ public:
     virtual bool verifyChunk(const Chunk &chunk) = 0;
 
     /**
-     * Update the container usage
+     * Update the container usage by summing up the size of all chunks in the container
      **/
     virtual void updateUsage() = 0;
 
     /**
-     * Update the container usage in background
+     * Reconcile the container usage with updateUsage() in background
      **/
     void bgUpdateUsage();
 
@@ -144,17 +171,69 @@ public:
 
 protected:
     int _id;                           /**< container id */
-    unsigned long int _usage;          /**< container usage */
+    std::atomic<unsigned long int> _usage; /**< container usage */
+    std::atomic<bool> _usageDirty;     /**< whether the usage is changed since last saved */
     unsigned long int _capacity;       /**< container capacity */
     bool _running;                     /**< whether the container is running */
     struct {
         pthread_t t;                   /**< background thread for usage update */
         pthread_cond_t cond;           /**< condition for background update */
         pthread_mutex_t lock;          /**< condition for background update */
+        bool started;                  /**< whether the background thread is started */
+        bool requested;                /**< whether a reconciliation is requested */
     } _usageUpdate;
 
     /**
-     * Background container usage update function 
+     * Initialize the container usage from the saved counter, or with updateUsage() if the counter is not available,
+     * and start the background usage update; derived containers should call it at the end of their constructors
+     **/
+    void initUsage();
+
+    /**
+     * Stop the background usage update and save the usage counter;
+     * derived containers should call it at the beginning of their destructors
+     **/
+    void stopUsageUpdate();
+
+    /**
+     * Adjust the container usage after a chunk operation
+     *
+     * @param[in] delta                change of the usage in bytes
+     **/
+    void addUsage(long int delta);
+
+    /**
+     * Reconcile the container usage with the total size listed in the container,
+     * keeping the changes tracked along the (possibly long) listing
+     *
+     * @param[in] total                total size listed
+     * @param[in] snapshot             usage tracked right before the listing
+     **/
+    void reconcileUsage(unsigned long int total, unsigned long int snapshot);
+
+    /**
+     * Load the saved usage counter
+     *
+     * @param[out] usage               usage saved
+     * @param[out] clean               whether the counter is saved on a clean shutdown
+     *
+     * @return whether the counter is loaded
+     **/
+    virtual bool loadUsage(unsigned long int &usage, bool &clean) { return false; }
+
+    /**
+     * Save the usage counter
+     *
+     * @param[in] usage                usage to save
+     * @param[in] clean                whether the container is shutting down
+     *
+     * @return whether the counter is saved
+     **/
+    virtual bool saveUsage(unsigned long int usage, bool clean) { return false; }
+
+    /**
+     * Background container usage update function, which saves the usage counter periodically,
+     * and reconciles the usage on request or after a long interval at low priority
      *
      * @param[in] arg                  container instance to perform update
      **/
@@ -1,8 +1,9 @@
 // SPDX-License-Identifier: Apache-2.0
 
-#include <stdio.h> // ftell(), rewind(), sprintf()
+#include <stdio.h> // fopen(), snprintf()
 #include <string.h> // strlen()
 #include <string>
+#include <vector>
 #include <time.h>
 #include <unistd.h>
 #include <linux/limits.h>
@@ -10,132 +11,312 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/file.h> // flock()
+#include <sys/mman.h> // mmap()
+#include <algorithm>
 #include <boost/filesystem.hpp>
 
 #include <boost/timer/timer.hpp>
+#include <boost/uuid/string_generator.hpp>
 
 #include <glog/logging.h>
 
 #include "../../common/config.hh"
+#include "../../common/checksum_calculator.hh"
 #include "fs.hh"
 
-FsContainer::FsContainer(int id, const char *dir, unsigned long int capacity) :
+#define MAX_NUM_CHUNKS_TO_SCRUB (1024)
+#define USAGE_FILE_NAME         ".usage"
+#define LAYOUT_FILE_NAME        ".layout"
+#define OLD_CHUNK_DIR_NAME      ".old"
+
+FsContainer::FsContainer(int id, const char *dir, unsigned long int capacity, int dirLevels) :
         Container(id, capacity) {
     strcpy(_dir, dir);
     // create the directory for chunk files
     mkdir(dir, 0755);
-    updateUsage();
 
     _running = true;
+    _dirLevels = dirLevels >= 0? dirLevels : Config::getInstance().getAgentFsDirLevels();
+
+    // chunk files are moved to the configured layout in background if the container is in another (or the flat) layout,
+    // chunk operations hold the lock in shared mode (once per operation) until then;
+    // prefer the migration over new chunk operations, so a steady stream of reads cannot hold off the moves forever
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&_migration.lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    _migration.prevLevels = 0;
+    _migration.running = !loadLayout(_migration.prevLevels) || _migration.prevLevels != _dirLevels;
+    _migration.started = false;
+
+    // I/O engine for chunk files
+    _ioEngine = FsIoEngine::create(Config::getInstance().getAgentFsIoEngine());
+    _directIoThreshold = Config::getInstance().getAgentFsDirectIoThreshold();
+    _mmapThreshold = Config::getInstance().getAgentFsMmapThreshold();
+    LOG(INFO) << "FS container " << id << " uses I/O engine " << _ioEngine->getName();
 
     // background cleaning thread
     pthread_cond_init(&_chunkCleanUp.cond, NULL);
     pthread_mutex_init(&_chunkCleanUp.lock, NULL);
     pthread_create(&_chunkCleanUp.th, NULL, FsContainer::cleanUpOldChunks, (FsContainer *) this);
+
+    // background scrubbing thread
+    _scrub.numWrites = 0;
+    _scrub.ratio = Config::getInstance().getAgentScrubRatio();
+    pthread_cond_init(&_scrub.cond, NULL);
+    pthread_mutex_init(&_scrub.lock, NULL);
+    pthread_create(&_scrub.th, NULL, FsContainer::scrubChunks, (FsContainer *) this);
+
+    // usage from the saved counter, or the chunks in the directory
+    initUsage();
+
+    // background layout migration thread, started after the usage is initialized so a scan never sees chunks half-way moved
+    if (_migration.running) {
+        LOG(INFO) << "Migrate chunks in FS container " << id << " from " << _migration.prevLevels << " to " << _dirLevels << " directory levels in background";
+        _migration.started = pthread_create(&_migration.th, NULL, FsContainer::migrateLayout, (FsContainer *) this) == 0;
+    }
 }
 
 FsContainer::~FsContainer() {
+    // stop the usage update before the container is torn down
+    stopUsageUpdate();
+
     // signal the background cleaning thread to terminate now
+    pthread_mutex_lock(&_chunkCleanUp.lock);
     _running = false;
     pthread_cond_signal(&_chunkCleanUp.cond);
+    pthread_mutex_unlock(&_chunkCleanUp.lock);
+    // stop the layout migration (which resumes on next start) before the old chunk queue goes away
+    if (_migration.started)
+        pthread_join(_migration.th, NULL);
+    pthread_rwlock_destroy(&_migration.lock);
     pthread_join(_chunkCleanUp.th, NULL);
     pthread_cond_destroy(&_chunkCleanUp.cond);
     pthread_mutex_destroy(&_chunkCleanUp.lock);
+    // signal the background scrubbing thread to terminate now
+    pthread_mutex_lock(&_scrub.lock);
+    pthread_cond_signal(&_scrub.cond);
+    pthread_mutex_unlock(&_scrub.lock);
+    pthread_join(_scrub.th, NULL);
+    pthread_cond_destroy(&_scrub.cond);
+    pthread_mutex_destroy(&_scrub.lock);
+
+    delete _ioEngine;
 }
 
-bool FsContainer::getChunkPath(char *fpath, std::string chunkName) {
-    return snprintf(fpath, PATH_MAX, "%s/%s", _dir, chunkName.c_str()) < PATH_MAX;
+FsContainer::LayoutLock::LayoutLock(FsContainer *container) {
+    // the lock is no longer needed once the migration completes
+    lock = container->_migration.running? &container->_migration.lock : NULL;
+    if (lock != NULL)
+        pthread_rwlock_rdlock(lock);
 }
 
-void FsContainer::getOldChunkPath(std::string &ofpath, char *fpath, const char *ctime) {
-    ofpath.clear();
-    ofpath = fpath;
-    ofpath += ".";
-    ofpath += ctime;
+FsContainer::LayoutLock::~LayoutLock() {
+    if (lock != NULL)
+        pthread_rwlock_unlock(lock);
 }
 
-bool FsContainer::putChunk(Chunk &chunk) {
-    char fpath[PATH_MAX];
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+std::string FsContainer::getChunkDir(const boost::uuids::uuid &fuuid, int levels, bool old) {
+    std::string dir(_dir);
+    if (old)
+        dir.append("/").append(OLD_CHUNK_DIR_NAME);
+    // FNV-1a hash on the file uuid, which must stay the same across builds and restarts
+    uint32_t hash = 2166136261u;
+    for (uint8_t byte : fuuid) {
+        hash ^= byte;
+        hash *= 16777619u;
+    }
+    // one byte of the hash for each level, i.e., 256 directories per level
+    char name[4];
+    for (int i = 0; i < levels; i++) {
+        snprintf(name, sizeof(name), "/%02x", (hash >> (8 * i)) & 0xff);
+        dir.append(name);
+    }
+    return dir;
+}
+
+bool FsContainer::getChunkPath(char *fpath, const Chunk &chunk, bool existing) {
+    std::string dir = getChunkDir(chunk.fuuid, _dirLevels, false);
+    if (!existing) {
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(dir, ec);
+        if (ec) {
+            LOG(ERROR) << "Failed to create directory " << dir << " for chunk " << chunk.getChunkName() << ", " << ec.message();
+            return false;
+        }
+    }
+    std::string chunkName = chunk.getChunkName();
+    if (snprintf(fpath, PATH_MAX, "%s/%s", dir.c_str(), chunkName.c_str()) >= PATH_MAX)
         return false;
 
+    // the chunk may not be migrated yet
+    char pfpath[PATH_MAX];
+    struct stat sbuf;
+    if (
+        _migration.running
+        && stat(fpath, &sbuf) != 0
+        && snprintf(pfpath, PATH_MAX, "%s/%s", getChunkDir(chunk.fuuid, _migration.prevLevels, false).c_str(), chunkName.c_str()) < PATH_MAX
+        && stat(pfpath, &sbuf) == 0
+    ) {
+        if (existing) {
+            // access the chunk in place
+            strcpy(fpath, pfpath);
+        } else if (rename(pfpath, fpath) != 0) {
+            // move the chunk to the current layout before it is replaced, so the migration never brings back a stale version
+            LOG(ERROR) << "Failed to move chunk " << pfpath << " to " << fpath;
+            return false;
+        }
+    }
+    return true;
+}
+
+void FsContainer::getOldChunkPath(std::string &ofpath, const Chunk &chunk, const char *version, bool existing) {
+    std::string dir = getChunkDir(chunk.fuuid, _dirLevels, true);
+    if (!existing) {
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(dir, ec);
+        LOG_IF(ERROR, ec) << "Failed to create directory " << dir << " for old chunks, " << ec.message();
+    }
+    std::string name = chunk.getChunkName() + "." + version;
+    ofpath = dir + "/" + name;
+    if (!existing || !_migration.running)
+        return;
+
+    // the old chunk may not be migrated yet, either in the old chunk tree, or next to the chunk in the flat layout
+    struct stat sbuf;
+    if (stat(ofpath.c_str(), &sbuf) == 0)
+        return;
+    std::string pofpaths[2] = {
+        getChunkDir(chunk.fuuid, _migration.prevLevels, true) + "/" + name,
+        getChunkDir(chunk.fuuid, _migration.prevLevels, false) + "/" + name
+    };
+    for (int i = 0; i < 2; i++) {
+        if (stat(pofpaths[i].c_str(), &sbuf) == 0) {
+            ofpath = pofpaths[i];
+            return;
+        }
+    }
+}
+
+int FsContainer::openChunkFileForWrite(Chunk &chunk, char *fpath, bool &direct, unsigned long int &prevSize) {
+    prevSize = 0;
+    if (getChunkPath(fpath, chunk, /* existing */ false) == false)
+        return -1;
+
     std::string ofpath(fpath);
     // backup the chunk first if exists
-    if (boost::filesystem::is_regular_file(ofpath)) {
+    struct stat sbuf;
+    if (stat(fpath, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) {
         // use the current time as the version of the previous chunk
         snprintf(chunk.chunkVersion, CHUNK_VERSION_MAX_LEN, "%ld", time(NULL));
         // generate the old chunk's path
-        getOldChunkPath(ofpath, fpath, chunk.chunkVersion);
+        getOldChunkPath(ofpath, chunk, chunk.chunkVersion, /* existing */ false);
         // move chunk
         if (rename(fpath, ofpath.c_str()) != 0) {
             LOG(ERROR) << "Failed to backup chunk " << fpath << " to " << ofpath << " before write";
-            return false;
+            return -1;
         }
+        prevSize = sbuf.st_size;
+        addOldChunk(ofpath);
     } else {
         // no previous version found
         chunk.chunkVersion[0] = 0;
     }
 
-    boost::timer::cpu_timer mytimer;
-
-    // open (and truncate) the file for write
-    FILE *chunkFile = fopen(fpath, "w");
-    if (chunkFile == NULL) {
-        return false;
+    // open (and truncate) the file for write, bypass the page cache for large chunks if the file system supports it
+    direct = _directIoThreshold > 0 && (unsigned long int) chunk.size >= _directIoThreshold;
+    int fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC | (direct? O_DIRECT : 0), 0644);
+    if (fd == -1 && direct && errno == EINVAL) {
+        direct = false;
+        fd = open(fpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd == -1) {
+        LOG(ERROR) << "Failed to open chunk file " << fpath << " for write, error = " << strerror(errno);
+        return -1;
     }
 
     // lock file for write
-    flock(fileno(chunkFile), LOCK_EX);
-
-    ssize_t written = 0;
-    while (written < chunk.size) {
-        ssize_t ret = 0;
-        ret = fwrite(chunk.data + written, 1, chunk.size - written, chunkFile);
-        if (ret <= 0) {
-            LOG(ERROR) << "Failed to write chunk data " << chunk.getChunkName() << " error = " << strerror(errno);
-            flock(fileno(chunkFile), LOCK_UN);
-            fclose(chunkFile);
-            return false;
+    flock(fd, LOCK_EX);
+
+    return fd;
+}
+
+bool FsContainer::putChunk(Chunk &chunk) {
+    Chunk *chunks[1] = { &chunk };
+    bool succeeded = false;
+    putChunks(chunks, 1, &succeeded);
+    return succeeded;
+}
+
+bool FsContainer::putChunks(Chunk *chunks[], int numChunks, bool succeeded[]) {
+    boost::timer::cpu_timer mytimer;
+    LayoutLock layoutLock(this);
+
+    // open the chunk files, and write them in one batch
+    char fpaths[numChunks][PATH_MAX];
+    std::vector<FsIoEngine::WriteTask> tasks;
+    std::vector<int> taskChunks;
+    std::vector<unsigned long int> prevSizes;
+    bool sync = Config::getInstance().getAgentFlushOnClose();
+    for (int i = 0; i < numChunks; i++) {
+        succeeded[i] = false;
+        FsIoEngine::WriteTask task;
+        unsigned long int prevSize = 0;
+        task.fd = openChunkFileForWrite(*chunks[i], fpaths[i], task.direct, prevSize);
+        if (task.fd == -1) {
+            addUsage(-(long int) prevSize);
+            continue;
         }
-        written += ret;
+        task.data = chunks[i]->data;
+        task.size = chunks[i]->size;
+        task.sync = sync;
+        task.success = false;
+        tasks.push_back(task);
+        taskChunks.push_back(i);
+        prevSizes.push_back(prevSize);
     }
 
-    if (Config::getInstance().getAgentFlushOnClose()) {
-        fflush(chunkFile);
-        fsync(fileno(chunkFile));
-    }
+    _ioEngine->write(tasks);
 
     // benchmark
     double elapsed = mytimer.elapsed().wall * 1.0 / 1e9;
-    DLOG(INFO) << "<WRITE> Write chunk, size: " << (chunk.size * 1.0 / (1 << 20)) << " MB, time: " << elapsed << " s, speed: " << (chunk.size * 1.0 / (1 << 20)) / elapsed << " MB/s";
-
-
-    // unlock file after write
-    flock(fileno(chunkFile), LOCK_UN);
-
-    // close the chunk file
-    fclose(chunkFile);
-
-    // check if all chunk data is successfully written
-    bool success = written == chunk.size;
-    // read chunk data back to get checksum, and verify the checksum if needed
-    Chunk readChunk;
-    readChunk.copyMeta(chunk);
-    success = success && (getChunkInternal(readChunk) || !Config::getInstance().verifyChunkChecksum());
-
-    if (success) {
-        readChunk.computeMD5();
-        chunk.copyMD5(readChunk);
-        elapsed = mytimer.elapsed().wall * 1.0 / 1e9;
-        LOG(INFO) << "Put chunk " << chunk.getChunkName() << " to path " << fpath << " size " << (chunk.size * 1.0 / (1 << 20)) << " MB in " << elapsed << "s, " << (chunk.size * 1.0 / (1 << 20)) / elapsed << " MB/s";
+    DLOG(INFO) << "<WRITE> Write " << tasks.size() << " chunks with " << _ioEngine->getName() << ", time: " << elapsed << " s";
+
+    bool allSucceeded = (int) tasks.size() == numChunks;
+    for (size_t j = 0; j < tasks.size(); j++) {
+        FsIoEngine::WriteTask &task = tasks.at(j);
+        Chunk &chunk = *chunks[taskChunks.at(j)];
+
+        // account for the file written, which replaces the previous version
+        struct stat sbuf;
+        addUsage((fstat(task.fd, &sbuf) == 0? (long int) sbuf.st_size : 0) - (long int) prevSizes.at(j));
+
+        // unlock file after write, and close the chunk file
+        flock(task.fd, LOCK_UN);
+        close(task.fd);
+
+        // check if all chunk data is successfully written
+        succeeded[taskChunks.at(j)] = task.success;
+        allSucceeded = task.success && allSucceeded;
+
+        // the checksum comes with the chunk (and is verified against the data before write if checksum verification is enabled),
+        // so the chunk is not read back; only sampled chunks are verified against the data on disk in background
+        if (task.success) {
+            sampleForScrub(chunk);
+            LOG(INFO) << "Put chunk " << chunk.getChunkName() << " to path " << fpaths[taskChunks.at(j)] << " size " << (chunk.size * 1.0 / (1 << 20)) << " MB in " << elapsed << "s, " << (chunk.size * 1.0 / (1 << 20)) / elapsed << " MB/s";
+        } else {
+            LOG(ERROR) << "Failed to write chunk data " << chunk.getChunkName() << " to path " << fpaths[taskChunks.at(j)];
+        }
     }
 
-    return success;
+    return allSucceeded;
 }
 
 bool FsContainer::getChunk(Chunk &chunk, bool skipVerification) {
+    LayoutLock layoutLock(this);
     char fpath[PATH_MAX];
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk) == false)
         return false;
 
     bool success = getChunkInternal(chunk, skipVerification);
@@ -143,9 +324,54 @@ bool FsContainer::getChunk(Chunk &chunk, bool skipVerification) {
     return success;
 }
 
+bool FsContainer::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    LayoutLock layoutLock(this);
+    char fpath[PATH_MAX];
+    if (getChunkPath(fpath, chunk) == false)
+        return false;
+
+    int fd = open(fpath, O_RDONLY);
+    if (fd == -1) {
+        LOG(ERROR) << "Failed to open chunk file " << fpath;
+        return false;
+    }
+
+    // lock file for read
+    flock(fd, LOCK_SH);
+
+    // get chunk (file) size, and read only the part of the range within the chunk
+    struct stat sbuf;
+    bool success = fstat(fd, &sbuf) == 0;
+    unsigned long int size = success? sbuf.st_size : 0;
+    chunk.size = offset >= size? 0 : (int) std::min(size - offset, (unsigned long int) length);
+    chunk.data = (unsigned char*) malloc (chunk.size > 0? chunk.size : 1);
+    success = success && chunk.data != NULL;
+    for (int bytesRead = 0; success && bytesRead < chunk.size; ) {
+        ssize_t ret = pread(fd, chunk.data + bytesRead, chunk.size - bytesRead, offset + bytesRead);
+        success = ret > 0;
+        bytesRead += ret;
+    }
+
+    // unlock file after read
+    flock(fd, LOCK_UN);
+
+    close(fd);
+
+    if (!success) {
+        LOG(ERROR) << "Failed to read chunk file " << fpath << " offset " << offset << " length " << length << ", error = " << strerror(errno);
+        free(chunk.data);
+        chunk.data = NULL;
+        chunk.size = 0;
+        return false;
+    }
+
+    DLOG(INFO) << "Get chunk " << chunk.getChunkName() << " range offset " << offset << " size " << chunk.size << " from path " << fpath;
+    return true;
+}
+
 bool FsContainer::getChunkInternal(Chunk &chunk, bool skipVerification) {
     char fpath[PATH_MAX];
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk) == false)
         return false;
 
     if (!readChunkFile(fpath, chunk)) {
@@ -158,8 +384,8 @@ bool FsContainer::getChunkInternal(Chunk &chunk, bool skipVerification) {
 }
 
 bool FsContainer::readChunkFile(const char fpath[], Chunk &chunk) {
-    FILE *chunkFile = fopen(fpath, "r");
-    if (chunkFile == NULL) {
+    int fd = open(fpath, O_RDONLY);
+    if (fd == -1) {
         LOG(ERROR) << "Failed to open chunk file " << fpath;
         return false;
     }
@@ -167,32 +393,34 @@ bool FsContainer::readChunkFile(const char fpath[], Chunk &chunk) {
     boost::timer::cpu_timer mytimer;
 
     // lock file for read
-    flock(fileno(chunkFile), LOCK_SH);
+    flock(fd, LOCK_SH);
 
     // get chunk (file) size
-    unsigned long int fsize = 0, read = 0;
-    fseek(chunkFile, 0, SEEK_END);
-    fsize = ftell(chunkFile);
-    rewind(chunkFile);
-    chunk.size = fsize;
-
-    // get chunk (file) data
-    chunk.data = (unsigned char*) malloc (fsize * sizeof(char));
-    size_t ret = 1;
-    while (ret != 0) {
-        ret = fread(chunk.data + read, 1, fsize - read, chunkFile);
-        if (ret < 0) {
-            flock(fileno(chunkFile), LOCK_UN);
-            fclose(chunkFile);
-            return false;
-        }
-        read += ret;
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) != 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return false;
+    }
+    chunk.size = sbuf.st_size;
+
+    // get chunk (file) data, map large chunks to serve them from the page cache without copying
+    bool mapped = _mmapThreshold > 0 && (unsigned long int) chunk.size >= _mmapThreshold && mapChunkFile(fd, chunk);
+    bool success = mapped;
+    if (!mapped) {
+        chunk.data = (unsigned char*) malloc (chunk.size * sizeof(char));
+        success = _ioEngine->read(fd, chunk.data, chunk.size);
     }
 
     // unlock file after read
-    flock(fileno(chunkFile), LOCK_UN);
+    flock(fd, LOCK_UN);
 
-    fclose(chunkFile);
+    close(fd);
+
+    if (!success) {
+        LOG(ERROR) << "Failed to read chunk file " << fpath << ", error = " << strerror(errno);
+        return false;
+    }
 
     double elapsed = mytimer.elapsed().wall * 1.0 / 1e9;
     LOG(INFO) << "Get chunk " << chunk.getChunkName() << " to path " << fpath << " size " << (chunk.size * 1.0 / (1 << 20)) << " MB in " << elapsed << "s, " << (chunk.size * 1.0 / (1 << 20)) / elapsed << " MB/s";
@@ -200,36 +428,75 @@ bool FsContainer::readChunkFile(const char fpath[], Chunk &chunk) {
     return true;
 }
 
+bool FsContainer::mapChunkFile(int fd, Chunk &chunk) {
+    size_t length = chunk.size;
+    // map privately and writable, so callers may still modify the data in place (on their own copy of the pages)
+    void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG(WARNING) << "Failed to map chunk file of chunk " << chunk.getChunkName() << ", error = " << strerror(errno);
+        return false;
+    }
+    madvise(addr, length, MADV_SEQUENTIAL);
+    madvise(addr, length, MADV_WILLNEED);
+
+    // the mapping stays valid after the file is unlocked, closed, or replaced, as chunk files are never modified in place
+    chunk.mapping = std::shared_ptr<void>(addr, [length] (void *p) { munmap(p, length); });
+    chunk.data = (unsigned char *) addr;
+    chunk.freeData = false;
+    return true;
+}
+
 bool FsContainer::deleteChunk(const Chunk &chunk) {
+    LayoutLock layoutLock(this);
+    return deleteChunkInternal(chunk);
+}
+
+bool FsContainer::deleteChunkInternal(const Chunk &chunk) {
     char fpath[PATH_MAX];
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk) == false)
         return false;
 
-    unlink(fpath);
+    unsigned long int size = getFileSize(fpath);
+    if (unlink(fpath) == 0)
+        addUsage(-(long int) size);
     LOG(INFO) << "Delete chunk " << chunk.getChunkName() << " at path " << fpath;
 
     return true;
 }
 
 bool FsContainer::copyChunk(const Chunk &src, Chunk &dst) {
+    LayoutLock layoutLock(this);
     char sfpath[PATH_MAX], dfpath[PATH_MAX];
-    if (getChunkPath(sfpath, src.getChunkName()) == false)
+    if (getChunkPath(sfpath, src) == false)
         return false;
-    if (getChunkPath(dfpath, dst.getChunkName()) == false)
+    if (getChunkPath(dfpath, dst, /* existing */ false) == false)
         return false;
     
     unsigned long int copyBlockSize = Config::getInstance().getCopyBlockSize();
     char buffer[copyBlockSize];
+    unsigned long int prevDstSize = getFileSize(dfpath);
     FILE *srcFile = fopen(sfpath, "r");
+    // replace instead of truncating the existing chunk at the destination, which may be mapped by readers
+    if (srcFile != NULL)
+        unlink(dfpath);
     FILE *dstFile = fopen(dfpath, "w");
 
-    if (srcFile == NULL || dstFile == NULL)
+    if (srcFile == NULL || dstFile == NULL) {
+        if (srcFile != NULL)
+            fclose(srcFile);
+        if (dstFile != NULL)
+            fclose(dstFile);
+        // the existing chunk at the destination may be truncated
+        addUsage((long int) getFileSize(dfpath) - (long int) prevDstSize);
         return false;
+    }
 
     // lock files for read/write
     flock(fileno(srcFile), LOCK_SH);
     flock(fileno(dstFile), LOCK_EX);
 
+    // compute the checksum of the copied data along the copy
+    MD5Calculator cal;
     size_t ret = 0;
     int size = 0;
     while (1) {
@@ -240,6 +507,7 @@ bool FsContainer::copyChunk(const Chunk &src, Chunk &dst) {
             LOG(ERROR) << "Failed to copy a file (not enough storage space?)";
             break;
         }
+        cal.appendData((unsigned char *) buffer, ret);
         size += ret;
     }
 
@@ -250,23 +518,26 @@ bool FsContainer::copyChunk(const Chunk &src, Chunk &dst) {
     fclose(srcFile);
     fclose(dstFile);
 
+    // account for the copied chunk, which replaces any existing one
+    addUsage((long int) getFileSize(dfpath) - (long int) prevDstSize);
+
     // check if the whole chuck is copied
     bool success = size == src.size;
 
-    // always compute and copy the MD5 of the copied chunk, and verify the checksum if needed
-    Chunk readChunk;
-    readChunk.copyMeta(dst);
-    success = success && (getChunkInternal(readChunk) || !Config::getInstance().verifyChunkChecksum());
+    // always mark the MD5 of the copied chunk, and verify the checksum if needed
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    unsigned int md5Length = MD5_DIGEST_LENGTH;
+    success = success && cal.finalize(md5, md5Length);
+    success = success && (!Config::getInstance().verifyChunkChecksum() || memcmp(md5, dst.md5, MD5_DIGEST_LENGTH) == 0);
 
     // remove newly copied chunk if (checksum verification) failed
     if (!success) {
-        deleteChunk(dst);
+        deleteChunkInternal(dst);
     } else {
         // mark the size copied
         dst.size = size;
         // mark the md5 of the copied chunk
-        readChunk.computeMD5();
-        dst.copyMD5(readChunk);
+        memcpy(dst.md5, md5, MD5_DIGEST_LENGTH);
         LOG(INFO) << "Copy chunk " << src.getChunkName() << " to " << dst.getChunkName() << " from path " << sfpath << " to path " << dfpath;
     }
 
@@ -274,17 +545,22 @@ bool FsContainer::copyChunk(const Chunk &src, Chunk &dst) {
 }
 
 bool FsContainer::moveChunk(const Chunk &src, Chunk &dst) {
+    LayoutLock layoutLock(this);
     char sfpath[PATH_MAX], dfpath[PATH_MAX];
-    if (getChunkPath(sfpath, src.getChunkName()) == false)
+    if (getChunkPath(sfpath, src) == false)
         return false;
-    if (getChunkPath(dfpath, dst.getChunkName()) == false)
+    if (getChunkPath(dfpath, dst, /* existing */ false) == false)
         return false;
 
     struct stat sbuf;
     if (stat(sfpath, &sbuf) != 0) 
         return false;
     
+    // a chunk at the destination is replaced (and not restored if the move is reverted)
+    unsigned long int prevDstSize = getFileSize(dfpath);
     bool success = rename(sfpath, dfpath) == 0;
+    if (success)
+        addUsage(-(long int) prevDstSize);
 
     // read the chunk for checksum computation if the request is successful
     Chunk readChunk;
@@ -306,28 +582,31 @@ bool FsContainer::moveChunk(const Chunk &src, Chunk &dst) {
 }
 
 bool FsContainer::hasChunk(const Chunk &chunk) {
+    LayoutLock layoutLock(this);
     char fpath[PATH_MAX];
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk) == false)
         return false;
 
     Chunk readChunk;
     readChunk.copyMeta(chunk);
-    bool checksumPassed = !Config::getInstance().verifyChunkChecksum() || getChunk(readChunk);
+    bool checksumPassed = !Config::getInstance().verifyChunkChecksum() || getChunkInternal(readChunk);
 
     struct stat sbuf;
     return stat(fpath, &sbuf) == 0 && chunk.size == sbuf.st_size && checksumPassed;
 }
 
 bool FsContainer::revertChunk(const Chunk &chunk) {
+    LayoutLock layoutLock(this);
     char fpath[PATH_MAX];
     std::string ofpath, tfpath;
 
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk, /* existing */ false) == false)
         return false;
 
-    getOldChunkPath(ofpath, fpath, chunk.chunkVersion);
-    getOldChunkPath(tfpath, fpath, "0");
+    getOldChunkPath(ofpath, chunk, chunk.chunkVersion);
+    getOldChunkPath(tfpath, chunk, "0", /* existing */ false);
 
+    unsigned long int curSize = getFileSize(fpath);
     rename(fpath, tfpath.c_str());
     bool okay = rename(ofpath.c_str(), fpath) == 0;
     if (!okay) {
@@ -335,16 +614,18 @@ bool FsContainer::revertChunk(const Chunk &chunk) {
         LOG(ERROR) << "Failed to revert chunk " << fpath << " back to version "  << chunk.chunkVersion << " (" << ofpath << ")";
     } else {
         unlink(tfpath.c_str());
+        addUsage((long int) getFileSize(fpath) - (long int) curSize);
     }
 
     return okay;
 }
 
 bool FsContainer::verifyChunk(const Chunk &chunk) {
+    LayoutLock layoutLock(this);
     char fpath[PATH_MAX];
     std::string ofpath, tfpath;
 
-    if (getChunkPath(fpath, chunk.getChunkName()) == false)
+    if (getChunkPath(fpath, chunk) == false)
         return false;
 
     bool matched = false;
@@ -360,11 +641,31 @@ bool FsContainer::verifyChunk(const Chunk &chunk) {
 
 bool FsContainer::getTotalSize(unsigned long int &total, bool needsLock) {
     total = 0;
-    // sum up the size of all files
+    boost::filesystem::path oldDir = boost::filesystem::path(_dir) / OLD_CHUNK_DIR_NAME;
     try {
-        for (boost::filesystem::directory_entry &f : boost::filesystem::recursive_directory_iterator(boost::filesystem::path(_dir))) {
-            if (boost::filesystem::is_regular_file(f.path()) && !isOldChunks(f.path().c_str()))
-                total += boost::filesystem::file_size(f.path());
+        // sum up the size of all chunk files, skipping the container metadata and the old chunk tree
+        boost::filesystem::recursive_directory_iterator end;
+        for (boost::filesystem::recursive_directory_iterator it(_dir); it != end; ++it) {
+            const boost::filesystem::path &fpath = it->path();
+            if (it.depth() == 0 && isMetaFile(fpath.c_str())) {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (!boost::filesystem::is_regular_file(fpath))
+                continue;
+            // old chunks next to the current ones in the flat layout are not migrated yet
+            if (isOldChunks(fpath.c_str())) {
+                addOldChunk(fpath.string());
+            } else {
+                total += boost::filesystem::file_size(fpath);
+            }
+        }
+        // pick up the old chunks left behind (e.g., before a restart) for removal
+        if (boost::filesystem::is_directory(oldDir)) {
+            for (boost::filesystem::directory_entry &f : boost::filesystem::recursive_directory_iterator(oldDir)) {
+                if (boost::filesystem::is_regular_file(f.path()))
+                    addOldChunk(f.path().string());
+            }
         }
     } catch (std::exception &e) {
         LOG(ERROR) << "Failed to list directory " << _dir << ", " << e.what();
@@ -373,6 +674,11 @@ bool FsContainer::getTotalSize(unsigned long int &total, bool needsLock) {
     return true;
 }
 
+unsigned long int FsContainer::getFileSize(const char *fpath) {
+    struct stat sbuf;
+    return stat(fpath, &sbuf) == 0 && S_ISREG(sbuf.st_mode)? sbuf.st_size : 0;
+}
+
 bool FsContainer::isOldChunks(const char *fpath) {
     // find the flie name in the path
     const char *idx = strrchr(fpath, '/');
@@ -380,15 +686,187 @@ bool FsContainer::isOldChunks(const char *fpath) {
     return strchr(idx == NULL? fpath : idx, '.') != NULL;
 }
 
+bool FsContainer::isMetaFile(const char *fpath) {
+    // names of chunks never start with a '.'
+    const char *idx = strrchr(fpath, '/');
+    return (idx == NULL? fpath : idx + 1)[0] == '.';
+}
+
 void FsContainer::updateUsage() {
+    // avoid counting chunks being moved by the layout migration twice (or not at all)
+    LayoutLock layoutLock(this);
+    unsigned long int snapshot = _usage;
     unsigned long int total = 0;
     if (getTotalSize(total)) {
-        _usage = total;
+        reconcileUsage(total, snapshot);
     } else {
         LOG(WARNING) << "Failed to update usage for container id = " << _id;
     }
 }
 
+bool FsContainer::loadUsage(unsigned long int &usage, bool &clean) {
+    std::string path = std::string(_dir) + "/" + USAGE_FILE_NAME;
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+    int isClean = 0;
+    bool okay = fscanf(f, "%lu %d", &usage, &isClean) == 2;
+    fclose(f);
+    clean = isClean != 0;
+    return okay;
+}
+
+bool FsContainer::saveUsage(unsigned long int usage, bool clean) {
+    // write to a temporary file and replace the counter, so the counter is never partially written
+    std::string path = std::string(_dir) + "/" + USAGE_FILE_NAME;
+    std::string tpath = path + ".tmp";
+    FILE *f = fopen(tpath.c_str(), "w");
+    if (f == NULL) {
+        LOG(WARNING) << "Failed to save usage of container id = " << _id << " to " << path;
+        return false;
+    }
+    bool okay = fprintf(f, "%lu %d\n", usage, clean? 1 : 0) > 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    okay = fclose(f) == 0 && okay;
+    okay = okay && rename(tpath.c_str(), path.c_str()) == 0;
+    LOG_IF(WARNING, !okay) << "Failed to save usage of container id = " << _id << " to " << path;
+    return okay;
+}
+
+bool FsContainer::loadLayout(int &levels) {
+    std::string path = std::string(_dir) + "/" + LAYOUT_FILE_NAME;
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+    bool okay = fscanf(f, "%d", &levels) == 1;
+    fclose(f);
+    return okay;
+}
+
+bool FsContainer::saveLayout(int levels) {
+    std::string path = std::string(_dir) + "/" + LAYOUT_FILE_NAME;
+    std::string tpath = path + ".tmp";
+    FILE *f = fopen(tpath.c_str(), "w");
+    if (f == NULL) {
+        LOG(WARNING) << "Failed to save layout of container id = " << _id << " to " << path;
+        return false;
+    }
+    bool okay = fprintf(f, "%d\n", levels) > 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    okay = fclose(f) == 0 && okay;
+    okay = okay && rename(tpath.c_str(), path.c_str()) == 0;
+    LOG_IF(WARNING, !okay) << "Failed to save layout of container id = " << _id << " to " << path;
+    return okay;
+}
+
+bool FsContainer::migrateChunkFile(const boost::filesystem::path &fpath) {
+    // find the file uuid in the chunk name, "<namespace id>_<file uuid>_<file version>_<chunk id>[.<chunk version>]"
+    std::string name = fpath.filename().string();
+    size_t start = name.find('_');
+    size_t end = start == std::string::npos? start : name.find('_', start + 1);
+    if (end == std::string::npos)
+        return false;
+    boost::uuids::uuid fuuid;
+    try {
+        fuuid = boost::uuids::string_generator()(name.substr(start + 1, end - start - 1));
+    } catch (std::exception &e) {
+        return false;
+    }
+
+    bool old = isOldChunks(fpath.c_str());
+    boost::filesystem::path target = boost::filesystem::path(getChunkDir(fuuid, _dirLevels, old)) / name;
+    if (target == fpath)
+        return false;
+
+    // move the file exclusively from chunk operations
+    pthread_rwlock_wrlock(&_migration.lock);
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(target.parent_path(), ec);
+    struct stat sbuf;
+    bool exists = stat(target.c_str(), &sbuf) == 0;
+    bool moved = !ec && !exists && rename(fpath.c_str(), target.c_str()) == 0;
+    pthread_rwlock_unlock(&_migration.lock);
+
+    if (exists) {
+        LOG(WARNING) << "Skip migrating chunk file " << fpath << " as " << target << " already exists";
+    } else if (!moved) {
+        LOG(ERROR) << "Failed to migrate chunk file " << fpath << " to " << target;
+    } else if (old) {
+        // the old chunk may be queued for removal at its previous path
+        addOldChunk(target.string());
+    }
+
+    return moved;
+}
+
+void *FsContainer::migrateLayout(void *arg) {
+    FsContainer *container = (FsContainer *) arg;
+    boost::filesystem::path dirs[2] = {
+        boost::filesystem::path(container->_dir),
+        boost::filesystem::path(container->_dir) / OLD_CHUNK_DIR_NAME
+    };
+
+    // move the chunk files until all are in place, as files may be missed when the directories change along the walk
+    unsigned long int numMoved = 0;
+    bool moved = true;
+    try {
+        while (moved && container->_running) {
+            moved = false;
+            for (int i = 0; i < 2 && container->_running; i++) {
+                if (!boost::filesystem::is_directory(dirs[i]))
+                    continue;
+                boost::filesystem::recursive_directory_iterator end;
+                for (boost::filesystem::recursive_directory_iterator it(dirs[i]); it != end && container->_running; ++it) {
+                    if (i == 0 && it.depth() == 0 && isMetaFile(it->path().c_str())) {
+                        it.disable_recursion_pending();
+                        continue;
+                    }
+                    if (!boost::filesystem::is_regular_file(it->path()))
+                        continue;
+                    // never look into the file again, which is moved away before the walk moves on
+                    it.disable_recursion_pending();
+                    if (container->migrateChunkFile(it->path())) {
+                        moved = true;
+                        numMoved++;
+                    }
+                }
+            }
+        }
+
+        if (!container->_running)
+            return 0;
+
+        // remove the directories emptied, the deeper ones first
+        std::vector<std::string> subdirs;
+        for (boost::filesystem::directory_entry &f : boost::filesystem::recursive_directory_iterator(dirs[0])) {
+            if (boost::filesystem::is_directory(f.path()))
+                subdirs.push_back(f.path().string());
+        }
+        std::sort(subdirs.begin(), subdirs.end(), [](const std::string &a, const std::string &b) { return a.size() > b.size(); });
+        pthread_rwlock_wrlock(&container->_migration.lock);
+        for (const std::string &subdir : subdirs)
+            rmdir(subdir.c_str());
+        pthread_rwlock_unlock(&container->_migration.lock);
+    } catch (std::exception &e) {
+        LOG(ERROR) << "Failed to migrate the layout of container id = " << container->_id << ", " << e.what();
+        return 0;
+    }
+
+    // chunk operations stop looking for chunks in the previous layout
+    pthread_rwlock_wrlock(&container->_migration.lock);
+    if (container->saveLayout(container->_dirLevels))
+        container->_migration.running = false;
+    pthread_rwlock_unlock(&container->_migration.lock);
+
+    LOG(INFO) << "Migrated " << numMoved << " chunk files in container id = " << container->_id << " to " << container->_dirLevels << " directory levels";
+
+    return 0;
+}
+
+void FsContainer::addOldChunk(const std::string &ofpath) {
+    pthread_mutex_lock(&_chunkCleanUp.lock);
+    _chunkCleanUp.oldChunks.emplace_back(time(NULL), ofpath);
+    pthread_mutex_unlock(&_chunkCleanUp.lock);
+}
+
 void *FsContainer::cleanUpOldChunks(void *arg) {
     FsContainer *container = (FsContainer *) arg;
     struct timespec nextSchTime;
@@ -401,29 +879,14 @@ void *FsContainer::cleanUpOldChunks(void *arg) {
         nextSchTime.tv_sec += timeout;
         // wait for signal or timeout before next checking and cleaning
         pthread_cond_timedwait(&container->_chunkCleanUp.cond, &container->_chunkCleanUp.lock, &nextSchTime);
-        // check and clean up
-        bool removed = false;
-        do {
-            // work-around for exception throw of invalid pointer after file removal
-            removed = false;
-            try {
-                // go over the directory
-                for (boost::filesystem::directory_entry &f : boost::filesystem::recursive_directory_iterator(boost::filesystem::path(container->_dir))) {
-                    //LOG(INFO) << "Clean up check path " << f.path();
-                    // skip (1) non-regular files, (2) files that are not old ones, and (3) old chunks that is yet expired (10mins)
-                    if (!boost::filesystem::is_regular_file(f.path()) ||
-                        !isOldChunks(f.path().c_str()) ||
-                        boost::filesystem::last_write_time(f.path()) + timeout * 10 > time(NULL))
-                        continue;
-                    // clean the chunk
-                    LOG(INFO) << "Clean chunk at " << f.path() << " of size " << boost::filesystem::file_size(f.path());
-                    unlink(f.path().c_str());
-                    removed = true;
-                }
-            } catch (std::exception &e) {
-                //LOG(ERROR) << "Failed to list directory " << container->_dir << " for cleaning up old chunks, " << e.what();
-            }
-        } while (removed);
+        // clean up the old chunks backed up for more than 10mins, the ones already reverted or removed are skipped
+        std::deque<std::pair<time_t, std::string> > &oldChunks = container->_chunkCleanUp.oldChunks;
+        time_t now = time(NULL);
+        while (!oldChunks.empty() && oldChunks.front().first + timeout * 10 <= now) {
+            if (unlink(oldChunks.front().second.c_str()) == 0)
+                LOG(INFO) << "Clean chunk at " << oldChunks.front().second;
+            oldChunks.pop_front();
+        }
     } while (container->_running);
     pthread_mutex_unlock(&container->_chunkCleanUp.lock);
 
@@ -431,3 +894,57 @@ void *FsContainer::cleanUpOldChunks(void *arg) {
 
     return 0;
 }
+
+void FsContainer::sampleForScrub(const Chunk &chunk) {
+    if (_scrub.ratio <= 0)
+        return;
+
+    pthread_mutex_lock(&_scrub.lock);
+    // spread the samples evenly over the writes
+    unsigned long int n = _scrub.numWrites++;
+    bool sampled = (n + 1) * _scrub.ratio / 100 > n * _scrub.ratio / 100;
+    // skip the sample if verification falls behind
+    if (sampled && _scrub.chunks.size() < MAX_NUM_CHUNKS_TO_SCRUB) {
+        _scrub.chunks.emplace_back();
+        _scrub.chunks.back().copyMeta(chunk);
+        pthread_cond_signal(&_scrub.cond);
+    }
+    pthread_mutex_unlock(&_scrub.lock);
+}
+
+void *FsContainer::scrubChunks(void *arg) {
+    FsContainer *container = (FsContainer *) arg;
+
+    pthread_mutex_lock(&container->_scrub.lock);
+    while (container->_running) {
+        if (container->_scrub.chunks.empty()) {
+            pthread_cond_wait(&container->_scrub.cond, &container->_scrub.lock);
+            continue;
+        }
+        Chunk readChunk;
+        readChunk.copyMeta(container->_scrub.chunks.front());
+        container->_scrub.chunks.pop_front();
+        pthread_mutex_unlock(&container->_scrub.lock);
+
+        // read the chunk back and verify its checksum; a chunk that is removed or replaced since is skipped
+        LayoutLock layoutLock(container);
+        char fpath[PATH_MAX];
+        struct stat sbuf;
+        if (
+            container->getChunkPath(fpath, readChunk)
+            && stat(fpath, &sbuf) == 0
+            && sbuf.st_size == readChunk.size
+            && container->getChunkInternal(readChunk, /* skip verification */ true)
+            && !readChunk.verifyMD5()
+        ) {
+            LOG(ERROR) << "Found corrupted chunk " << readChunk.getChunkName() << " at path " << fpath << " in container " << container->_id << " on scrubbing";
+        }
+
+        pthread_mutex_lock(&container->_scrub.lock);
+    }
+    pthread_mutex_unlock(&container->_scrub.lock);
+
+    LOG(WARNING) << "FS container scrub thread exists now";
+
+    return 0;
+}
@@ -3,16 +3,31 @@
 #ifndef __FS_CONTAINER_HH__
 #define __FS_CONTAINER_HH__
 
+#include <atomic>
+#include <deque>
 #include <string>
+#include <utility>
 #include <pthread.h>
 #include <linux/limits.h>
 
+#include <boost/filesystem.hpp>
+#include <boost/uuid/uuid.hpp>
+
 #include "container.hh"
+#include "fs_io_engine.hh"
 #include "../../ds/chunk.hh"
 
 class FsContainer : public Container {
 public:
-    FsContainer(int id, const char* dir, unsigned long int capacity);
+    /**
+     * Constructor
+     *
+     * @param[in] id           container id
+     * @param[in] dir          directory of the chunk files
+     * @param[in] capacity     capacity of the container
+     * @param[in] dirLevels    number of hashed directory levels above chunk files, negative to use the configured levels
+     **/
+    FsContainer(int id, const char* dir, unsigned long int capacity, int dirLevels = -1);
     ~FsContainer();
 
     /**
@@ -20,11 +35,21 @@ public:
      **/
     bool putChunk(Chunk &chunk);
 
+    /**
+     * See Container::putChunks()
+     **/
+    bool putChunks(Chunk *chunks[], int numChunks, bool succeeded[]);
+
     /**
      * See Container::getChunk()
      **/
     bool getChunk(Chunk &chunk, bool skipVerification = false);
 
+    /**
+     * See Container::getChunkRange()
+     **/
+    bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
     /**
      * See Container::deleteChunk()
      **/
@@ -66,31 +91,175 @@ private:
         pthread_t th; /**< background chunk cleanup thread */
         pthread_cond_t cond;
         pthread_mutex_t lock;
+        std::deque<std::pair<time_t, std::string> > oldChunks; /**< old chunks pending removal, (time of backup, path) in the order of backup */
     } _chunkCleanUp;
 
+    struct {
+        pthread_t th; /**< background chunk scrubbing thread */
+        pthread_cond_t cond;
+        pthread_mutex_t lock;
+        std::deque<Chunk> chunks; /**< metadata of the written chunks pending verification */
+        unsigned long int numWrites; /**< number of chunks written, for sampling */
+        int ratio; /**< percentage of written chunks to verify */
+    } _scrub;
+
+    struct {
+        pthread_t th; /**< background layout migration thread */
+        pthread_rwlock_t lock; /**< lock on chunk paths, taken exclusively when chunks are moved to the current layout, and never re-entered */
+        std::atomic<bool> running; /**< whether chunks may still be in the previous layout */
+        bool started; /**< whether the migration thread is started */
+        int prevLevels; /**< number of directory levels in the previous layout */
+    } _migration;
+
+    /**
+     * Shared lock on chunk paths for chunk operations while the layout is being migrated
+     **/
+    struct LayoutLock {
+        LayoutLock(FsContainer *container);
+        ~LayoutLock();
+        pthread_rwlock_t *lock;
+    };
+
     bool _running; /**< whether the container is "running" */
+    int _dirLevels; /**< number of hashed directory levels above chunk files */
+
+    FsIoEngine *_ioEngine; /**< engine for reading and writing chunk files */
+    unsigned long int _directIoThreshold; /**< minimum chunk size to write with direct I/O, 0 to disable */
+    unsigned long int _mmapThreshold; /**< minimum chunk size to read by mapping the chunk file, 0 to disable */
+
+    /**
+     * Get the directory of chunk files, which is hashed from the file uuid, so the chunks of a file share a directory
+     *
+     * @param[in] fuuid       file uuid of the chunk
+     * @param[in] levels      number of directory levels
+     * @param[in] old         whether the directory is for old chunks
+     *
+     * @return path of the directory
+     **/
+    std::string getChunkDir(const boost::uuids::uuid &fuuid, int levels, bool old);
 
     /**
      * Get the path of chunk file
      *
      * @param[out] fpath      path of the chunk file
-     * @param[in]  chunkName  name of the chunk
+     * @param[in]  chunk      chunk
+     * @param[in]  existing   whether the path is to access an existing chunk, which may not be migrated to the current layout yet;
+     *                        otherwise, the path is to create the chunk, and its directory is created
      *
      * @return whether the path of the chunk file can be generated
      **/
-    bool getChunkPath(char *fpath, std::string chunkName);
+    bool getChunkPath(char *fpath, const Chunk &chunk, bool existing = true);
 
-    void getOldChunkPath(std::string &ofpath, char *fpath, const char *ctime);
+    /**
+     * Get the path of an old version of chunk, which is kept in a separate tree
+     *
+     * @param[out] ofpath     path of the old chunk
+     * @param[in]  chunk      chunk
+     * @param[in]  version    version of the old chunk
+     * @param[in]  existing   see getChunkPath()
+     **/
+    void getOldChunkPath(std::string &ofpath, const Chunk &chunk, const char *version, bool existing = true);
+
+    /**
+     * Back up the current version of a chunk, and open (and lock) the chunk file for write
+     *
+     * @param[in,out] chunk   chunk to write; the version of the backup is filled
+     * @param[out] fpath      path of the chunk file
+     * @param[out] direct     whether the file is opened with direct I/O
+     * @param[out] prevSize   size of the current version that is backed up, which no longer counts towards the usage
+     *
+     * @return descriptor of the chunk file, or -1 on failure
+     **/
+    int openChunkFileForWrite(Chunk &chunk, char *fpath, bool &direct, unsigned long int &prevSize);
+
+    /**
+     * Get the size of a file
+     *
+     * @param[in] fpath       path of the file
+     *
+     * @return size of the file, or 0 if the file does not exist
+     **/
+    static unsigned long int getFileSize(const char *fpath);
 
     bool getTotalSize(unsigned long int &total, bool needsLock = true);
 
+    /**
+     * Queue an old chunk for removal after it expires
+     *
+     * @param[in] ofpath      path of the old chunk
+     **/
+    void addOldChunk(const std::string &ofpath);
+
+    /**
+     * See Container::loadUsage()
+     **/
+    bool loadUsage(unsigned long int &usage, bool &clean);
+
+    /**
+     * See Container::saveUsage()
+     **/
+    bool saveUsage(unsigned long int usage, bool clean);
+
+    /**
+     * Tell whether a file or directory at the top of container keeps the container metadata (usage counter, layout, old chunks)
+     *
+     * @param[in] fpath       path of the file
+     *
+     * @return whether it keeps the container metadata
+     **/
+    static bool isMetaFile(const char *fpath);
+
+    bool loadLayout(int &levels);
+
+    bool saveLayout(int levels);
+
+    /**
+     * Move a chunk file to its path in the current layout
+     *
+     * @param[in] fpath       path of the chunk file
+     *
+     * @return whether the file is moved
+     **/
+    bool migrateChunkFile(const boost::filesystem::path &fpath);
+
+    static void *migrateLayout(void *arg);
+
     bool getChunkInternal(Chunk &chunk, bool skipVerification = false);
 
+    bool deleteChunkInternal(const Chunk &chunk);
+
+    /**
+     * Read a chunk file, chunks of at least the mmap threshold are mapped instead of copied into a buffer
+     *
+     * @param[in] fpath       path of the chunk file
+     * @param[out] chunk      chunk to read into, Chunk::data and Chunk::size (and Chunk::mapping if mapped) are filled
+     *
+     * @return whether the chunk file is read
+     **/
     bool readChunkFile(const char fpath[], Chunk &chunk);
 
+    /**
+     * Map a chunk file (opened and locked for read) as the chunk data
+     *
+     * @param[in] fd          descriptor of the chunk file
+     * @param[out] chunk      chunk with the size set, Chunk::data and Chunk::mapping are filled
+     *
+     * @return whether the chunk file is mapped
+     **/
+    static bool mapChunkFile(int fd, Chunk &chunk);
+
     static bool isOldChunks(const char *fpath);
 
     static void *cleanUpOldChunks(void *arg);
+
+    /**
+     * Queue a written chunk for verification in background if it is sampled
+     *
+     * @param[in] chunk       written chunk with the checksum filled
+     **/
+    void sampleForScrub(const Chunk &chunk);
+
+    static void *scrubChunks(void *arg);
 };
 
 #endif // define __FS_CONTAINER_HH__
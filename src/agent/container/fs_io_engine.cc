@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>  // posix_memalign()
+#include <string.h>  // memcpy(), memset()
+#include <unistd.h>  // pread(), pwrite(), fsync(), ftruncate()
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "fs_io_engine.hh"
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#define DIRECT_IO_ALIGNMENT        (4096)
+
+bool FsIoEngine::read(int fd, unsigned char *buf, size_t size) {
+    size_t bytesRead = 0;
+    while (bytesRead < size) {
+        ssize_t ret = pread(fd, buf + bytesRead, size - bytesRead, bytesRead);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        bytesRead += ret;
+    }
+    return bytesRead == size;
+}
+
+bool FsIoEngine::writeSync(WriteTask &task, size_t offset) {
+    // the data buffer is not aligned for direct I/O
+    if (task.direct) {
+        int flags = fcntl(task.fd, F_GETFL);
+        if (flags == -1 || fcntl(task.fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+            LOG(ERROR) << "Failed to turn off direct I/O for write, error = " << strerror(errno);
+            task.success = false;
+            return false;
+        }
+        task.direct = false;
+    }
+
+    while (offset < task.size) {
+        ssize_t ret = pwrite(task.fd, task.data + offset, task.size - offset, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            LOG(ERROR) << "Failed to write chunk data, error = " << strerror(errno);
+            break;
+        }
+        offset += ret;
+    }
+
+    // drop any padding of previous direct writes
+    task.success = offset == task.size && ftruncate(task.fd, task.size) == 0 && (!task.sync || fsync(task.fd) == 0);
+    return task.success;
+}
+
+bool PosixIoEngine::write(std::vector<WriteTask> &tasks) {
+    bool allSuccess = true;
+    for (size_t i = 0; i < tasks.size(); i++)
+        allSuccess = writeSync(tasks.at(i), 0) && allSuccess;
+    return allSuccess;
+}
+
+FsIoEngine *FsIoEngine::create(const std::string &name) {
+    if (name == "io_uring") {
+#ifdef HAVE_IO_URING
+        IoUringEngine *engine = new IoUringEngine();
+        if (engine->isReady())
+            return engine;
+        delete engine;
+        LOG(WARNING) << "io_uring is not supported by the kernel, fall back to the portable I/O engine";
+#else
+        LOG(WARNING) << "io_uring is not supported by the build, fall back to the portable I/O engine";
+#endif
+    } else if (name != "posix") {
+        LOG(WARNING) << "Unknown I/O engine " << name << ", fall back to the portable I/O engine";
+    }
+    return new PosixIoEngine();
+}
+
+#ifdef HAVE_IO_URING
+
+#define IO_URING_NUM_ENTRIES       (64)
+#define IO_URING_NUM_BUFFERS       (16)
+#define IO_URING_BUFFER_SIZE       (1 << 20)
+#define IO_URING_MAX_WRITE_SIZE    (1 << 30)
+
+/**
+ * Ring with a set of registered buffers for direct writes
+ **/
+struct IoUringEngine::Ring {
+    int fd;                                   /**< ring descriptor */
+    unsigned int numEntries;                  /**< number of submission queue entries */
+    unsigned int *sqHead;                     /**< submission queue head */
+    unsigned int *sqTail;                     /**< submission queue tail */
+    unsigned int *sqMask;                     /**< submission queue index mask */
+    unsigned int *sqArray;                    /**< submission queue index array */
+    struct io_uring_sqe *sqes;                /**< submission queue entries */
+    unsigned int *cqHead;                     /**< completion queue head */
+    unsigned int *cqTail;                     /**< completion queue tail */
+    unsigned int *cqMask;                     /**< completion queue index mask */
+    struct io_uring_cqe *cqes;                /**< completion queue entries */
+    void *sqRing;                             /**< mapped submission queue ring */
+    void *cqRing;                             /**< mapped completion queue ring */
+    size_t sqRingSize;                        /**< size of the mapped submission queue ring */
+    size_t cqRingSize;                        /**< size of the mapped completion queue ring */
+    std::vector<struct iovec> buffers;        /**< aligned buffers for direct writes */
+    bool fixedBuffers;                        /**< whether the buffers are registered to the ring */
+    unsigned int tail;                        /**< submission queue tail not yet published */
+
+    Ring() : fd(-1), sqes((struct io_uring_sqe *) MAP_FAILED), sqRing(MAP_FAILED), cqRing(MAP_FAILED), fixedBuffers(false) {}
+
+    ~Ring() {
+        // tear down the ring before its buffers are freed
+        if (fd != -1)
+            close(fd);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, numEntries * sizeof(struct io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        for (size_t i = 0; i < buffers.size(); i++)
+            free(buffers.at(i).iov_base);
+    }
+
+    bool setup() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, IO_URING_NUM_ENTRIES, &params);
+        if (fd < 0)
+            return false;
+
+        // map the queues
+        numEntries = params.sq_entries;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return false;
+        cqRing = singleMap? sqRing : mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        sqes = (struct io_uring_sqe *) mmap(0, numEntries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+
+        sqHead = (unsigned int *) ((char *) sqRing + params.sq_off.head);
+        sqTail = (unsigned int *) ((char *) sqRing + params.sq_off.tail);
+        sqMask = (unsigned int *) ((char *) sqRing + params.sq_off.ring_mask);
+        sqArray = (unsigned int *) ((char *) sqRing + params.sq_off.array);
+        cqHead = (unsigned int *) ((char *) cqRing + params.cq_off.head);
+        cqTail = (unsigned int *) ((char *) cqRing + params.cq_off.tail);
+        cqMask = (unsigned int *) ((char *) cqRing + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *) ((char *) cqRing + params.cq_off.cqes);
+        tail = *sqTail;
+
+        // allocate and register the buffers, direct writes still work with unregistered buffers if the registration fails
+        for (int i = 0; i < IO_URING_NUM_BUFFERS; i++) {
+            void *buf = 0;
+            if (posix_memalign(&buf, DIRECT_IO_ALIGNMENT, IO_URING_BUFFER_SIZE) != 0)
+                break;
+            struct iovec iov;
+            iov.iov_base = buf;
+            iov.iov_len = IO_URING_BUFFER_SIZE;
+            buffers.push_back(iov);
+        }
+        fixedBuffers = !buffers.empty() && syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == 0;
+        LOG_IF(WARNING, !fixedBuffers) << "Failed to register buffers to io_uring, error = " << strerror(errno);
+
+        return true;
+    }
+
+    struct io_uring_sqe *nextSqe() {
+        struct io_uring_sqe *sqe = &sqes[tail & *sqMask];
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        tail++;
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        return sqe;
+    }
+
+    /**
+     * Submit the prepared entries, and wait for their completions
+     *
+     * @param[in] numPrepared          number of entries prepared
+     * @param[in] onComplete           handler of each completion
+     *
+     * @return whether all entries are submitted and completed; on failure, the ring must not be reused
+     **/
+    template <typename Handler>
+    bool submitAndWait(unsigned int numPrepared, Handler onComplete) {
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned int numToSubmit = numPrepared, numCompleted = 0;
+        while (numCompleted < numPrepared) {
+            int ret = syscall(__NR_io_uring_enter, fd, numToSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                    continue;
+                LOG(ERROR) << "Failed to submit writes to io_uring, error = " << strerror(errno);
+                // collect the entries already submitted, so none of them is still writing when the caller falls back to the portable path
+                drain(numPrepared - numToSubmit, numCompleted, onComplete);
+                return false;
+            }
+            numToSubmit -= std::min(numToSubmit, (unsigned int) ret);
+            numCompleted += reap(onComplete);
+        }
+        return true;
+    }
+
+    /**
+     * Wait for the completions of entries already submitted, without submitting more
+     *
+     * @param[in] numSubmitted         number of entries submitted
+     * @param[in] numCompleted         number of entries completed
+     * @param[in] onComplete           handler of each completion
+     *
+     * @return whether all submitted entries are completed
+     **/
+    template <typename Handler>
+    bool drain(unsigned int numSubmitted, unsigned int numCompleted, Handler onComplete) {
+        numCompleted += reap(onComplete);
+        while (numCompleted < numSubmitted) {
+            int ret = syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                LOG(ERROR) << "Failed to wait for " << numSubmitted - numCompleted << " submitted writes on io_uring, error = " << strerror(errno);
+                return false;
+            }
+            numCompleted += reap(onComplete);
+        }
+        return true;
+    }
+
+    /**
+     * Consume the completions posted so far
+     *
+     * @param[in] onComplete           handler of each completion
+     *
+     * @return number of completions consumed
+     **/
+    template <typename Handler>
+    unsigned int reap(Handler onComplete) {
+        unsigned int head = *cqHead, numReaped = 0;
+        unsigned int cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != cqTailNow; head++, numReaped++)
+            onComplete(cqes[head & *cqMask]);
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return numReaped;
+    }
+};
+
+IoUringEngine::IoUringEngine() {
+}
+
+IoUringEngine::~IoUringEngine() {
+    for (size_t i = 0; i < _rings.size(); i++)
+        delete _rings.at(i);
+}
+
+bool IoUringEngine::isReady() {
+    Ring *ring = acquireRing();
+    if (ring == NULL)
+        return false;
+    releaseRing(ring);
+    return true;
+}
+
+IoUringEngine::Ring *IoUringEngine::acquireRing() {
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        if (!_idleRings.empty()) {
+            Ring *ring = _idleRings.back();
+            _idleRings.pop_back();
+            return ring;
+        }
+    }
+
+    // set up a new ring for the concurrent writer
+    Ring *ring = new Ring();
+    if (!ring->setup()) {
+        LOG(ERROR) << "Failed to set up io_uring, error = " << strerror(errno);
+        delete ring;
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lk(_lock);
+    _rings.push_back(ring);
+    return ring;
+}
+
+void IoUringEngine::releaseRing(Ring *ring) {
+    std::lock_guard<std::mutex> lk(_lock);
+    _idleRings.push_back(ring);
+}
+
+void IoUringEngine::dropRing(Ring *ring) {
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _rings.erase(std::remove(_rings.begin(), _rings.end(), ring), _rings.end());
+    }
+    // closing the ring cancels any entries left in it
+    delete ring;
+}
+
+bool IoUringEngine::write(std::vector<WriteTask> &tasks) {
+    Ring *ring = acquireRing();
+    if (ring == NULL) {
+        bool allSuccess = true;
+        for (size_t i = 0; i < tasks.size(); i++)
+            allSuccess = writeSync(tasks.at(i), 0) && allSuccess;
+        return allSuccess;
+    }
+
+    std::vector<size_t> written(tasks.size(), 0);
+    std::vector<bool> failed(tasks.size(), false);
+    bool ringUsable = true;
+
+    // number of entries and buffers needed by a write
+    auto numSegments = [] (const WriteTask &task) {
+        size_t segmentSize = task.direct? IO_URING_BUFFER_SIZE : IO_URING_MAX_WRITE_SIZE;
+        size_t size = task.direct? (task.size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT : task.size;
+        return (size + segmentSize - 1) / segmentSize;
+    };
+
+    size_t next = 0;
+    while (next < tasks.size() && ringUsable) {
+        // pack as many writes as the ring and buffers hold into one submission
+        unsigned int numPrepared = 0, numBuffersUsed = 0;
+        size_t start = next;
+        for (; next < tasks.size(); next++) {
+            WriteTask &task = tasks.at(next);
+            task.success = false;
+            size_t numSegs = numSegments(task);
+            // the padding of direct writes is truncated after the writes, and the sync must come after the truncate
+            bool padded = task.direct && task.size % DIRECT_IO_ALIGNMENT != 0;
+            bool linkSync = task.sync && !padded;
+            size_t numEntries = numSegs + (linkSync? 1 : 0);
+            size_t numBuffers = task.direct? numSegs : 0;
+            // writes too large for the ring go through the portable path
+            if (numEntries > ring->numEntries || numBuffers > ring->buffers.size()) {
+                failed.at(next) = true;
+                continue;
+            }
+            if (numPrepared + numEntries > ring->numEntries || numBuffersUsed + numBuffers > ring->buffers.size())
+                break;
+            if (numEntries == 0) {
+                task.success = ftruncate(task.fd, 0) == 0;
+                continue;
+            }
+
+            // writes of the file, followed by the sync, are linked so the sync only runs after all writes succeed
+            for (size_t s = 0, offset = 0; s < numSegs; s++) {
+                struct io_uring_sqe *sqe = ring->nextSqe();
+                size_t length = 0;
+                if (task.direct) {
+                    struct iovec &buf = ring->buffers.at(numBuffersUsed);
+                    size_t dataLength = std::min(task.size - offset, (size_t) IO_URING_BUFFER_SIZE);
+                    memcpy(buf.iov_base, task.data + offset, dataLength);
+                    length = (dataLength + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+                    memset((char *) buf.iov_base + dataLength, 0, length - dataLength);
+                    sqe->opcode = ring->fixedBuffers? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                    sqe->addr = (unsigned long) buf.iov_base;
+                    sqe->buf_index = numBuffersUsed;
+                    numBuffersUsed++;
+                } else {
+                    length = std::min(task.size - offset, (size_t) IO_URING_MAX_WRITE_SIZE);
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->addr = (unsigned long) (task.data + offset);
+                }
+                sqe->fd = task.fd;
+                sqe->off = offset;
+                sqe->len = length;
+                sqe->flags = (s + 1 < numSegs || linkSync)? IOSQE_IO_LINK : 0;
+                sqe->user_data = ((uint64_t) next << 32) | length;
+                offset += length;
+                numPrepared++;
+            }
+            if (linkSync) {
+                struct io_uring_sqe *sqe = ring->nextSqe();
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = task.fd;
+                sqe->user_data = (uint64_t) next << 32;
+                numPrepared++;
+            }
+        }
+
+        if (numPrepared == 0)
+            continue;
+
+        ringUsable = ring->submitAndWait(numPrepared, [&tasks, &written, &failed] (const struct io_uring_cqe &cqe) {
+            size_t idx = cqe.user_data >> 32;
+            unsigned int expected = cqe.user_data & 0xffffffff;
+            if (cqe.res < 0 || (unsigned int) cqe.res != expected) {
+                failed.at(idx) = true;
+            } else {
+                written.at(idx) += cqe.res;
+            }
+        });
+
+        for (size_t i = start; i < next && ringUsable; i++) {
+            WriteTask &task = tasks.at(i);
+            if (failed.at(i) || written.at(i) < task.size)
+                continue;
+            // drop the padding of direct writes, and sync the file afterwards so the padding never outlives a crash
+            bool padded = task.direct && written.at(i) != task.size;
+            task.success = !padded || (ftruncate(task.fd, task.size) == 0 && (!task.sync || fsync(task.fd) == 0));
+        }
+    }
+
+    if (ringUsable) {
+        releaseRing(ring);
+    } else {
+        // unsubmitted entries may be left in the broken ring, so it is torn down instead of reused
+        LOG(ERROR) << "Drop a broken io_uring";
+        dropRing(ring);
+    }
+
+    // retry the failed (and the unsubmitted) writes through the portable path
+    bool allSuccess = true;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (!tasks.at(i).success)
+            writeSync(tasks.at(i), 0);
+        allSuccess = tasks.at(i).success && allSuccess;
+    }
+    return allSuccess;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __FS_IO_ENGINE_HH__
+#define __FS_IO_ENGINE_HH__
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+/**
+ * Engine for reading and writing chunk files of a file system container
+ **/
+class FsIoEngine {
+public:
+
+    /**
+     * Write of a whole chunk file
+     **/
+    struct WriteTask {
+        int fd;                        /**< descriptor of the file opened for write */
+        const unsigned char *data;     /**< data to write from offset 0 */
+        size_t size;                   /**< size of the data */
+        bool direct;                   /**< whether the file is opened with O_DIRECT */
+        bool sync;                     /**< whether to sync the file after write */
+        bool success;                  /**< (out) whether the data is written (and synced) */
+    };
+
+    virtual ~FsIoEngine() {}
+
+    /**
+     * Write a batch of files
+     *
+     * @param[in,out] tasks            writes to run; files opened with O_DIRECT are padded to the alignment while writing, and truncated to the data size afterwards
+     *
+     * @return whether all writes succeed
+     **/
+    virtual bool write(std::vector<WriteTask> &tasks) = 0;
+
+    /**
+     * Read a file from offset 0
+     *
+     * @param[in] fd                   descriptor of the file opened for read
+     * @param[out] buf                 buffer to read into
+     * @param[in] size                 number of bytes to read
+     *
+     * @return whether all bytes are read
+     **/
+    virtual bool read(int fd, unsigned char *buf, size_t size);
+
+    /**
+     * Tell the name of the engine
+     *
+     * @return name of the engine
+     **/
+    virtual const char *getName() const = 0;
+
+    /**
+     * Create an engine, which falls back to the portable engine if the requested one is not available
+     *
+     * @param[in] name                 name of the engine, "io_uring" or "posix"
+     *
+     * @return the engine created
+     **/
+    static FsIoEngine *create(const std::string &name);
+
+protected:
+    bool writeSync(WriteTask &task, size_t offset);
+};
+
+/**
+ * Portable engine on pread(), pwrite() and fsync()
+ **/
+class PosixIoEngine : public FsIoEngine {
+public:
+    bool write(std::vector<WriteTask> &tasks);
+    const char *getName() const { return "posix"; }
+};
+
+#ifdef HAVE_IO_URING
+
+/**
+ * Engine on io_uring, which submits the writes of a batch together with one system call;
+ * the writes and sync of each file are linked, and writes to files opened with O_DIRECT go through registered buffers
+ **/
+class IoUringEngine : public FsIoEngine {
+public:
+    IoUringEngine();
+    ~IoUringEngine();
+
+    /**
+     * Tell whether the kernel supports the engine
+     *
+     * @return whether a ring can be set up
+     **/
+    bool isReady();
+
+    bool write(std::vector<WriteTask> &tasks);
+    const char *getName() const { return "io_uring"; }
+
+private:
+    struct Ring;
+
+    Ring *acquireRing();
+    void releaseRing(Ring *ring);
+    void dropRing(Ring *ring);
+
+    std::mutex _lock;                  /**< lock on the idle rings */
+    std::vector<Ring *> _idleRings;    /**< rings not in use, one ring is used by one thread at a time */
+    std::vector<Ring *> _rings;        /**< all rings set up */
+};
+
+#endif // HAVE_IO_URING
+
+#endif // define __FS_IO_ENGINE_HH__
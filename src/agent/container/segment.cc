@@ -0,0 +1,1052 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdio.h> // fopen(), snprintf()
+#include <stdlib.h> // strtoul()
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <time.h>
+#include <limits.h> // IOV_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h> // pwritev()
+#include <boost/filesystem.hpp>
+
+#include <boost/timer/timer.hpp>
+
+#include <glog/logging.h>
+
+#include "../../common/config.hh"
+#include "../../common/checksum_calculator.hh"
+#include "segment.hh"
+
+#define SEGMENT_FILE_PREFIX     "seg."
+#define CHECKPOINT_FILE_NAME    ".index"
+#define RECORD_MAGIC            (0x31474553)  // "SEG1"
+#define CHECKPOINT_MAGIC        (0x31584449)  // "IDX1"
+#define CHECKPOINT_INTERVAL     (60)          // interval (in seconds) to save the checkpoint and look for segments to compact
+#define OLD_CHUNK_TTL           (600)         // time (in seconds) to keep the replaced chunks for revert, same as file system containers
+#define OLD_CHUNK_MARK          "old"         // argument of relocated records for replaced chunks
+#define MAX_RELOCATE_BATCH_SIZE (64 << 20)    // maximum size of chunk data to relocate in one append on compaction
+
+SegmentContainer::Segment::~Segment() {
+    if (fd != -1)
+        close(fd);
+}
+
+SegmentContainer::SegmentContainer(int id, const char *dir, unsigned long int capacity, unsigned long int segmentSize) :
+        Container(id, capacity) {
+    strcpy(_dir, dir);
+    // create the directory for segment files
+    mkdir(dir, 0755);
+
+    _running = true;
+
+    _segmentSize = segmentSize > 0? segmentSize : Config::getInstance().getAgentSegmentSize();
+    _compactionThreshold = Config::getInstance().getAgentSegmentCompactionThreshold();
+    _checkpoint.segment = 0;
+    _checkpoint.offset = 0;
+
+    pthread_mutex_init(&_appendLock, NULL);
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_compaction.cond, NULL);
+    pthread_mutex_init(&_compaction.lock, NULL);
+
+    // index of chunks from the checkpoint and the records appended since
+    boost::timer::cpu_timer mytimer;
+    if (recover()) {
+        LOG(INFO) << "Segment container " << id << " recovered " << _chunks.size() << " chunks in " << _segments.size() << " segments in " << mytimer.elapsed().wall * 1.0 / 1e9 << "s";
+    } else {
+        // refuse to serve with an index that may miss chunks or bring deleted ones back
+        LOG(ERROR) << "Failed to recover segment container " << id << " at " << dir;
+        exit(1);
+    }
+
+    // background compaction thread
+    _compaction.started = pthread_create(&_compaction.th, NULL, SegmentContainer::runCompaction, (SegmentContainer *) this) == 0;
+
+    // usage from the index
+    initUsage();
+}
+
+SegmentContainer::~SegmentContainer() {
+    // stop the usage update before the container is torn down
+    stopUsageUpdate();
+
+    // signal the background compaction thread to terminate now
+    pthread_mutex_lock(&_compaction.lock);
+    _running = false;
+    pthread_cond_signal(&_compaction.cond);
+    pthread_mutex_unlock(&_compaction.lock);
+    if (_compaction.started)
+        pthread_join(_compaction.th, NULL);
+    pthread_cond_destroy(&_compaction.cond);
+    pthread_mutex_destroy(&_compaction.lock);
+
+    // save the index, so the records need not be replayed on next start
+    saveCheckpoint();
+
+    _active.reset();
+    _segments.clear();
+    pthread_mutex_destroy(&_appendLock);
+    pthread_mutex_destroy(&_lock);
+}
+
+std::string SegmentContainer::getSegmentPath(uint32_t id) const {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s%010u", _dir, SEGMENT_FILE_PREFIX, id);
+    return std::string(path);
+}
+
+bool SegmentContainer::putChunk(Chunk &chunk) {
+    Chunk *chunks[1] = { &chunk };
+    bool succeeded = false;
+    putChunks(chunks, 1, &succeeded);
+    return succeeded;
+}
+
+bool SegmentContainer::putChunks(Chunk *chunks[], int numChunks, bool succeeded[]) {
+    boost::timer::cpu_timer mytimer;
+
+    std::vector<Record> records(numChunks);
+    for (int i = 0; i < numChunks; i++) {
+        succeeded[i] = false;
+        records[i].key = chunks[i]->getChunkName();
+        records[i].data = chunks[i]->data;
+        records[i].header.dataLength = chunks[i]->size;
+        memcpy(records[i].header.md5, chunks[i]->md5, MD5_DIGEST_LENGTH);
+    }
+
+    pthread_mutex_lock(&_appendLock);
+
+    // keep the replaced chunks for revert, and use the current time as their version
+    char version[CHUNK_VERSION_MAX_LEN];
+    snprintf(version, CHUNK_VERSION_MAX_LEN, "%ld", time(NULL));
+    std::unordered_set<std::string> written;
+    pthread_mutex_lock(&_lock);
+    for (int i = 0; i < numChunks; i++) {
+        bool exists = _chunks.count(records[i].key) > 0 || !written.insert(records[i].key).second;
+        strncpy(chunks[i]->chunkVersion, exists? version : "", CHUNK_VERSION_MAX_LEN);
+        records[i].arg = chunks[i]->chunkVersion;
+        sealRecord(records[i], RecordType::RECORD_PUT);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    // append all chunks in one write (and sync)
+    std::vector<Entry> entries;
+    bool okay = appendRecords(records, entries);
+    long int delta = 0;
+    if (okay) {
+        pthread_mutex_lock(&_lock);
+        for (int i = 0; i < numChunks; i++)
+            delta += applyRecord(RecordType::RECORD_PUT, records[i].key, records[i].arg, entries.at(i));
+        pthread_mutex_unlock(&_lock);
+    }
+
+    pthread_mutex_unlock(&_appendLock);
+
+    addUsage(delta);
+
+    double elapsed = mytimer.elapsed().wall * 1.0 / 1e9;
+    for (int i = 0; i < numChunks; i++) {
+        succeeded[i] = okay;
+        if (okay) {
+            DLOG(INFO) << "Put chunk " << records[i].key << " to segment " << entries.at(i).segment << " offset " << entries.at(i).offset << " size " << entries.at(i).length;
+        } else {
+            LOG(ERROR) << "Failed to write chunk data " << records[i].key << " to segments in " << _dir;
+        }
+    }
+    LOG_IF(INFO, okay) << "Put " << numChunks << " chunks to segment container " << _id << " in " << elapsed << "s";
+
+    return okay;
+}
+
+bool SegmentContainer::getChunk(Chunk &chunk, bool skipVerification) {
+    bool success = getChunkInternal(chunk, skipVerification);
+    LOG_IF(INFO, success) << "Get chunk " << chunk.getChunkName() << " from segment container " << _id;
+    return success;
+}
+
+bool SegmentContainer::getChunkInternal(Chunk &chunk, bool skipVerification) {
+    if (!readChunk(chunk.getChunkName(), /* old */ false, chunk)) {
+        DLOG(WARNING) << "Failed to read chunk " << chunk.getChunkName();
+        return false;
+    }
+
+    // verify checksum if needed
+    return skipVerification || !Config::getInstance().verifyChunkChecksum() || chunk.verifyMD5();
+}
+
+bool SegmentContainer::readChunk(const std::string &key, bool old, Chunk &chunk, unsigned long int offset, int length) {
+    // locate the chunk, and keep the segment open until the read completes
+    pthread_mutex_lock(&_lock);
+    std::unordered_map<std::string, Entry> &index = old? _oldChunks : _chunks;
+    std::unordered_map<std::string, Entry>::iterator it = index.find(key);
+    std::shared_ptr<Segment> segment;
+    Entry entry;
+    if (it != index.end()) {
+        entry = it->second;
+        std::map<uint32_t, std::shared_ptr<Segment> >::iterator sit = _segments.find(entry.segment);
+        if (sit != _segments.end())
+            segment = sit->second;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (segment == nullptr)
+        return false;
+
+    // read only the part of the range within the chunk
+    uint32_t rangeLength = offset >= entry.length? 0 : entry.length - offset;
+    if (length >= 0 && (uint32_t) length < rangeLength)
+        rangeLength = length;
+    chunk.size = rangeLength;
+    chunk.data = (unsigned char*) malloc (rangeLength > 0? rangeLength : 1);
+    for (uint32_t bytesRead = 0; bytesRead < rangeLength; ) {
+        ssize_t ret = pread(segment->fd, chunk.data + bytesRead, rangeLength - bytesRead, entry.offset + offset + bytesRead);
+        if (ret <= 0) {
+            LOG(ERROR) << "Failed to read chunk " << key << " from segment " << entry.segment << " offset " << entry.offset + offset << ", error = " << strerror(errno);
+            return false;
+        }
+        bytesRead += ret;
+    }
+    return true;
+}
+
+bool SegmentContainer::getChunkRange(Chunk &chunk, unsigned long int offset, int length) {
+    bool success = readChunk(chunk.getChunkName(), /* old */ false, chunk, offset, length);
+    DLOG_IF(INFO, success) << "Get chunk " << chunk.getChunkName() << " range offset " << offset << " size " << chunk.size << " from segment container " << _id;
+    return success;
+}
+
+bool SegmentContainer::deleteChunk(const Chunk &chunk) {
+    Record record;
+    record.key = chunk.getChunkName();
+    record.data = NULL;
+    record.header.dataLength = 0;
+    memset(record.header.md5, 0, MD5_DIGEST_LENGTH);
+    sealRecord(record, RecordType::RECORD_DELETE);
+
+    pthread_mutex_lock(&_appendLock);
+
+    pthread_mutex_lock(&_lock);
+    bool exists = _chunks.count(record.key) > 0;
+    pthread_mutex_unlock(&_lock);
+
+    // append a tombstone, and leave the data to compaction
+    std::vector<Entry> entries;
+    bool okay = !exists || appendRecords(std::vector<Record>(1, record), entries);
+    long int delta = 0;
+    if (exists && okay) {
+        pthread_mutex_lock(&_lock);
+        delta = applyRecord(RecordType::RECORD_DELETE, record.key, record.arg, entries.at(0));
+        pthread_mutex_unlock(&_lock);
+    }
+
+    pthread_mutex_unlock(&_appendLock);
+
+    addUsage(delta);
+    LOG(INFO) << "Delete chunk " << record.key << " in segment container " << _id;
+
+    return okay;
+}
+
+bool SegmentContainer::copyChunk(const Chunk &src, Chunk &dst) {
+    Chunk readChunk;
+    readChunk.copyMeta(src);
+    if (!this->readChunk(src.getChunkName(), /* old */ false, readChunk))
+        return false;
+
+    // check if the whole chuck is read
+    bool success = readChunk.size == src.size;
+
+    // always mark the MD5 of the copied chunk, and verify the checksum if needed
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    unsigned int md5Length = MD5_DIGEST_LENGTH;
+    MD5Calculator cal;
+    cal.appendData(readChunk.data, readChunk.size);
+    success = success && cal.finalize(md5, md5Length);
+    success = success && (!Config::getInstance().verifyChunkChecksum() || memcmp(md5, dst.md5, MD5_DIGEST_LENGTH) == 0);
+    if (!success)
+        return false;
+
+    // append the copy, which replaces any existing chunk at the destination without keeping it
+    Record record;
+    record.key = dst.getChunkName();
+    record.data = readChunk.data;
+    record.header.dataLength = readChunk.size;
+    memcpy(record.header.md5, md5, MD5_DIGEST_LENGTH);
+    sealRecord(record, RecordType::RECORD_PUT);
+
+    pthread_mutex_lock(&_appendLock);
+    std::vector<Entry> entries;
+    success = appendRecords(std::vector<Record>(1, record), entries);
+    long int delta = 0;
+    if (success) {
+        pthread_mutex_lock(&_lock);
+        delta = applyRecord(RecordType::RECORD_PUT, record.key, record.arg, entries.at(0));
+        pthread_mutex_unlock(&_lock);
+    }
+    pthread_mutex_unlock(&_appendLock);
+
+    addUsage(delta);
+
+    if (success) {
+        // mark the size copied
+        dst.size = readChunk.size;
+        // mark the md5 of the copied chunk
+        memcpy(dst.md5, md5, MD5_DIGEST_LENGTH);
+        LOG(INFO) << "Copy chunk " << src.getChunkName() << " to " << dst.getChunkName() << " in segment container " << _id;
+    }
+
+    return success;
+}
+
+bool SegmentContainer::moveChunk(const Chunk &src, Chunk &dst) {
+    Record records[2];
+    records[0].key = src.getChunkName();
+    records[0].arg = dst.getChunkName();
+    records[1].key = records[0].arg;
+    records[1].arg = records[0].key;
+    for (int i = 0; i < 2; i++) {
+        records[i].data = NULL;
+        records[i].header.dataLength = 0;
+        memset(records[i].header.md5, 0, MD5_DIGEST_LENGTH);
+        sealRecord(records[i], RecordType::RECORD_MOVE);
+    }
+
+    pthread_mutex_lock(&_appendLock);
+
+    // the move only updates the index
+    pthread_mutex_lock(&_lock);
+    std::unordered_map<std::string, Entry>::iterator it = _chunks.find(records[0].key);
+    Entry entry;
+    bool exists = it != _chunks.end();
+    if (exists)
+        entry = it->second;
+    pthread_mutex_unlock(&_lock);
+
+    std::vector<Entry> entries;
+    bool success = exists && appendRecords(std::vector<Record>(1, records[0]), entries);
+    long int delta = 0;
+    if (success) {
+        pthread_mutex_lock(&_lock);
+        // a chunk at the destination is replaced (and not restored if the move is reverted)
+        delta = applyRecord(RecordType::RECORD_MOVE, records[0].key, records[0].arg, entries.at(0));
+        pthread_mutex_unlock(&_lock);
+    }
+
+    pthread_mutex_unlock(&_appendLock);
+
+    addUsage(delta);
+
+    if (!success)
+        return false;
+
+    // read the chunk for checksum verification if needed, otherwise the checksum in the index is used
+    Chunk readChunk;
+    readChunk.copyMeta(dst);
+    if (Config::getInstance().verifyChunkChecksum() && !getChunkInternal(readChunk)) {
+        // revert the change if checksum verification failed
+        pthread_mutex_lock(&_appendLock);
+        if (appendRecords(std::vector<Record>(1, records[1]), entries)) {
+            pthread_mutex_lock(&_lock);
+            applyRecord(RecordType::RECORD_MOVE, records[1].key, records[1].arg, entries.at(0));
+            pthread_mutex_unlock(&_lock);
+        }
+        pthread_mutex_unlock(&_appendLock);
+        return false;
+    }
+
+    // mark the size moved
+    dst.size = entry.length;
+    // mark the md5 of the moved chunk
+    memcpy(dst.md5, entry.md5, MD5_DIGEST_LENGTH);
+    LOG(INFO) << "Move chunk " << src.getChunkName() << " to " << dst.getChunkName() << " in segment container " << _id;
+
+    return true;
+}
+
+bool SegmentContainer::hasChunk(const Chunk &chunk) {
+    pthread_mutex_lock(&_lock);
+    std::unordered_map<std::string, Entry>::iterator it = _chunks.find(chunk.getChunkName());
+    bool exists = it != _chunks.end() && it->second.length == (uint32_t) chunk.size;
+    pthread_mutex_unlock(&_lock);
+
+    Chunk readChunk;
+    readChunk.copyMeta(chunk);
+    return exists && (!Config::getInstance().verifyChunkChecksum() || getChunk(readChunk));
+}
+
+bool SegmentContainer::revertChunk(const Chunk &chunk) {
+    Record record;
+    record.key = chunk.getChunkName();
+    record.arg = chunk.chunkVersion;
+    record.data = NULL;
+    record.header.dataLength = 0;
+    memset(record.header.md5, 0, MD5_DIGEST_LENGTH);
+    sealRecord(record, RecordType::RECORD_REVERT);
+
+    pthread_mutex_lock(&_appendLock);
+
+    pthread_mutex_lock(&_lock);
+    bool exists = _oldChunks.count(record.key + "." + record.arg) > 0;
+    pthread_mutex_unlock(&_lock);
+
+    std::vector<Entry> entries;
+    bool okay = exists && appendRecords(std::vector<Record>(1, record), entries);
+    long int delta = 0;
+    if (okay) {
+        pthread_mutex_lock(&_lock);
+        delta = applyRecord(RecordType::RECORD_REVERT, record.key, record.arg, entries.at(0));
+        pthread_mutex_unlock(&_lock);
+    }
+
+    pthread_mutex_unlock(&_appendLock);
+
+    addUsage(delta);
+    LOG_IF(ERROR, !okay) << "Failed to revert chunk " << record.key << " back to version " << record.arg << " in segment container " << _id;
+
+    return okay;
+}
+
+bool SegmentContainer::verifyChunk(const Chunk &chunk) {
+    Chunk readChunk;
+    readChunk.copyMeta(chunk);
+    // either verified when reading chunk data back (if checksum verification is enabled), or manual verification
+    bool matched = getChunkInternal(readChunk) && (Config::getInstance().verifyChunkChecksum() || readChunk.verifyMD5());
+    LOG_IF(WARNING, !matched) << "Check chunk " << chunk.getChunkName() << " by reading data and computing checksum, result = " << matched;
+
+    return matched;
+}
+
+void SegmentContainer::updateUsage() {
+    unsigned long int snapshot = _usage;
+    unsigned long int total = 0;
+    pthread_mutex_lock(&_lock);
+    for (auto &chunk : _chunks)
+        total += chunk.second.length;
+    pthread_mutex_unlock(&_lock);
+    reconcileUsage(total, snapshot);
+}
+
+void SegmentContainer::sealRecord(Record &record, RecordType type) {
+    record.header.magic = RECORD_MAGIC;
+    record.header.type = type;
+    record.header.reserved = 0;
+    record.header.keyLength = record.key.size();
+    record.header.argLength = record.arg.size();
+    record.header.reserved2 = 0;
+    record.header.checksum = getRecordChecksum(record.header, record.key, record.arg);
+}
+
+uint32_t SegmentContainer::getRecordChecksum(const RecordHeader &header, const std::string &key, const std::string &arg) {
+    RecordHeader h = header;
+    h.checksum = 0;
+    // FNV-1a hash, which detects torn headers at a fraction of the cost of a cryptographic one
+    uint32_t hash = 2166136261u;
+    auto append = [&hash](const unsigned char *data, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+    };
+    append((const unsigned char *) &h, sizeof(h));
+    append((const unsigned char *) key.data(), key.size());
+    append((const unsigned char *) arg.data(), arg.size());
+    return hash;
+}
+
+bool SegmentContainer::addSegment() {
+    uint32_t id = 0;
+    pthread_mutex_lock(&_lock);
+    if (!_segments.empty())
+        id = _segments.rbegin()->first + 1;
+    pthread_mutex_unlock(&_lock);
+
+    std::string path = getSegmentPath(id);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        LOG(ERROR) << "Failed to create segment " << path << ", error = " << strerror(errno);
+        return false;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _active = std::make_shared<Segment>(id, fd, 0);
+    _segments[id] = _active;
+    pthread_mutex_unlock(&_lock);
+
+    // the previous segment is sealed, and may be compacted
+    pthread_mutex_lock(&_compaction.lock);
+    pthread_cond_signal(&_compaction.cond);
+    pthread_mutex_unlock(&_compaction.lock);
+
+    DLOG(INFO) << "Start segment " << path << " in segment container " << _id;
+    return true;
+}
+
+bool SegmentContainer::appendRecords(const std::vector<Record> &records, std::vector<Entry> &entries) {
+    uint64_t total = 0;
+    for (const Record &record : records)
+        total += sizeof(RecordHeader) + record.header.keyLength + record.header.argLength + record.header.dataLength;
+
+    // start a new segment if the active one is full
+    if ((_active == nullptr || (_active->size > 0 && _active->size + total > _segmentSize)) && !addSegment())
+        return false;
+
+    // locate the records
+    uint64_t start = _active->size;
+    uint64_t offset = start;
+    std::vector<struct iovec> iovs;
+    entries.clear();
+    for (const Record &record : records) {
+        Entry entry;
+        entry.segment = _active->id;
+        entry.offset = offset + sizeof(RecordHeader) + record.header.keyLength + record.header.argLength;
+        entry.length = record.header.dataLength;
+        entry.recordLength = entry.offset + entry.length - offset;
+        memcpy(entry.md5, record.header.md5, MD5_DIGEST_LENGTH);
+        entries.push_back(entry);
+        offset += entry.recordLength;
+
+        iovs.push_back({ (void *) &record.header, sizeof(RecordHeader) });
+        if (!record.key.empty())
+            iovs.push_back({ (void *) record.key.data(), record.key.size() });
+        if (!record.arg.empty())
+            iovs.push_back({ (void *) record.arg.data(), record.arg.size() });
+        if (record.header.dataLength > 0)
+            iovs.push_back({ (void *) record.data, record.header.dataLength });
+    }
+
+    // write the records in as few system calls as possible
+    bool okay = true;
+    offset = start;
+    for (size_t idx = 0; idx < iovs.size() && okay; ) {
+        ssize_t ret = pwritev(_active->fd, &iovs[idx], std::min(iovs.size() - idx, (size_t) IOV_MAX), offset);
+        if (ret <= 0) {
+            okay = false;
+            break;
+        }
+        offset += ret;
+        // skip the buffers written
+        for (; idx < iovs.size() && (size_t) ret >= iovs[idx].iov_len; idx++)
+            ret -= iovs[idx].iov_len;
+        if (ret > 0) {
+            iovs[idx].iov_base = (char *) iovs[idx].iov_base + ret;
+            iovs[idx].iov_len -= ret;
+        }
+    }
+
+    // sync the records once for all
+    okay = okay && (!Config::getInstance().getAgentFlushOnClose() || fdatasync(_active->fd) == 0);
+
+    if (!okay) {
+        LOG(ERROR) << "Failed to append " << records.size() << " records to segment " << _active->id << " in segment container " << _id << ", error = " << strerror(errno);
+        // drop the partial records, or start a new segment to keep the records after intact for recovery
+        if (ftruncate(_active->fd, start) != 0)
+            addSegment();
+        return false;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _active->size = start + total;
+    pthread_mutex_unlock(&_lock);
+
+    return true;
+}
+
+void SegmentContainer::updateLiveBytes(const Entry &entry, bool referenced) {
+    std::map<uint32_t, std::shared_ptr<Segment> >::iterator it = _segments.find(entry.segment);
+    if (it == _segments.end())
+        return;
+    if (referenced) {
+        it->second->liveBytes += entry.recordLength;
+    } else {
+        it->second->liveBytes -= std::min((uint64_t) entry.recordLength, it->second->liveBytes);
+    }
+}
+
+long int SegmentContainer::applyRecord(int type, const std::string &key, const std::string &arg, const Entry &entry, bool recovering) {
+    std::unordered_map<std::string, Entry>::iterator it, oit;
+    long int delta = 0;
+
+    switch (type) {
+    case RecordType::RECORD_PUT:
+        it = _chunks.find(key);
+        if (it != _chunks.end()) {
+            delta -= it->second.length;
+            if (!arg.empty()) {
+                // keep the replaced chunk for revert
+                std::string okey = key + "." + arg;
+                oit = _oldChunks.find(okey);
+                if (oit != _oldChunks.end())
+                    updateLiveBytes(oit->second, false);
+                _oldChunks[okey] = it->second;
+                _oldChunkQueue.emplace_back(time(NULL), okey);
+            } else {
+                updateLiveBytes(it->second, false);
+            }
+            _chunks.erase(it);
+        }
+        _chunks[key] = entry;
+        updateLiveBytes(entry, true);
+        delta += entry.length;
+        break;
+
+    case RecordType::RECORD_DELETE:
+        it = _chunks.find(key);
+        if (it != _chunks.end()) {
+            delta -= it->second.length;
+            updateLiveBytes(it->second, false);
+            _chunks.erase(it);
+        }
+        break;
+
+    case RecordType::RECORD_REVERT:
+        oit = _oldChunks.find(key + "." + arg);
+        if (oit == _oldChunks.end())
+            break;
+        // the current chunk is dropped
+        it = _chunks.find(key);
+        if (it != _chunks.end()) {
+            delta -= it->second.length;
+            updateLiveBytes(it->second, false);
+            _chunks.erase(it);
+        }
+        delta += oit->second.length;
+        _chunks[key] = oit->second;
+        _oldChunks.erase(oit);
+        break;
+
+    case RecordType::RECORD_MOVE: {
+        it = _chunks.find(key);
+        if (it == _chunks.end())
+            break;
+        Entry moved = it->second;
+        _chunks.erase(it);
+        // the chunk at the destination is dropped
+        it = _chunks.find(arg);
+        if (it != _chunks.end()) {
+            delta -= it->second.length;
+            updateLiveBytes(it->second, false);
+            _chunks.erase(it);
+        }
+        _chunks[arg] = moved;
+        break;
+    }
+
+    case RecordType::RECORD_RELOCATE: {
+        // relocated chunks are added back if the records before are gone with the compacted segments
+        bool old = arg == OLD_CHUNK_MARK;
+        std::unordered_map<std::string, Entry> &index = old? _oldChunks : _chunks;
+        it = index.find(key);
+        if (it != index.end()) {
+            updateLiveBytes(it->second, false);
+            delta -= old? 0 : it->second.length;
+        } else if (old) {
+            _oldChunkQueue.emplace_back(time(NULL), key);
+        }
+        index[key] = entry;
+        updateLiveBytes(entry, true);
+        delta += old? 0 : entry.length;
+        break;
+    }
+
+    default:
+        LOG_IF(WARNING, !recovering) << "Unknown record type " << type << " for chunk " << key;
+        break;
+    }
+
+    return delta;
+}
+
+bool SegmentContainer::recover() {
+    // open the segments
+    try {
+        for (boost::filesystem::directory_entry &f : boost::filesystem::directory_iterator(boost::filesystem::path(_dir))) {
+            std::string name = f.path().filename().string();
+            if (!boost::filesystem::is_regular_file(f.path()) || name.compare(0, strlen(SEGMENT_FILE_PREFIX), SEGMENT_FILE_PREFIX) != 0)
+                continue;
+            char *end = NULL;
+            uint32_t id = strtoul(name.c_str() + strlen(SEGMENT_FILE_PREFIX), &end, 10);
+            if (end == NULL || *end != 0)
+                continue;
+            int fd = open(f.path().c_str(), O_RDWR);
+            struct stat sbuf;
+            if (fd == -1 || fstat(fd, &sbuf) != 0) {
+                LOG(ERROR) << "Failed to open segment " << f.path() << ", error = " << strerror(errno);
+                if (fd != -1)
+                    close(fd);
+                return false;
+            }
+            _segments[id] = std::make_shared<Segment>(id, fd, sbuf.st_size);
+        }
+    } catch (std::exception &e) {
+        LOG(ERROR) << "Failed to list directory " << _dir << ", " << e.what();
+        return false;
+    }
+
+    // index from the checkpoint
+    if (!loadCheckpoint()) {
+        // compaction drops tombstones together with the segments compacted, so replaying the remaining segments would bring deleted chunks back
+        if (!_segments.empty() && _segments.rbegin()->first + 1 != _segments.size()) {
+            LOG(ERROR) << "Failed to load the checkpoint of segment container " << _id << " with segments removed by compaction, cannot rebuild the index from the segments";
+            return false;
+        }
+        LOG_IF(WARNING, !_segments.empty()) << "Failed to load the checkpoint of segment container " << _id << ", replay all segments";
+        _chunks.clear();
+        _oldChunks.clear();
+        _oldChunkQueue.clear();
+        _checkpoint.segment = 0;
+        _checkpoint.offset = 0;
+    }
+    time_t now = time(NULL);
+    for (auto &chunk : _oldChunks)
+        _oldChunkQueue.emplace_back(now, chunk.first);
+    std::unordered_map<std::string, Entry> *indexes[2] = { &_chunks, &_oldChunks };
+    for (int i = 0; i < 2; i++) {
+        for (std::unordered_map<std::string, Entry>::iterator it = indexes[i]->begin(); it != indexes[i]->end(); ) {
+            if (_segments.count(it->second.segment) == 0) {
+                LOG(WARNING) << "Drop chunk " << it->first << " in missing segment " << it->second.segment;
+                it = indexes[i]->erase(it);
+            } else {
+                updateLiveBytes(it->second, true);
+                it++;
+            }
+        }
+    }
+
+    // replay the records appended after the checkpoint, and drop the records torn on crash
+    for (auto &segment : _segments) {
+        if (segment.first < _checkpoint.segment)
+            continue;
+        uint64_t start = segment.first == _checkpoint.segment? _checkpoint.offset : 0;
+        uint64_t end = replay(*segment.second, start);
+        if (end < segment.second->size) {
+            // only the last segment may be torn, as appends to a sealed segment completed before the next segment started
+            if (segment.second != _segments.rbegin()->second) {
+                LOG(ERROR) << "Corrupted record at offset " << end << " of sealed segment " << segment.first << " in segment container " << _id;
+                return false;
+            }
+            LOG(WARNING) << "Drop " << segment.second->size - end << " bytes of torn records at the end of segment " << segment.first;
+            if (ftruncate(segment.second->fd, end) != 0)
+                LOG(ERROR) << "Failed to truncate segment " << segment.first << ", error = " << strerror(errno);
+            segment.second->size = end;
+        }
+    }
+
+    // continue to append to the last segment
+    if (!_segments.empty()) {
+        _active = _segments.rbegin()->second;
+        return true;
+    }
+    return addSegment();
+}
+
+uint64_t SegmentContainer::replay(Segment &segment, uint64_t offset) {
+    RecordHeader header;
+    std::string key, arg;
+    while (offset + sizeof(header) <= segment.size) {
+        if (pread(segment.fd, &header, sizeof(header), offset) != sizeof(header) || header.magic != RECORD_MAGIC)
+            break;
+        uint64_t recordLength = sizeof(header) + header.keyLength + header.argLength + header.dataLength;
+        if (offset + recordLength > segment.size)
+            break;
+        key.resize(header.keyLength);
+        arg.resize(header.argLength);
+        if (
+            pread(segment.fd, &key[0], header.keyLength, offset + sizeof(header)) != header.keyLength
+            || pread(segment.fd, &arg[0], header.argLength, offset + sizeof(header) + header.keyLength) != header.argLength
+            || getRecordChecksum(header, key, arg) != header.checksum
+        ) {
+            break;
+        }
+
+        Entry entry;
+        entry.segment = segment.id;
+        entry.offset = offset + sizeof(header) + header.keyLength + header.argLength;
+        entry.length = header.dataLength;
+        entry.recordLength = recordLength;
+        memcpy(entry.md5, header.md5, MD5_DIGEST_LENGTH);
+        applyRecord(header.type, key, arg, entry, /* recovering */ true);
+
+        offset += recordLength;
+    }
+    return offset;
+}
+
+bool SegmentContainer::loadCheckpoint() {
+    std::string path = std::string(_dir) + "/" + CHECKPOINT_FILE_NAME;
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+
+    uint32_t magic = 0;
+    uint64_t numEntries[2] = { 0, 0 };
+    bool okay =
+        fread(&magic, sizeof(magic), 1, f) == 1 && magic == CHECKPOINT_MAGIC
+        && fread(&_checkpoint.segment, sizeof(_checkpoint.segment), 1, f) == 1
+        && fread(&_checkpoint.offset, sizeof(_checkpoint.offset), 1, f) == 1
+        && fread(numEntries, sizeof(uint64_t), 2, f) == 2;
+
+    // entries of the current chunks, followed by those of the replaced ones
+    std::unordered_map<std::string, Entry> *indexes[2] = { &_chunks, &_oldChunks };
+    std::string key;
+    for (int i = 0; i < 2 && okay; i++) {
+        indexes[i]->reserve(numEntries[i]);
+        for (uint64_t j = 0; j < numEntries[i] && okay; j++) {
+            uint16_t keyLength = 0;
+            Entry entry;
+            okay = fread(&keyLength, sizeof(keyLength), 1, f) == 1;
+            key.resize(keyLength);
+            okay = okay && fread(&key[0], 1, keyLength, f) == keyLength && fread(&entry, sizeof(entry), 1, f) == 1;
+            if (okay)
+                indexes[i]->emplace(key, entry);
+        }
+    }
+    fclose(f);
+
+    LOG_IF(ERROR, !okay) << "Failed to load the checkpoint of segment container " << _id << " from " << path;
+    return okay;
+}
+
+bool SegmentContainer::saveCheckpoint() {
+    // take a snapshot of the index together with the end of records
+    pthread_mutex_lock(&_appendLock);
+    pthread_mutex_lock(&_lock);
+    if (_active == nullptr || (_active->id == _checkpoint.segment && _active->size == _checkpoint.offset)) {
+        // nothing changed since last checkpoint
+        pthread_mutex_unlock(&_lock);
+        pthread_mutex_unlock(&_appendLock);
+        return true;
+    }
+    uint32_t segment = _active->id;
+    uint64_t offset = _active->size;
+    std::vector<std::pair<std::string, Entry> > entries[2] = {
+        std::vector<std::pair<std::string, Entry> >(_chunks.begin(), _chunks.end()),
+        std::vector<std::pair<std::string, Entry> >(_oldChunks.begin(), _oldChunks.end())
+    };
+    pthread_mutex_unlock(&_lock);
+    pthread_mutex_unlock(&_appendLock);
+
+    // write to a temporary file and replace the checkpoint, so the checkpoint is never partially written
+    std::string path = std::string(_dir) + "/" + CHECKPOINT_FILE_NAME;
+    std::string tpath = path + ".tmp";
+    FILE *f = fopen(tpath.c_str(), "w");
+    if (f == NULL) {
+        LOG(WARNING) << "Failed to save the checkpoint of segment container id = " << _id << " to " << path;
+        return false;
+    }
+    uint32_t magic = CHECKPOINT_MAGIC;
+    uint64_t numEntries[2] = { entries[0].size(), entries[1].size() };
+    bool okay =
+        fwrite(&magic, sizeof(magic), 1, f) == 1
+        && fwrite(&segment, sizeof(segment), 1, f) == 1
+        && fwrite(&offset, sizeof(offset), 1, f) == 1
+        && fwrite(numEntries, sizeof(uint64_t), 2, f) == 2;
+    for (int i = 0; i < 2 && okay; i++) {
+        for (size_t j = 0; j < entries[i].size() && okay; j++) {
+            uint16_t keyLength = entries[i][j].first.size();
+            okay =
+                fwrite(&keyLength, sizeof(keyLength), 1, f) == 1
+                && fwrite(entries[i][j].first.data(), 1, keyLength, f) == keyLength
+                && fwrite(&entries[i][j].second, sizeof(Entry), 1, f) == 1;
+        }
+    }
+    okay = okay && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    okay = fclose(f) == 0 && okay;
+    okay = okay && rename(tpath.c_str(), path.c_str()) == 0;
+    LOG_IF(WARNING, !okay) << "Failed to save the checkpoint of segment container id = " << _id << " to " << path;
+
+    if (okay) {
+        _checkpoint.segment = segment;
+        _checkpoint.offset = offset;
+    }
+    return okay;
+}
+
+void SegmentContainer::expireOldChunks() {
+    // remove the replaced chunks kept for more than 10mins, the ones already reverted are skipped
+    time_t now = time(NULL);
+    pthread_mutex_lock(&_lock);
+    while (!_oldChunkQueue.empty() && _oldChunkQueue.front().first + OLD_CHUNK_TTL <= now) {
+        std::unordered_map<std::string, Entry>::iterator it = _oldChunks.find(_oldChunkQueue.front().second);
+        if (it != _oldChunks.end()) {
+            updateLiveBytes(it->second, false);
+            _oldChunks.erase(it);
+        }
+        _oldChunkQueue.pop_front();
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+bool SegmentContainer::compactSegment(uint32_t id) {
+    boost::timer::cpu_timer mytimer;
+
+    // find the chunks in the segment
+    std::vector<std::pair<std::string, Entry> > chunks[2];
+    std::shared_ptr<Segment> segment;
+    pthread_mutex_lock(&_lock);
+    std::map<uint32_t, std::shared_ptr<Segment> >::iterator sit = _segments.find(id);
+    if (sit != _segments.end() && sit->second != _active) {
+        segment = sit->second;
+        std::unordered_map<std::string, Entry> *indexes[2] = { &_chunks, &_oldChunks };
+        for (int i = 0; i < 2; i++) {
+            for (auto &chunk : *indexes[i]) {
+                if (chunk.second.segment == id)
+                    chunks[i].push_back(chunk);
+            }
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (segment == nullptr)
+        return false;
+
+    // relocate the chunks to the active segment in batches
+    size_t numRelocated = 0;
+    std::set<uint32_t> targets;
+    for (int i = 0; i < 2 && _running; i++) {
+        for (size_t start = 0; start < chunks[i].size() && _running; ) {
+            // read a batch of chunks from the segment, which no longer changes
+            std::vector<Record> records;
+            std::vector<std::vector<unsigned char> > data;
+            uint64_t batchSize = 0;
+            for (; start < chunks[i].size() && (records.empty() || batchSize < MAX_RELOCATE_BATCH_SIZE); start++) {
+                const Entry &entry = chunks[i][start].second;
+                data.emplace_back(entry.length);
+                if (entry.length > 0 && pread(segment->fd, data.back().data(), entry.length, entry.offset) != entry.length) {
+                    LOG(ERROR) << "Failed to read chunk " << chunks[i][start].first << " from segment " << id << " for compaction";
+                    return false;
+                }
+                records.emplace_back();
+                records.back().key = chunks[i][start].first;
+                records.back().arg = i == 0? "" : OLD_CHUNK_MARK;
+                records.back().header.dataLength = entry.length;
+                memcpy(records.back().header.md5, entry.md5, MD5_DIGEST_LENGTH);
+                sealRecord(records.back(), RecordType::RECORD_RELOCATE);
+                batchSize += entry.length;
+            }
+            // data buffers no longer move once all are added
+            for (size_t j = 0; j < records.size(); j++)
+                records[j].data = data[j].data();
+
+            pthread_mutex_lock(&_appendLock);
+
+            // skip the chunks changed since read
+            std::vector<Record> valid;
+            pthread_mutex_lock(&_lock);
+            std::unordered_map<std::string, Entry> &index = i == 0? _chunks : _oldChunks;
+            for (size_t j = 0; j < records.size(); j++) {
+                const Entry &entry = chunks[i][start - records.size() + j].second;
+                std::unordered_map<std::string, Entry>::iterator it = index.find(records[j].key);
+                if (it != index.end() && it->second.segment == id && it->second.offset == entry.offset)
+                    valid.push_back(records[j]);
+            }
+            pthread_mutex_unlock(&_lock);
+
+            std::vector<Entry> entries;
+            bool okay = valid.empty() || appendRecords(valid, entries);
+            if (okay && !valid.empty()) {
+                pthread_mutex_lock(&_lock);
+                for (size_t j = 0; j < valid.size(); j++) {
+                    applyRecord(RecordType::RECORD_RELOCATE, valid[j].key, valid[j].arg, entries.at(j));
+                    targets.insert(entries.at(j).segment);
+                }
+                pthread_mutex_unlock(&_lock);
+            }
+
+            pthread_mutex_unlock(&_appendLock);
+
+            if (!okay)
+                return false;
+            numRelocated += valid.size();
+        }
+    }
+
+    // persist the relocated chunks, regardless of flush on close, as their only other copy is removed with the segment
+    if (!_running)
+        return false;
+    for (uint32_t target : targets) {
+        pthread_mutex_lock(&_lock);
+        std::map<uint32_t, std::shared_ptr<Segment> >::iterator tit = _segments.find(target);
+        std::shared_ptr<Segment> targetSegment = tit != _segments.end()? tit->second : nullptr;
+        pthread_mutex_unlock(&_lock);
+        if (targetSegment == nullptr || fdatasync(targetSegment->fd) != 0) {
+            LOG(ERROR) << "Failed to sync segment " << target << " with chunks relocated from segment " << id << ", error = " << strerror(errno);
+            return false;
+        }
+    }
+
+    // persist the new locations before the segment is removed
+    if (!saveCheckpoint())
+        return false;
+
+    pthread_mutex_lock(&_lock);
+    bool empty = segment->liveBytes == 0;
+    if (empty)
+        _segments.erase(id);
+    pthread_mutex_unlock(&_lock);
+
+    if (!empty) {
+        LOG(WARNING) << "Segment " << id << " in segment container " << _id << " still has " << segment->liveBytes << " bytes referenced after compaction";
+        return false;
+    }
+
+    // the segment file is closed once all reads on it complete
+    std::string path = getSegmentPath(id);
+    unlink(path.c_str());
+    LOG(INFO) << "Compact segment " << path << " of " << segment->size << " bytes, relocate " << numRelocated << " chunks in " << mytimer.elapsed().wall * 1.0 / 1e9 << "s";
+
+    return true;
+}
+
+void SegmentContainer::compact() {
+    expireOldChunks();
+
+    // compact the sealed segments with the most garbage first
+    std::vector<std::pair<uint64_t, uint32_t> > candidates;
+    if (_compactionThreshold > 0) {
+        pthread_mutex_lock(&_lock);
+        for (auto &segment : _segments) {
+            const Segment &s = *segment.second;
+            if (segment.second != _active && (s.size - s.liveBytes) * 100 >= s.size * _compactionThreshold)
+                candidates.emplace_back(s.size - s.liveBytes, s.id);
+        }
+        pthread_mutex_unlock(&_lock);
+    }
+    std::sort(candidates.rbegin(), candidates.rend());
+    for (size_t i = 0; i < candidates.size() && _running; i++)
+        compactSegment(candidates[i].second);
+
+    saveCheckpoint();
+}
+
+void *SegmentContainer::runCompaction(void *arg) {
+    SegmentContainer *container = (SegmentContainer *) arg;
+    struct timespec nextSchTime;
+
+    pthread_mutex_lock(&container->_compaction.lock);
+    while (container->_running) {
+        clock_gettime(CLOCK_REALTIME, &nextSchTime);
+        nextSchTime.tv_sec += CHECKPOINT_INTERVAL;
+        // wait for a sealed segment or timeout before next checking
+        pthread_cond_timedwait(&container->_compaction.cond, &container->_compaction.lock, &nextSchTime);
+        if (!container->_running)
+            break;
+        pthread_mutex_unlock(&container->_compaction.lock);
+
+        container->compact();
+
+        pthread_mutex_lock(&container->_compaction.lock);
+    }
+    pthread_mutex_unlock(&container->_compaction.lock);
+
+    LOG(WARNING) << "Segment container compaction thread exists now";
+
+    return 0;
+}
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __SEGMENT_CONTAINER_HH__
+#define __SEGMENT_CONTAINER_HH__
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/limits.h>
+
+#include "container.hh"
+#include "../../ds/chunk.hh"
+
+/**
+ * Container that appends chunks as records to large segment files in a local directory;
+ * an in-memory index locates the chunks in the segments, and is checkpointed to the directory
+ * and rebuilt from the checkpoint and the records appended since on start;
+ * deletes and reverts are appended as records, and segments mostly taken up by replaced or deleted chunks are compacted in background
+ **/
+class SegmentContainer : public Container {
+public:
+    /**
+     * Constructor
+     *
+     * @param[in] id           container id
+     * @param[in] dir          directory of the segment files
+     * @param[in] capacity     capacity of the container
+     * @param[in] segmentSize  size of segment files, 0 to use the configured size
+     **/
+    SegmentContainer(int id, const char* dir, unsigned long int capacity, unsigned long int segmentSize = 0);
+    ~SegmentContainer();
+
+    /**
+     * Expire the replaced chunks kept for long enough, and compact the sealed segments mostly taken up by replaced or deleted chunks now
+     **/
+    void compact();
+
+    /**
+     * See Container::putChunk()
+     **/
+    bool putChunk(Chunk &chunk);
+
+    /**
+     * See Container::putChunks()
+     **/
+    bool putChunks(Chunk *chunks[], int numChunks, bool succeeded[]);
+
+    /**
+     * See Container::getChunk()
+     **/
+    bool getChunk(Chunk &chunk, bool skipVerification = false);
+
+    /**
+     * See Container::getChunkRange()
+     **/
+    bool getChunkRange(Chunk &chunk, unsigned long int offset, int length);
+
+    /**
+     * See Container::deleteChunk()
+     **/
+    bool deleteChunk(const Chunk &chunk);
+
+    /**
+     * See Container::copyChunk()
+     **/
+    bool copyChunk(const Chunk &chunk, Chunk &dst);
+
+    /**
+     * See Container::moveChunk()
+     **/
+    bool moveChunk(const Chunk &src, Chunk &dst);
+
+    /**
+     * See Container::hasChunk()
+     **/
+    bool hasChunk(const Chunk &chunk);
+
+    /**
+     * See Container::revertChunk()
+     **/
+    bool revertChunk(const Chunk &chunk);
+
+    /**
+     * See Container::verifyChunk()
+     **/
+    bool verifyChunk(const Chunk &chunk);
+
+    /**
+     * See Container::updateUsage()
+     **/
+    void updateUsage();
+
+private:
+    enum RecordType {
+        RECORD_PUT,                    /**< chunk data; the argument is the version assigned to the replaced chunk, empty if it is not kept */
+        RECORD_DELETE,                 /**< tombstone of a chunk */
+        RECORD_REVERT,                 /**< revert of a chunk; the argument is the version to restore */
+        RECORD_MOVE,                   /**< move of a chunk; the argument is the destination chunk name */
+        RECORD_RELOCATE,               /**< chunk data copied by compaction; the key is the index key of the chunk */
+
+        UNKNOWN_RECORD
+    };
+
+    /**
+     * Header of a record in segments, followed by the key, the argument, and the data
+     **/
+    struct RecordHeader {
+        uint32_t magic;
+        uint8_t type;                  /**< record type, see RecordType */
+        uint8_t reserved;
+        uint16_t keyLength;            /**< length of the key (chunk name) */
+        uint16_t argLength;            /**< length of the argument */
+        uint16_t reserved2;
+        uint32_t dataLength;           /**< length of the chunk data */
+        unsigned char md5[MD5_DIGEST_LENGTH]; /**< checksum of the chunk data */
+        uint32_t checksum;             /**< checksum of the header (with this field as 0), the key and the argument */
+    } __attribute__((packed));
+
+    /**
+     * Location of a chunk in the segments
+     **/
+    struct Entry {
+        uint32_t segment;              /**< segment id */
+        uint64_t offset;               /**< offset of the chunk data in the segment */
+        uint32_t length;               /**< length of the chunk data */
+        uint32_t recordLength;         /**< length of the whole record */
+        unsigned char md5[MD5_DIGEST_LENGTH]; /**< checksum of the chunk data */
+    };
+
+    /**
+     * Segment file
+     **/
+    struct Segment {
+        Segment(uint32_t id, int fd, uint64_t size) : id(id), fd(fd), size(size), liveBytes(0) {}
+        ~Segment();
+        uint32_t id;                   /**< segment id */
+        int fd;                        /**< descriptor of the segment file, closed when the segment is no longer referenced */
+        uint64_t size;                 /**< size of the records appended */
+        uint64_t liveBytes;            /**< size of the records referenced by the index */
+    };
+
+    /**
+     * Record to append
+     **/
+    struct Record {
+        RecordHeader header;
+        std::string key;
+        std::string arg;
+        const unsigned char *data;
+    };
+
+    char _dir[PATH_MAX];               /**< container folder path */
+    bool _running;                     /**< whether the container is "running" */
+
+    pthread_mutex_t _appendLock;       /**< lock on appending records, held by all index changes to keep them in the order of the records */
+    pthread_mutex_t _lock;             /**< lock on the index and the segments */
+    std::unordered_map<std::string, Entry> _chunks; /**< index of the current chunks, by chunk name */
+    std::unordered_map<std::string, Entry> _oldChunks; /**< index of the replaced chunks kept for revert, by chunk name and version */
+    std::deque<std::pair<time_t, std::string> > _oldChunkQueue; /**< old chunks pending removal, (time of replacement, index key) in the order of replacement */
+    std::map<uint32_t, std::shared_ptr<Segment> > _segments; /**< segments by id */
+    std::shared_ptr<Segment> _active; /**< segment to append to */
+    uint64_t _segmentSize;             /**< size of a segment to start appending to a new one */
+    int _compactionThreshold;          /**< percentage of garbage in a segment to compact it, 0 to disable */
+
+    struct {
+        uint32_t segment;              /**< segment of the last record covered by the checkpoint */
+        uint64_t offset;               /**< end of the last record covered by the checkpoint */
+    } _checkpoint;
+
+    struct {
+        pthread_t th;                  /**< background compaction (and checkpoint) thread */
+        pthread_cond_t cond;
+        pthread_mutex_t lock;
+        bool started;                  /**< whether the background thread is started */
+    } _compaction;
+
+    /**
+     * Get the path of a segment file
+     *
+     * @param[in] id          segment id
+     *
+     * @return path of the segment file
+     **/
+    std::string getSegmentPath(uint32_t id) const;
+
+    /**
+     * Open the segment files, and rebuild the index from the checkpoint and the records appended after it
+     *
+     * @return whether the index is rebuilt
+     **/
+    bool recover();
+
+    /**
+     * Replay the records of a segment to the index
+     *
+     * @param[in] segment     segment to replay
+     * @param[in] offset      offset of the first record to replay
+     *
+     * @return end of the last valid record; records after it are torn
+     **/
+    uint64_t replay(Segment &segment, uint64_t offset);
+
+    bool loadCheckpoint();
+
+    /**
+     * Save the index as the checkpoint, which covers all records appended so far
+     *
+     * @return whether the checkpoint is saved
+     **/
+    bool saveCheckpoint();
+
+    /**
+     * Start appending to a new segment
+     *
+     * @return whether the segment is created
+     **/
+    bool addSegment();
+
+    /**
+     * Fill the header of a record
+     *
+     * @param[in,out] record  record with the key, argument, and data length (and checksum) set
+     * @param[in] type        record type
+     **/
+    static void sealRecord(Record &record, RecordType type);
+
+    static uint32_t getRecordChecksum(const RecordHeader &header, const std::string &key, const std::string &arg);
+
+    /**
+     * Append records to the active segment in one write; callers should hold _appendLock
+     *
+     * @param[in] records     records to append
+     * @param[out] entries    locations of the chunk data in the records
+     *
+     * @return whether the records are appended
+     **/
+    bool appendRecords(const std::vector<Record> &records, std::vector<Entry> &entries);
+
+    /**
+     * Apply a record to the index; callers should hold _lock
+     *
+     * @param[in] type        record type
+     * @param[in] key         key of the record
+     * @param[in] arg         argument of the record
+     * @param[in] entry       location of the chunk data in the record
+     * @param[in] recovering  whether the record is replayed on start
+     *
+     * @return change of usage
+     **/
+    long int applyRecord(int type, const std::string &key, const std::string &arg, const Entry &entry, bool recovering = false);
+
+    /**
+     * Account for an entry added to or dropped from the index in the live bytes of its segment; callers should hold _lock
+     *
+     * @param[in] entry       entry added or dropped
+     * @param[in] referenced  whether the entry is added
+     **/
+    void updateLiveBytes(const Entry &entry, bool referenced);
+
+    /**
+     * Read the data of a chunk
+     *
+     * @param[in] key         index key of the chunk
+     * @param[in] old         whether the chunk is a replaced one
+     * @param[in,out] chunk   chunk to read into, Chunk::data and Chunk::size are filled
+     * @param[in] offset      offset of the range to read in the chunk
+     * @param[in] length      length of the range to read, -1 to read till the end of the chunk
+     *
+     * @return whether the chunk is read
+     **/
+    bool readChunk(const std::string &key, bool old, Chunk &chunk, unsigned long int offset = 0, int length = -1);
+
+    bool getChunkInternal(Chunk &chunk, bool skipVerification = false);
+
+    /**
+     * Remove the replaced chunks kept for long enough
+     **/
+    void expireOldChunks();
+
+    /**
+     * Move the chunks referenced in a segment to the active segment, and remove the segment
+     *
+     * @param[in] id          segment id
+     *
+     * @return whether the segment is compacted
+     **/
+    bool compactSegment(uint32_t id);
+
+    static void *runCompaction(void *arg);
+};
+
+#endif // define __SEGMENT_CONTAINER_HH__
@@ -1,5 +1,8 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <atomic>
+#include <future>
+#include <memory>
 #include <stdexcept>
 #include <unistd.h>
 #include <linux/limits.h>
@@ -43,6 +46,10 @@ ContainerManager::ContainerManager() {
             _containerPtrs[i] = new AzureContainer(cid, cstr, key, capacity, proxyIP, proxyPort);
             DLOG(INFO) << "Azure container with id = " << cid << " capacity = " << capacity;
             break;
+        case ContainerType::SEGMENT_CONTAINER:
+            _containerPtrs[i] = new SegmentContainer(cid, cstr.c_str(), capacity);
+            DLOG(INFO) << "Segment container with id = " << cid << " folder name = " << cstr << " capacity = " << capacity;
+            break;
         default:
             LOG(ERROR) << "Container type " << ctype << " not supported! (container no. = " << i << ")";
             exit(1);
@@ -53,10 +60,41 @@ ContainerManager::ContainerManager() {
             exit(1);
         }
     }
+
+    // start the I/O threads of containers, which only help when chunks of a request span multiple containers
+    int numIoThreads = _numContainers > 1? config.getAgentNumContainerIoThreads() : 0;
+    for (int i = 0; i < _numContainers && numIoThreads > 0; i++) {
+        IoExecutor *executor = new IoExecutor();
+        executor->running = true;
+        for (int t = 0; t < numIoThreads; t++) {
+            pthread_t pt;
+            if (pthread_create(&pt, NULL, ContainerManager::runIoExecutor, executor) != 0) {
+                LOG(ERROR) << "Failed to start I/O thread " << t << " of container " << _containerPtrs[i]->getId();
+                continue;
+            }
+            executor->workers.push_back(pt);
+        }
+        _executors.insert(std::make_pair(_containerPtrs[i], executor));
+    }
+
+    _cache = new ChunkCache(config.getAgentChunkCacheSize(), config.getAgentChunkCacheDir(), config.getAgentChunkCacheDirSize());
 }
 
 ContainerManager::~ContainerManager() {
     LOG(WARNING) << "Terminating Container Manager ...";
+    // stop the I/O threads before releasing the containers
+    for (auto &executor : _executors) {
+        {
+            std::lock_guard<std::mutex> lk(executor.second->lock);
+            executor.second->running = false;
+        }
+        executor.second->cv.notify_all();
+        for (size_t i = 0; i < executor.second->workers.size(); i++)
+            pthread_join(executor.second->workers.at(i), NULL);
+        delete executor.second;
+    }
+    _executors.clear();
+    delete _cache;
     // release the containers
     for (int i = 0; i < _numContainers; i++)
         delete _containerPtrs[i];
@@ -64,90 +102,101 @@ ContainerManager::~ContainerManager() {
 }
 
 bool ContainerManager::putChunks(int containerId[], Chunk chunks[], int numChunks) {
-    bool ret = true;
-    int i = 0;
-
     bool verifyChecksum = Config::getInstance().verifyChunkChecksum();
+    bool stored[numChunks];
 
-    // store chunks to containers
-    for (i = 0; i < numChunks && ret; i++) {
-        try {
-            // verify checksum before write
-            if (verifyChecksum && !chunks[i].verifyMD5()) {
-                ret = false;
-                break;
-            }
-            // write chunk
-            if ((ret = _containers.at(containerId[i])->putChunk(chunks[i])) == false) {
-                ret = false;
-                break;
-            }
-            _containers.at(containerId[i])->bgUpdateUsage();
-        } catch (std::exception &e) {
-            LOG(ERROR) << "Cannot find container " << containerId[i] << " to write chunk";
-            ret = false;
-            break;
+    // store chunks to containers, each container writes its chunks in one batch
+    bool ret = runOnContainerGroups(containerId, numChunks, [&] (Container *container, const std::vector<int> &indices) {
+        if (container == NULL) {
+            LOG(ERROR) << "Cannot find container " << containerId[indices.at(0)] << " to write chunk";
+            return;
         }
-    }
-    // remove stored chunks once failed
-    for (int j = 0; j < i && !ret; j++) { 
-        try {
-            _containers.at(containerId[j])->deleteChunk(chunks[i]);
-            _containers.at(containerId[i])->bgUpdateUsage();
-        } catch (std::exception &e) {
-            LOG(ERROR) << "Cannot find container " << containerId[j] << " to remove chunk after write failure";
+        // verify checksum before write
+        std::vector<Chunk *> toWrite;
+        std::vector<int> toWriteIndices;
+        for (size_t j = 0; j < indices.size(); j++) {
+            int i = indices.at(j);
+            if (verifyChecksum && !chunks[i].verifyMD5())
+                continue;
+            toWrite.push_back(&chunks[i]);
+            toWriteIndices.push_back(i);
         }
+        if (toWrite.empty())
+            return;
+        // write chunks
+        bool written[toWrite.size()];
+        container->putChunks(toWrite.data(), toWrite.size(), written);
+        for (size_t j = 0; j < toWrite.size(); j++)
+            stored[toWriteIndices.at(j)] = written[j];
+    }, stored);
+
+    // remove stored chunks once failed
+    if (!ret) {
+        bool removed[numChunks];
+        runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+            if (container == NULL || !stored[i])
+                return true;
+            container->deleteChunk(chunks[i]);
+            return true;
+        }, removed, /* stop on failure */ false);
     }
+
+    // drop the cached copies of overwritten chunks
+    for (int i = 0; i < numChunks; i++)
+        _cache->invalidate(containerId[i], chunks[i]);
     return ret;
 }
 
 bool ContainerManager::getChunks(int containerId[], Chunk chunks[], int numChunks) {
-    bool ret = true;
-    // get chunks from containers
-    for (int i = 0; i < numChunks; i++ ) {
-        try {
-            if ((ret = _containers.at(containerId[i])->getChunk(chunks[i])) == false) {
-                throw std::invalid_argument("");
-            }
-        } catch (std::exception &e) {
-            ret = false;
-            break;
-        }
-    }
-    return ret;
+    bool fetched[numChunks];
+    // get chunks from the cache or containers
+    return runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+        return container != NULL && getChunkWithCache(container, chunks[i]);
+    }, fetched, /* stop on failure */ true);
 }
 
 bool ContainerManager::deleteChunks(int containerId[], Chunk chunks[], int numChunks) {
+    bool removed[numChunks];
     // delete chunks from containers
-    for (int i = 0; i < numChunks; i++ ) {
-        try {
-            _containers.at(containerId[i])->deleteChunk(chunks[i]);
-            _containers.at(containerId[i])->bgUpdateUsage();
-        } catch (std::exception &e) {
+    runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+        if (container == NULL) {
             LOG(ERROR) << "Cannot find container " << containerId[i] << " to remove chunk";
+            return true;
         }
-    }
+        container->deleteChunk(chunks[i]);
+        _cache->invalidate(containerId[i], chunks[i]);
+        return true;
+    }, removed, /* stop on failure */ false);
     return true;
 }
 
 bool ContainerManager::copyChunks(int containerId[], Chunk srcChunks[], Chunk dstChunks[], int numChunks) {
+    std::atomic<bool> missingContainer(false);
+    bool copied[numChunks];
+
     // copy chunks within containers
-    bool ret = true;
-    for (int i = 0; i < numChunks; i++) {
-        try {
-            ret = _containers.at(containerId[i])->copyChunk(srcChunks[i], dstChunks[i]) && ret;
-            _containers.at(containerId[i])->bgUpdateUsage();
-        } catch (std::exception &e) {
-            ret = false;
-            // remove already copied chunks upon error
-            for (int j = 0; j < i; j++)
-                try {
-                    _containers.at(containerId[j])->deleteChunk(dstChunks[j]);
-                } catch (std::exception &e) {
-                    LOG(ERROR) << "Cannot find container " << containerId[j] << " to remove chunk after copy failure";
-                }
-            break;
-        } 
+    bool ret = runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+        if (container == NULL) {
+            missingContainer = true;
+            return false;
+        }
+        bool success = container->copyChunk(srcChunks[i], dstChunks[i]);
+        _cache->invalidate(containerId[i], dstChunks[i]);
+        return success;
+    }, copied, /* stop on failure */ false);
+
+    // remove already copied chunks upon error
+    if (missingContainer) {
+        bool removed[numChunks];
+        runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+            if (container == NULL) {
+                LOG(ERROR) << "Cannot find container " << containerId[i] << " to remove chunk after copy failure";
+            } else if (copied[i]) {
+                container->deleteChunk(dstChunks[i]);
+                _cache->invalidate(containerId[i], dstChunks[i]);
+            }
+            return true;
+        }, removed, /* stop on failure */ false);
     }
     return ret;
 }
@@ -157,12 +206,16 @@ bool ContainerManager::moveChunks(int containerId[], Chunk srcChunks[], Chunk ds
     for (int i = 0; i < numChunks; i++) {
         try {
             ret = _containers.at(containerId[i])->moveChunk(srcChunks[i], dstChunks[i]) && ret;
+            _cache->invalidate(containerId[i], srcChunks[i]);
+            _cache->invalidate(containerId[i], dstChunks[i]);
         } catch (std::exception &e) {
             ret = false;
             // revert already moved chunks upon error
             for (int j = 0; j < i; j++)
                 try {
                     _containers.at(containerId[j])->moveChunk(dstChunks[j], srcChunks[j]);
+                    _cache->invalidate(containerId[j], srcChunks[j]);
+                    _cache->invalidate(containerId[j], dstChunks[j]);
                 } catch (std::exception &e) {
                     LOG(ERROR) << "Cannot find container " << containerId[j] << " to reverse chunk moving after move failure";
                 }
@@ -211,6 +264,7 @@ bool ContainerManager::revertChunks(int containerId[], Chunk chunks[], int numCh
     for (int i = 0; ret && i < numChunks; i++) {
         try {
             ret = _containers.at(containerId[i])->revertChunk(chunks[i]) && ret;
+            _cache->invalidate(containerId[i], chunks[i]);
         } catch (std::exception &e) {
             LOG(ERROR) << "Failed to find container " << containerId[i] << " to revert chunk";
         }
@@ -227,7 +281,7 @@ Chunk ContainerManager::getEncodedChunks(int containerId[], Chunk chunks[], int
         rawChunks[i].fileVersion = chunks[i].fileVersion;
         // get the chunk
         try {
-            if ((ret = _containers.at(containerId[i])->getChunk(rawChunks[i], true)) == false) {
+            if ((ret = getChunkWithCache(_containers.at(containerId[i]), rawChunks[i], true)) == false) {
                 LOG(ERROR) << "Failed to get chunk id = " << chunks[i].getChunkName() << " from container " << containerId[i];
                 throw std::invalid_argument("");
             }
@@ -257,6 +311,152 @@ Chunk ContainerManager::getEncodedChunks(int containerId[], Chunk chunks[], int
     return codedChunk;
 }
 
+bool ContainerManager::getEncodedChunkSlice(int containerId[], Chunk chunks[], int numChunks, unsigned char matrix[], unsigned long int offset, int length, Chunk &codedChunk) {
+    Chunk rawChunks[numChunks];
+    unsigned char *rawData[numChunks];
+    bool succeeded[numChunks];
+
+    for (int i = 0; i < numChunks; i++) {
+        rawChunks[i].setId(chunks[i].getNamespaceId(), chunks[i].getFileUUID(), chunks[i].getChunkId());
+        rawChunks[i].fileVersion = chunks[i].fileVersion;
+    }
+
+    // read the slice of chunks from their containers in parallel, the cache only holds whole chunks
+    bool ret = runOnContainers(containerId, numChunks, [&] (Container *container, int i) {
+        if (container == NULL || !container->getChunkRange(rawChunks[i], offset, length)) {
+            LOG(ERROR) << "Failed to get chunk id = " << chunks[i].getChunkName() << " offset " << offset << " from container " << containerId[i];
+            return false;
+        }
+        return true;
+    }, succeeded, /* stopOnFailure */ false);
+
+    // all chunks in a stripe are of the same size, and so are their slices
+    for (int i = 0; ret && i < numChunks; i++) {
+        rawData[i] = rawChunks[i].data;
+        if (rawChunks[i].size != rawChunks[0].size) {
+            LOG(ERROR) << "Slice size mismatch on chunk id = " << chunks[i].getChunkName() << " offset " << offset << ", " << rawChunks[i].size << " vs " << rawChunks[0].size;
+            ret = false;
+        }
+    }
+    if (!ret)
+        return false;
+
+    codedChunk.data = NULL;
+    codedChunk.size = numChunks > 0? rawChunks[0].size : 0;
+    codedChunk.freeData = true;
+    if (codedChunk.size == 0)
+        return true;
+
+    codedChunk.data = (unsigned char *) malloc (codedChunk.size);
+    if (codedChunk.data == NULL) {
+        LOG(ERROR) << "Failed to allocate memory for data of the encoded chunk slice";
+        codedChunk.size = 0;
+        return false;
+    }
+
+    // encode the slice
+    CodingUtils::encode(rawData, numChunks, &codedChunk.data, 1, codedChunk.size, matrix);
+    return true;
+}
+
+bool ContainerManager::getChunkWithCache(Container *container, Chunk &chunk, bool skipVerification) {
+    if (!_cache->isEnabled())
+        return container->getChunk(chunk, skipVerification);
+
+    int containerId = container->getId();
+    if (_cache->get(containerId, chunk)) {
+        // check the cached copy against the expected checksum, and read from the container on mismatch
+        if (skipVerification || !Config::getInstance().verifyChunkChecksum() || chunk.verifyMD5())
+            return true;
+        LOG(WARNING) << "Checksum mismatch on cached chunk " << chunk.getChunkName() << " of container " << containerId;
+        _cache->invalidate(containerId, chunk);
+        free(chunk.data);
+        chunk.data = NULL;
+        chunk.size = 0;
+    }
+
+    unsigned long int generation = _cache->getGeneration(containerId, chunk);
+    if (!container->getChunk(chunk, skipVerification))
+        return false;
+    _cache->put(containerId, chunk, generation);
+    return true;
+}
+
+bool ContainerManager::runOnContainers(int containerId[], int numChunks, const std::function<bool (Container *, int)> &op, bool succeeded[], bool stopOnFailure) {
+    std::atomic<bool> failed(false);
+
+    runOnContainerGroups(containerId, numChunks, [&] (Container *container, const std::vector<int> &indices) {
+        for (size_t j = 0; j < indices.size() && !(stopOnFailure && failed); j++) {
+            int i = indices.at(j);
+            succeeded[i] = op(container, i);
+            if (!succeeded[i])
+                failed = true;
+        }
+    }, succeeded);
+
+    return !failed;
+}
+
+bool ContainerManager::runOnContainerGroups(int containerId[], int numChunks, const std::function<void (Container *, const std::vector<int> &)> &op, bool succeeded[]) {
+    // group the chunks by container, in the order of the list
+    std::map<Container*, std::vector<int> > groups;
+    for (int i = 0; i < numChunks; i++) {
+        succeeded[i] = false;
+        auto it = _containers.find(containerId[i]);
+        groups[it == _containers.end()? NULL : it->second].push_back(i);
+    }
+
+    // hand the chunks of each container to its I/O threads, unless all chunks are in the same container
+    std::vector<std::future<void> > pending;
+    std::vector<Container*> inPlace;
+    for (auto &group : groups) {
+        auto executor = _executors.find(group.first);
+        if (groups.size() == 1 || executor == _executors.end() || executor->second->workers.empty()) {
+            inPlace.push_back(group.first);
+            continue;
+        }
+        Container *container = group.first;
+        std::vector<int> &indices = group.second;
+        std::shared_ptr<std::packaged_task<void ()> > task = std::make_shared<std::packaged_task<void ()> >([&op, container, &indices] () { op(container, indices); });
+        pending.push_back(task->get_future());
+        {
+            std::lock_guard<std::mutex> lk(executor->second->lock);
+            executor->second->tasks.emplace_back([task] () { (*task)(); });
+        }
+        executor->second->cv.notify_one();
+    }
+
+    // run the remaining chunks in the calling thread, and wait for the others
+    for (size_t i = 0; i < inPlace.size(); i++)
+        op(inPlace.at(i), groups.at(inPlace.at(i)));
+    for (size_t i = 0; i < pending.size(); i++)
+        pending.at(i).wait();
+
+    for (int i = 0; i < numChunks; i++)
+        if (!succeeded[i])
+            return false;
+    return true;
+}
+
+void *ContainerManager::runIoExecutor(void *arg) {
+    IoExecutor *executor = (IoExecutor *) arg;
+
+    while (true) {
+        std::function<void ()> task;
+        {
+            std::unique_lock<std::mutex> lk(executor->lock);
+            executor->cv.wait(lk, [executor] { return !executor->tasks.empty() || !executor->running; });
+            if (executor->tasks.empty())
+                break;
+            task = std::move(executor->tasks.front());
+            executor->tasks.pop_front();
+        }
+        task();
+    }
+
+    return NULL;
+}
+
 int ContainerManager::getNumContainers() {
     return _numContainers;
 }
@@ -276,6 +476,9 @@ void ContainerManager::getContainerUsage(unsigned long int containerUsage[], uns
     for (int i = 0; i < _numContainers; i++) {
         containerUsage[i] = _containerPtrs[i]->getUsage();
         containerCapacity[i] = _containerPtrs[i]->getCapacity();
-        _containerPtrs[i]->bgUpdateUsage();
     }
 }
+
+void ContainerManager::getCacheStats(CacheStats &stats) {
+    _cache->getStats(stats);
+}
@@ -3,9 +3,18 @@
 #ifndef __CONTAINER_MANAGER_HH__
 #define __CONTAINER_MANAGER_HH__
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <vector>
+
+#include <pthread.h>
 
 #include "../ds/chunk.hh"
+#include "../ds/coordinator_event.hh"
+#include "chunk_cache.hh"
 #include "container/container.hh"
 
 class ContainerManager {
@@ -128,6 +137,23 @@ public:
      **/
     Chunk getEncodedChunks(int containerId[], Chunk chunks[], int numChunks, unsigned char matrix[]);
 
+    /**
+     * Generate a slice of the partial encoded chunk from a range of chunks in the coresponding containers
+     *
+     * @param[in] containerId        ids of containers storing the corresponding chunks to encode
+     * @param[in] chunks             list of ids of chunks to encode;
+     *                               each of them should have all fields filled, except Chunk::data and Chunk::freeData;
+     * @param[in] numChunks          number of chunks to encode
+     * @param[in] matrix             matrix for encoding chunks
+     * @param[in] offset             offset of the slice in the chunks
+     * @param[in] length             length of the slice
+     * @param[out] codedChunk        the slice of partial encoded chunk; Chunk::size is less than the length for the last slice, and 0 for a slice after the end of the chunks
+     *
+     * @return whether the slice is encoded
+     * @remark data of the slice is allocated by malloc() and set to be freed
+     **/
+    bool getEncodedChunkSlice(int containerId[], Chunk chunks[], int numChunks, unsigned char matrix[], unsigned long int offset, int length, Chunk &codedChunk);
+
     /**
      * Tell the number of containers managed
      *
@@ -160,10 +186,70 @@ public:
      **/
     void getContainerUsage(unsigned long int containerUsage[], unsigned long int containerCapacity[]);
 
+    /**
+     * Tell the statistics of the chunk cache
+     *
+     * @param[out] stats             statistics of the chunk cache
+     **/
+    void getCacheStats(CacheStats &stats);
+
 private:
+    /**
+     * Threads running the chunk operations of a container
+     **/
+    struct IoExecutor {
+        std::vector<pthread_t> workers;              /**< I/O threads */
+        std::deque<std::function<void ()> > tasks;   /**< operations pending to run */
+        std::mutex lock;                             /**< lock on the operation queue */
+        std::condition_variable cv;                  /**< signal on new operations and termination */
+        bool running;                                /**< whether the threads should keep running */
+    };
+
+    static void *runIoExecutor(void *arg);
+
+    /**
+     * Run an operation on a list of chunks, where the chunks of each container run in order on the I/O threads of the container,
+     * and the chunks of different containers run in parallel
+     *
+     * @param[in] containerId        ids of containers storing the corresponding chunks
+     * @param[in] numChunks          number of chunks
+     * @param[in] op                 operation on a chunk (by index) in its container (NULL if the container is not found), which returns whether it succeeds
+     * @param[out] succeeded         whether the operation succeeds on each chunk
+     * @param[in] stopOnFailure      whether to skip the remaining chunks once an operation fails
+     *
+     * @return whether the operation succeeds on all chunks
+     **/
+    bool runOnContainers(int containerId[], int numChunks, const std::function<bool (Container *, int)> &op, bool succeeded[], bool stopOnFailure);
+
+    /**
+     * Run an operation on a list of chunks, where the chunks of each container are handed to the operation as a group,
+     * and the groups of different containers run in parallel
+     *
+     * @param[in] containerId        ids of containers storing the corresponding chunks
+     * @param[in] numChunks          number of chunks
+     * @param[in] op                 operation on the chunks (by indices) in their container (NULL if the container is not found), which marks whether it succeeds on each chunk in succeeded
+     * @param[out] succeeded         whether the operation succeeds on each chunk
+     *
+     * @return whether the operation succeeds on all chunks
+     **/
+    bool runOnContainerGroups(int containerId[], int numChunks, const std::function<void (Container *, const std::vector<int> &)> &op, bool succeeded[]);
+
+    /**
+     * Get a chunk from the chunk cache, or from its container (and add it to the cache)
+     *
+     * @param[in] container          container storing the chunk
+     * @param[in,out] chunk          chunk to get, see Container::getChunk()
+     * @param[in] skipVerification   whether to skip the checksum verification
+     *
+     * @return whether the chunk is found
+     **/
+    bool getChunkWithCache(Container *container, Chunk &chunk, bool skipVerification = false);
+
     int _numContainers;                              /**< number of containers */
     std::map<int, Container*> _containers;           /**< mapping of containers id to container */
     Container *_containerPtrs[MAX_NUM_CONTAINERS];   /**< list of containers */
+    std::map<Container*, IoExecutor*> _executors;    /**< mapping of containers to their I/O threads */
+    ChunkCache *_cache;                              /**< cache of chunks read from containers */
 };
 
 #endif // define __CONTAINER_MANAGER_HH__
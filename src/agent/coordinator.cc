@@ -194,6 +194,7 @@ void AgentCoordinator::prepareStatus(CoordinatorEvent &event) {
     event.containerUsage = new unsigned long int[event.numContainers];
     event.containerCapacity = new unsigned long int[event.numContainers];
     _cm->getContainerUsage(event.containerUsage, event.containerCapacity);
+    _cm->getCacheStats(event.cacheStats);
 }
 
 void AgentCoordinator::prepareSysInfo(CoordinatorEvent &event) {
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <errno.h>
+
+#include <chrono>
+
+#include <glog/logging.h>
+
+#include "peer_connection_pool.hh"
+#include "../common/config.hh"
+#include "../common/util.hh"
+
+PeerConnectionPool::PeerConnectionPool(zmq::context_t *cxt, int maxIdlePerPeer) {
+    _cxt = cxt;
+    _maxIdlePerPeer = maxIdlePerPeer;
+    _closed = false;
+}
+
+PeerConnectionPool::~PeerConnectionPool() {
+    close();
+}
+
+bool PeerConnectionPool::request(IO::RequestMeta meta[], int numRequests, bool succeeded[]) {
+    zmq::socket_t *sockets[numRequests];
+    sendRequests(meta, numRequests, sockets);
+    return waitForReplies(meta, numRequests, sockets, succeeded);
+}
+
+void PeerConnectionPool::sendRequests(IO::RequestMeta meta[], int numRequests, zmq::socket_t *sockets[]) {
+    for (int i = 0; i < numRequests; i++) {
+        sockets[i] = acquire(meta[i].address);
+        if (sockets[i] == NULL)
+            continue;
+        bool sent = false;
+        try {
+            sent = IO::sendChunkEventMessage(*sockets[i], *meta[i].request) > 0;
+        } catch (zmq::error_t &e) {
+            LOG(ERROR) << "Failed to send the chunk request opcode = " << meta[i].request->opcode << " to agent at " << meta[i].address << ", " << e.what();
+        }
+        if (!sent) {
+            LOG(ERROR) << "Failed to send chunk event over socket at " << meta[i].address;
+            release(meta[i].address, sockets[i], /* reusable */ false);
+            sockets[i] = NULL;
+        }
+    }
+}
+
+bool PeerConnectionPool::waitForReplies(IO::RequestMeta meta[], int numRequests, zmq::socket_t *sockets[], bool succeeded[]) {
+    // all replies share one deadline, instead of one timeout per reply
+    int timeout = Config::getInstance().getFailureTimeout();
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    bool allSucceeded = true;
+    int numPending = 0;
+    for (int i = 0; i < numRequests; i++) {
+        succeeded[i] = false;
+        if (sockets[i] == NULL) {
+            allSucceeded = false;
+            continue;
+        }
+        numPending++;
+    }
+
+    zmq_pollitem_t items[numRequests > 0? numRequests : 1];
+    int pending[numRequests > 0? numRequests : 1];
+    while (numPending > 0) {
+        // wait on the connections still without replies
+        int numItems = 0;
+        for (int i = 0; i < numRequests; i++) {
+            if (sockets[i] == NULL)
+                continue;
+            items[numItems].socket = (void *) *sockets[i];
+            items[numItems].fd = 0;
+            items[numItems].events = ZMQ_POLLIN;
+            items[numItems].revents = 0;
+            pending[numItems] = i;
+            numItems++;
+        }
+        long remaining = -1;
+        if (timeout >= 0) {
+            remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0)
+                break;
+        }
+        try {
+            if (zmq::poll(items, numItems, remaining) == 0)
+                break;
+        } catch (zmq::error_t &e) {
+            if (e.num() == EINTR)
+                continue;
+            LOG(ERROR) << "Failed to wait for the chunk replies from agents, " << e.what();
+            break;
+        }
+
+        // receive the replies arrived
+        for (int j = 0; j < numItems; j++) {
+            if (!(items[j].revents & ZMQ_POLLIN))
+                continue;
+            int i = pending[j];
+            try {
+                succeeded[i] = IO::getChunkEventMessage(*sockets[i], *meta[i].reply) > 0;
+            } catch (zmq::error_t &e) {
+                LOG(ERROR) << "Failed to get the chunk reply from agent at " << meta[i].address << ", " << e.what();
+            }
+            if (!succeeded[i])
+                LOG(ERROR) << "Failed to get a chunk event reply over socket at " << meta[i].address;
+            // a request socket without the reply received cannot send again
+            release(meta[i].address, sockets[i], succeeded[i]);
+            sockets[i] = NULL;
+            allSucceeded = succeeded[i] && allSucceeded;
+            numPending--;
+        }
+    }
+
+    // drop the connections of requests without replies before the deadline
+    for (int i = 0; i < numRequests; i++) {
+        if (sockets[i] == NULL)
+            continue;
+        LOG(ERROR) << "Timed out waiting for a chunk event reply over socket at " << meta[i].address;
+        release(meta[i].address, sockets[i], /* reusable */ false);
+        sockets[i] = NULL;
+        allSucceeded = false;
+    }
+    return allSucceeded;
+}
+
+void PeerConnectionPool::close() {
+    std::lock_guard<std::mutex> lk(_lock);
+    _closed = true;
+    for (auto &peer : _idle) {
+        for (size_t i = 0; i < peer.second.size(); i++) {
+            peer.second.at(i)->close();
+            delete peer.second.at(i);
+        }
+    }
+    _idle.clear();
+}
+
+zmq::socket_t *PeerConnectionPool::acquire(const std::string &address) {
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        if (_closed)
+            return NULL;
+        auto it = _idle.find(address);
+        if (it != _idle.end() && !it->second.empty()) {
+            zmq::socket_t *socket = it->second.back();
+            it->second.pop_back();
+            return socket;
+        }
+    }
+
+    // connect to the peer
+    zmq::socket_t *socket = NULL;
+    try {
+        socket = new zmq::socket_t(*_cxt, ZMQ_REQ);
+        // setup socket options (TCP keep alive and Agent timeout)
+        Util::setSocketOptions(socket, AGENT_TO_AGENT);
+        int timeout = Config::getInstance().getFailureTimeout();
+        socket->setsockopt(ZMQ_SNDTIMEO, timeout);
+        socket->setsockopt(ZMQ_RCVTIMEO, timeout);
+        socket->setsockopt(ZMQ_LINGER, timeout);
+        socket->connect(address);
+    } catch (zmq::error_t &e) {
+        LOG(ERROR) << "Failed to connect to agent at " << address << ", " << e.what();
+        if (socket != NULL) {
+            socket->close();
+            delete socket;
+        }
+        return NULL;
+    }
+    return socket;
+}
+
+void PeerConnectionPool::release(const std::string &address, zmq::socket_t *socket, bool reusable) {
+    if (reusable) {
+        std::lock_guard<std::mutex> lk(_lock);
+        std::vector<zmq::socket_t *> &idle = _idle[address];
+        if (!_closed && (int) idle.size() < _maxIdlePerPeer) {
+            idle.push_back(socket);
+            return;
+        }
+    }
+    socket->close();
+    delete socket;
+}
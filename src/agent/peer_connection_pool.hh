@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __PEER_CONNECTION_POOL_HH__
+#define __PEER_CONNECTION_POOL_HH__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "../common/io.hh"
+
+/**
+ * Pool of long-lived connections to peer agents, shared by the workers of an agent;
+ * each connection is used by one request-reply at a time, and kept for later requests to the same peer afterwards
+ **/
+class PeerConnectionPool {
+public:
+    /**
+     * Constructor
+     *
+     * @param[in] cxt                  zeromq context to create connections in
+     * @param[in] maxIdlePerPeer       maximum number of idle connections to keep for each peer, 0 to close connections after use
+     **/
+    PeerConnectionPool(zmq::context_t *cxt, int maxIdlePerPeer);
+    ~PeerConnectionPool();
+
+    /**
+     * Send chunk requests to peer agents and wait for their replies, without extra threads;
+     * all requests are sent before waiting for any reply, so the peers serve them in parallel
+     *
+     * @param[in,out] meta             requests, with RequestMeta::address, RequestMeta::request and RequestMeta::reply set
+     * @param[in] numRequests          number of requests
+     * @param[out] succeeded           whether the reply of each request is received
+     *
+     * @return whether the replies of all requests are received
+     **/
+    bool request(IO::RequestMeta meta[], int numRequests, bool succeeded[]);
+
+    /**
+     * Send chunk requests to peer agents without waiting for the replies, see request()
+     *
+     * @param[in] meta                 requests, with RequestMeta::address and RequestMeta::request set
+     * @param[in] numRequests          number of requests
+     * @param[out] sockets             connections to wait for the replies on, see waitForReplies()
+     **/
+    void sendRequests(IO::RequestMeta meta[], int numRequests, zmq::socket_t *sockets[]);
+
+    /**
+     * Wait for the replies of the chunk requests sent by sendRequests() on all connections at once, up to the failure timeout in total,
+     * and return the connections to the pool
+     *
+     * @param[in,out] meta             requests, with RequestMeta::reply set
+     * @param[in] numRequests          number of requests
+     * @param[in] sockets              connections returned by sendRequests(), NULL for requests failed to send
+     * @param[out] succeeded           whether the reply of each request is received
+     *
+     * @return whether the replies of all requests are received
+     **/
+    bool waitForReplies(IO::RequestMeta meta[], int numRequests, zmq::socket_t *sockets[], bool succeeded[]);
+
+    /**
+     * Close all idle connections, and stop keeping connections; call before closing the zeromq context
+     **/
+    void close();
+
+private:
+    /**
+     * Get a connection to a peer, either an idle one or a new one
+     *
+     * @param[in] address              address of the peer
+     *
+     * @return connection to the peer, or NULL if failed
+     **/
+    zmq::socket_t *acquire(const std::string &address);
+
+    /**
+     * Return a connection after a request-reply
+     *
+     * @param[in] address              address of the peer
+     * @param[in] socket               connection to the peer
+     * @param[in] reusable             whether the request-reply completes, so the connection can serve another request
+     **/
+    void release(const std::string &address, zmq::socket_t *socket, bool reusable);
+
+    zmq::context_t *_cxt;                                        /**< zeromq context */
+    int _maxIdlePerPeer;                                         /**< maximum number of idle connections to keep for each peer */
+    bool _closed;                                                /**< whether the pool stops keeping connections */
+    std::map<std::string, std::vector<zmq::socket_t *> > _idle;  /**< idle connections by peer address */
+    std::mutex _lock;                                            /**< lock on idle connections */
+};
+
+#endif // define __PEER_CONNECTION_POOL_HH__
@@ -129,6 +129,8 @@ int file_list_head_t_init(file_list_head_t *head) {
 
     head->list = 0;
     head->total = 0;
+    head->cursor = 0;
+    head->page_size = 0;
     return 0;
 }
 
@@ -139,6 +141,7 @@ void file_list_head_t_release(file_list_head_t *head) {
     for (unsigned int i = 0; i < head->total; i++)
         file_list_item_t_release(&head->list[i]);
     free(head->list);
+    free(head->cursor);
 
     file_list_head_t_init(head);
 }
@@ -479,6 +482,19 @@ int set_get_file_list_request(request_t *req, unsigned char namespace_id, char *
     return 0;
 }
 
+int set_get_file_list_page_request(request_t *req, unsigned char namespace_id, char *prefix, const char *cursor, unsigned int page_size) {
+    if (set_get_file_list_request(req, namespace_id, prefix) != 0)
+        return -1;
+
+    // start from the first page if no token is given
+    req->file_list.cursor = strdup(cursor == NULL || cursor[0] == 0? "0" : cursor);
+    if (req->file_list.cursor == NULL)
+        return -1;
+    req->file_list.page_size = page_size > 0? page_size : 1;
+
+    return 0;
+}
+
 int set_get_append_size_request(request_t *req, char *storage_class) {
     if (request_t_init(req) != 0)
         return -1;
@@ -651,13 +667,28 @@ static int issue_request(void *socket, int opcode, unsigned char namespace_id, f
             }
             log_info("Send file storage class = %s\n", file->storage_class.name);
         } else if (opcode == GET_READ_SIZE_REQ || opcode == GET_FILE_LIST_REQ) {
+            int is_paged = opcode == GET_FILE_LIST_REQ && flist != NULL && flist->page_size > 0;
             // send file name, or file prefix
             msg_length = file->filename.length;
-            if (!send_field(file->filename.name, 0)) {
+            if (!send_field(file->filename.name, is_paged? ZMQ_SNDMORE : 0)) {
                 log_error("Failed to send the request file name, err = %d\n", errno);
                 return -1;
             }
             log_info("Send file name = %s\n", file->filename.name);
+            if (is_paged) {
+                // send the continuation token and page size
+                msg_length = strlen(flist->cursor);
+                if (!send_field(flist->cursor, ZMQ_SNDMORE)) {
+                    log_error("Failed to send the request file list cursor, err = %d\n", errno);
+                    return -1;
+                }
+                msg_length = sizeof(flist->page_size);
+                if (!send_field(&flist->page_size, 0)) {
+                    log_error("Failed to send the request file list page size, err = %d\n", errno);
+                    return -1;
+                }
+                log_info("Send file list cursor = %s page size = %u\n", flist->cursor, flist->page_size);
+            }
         } else {
             // send file name
             msg_length = file->filename.length;
@@ -867,6 +898,21 @@ static int issue_request(void *socket, int opcode, unsigned char namespace_id, f
             check_more_msg();
             get_field(&flist->list[i].mtime);
         }
+        // get the token for the next page
+        if (flist->page_size > 0) {
+            check_more_msg();
+            get_new_msg();
+            int size = zmq_msg_size(&msg);
+            free(flist->cursor);
+            flist->cursor = (char *) malloc (size + 1);
+            if (flist->cursor == NULL) {
+                log_error("Failed to allocate memory for file list cursor\n");
+                zmq_msg_close(&msg);
+                return -1;
+            }
+            memcpy(flist->cursor, zmq_msg_data(&msg), size);
+            flist->cursor[size] = 0;
+        }
     } else if (
             reply_opcode == GET_APPEND_SIZE_REP_SUCCESS ||
             reply_opcode == GET_READ_SIZE_REP_SUCCESS
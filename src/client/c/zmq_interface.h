@@ -79,6 +79,8 @@ typedef struct {
 typedef struct {
     file_list_item_t *list;
     unsigned int total;
+    char *cursor;                 /**< continuation token of the listing, "0" when the listing completes */
+    unsigned int page_size;       /**< number of files per page, 0 to list all files at once */
 } file_list_head_t;
 
 typedef struct {
@@ -140,6 +142,7 @@ void ncloud_conn_t_release(ncloud_conn_t *conn);
 // system (metadata) operations
 int set_get_storage_capacity_request(request_t *req);
 int set_get_file_list_request(request_t *req, unsigned char namespace_id, char *preifx);
+int set_get_file_list_page_request(request_t *req, unsigned char namespace_id, char *prefix, const char *cursor, unsigned int page_size);
 int set_get_agent_status_request(request_t *req);
 int set_get_proxy_status_request(request_t *req);
 int set_get_repair_stats_request(request_t *req);
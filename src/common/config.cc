@@ -18,6 +18,7 @@ const char *Config::ContainerTypeName[] = {
     "Alibaba",
     "AWS",
     "Azure",
+    "Segment",
 
     "Unknown"
 };
@@ -54,6 +55,7 @@ const char *Config::ChunkScanSamplingPolicyName[] = {
 // see MetaStore in common/define.hh
 const char *Config::MetaStoreName[] = {
     "Redis",
+    "Local",
 
     "Unknown"
 };
@@ -192,6 +194,21 @@ void Config::setConfigPath (const char *generalPath, const char *proxyPath, cons
         _agent.misc.copyBlockSize = readULL(_agentPt, "misc.copy_block_size");
         _agent.misc.flushOnClose = readBool(_agentPt, "misc.flush_on_close");
         _agent.misc.registerToProxy = readBool(_agentPt, "misc.register_to_proxy");
+        _agent.misc.numContainerIoThreads = readIntWithBoundsAndDefault(_agentPt, "misc.container_io_threads", _agent.misc.numWorkers, 0, MAX_NUM_WORKERS);
+        _agent.misc.scrubRatio = readIntWithBoundsAndDefault(_agentPt, "misc.scrub_ratio", 0, 0, 100);
+        _agent.misc.fsIoEngine = readStringWithDefault(_agentPt, "misc.fs_io_engine", "posix");
+        _agent.misc.fsDirectIoThreshold = readULLWithDefault(_agentPt, "misc.fs_direct_io_threshold", 0);
+        _agent.misc.fsMmapThreshold = readULLWithDefault(_agentPt, "misc.fs_mmap_threshold", 0);
+        _agent.misc.usageReconcileInterval = readIntWithBoundsAndDefault(_agentPt, "misc.usage_reconcile_interval", 86400, 0);
+        _agent.misc.fsDirLevels = readIntWithBoundsAndDefault(_agentPt, "misc.fs_dir_levels", 2, 0, 3);
+        _agent.misc.segmentSize = readULLWithDefault(_agentPt, "misc.segment_file_size", 1 << 30);
+        _agent.misc.segmentCompactionThreshold = readIntWithBoundsAndDefault(_agentPt, "misc.segment_compaction_threshold", 50, 0, 100);
+        _agent.misc.chunkCacheSize = readULLWithDefault(_agentPt, "misc.chunk_cache_size", 0);
+        _agent.misc.chunkCacheDir = readStringWithDefault(_agentPt, "misc.chunk_cache_dir", "");
+        _agent.misc.chunkCacheDirSize = readULLWithDefault(_agentPt, "misc.chunk_cache_dir_size", 0);
+        _agent.misc.numPeerConnections = readIntWithBoundsAndDefault(_agentPt, "misc.peer_connections", _agent.misc.numWorkers, 0, MAX_NUM_WORKERS);
+        _agent.misc.repairSliceSize = readIntWithBoundsAndDefault(_agentPt, "misc.repair_slice_size", 0, 0);
+        _agent.misc.repairChain = readBoolWithDefault(_agentPt, "misc.repair_chain", false);
         // agent containers
         _agent.numContainers = readInt(_agentPt, "agent.num_containers");
         char pname[32];
@@ -293,10 +310,27 @@ void Config::setConfigPath (const char *generalPath, const char *proxyPath, cons
                 LOG(ERROR) << "Port number for metastore must be within 0 and 65536";
                 exit(-1);
             }
+            _proxy.metastore.redis.numConnections = readIntWithBoundsAndDefault(_proxyPt, "metastore.num_connections", 8, 1, 256);
+            _proxy.metastore.redis.lockTTL = readIntWithBoundsAndDefault(_proxyPt, "metastore.lock_ttl", 30, 1, 86400);
+            break;
+        case MetaStoreType::LOCAL:
+            _proxy.metastore.local.path = readString(_proxyPt, "metastore.path");
+            if (_proxy.metastore.local.path.empty()) {
+                LOG(ERROR) << "Path of the local metastore must be set";
+                exit(-1);
+            }
+            _proxy.metastore.local.segmentSize = (unsigned long int) readIntWithBoundsAndDefault(_proxyPt, "metastore.segment_size", 64, 1, 4095) << 20;
+            _proxy.metastore.local.sync = readBoolWithDefault(_proxyPt, "metastore.sync", true);
+            _proxy.metastore.local.compactionInterval = readIntWithBoundsAndDefault(_proxyPt, "metastore.compaction_interval", 300, 0);
+            _proxy.metastore.local.compactionThreshold = readIntWithBoundsAndDefault(_proxyPt, "metastore.compaction_threshold", 50, 0, 100);
+            // number of operations running concurrently on the store
+            _proxy.metastore.redis.numConnections = readIntWithBoundsAndDefault(_proxyPt, "metastore.num_connections", 8, 1, 256);
             break;
         default:
             break;
         }
+        _proxy.metastore.cache.size = readIntWithBoundsAndDefault(_proxyPt, "metastore.cache_size", 4096, 0);
+        _proxy.metastore.cache.ttl = readIntWithBoundsAndDefault(_proxyPt, "metastore.cache_ttl", 60, 0);
         // auto recovery
         _proxy.recovery.enabled = readBool(_proxyPt, "recovery.trigger_enabled");
         _proxy.recovery.recoverIntv = std::max(readInt(_proxyPt, "recovery.trigger_start_interval"), 5);
@@ -304,6 +338,7 @@ void Config::setConfigPath (const char *generalPath, const char *proxyPath, cons
         _proxy.recovery.scanChunkIntv = std::max(readInt(_proxyPt, "recovery.scan_chunk_interval"), 0);
         _proxy.recovery.chunkBatchSize = std::max(readInt(_proxyPt, "recovery.scan_chunk_batch_size"), 1);
         _proxy.recovery.batchSize = std::max(readInt(_proxyPt, "recovery.batch_size"), 1);
+        _proxy.recovery.metaBatchSize = readIntWithBoundsAndDefault(_proxyPt, "recovery.scan_meta_batch_size", 128, 1, 65536);
         _proxy.recovery.chunkScanSampling.policy = parseChunkScanSamplingPolicy(readString(_proxyPt, "recovery.chunk_scan_sampling_policy"));
         if (_proxy.recovery.chunkScanSampling.policy >= ChunkScanSamplingPolicy::UNKNOWN_SAMPLING_POLICY)
             _proxy.recovery.chunkScanSampling.policy = ChunkScanSamplingPolicy::NONE_SAMPLING_POLICY;
@@ -391,6 +426,19 @@ void Config::setConfigPath (const char *generalPath, const char *proxyPath, cons
         _proxy.staging.bgwrite.policy = readString(_proxyPt, "staging.bgwrite_policy");
         _proxy.staging.bgwrite.scanIntv = readInt(_proxyPt, "staging.bgwrite_scan_interval");
         _proxy.staging.bgwrite.scheduledTime = readString(_proxyPt, "staging.bgwrite_scheduled_time");
+
+        // deduplication (optional)
+        _proxy.dedup.enabled = readBoolWithDefault(_proxyPt, "dedup.enabled", false);
+        _proxy.dedup.blockSize = readIntWithBoundsAndDefault(_proxyPt, "dedup.block_size", 4096, 512, 1 << 24);
+        _proxy.dedup.numFingerprintLanes = readIntWithBoundsAndDefault(_proxyPt, "dedup.num_fingerprint_lanes", 4, 1, MAX_NUM_WORKERS);
+        _proxy.dedup.numExternalStripeReaders = readIntWithBoundsAndDefault(_proxyPt, "dedup.num_external_stripe_readers", 4, 1, MAX_NUM_WORKERS);
+        _proxy.dedup.index.numShards = readIntWithBoundsAndDefault(_proxyPt, "dedup.index_num_shards", 16, 1, 1024);
+        _proxy.dedup.index.cacheCapacity = readIntWithBoundsAndDefault(_proxyPt, "dedup.index_cache_capacity", 1 << 20, 0);
+        _proxy.dedup.index.bloomFilterCapacity = readIntWithBoundsAndDefault(_proxyPt, "dedup.bloom_filter_capacity", 1 << 24, 1024);
+        _proxy.dedup.index.warmUp = readBoolWithDefault(_proxyPt, "dedup.index_warm_up", true);
+        _proxy.dedup.gc.interval = readIntWithBoundsAndDefault(_proxyPt, "dedup.gc_interval", 60, 0);
+        _proxy.dedup.gc.batchSize = readIntWithBoundsAndDefault(_proxyPt, "dedup.gc_batch_size", 64, 1, 65536);
+        _proxy.dedup.gc.compactionThreshold = readIntWithBoundsAndDefault(_proxyPt, "dedup.gc_compaction_threshold", 50, 0, 100);
     }
 
     printConfig();
@@ -604,6 +652,81 @@ bool Config::getAgentRegisterToProxy() const {
     return _agent.misc.registerToProxy;
 }
 
+int Config::getAgentNumContainerIoThreads() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.numContainerIoThreads;
+}
+
+int Config::getAgentScrubRatio() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.scrubRatio;
+}
+
+std::string Config::getAgentFsIoEngine() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.fsIoEngine;
+}
+
+unsigned long int Config::getAgentFsDirectIoThreshold() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.fsDirectIoThreshold;
+}
+
+unsigned long int Config::getAgentFsMmapThreshold() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.fsMmapThreshold;
+}
+
+int Config::getAgentUsageReconcileInterval() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.usageReconcileInterval;
+}
+
+int Config::getAgentFsDirLevels() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.fsDirLevels;
+}
+
+unsigned long int Config::getAgentSegmentSize() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.segmentSize;
+}
+
+int Config::getAgentSegmentCompactionThreshold() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.segmentCompactionThreshold;
+}
+
+unsigned long int Config::getAgentChunkCacheSize() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.chunkCacheSize;
+}
+
+std::string Config::getAgentChunkCacheDir() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.chunkCacheDir;
+}
+
+unsigned long int Config::getAgentChunkCacheDirSize() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.chunkCacheDirSize;
+}
+
+int Config::getAgentNumPeerConnections() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.numPeerConnections;
+}
+
+int Config::getAgentRepairSliceSize() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.repairSliceSize;
+}
+
+bool Config::getAgentRepairChain() const {
+    assert(!_agentPt.empty());
+    return _agent.misc.repairChain;
+}
+
 // Proxy
 
 int Config::getNumProxy() const {
@@ -691,8 +814,8 @@ int Config::getStorageClassConfig(std::string storageClass, std::string config,
 }
 
 int Config::readIntWithBounds(const boost::property_tree::ptree &pt, const char *key, int min, int max) const {
-    assert(!_storageClassPt.empty());
-    int value = readInt(_storageClassPt, key);
+    assert(!pt.empty());
+    int value = readInt(pt, key);
     return value <= min ? min : (value > max? max : value);
 }
 
@@ -720,6 +843,51 @@ unsigned short Config::getProxyMetaStorePort() const {
     return _proxy.metastore.redis.port;
 }
 
+int Config::getProxyMetaStoreNumConnections() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.redis.numConnections;
+}
+
+std::string Config::getProxyMetaStorePath() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.local.path;
+}
+
+unsigned long int Config::getProxyMetaStoreSegmentSize() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.local.segmentSize;
+}
+
+bool Config::proxyMetaStoreSyncOnCommit() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.local.sync;
+}
+
+int Config::getProxyMetaStoreCompactionInterval() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.local.compactionInterval;
+}
+
+int Config::getProxyMetaStoreCompactionThreshold() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.local.compactionThreshold;
+}
+
+int Config::getProxyMetaStoreLockTTL() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.redis.lockTTL;
+}
+
+int Config::getProxyMetaStoreCacheSize() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.cache.size;
+}
+
+int Config::getProxyMetaStoreCacheTTL() const {
+    assert(!_proxyPt.empty());
+    return _proxy.metastore.cache.ttl;
+}
+
 int Config::getProxyNumZmqThread() const {
     assert(!_proxyPt.empty());
     return _proxy.misc.numZmqThread;
@@ -850,6 +1018,11 @@ int Config::getFileRecoverBatchSize() const {
     return _proxy.recovery.batchSize;
 }
 
+int Config::getFileScanMetaBatchSize() const {
+    assert(!_proxyPt.empty());
+    return _proxy.recovery.metaBatchSize;
+}
+
 int Config::getChunkScanSamplingPolicy() const {
     assert(!_proxyPt.empty());
     return _proxy.recovery.chunkScanSampling.policy;
@@ -926,6 +1099,61 @@ std::string Config::getProxyStagingBackgroundWriteTimestamp() const {
     return _proxy.staging.bgwrite.scheduledTime;
 }
 
+bool Config::proxyDedupEnabled() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.enabled;
+}
+
+int Config::getProxyDedupBlockSize() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.blockSize;
+}
+
+int Config::getProxyDedupNumFingerprintLanes() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.numFingerprintLanes;
+}
+
+int Config::getProxyDedupNumExternalStripeReaders() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.numExternalStripeReaders;
+}
+
+int Config::getProxyDedupIndexNumShards() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.index.numShards;
+}
+
+int Config::getProxyDedupIndexCacheCapacity() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.index.cacheCapacity;
+}
+
+int Config::getProxyDedupBloomFilterCapacity() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.index.bloomFilterCapacity;
+}
+
+bool Config::proxyDedupIndexWarmUp() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.index.warmUp;
+}
+
+int Config::getProxyDedupGcInterval() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.gc.interval;
+}
+
+int Config::getProxyDedupGcBatchSize() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.gc.batchSize;
+}
+
+int Config::getProxyDedupGcCompactionThreshold() const {
+    assert(!_proxyPt.empty());
+    return _proxy.dedup.gc.compactionThreshold;
+}
+
 
 
 // Print
@@ -1008,11 +1236,37 @@ void Config::printConfig() const {
             length += snprintf(buf + length, bufSize - length,
                 "   - IP                      : %s\n"
                 "   - Port                    : %d\n"
+                "   - Num. of connections     : %d\n"
+                "   - Lock TTL (s)            : %d\n"
                 , getProxyMetaStoreIP().c_str()
                 , getProxyMetaStorePort()
+                , getProxyMetaStoreNumConnections()
+                , getProxyMetaStoreLockTTL()
+            );
+            break;
+        case MetaStoreType::LOCAL:
+            length += snprintf(buf + length, bufSize - length,
+                "   - Path                    : %s\n"
+                "   - Segment size (MB)       : %lu\n"
+                "   - Sync on commit          : %s\n"
+                "   - Compaction interval (s) : %d\n"
+                "   - Compaction threshold (%%): %d\n"
+                "   - Num. of workers         : %d\n"
+                , getProxyMetaStorePath().c_str()
+                , getProxyMetaStoreSegmentSize() >> 20
+                , proxyMetaStoreSyncOnCommit()? "true" : "false"
+                , getProxyMetaStoreCompactionInterval()
+                , getProxyMetaStoreCompactionThreshold()
+                , getProxyMetaStoreNumConnections()
             );
             break;
         }
+        length += snprintf(buf + length, bufSize - length,
+            "   - Cache size              : %d\n"
+            "   - Cache TTL (s)           : %d\n"
+            , getProxyMetaStoreCacheSize()
+            , getProxyMetaStoreCacheTTL()
+        );
         int numClasses = getNumStorageClasses();
         length += snprintf(buf + length, bufSize - length,
             " - Storage classes (%d)\n"
@@ -1051,6 +1305,7 @@ void Config::printConfig() const {
             "       - Sampling policy     : %s\n"
             "       - Sampling rate       : %.lf\n"
             "   - Num files per batch     : %d\n"
+            "   - Num files per meta batch: %d\n"
             , autoFileRecovery()? "On" : "Off"
             , getFileRecoverInterval()
             , getFileScanInterval()
@@ -1059,6 +1314,7 @@ void Config::printConfig() const {
             , ChunkScanSamplingPolicyName[getChunkScanSamplingPolicy()]
             , getChunkScanSamplingRate()
             , getFileRecoverBatchSize()
+            , getFileScanMetaBatchSize()
         );
         int numRanges = 0;
         int *ranges = getProxyNearIpRanges(numRanges);
@@ -1141,6 +1397,30 @@ void Config::printConfig() const {
             , getProxyStagingBackgroundWriteScanInterval()
             , getProxyStagingBackgroundWriteTimestamp().c_str()
         );
+        length += snprintf(buf + length, bufSize - length,
+            " - Deduplication             : %s\n"
+            "   - Block size              : %dB\n"
+            "   - Fingerprint lanes       : %d\n"
+            "   - External stripe readers : %d\n"
+            "   - Index shards            : %d\n"
+            "   - Index cache capacity    : %d\n"
+            "   - Bloom filter capacity   : %d\n"
+            "   - Index warm-up           : %s\n"
+            "   - GC interval             : %ds\n"
+            "   - GC batch size           : %d\n"
+            "   - GC compaction threshold : %d%%\n"
+            , proxyDedupEnabled() ? "On" : "Off"
+            , getProxyDedupBlockSize()
+            , getProxyDedupNumFingerprintLanes()
+            , getProxyDedupNumExternalStripeReaders()
+            , getProxyDedupIndexNumShards()
+            , getProxyDedupIndexCacheCapacity()
+            , getProxyDedupBloomFilterCapacity()
+            , proxyDedupIndexWarmUp() ? "true" : "false"
+            , getProxyDedupGcInterval()
+            , getProxyDedupGcBatchSize()
+            , getProxyDedupGcCompactionThreshold()
+        );
         LOG(ERROR) << buf;
         length = 0;
     }
@@ -1168,6 +1448,21 @@ void Config::printConfig() const {
             " Num of containers           : %d\n"
             " Num zmq threads             : %d\n"
             " Copy block size             : %luB\n"
+            " I/O threads per container   : %d\n"
+            " Scrub ratio                 : %d%%\n"
+            " FS I/O engine               : %s\n"
+            " FS direct I/O threshold     : %luB\n"
+            " FS mmap threshold           : %luB\n"
+            " Usage reconcile interval    : %ds\n"
+            " FS directory levels         : %d\n"
+            " Segment size                : %luB\n"
+            " Segment compaction threshold: %d%%\n"
+            " Chunk cache size            : %luB\n"
+            " Chunk cache directory       : %s\n"
+            " Chunk cache directory size  : %luB\n"
+            " Peer connections per agent  : %d\n"
+            " Repair slice size           : %dB\n"
+            " Repair chain                : %s\n"
             , getAgentIP().c_str()
             , getAgentPort()
             , getAgentCPort()
@@ -1175,6 +1470,21 @@ void Config::printConfig() const {
             , getNumContainers()
             , getAgentNumZmqThread()
             , getCopyBlockSize()
+            , getAgentNumContainerIoThreads()
+            , getAgentScrubRatio()
+            , getAgentFsIoEngine().c_str()
+            , getAgentFsDirectIoThreshold()
+            , getAgentFsMmapThreshold()
+            , getAgentUsageReconcileInterval()
+            , getAgentFsDirLevels()
+            , getAgentSegmentSize()
+            , getAgentSegmentCompactionThreshold()
+            , getAgentChunkCacheSize()
+            , getAgentChunkCacheDir().c_str()
+            , getAgentChunkCacheDirSize()
+            , getAgentNumPeerConnections()
+            , getAgentRepairSliceSize()
+            , getAgentRepairChain()? "true" : "false"
         );
         for (int i = 0; i < getNumContainers(); i++) {
             int type = getContainerType(i);
@@ -1204,6 +1514,11 @@ bool Config::readBool (const boost::property_tree::ptree &pt, const char *key) c
     return pt.get<bool>(key);
 }
 
+bool Config::readBoolWithDefault (const boost::property_tree::ptree &pt, const char *key, bool dv) const {
+    assert(!pt.empty());
+    return pt.get<bool>(key, dv);
+}
+
 int Config::readInt (const boost::property_tree::ptree &pt, const char *key) const {
     assert(!pt.empty());
     return pt.get<int>(key);
@@ -1224,6 +1539,11 @@ unsigned long long Config::readULL (const boost::property_tree::ptree &pt, const
     return pt.get<unsigned long long>(key);
 }
 
+unsigned long long Config::readULLWithDefault (const boost::property_tree::ptree &pt, const char *key, unsigned long long dv) const {
+    assert(!pt.empty());
+    return pt.get<unsigned long long>(key, dv);
+}
+
 double Config::readFloat (const boost::property_tree::ptree &pt, const char *key) const {
     assert(!pt.empty());
     return pt.get<double>(key);
@@ -1234,6 +1554,11 @@ std::string Config::readString (const boost::property_tree::ptree &pt, const cha
     return pt.get<std::string>(key);
 }
 
+std::string Config::readStringWithDefault (const boost::property_tree::ptree &pt, const char *key, const std::string &dv) const {
+    assert(!pt.empty());
+    return pt.get<std::string>(key, dv);
+}
+
 char* Config::readBytesFromFile (const std::string filepath, int numBytesToRead) const {
     // skip reading if no filename is available
     if (filepath.empty()) {
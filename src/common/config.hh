@@ -73,6 +73,21 @@ public:
     unsigned long int getCopyBlockSize() const;
     bool getAgentFlushOnClose() const;
     bool getAgentRegisterToProxy() const;
+    int getAgentNumContainerIoThreads() const;
+    int getAgentScrubRatio() const;
+    std::string getAgentFsIoEngine() const;
+    unsigned long int getAgentFsDirectIoThreshold() const;
+    unsigned long int getAgentFsMmapThreshold() const;
+    int getAgentUsageReconcileInterval() const;
+    int getAgentFsDirLevels() const;
+    unsigned long int getAgentSegmentSize() const;
+    int getAgentSegmentCompactionThreshold() const;
+    unsigned long int getAgentChunkCacheSize() const;
+    std::string getAgentChunkCacheDir() const;
+    unsigned long int getAgentChunkCacheDirSize() const;
+    int getAgentNumPeerConnections() const;
+    int getAgentRepairSliceSize() const;
+    bool getAgentRepairChain() const;
 
     // proxy
     int getNumProxy() const;
@@ -96,6 +111,15 @@ public:
     int getProxyMetaStoreType() const;
     std::string getProxyMetaStoreIP() const;
     unsigned short getProxyMetaStorePort() const;
+    int getProxyMetaStoreNumConnections() const;
+    std::string getProxyMetaStorePath() const;
+    unsigned long int getProxyMetaStoreSegmentSize() const;
+    bool proxyMetaStoreSyncOnCommit() const;
+    int getProxyMetaStoreCompactionInterval() const;
+    int getProxyMetaStoreCompactionThreshold() const;
+    int getProxyMetaStoreCacheSize() const;
+    int getProxyMetaStoreCacheTTL() const;
+    int getProxyMetaStoreLockTTL() const;
     // proxy.misc
     int getProxyNumZmqThread() const;
     bool isRepairAtProxy() const;
@@ -124,6 +148,7 @@ public:
     time_t getChunkScanInterval() const;
     int getChunkScanBatchSize() const;
     int getFileRecoverBatchSize() const;
+    int getFileScanMetaBatchSize() const;
     int getChunkScanSamplingPolicy() const;
     double getChunkScanSamplingRate() const;
     // proxy.reporter
@@ -145,6 +170,19 @@ public:
     int getProxyStagingBackgroundWriteScanInterval() const;
     std::string getProxyStagingBackgroundWriteTimestamp() const;
 
+    // proxy.dedup
+    bool proxyDedupEnabled() const;
+    int getProxyDedupBlockSize() const;
+    int getProxyDedupNumFingerprintLanes() const;
+    int getProxyDedupNumExternalStripeReaders() const;
+    int getProxyDedupIndexNumShards() const;
+    int getProxyDedupIndexCacheCapacity() const;
+    int getProxyDedupBloomFilterCapacity() const;
+    bool proxyDedupIndexWarmUp() const;
+    int getProxyDedupGcInterval() const;
+    int getProxyDedupGcBatchSize() const;
+    int getProxyDedupGcCompactionThreshold() const;
+
     void printConfig() const;
 
 private:
@@ -153,12 +191,15 @@ private:
     void operator=(Config const&); // Don't implement
     
     bool readBool (const boost::property_tree::ptree &pt, const char *key) const;
+    bool readBoolWithDefault (const boost::property_tree::ptree &pt, const char *key, bool dv = false) const;
     int readInt (const boost::property_tree::ptree &pt, const char *key) const;
     unsigned int readUInt (const boost::property_tree::ptree &pt, const char *key) const;
     long long readLL (const boost::property_tree::ptree &pt, const char *key) const;
     unsigned long long readULL (const boost::property_tree::ptree &pt, const char *key) const;
+    unsigned long long readULLWithDefault (const boost::property_tree::ptree &pt, const char *key, unsigned long long dv = 0) const;
     double readFloat (const boost::property_tree::ptree &pt, const char *key) const;
     std::string readString (const boost::property_tree::ptree &pt, const char *key) const;
+    std::string readStringWithDefault (const boost::property_tree::ptree &pt, const char *key, const std::string &dv = "") const;
     char* readBytesFromFile (const std::string filename, int numBytesToRead) const;
 
     int readIntWithBounds (const boost::property_tree::ptree &pt, const char *key, int min = 0, int max = INT32_MAX) const;
@@ -256,6 +297,21 @@ private:
             unsigned long int copyBlockSize;
             bool flushOnClose;
             bool registerToProxy;
+            int numContainerIoThreads;
+            int scrubRatio;
+            std::string fsIoEngine;
+            unsigned long int fsDirectIoThreshold;
+            unsigned long int fsMmapThreshold;
+            int usageReconcileInterval;
+            int fsDirLevels;
+            unsigned long int segmentSize;
+            int segmentCompactionThreshold;
+            unsigned long int chunkCacheSize;
+            std::string chunkCacheDir;
+            unsigned long int chunkCacheDirSize;
+            int numPeerConnections;
+            int repairSliceSize;
+            bool repairChain;
         } misc;
     } _agent;
 
@@ -275,7 +331,20 @@ private:
             struct {
                 std::string ip;
                 unsigned short port;
+                int numConnections;
+                int lockTTL;
             } redis;
+            struct {
+                std::string path;
+                unsigned long int segmentSize;
+                bool sync;
+                int compactionInterval;
+                int compactionThreshold;
+            } local;
+            struct {
+                int size;
+                int ttl;
+            } cache;
         } metastore;
         struct {
             std::string curvePublicKey;
@@ -314,6 +383,7 @@ private:
             int scanChunkIntv;
             int chunkBatchSize;
             int batchSize;
+            int metaBatchSize;
             struct {
                 int policy;
                 double rate;
@@ -338,6 +408,23 @@ private:
                 std::string scheduledTime;
             } bgwrite;
         } staging;
+        struct {
+            bool enabled;
+            int blockSize;
+            int numFingerprintLanes;
+            int numExternalStripeReaders;
+            struct {
+                int numShards;
+                int cacheCapacity;
+                int bloomFilterCapacity;
+                bool warmUp;
+            } index;
+            struct {
+                int interval;
+                int batchSize;
+                int compactionThreshold;
+            } gc;
+        } dedup;
     } _proxy;
 };
 
@@ -52,6 +52,8 @@ unsigned long int Coordinator::sendEventMessage(zmq::socket_t &socket, const Coo
         if (addrLength)
             bytes += socket.send(event.agentAddr.c_str(), addrLength, ZMQ_SNDMORE);
         bytes += socket.send(&event.cport, sizeof(event.cport), ZMQ_SNDMORE);
+        // chunk cache statistics
+        bytes += socket.send(&event.cacheStats, sizeof(event.cacheStats), ZMQ_SNDMORE);
         // number of containers held by the agent
         bytes += socket.send(&event.numContainers, sizeof(int), event.numContainers > 0? ZMQ_SNDMORE : 0);
         // list of container ids
@@ -135,6 +137,10 @@ unsigned long int Coordinator::getEventMessage(zmq::socket_t &socket, Coordinato
         if (!msg.more()) return 0;
         getField(cport, unsigned short);
 
+        // chunk cache statistics
+        if (!msg.more()) return 0;
+        getField(cacheStats, CacheStats);
+
         // number of containers
         if (!msg.more()) return 0;
         getField(numContainers, int);
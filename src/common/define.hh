@@ -43,6 +43,8 @@ typedef uint32_t                   num_t;
 #define HOUR_IN_SECONDS            (3600)
 //#define HOUR_IN_SECONDS            (30) // for code testing
 
+#define REPAIR_SLICE_WINDOW        (int)(4) // number of chunk slices in flight when repairing chunks in slices
+
 // see also CodingSchemeName in common/config.cc
 enum CodingScheme {
     RS,
@@ -118,6 +120,7 @@ enum ContainerType {
     ALI_CONTAINER,
     AWS_CONTAINER,
     AZURE_CONTAINER,
+    SEGMENT_CONTAINER,
 
     UNKNOWN_CONTAINER,
 };
@@ -163,6 +166,7 @@ enum HostType {
 
 enum MetaStoreType {
     REDIS,
+    LOCAL,
 
     UNKNOWN_METASTORE
 };
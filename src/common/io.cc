@@ -7,7 +7,6 @@
 
 #include "io.hh"
 #include "../common/define.hh"
-#include "../common/util.hh"
 
 #include "../common/benchmark/benchmark.hh"
 
@@ -83,9 +82,18 @@ bool IO::needsCoding(unsigned short opcode) {
 }
 
 bool IO::hasRepairChunkInfo(unsigned short opcode) {
-    // only the encoding chunk request contains coding metadata
+    // repair chunk requests, and encoding chunk requests (for the agents down the repair chain) contain chunk groups
+    return (
+        opcode == Opcode::RPR_CHUNK_REQ ||
+        opcode == Opcode::ENC_CHUNK_REQ ||
+        false
+    );
+}
+
+bool IO::hasSliceInfo(unsigned short opcode) {
+    // only the encoding chunk request may ask for a slice of chunks
     return (
-        opcode == Opcode::RPR_CHUNK_REQ
+        opcode == Opcode::ENC_CHUNK_REQ
     );
 }
 
@@ -267,6 +275,14 @@ unsigned long int IO::getChunkEventMessage(zmq::socket_t &socket, ChunkEvent &ev
         getField(repairUsingCAR, bool);
     }
 
+    // slice info
+    if (hasSliceInfo(event.opcode)) {
+        if (!req.more()) return 0;
+        getField(sliceOffset, unsigned long int);
+        if (!req.more()) return 0;
+        getField(sliceLength, int);
+    }
+
     DLOG(INFO) << "Message received (" << bytes << "B)";
 
 #undef getNextMsg
@@ -333,7 +349,7 @@ unsigned long int IO::sendChunkEventMessage(zmq::socket_t &socket, const ChunkEv
         bytes += socket.send(&event.chunks[i].size, sizeof(event.chunks[i].size), (!hasChunkData(event.opcode) && !needsCoding(event.opcode) && i + 1 == actualNumChunks)? 0: ZMQ_SNDMORE);
         // chunk data
         if (hasChunkData(event.opcode)) {
-            bytes += socket.send(event.chunks[i].data, event.chunks[i].size, (!needsCoding(event.opcode) && i + 1 == actualNumChunks)? 0 : ZMQ_SNDMORE);
+            bytes += sendChunkData(socket, event.chunks[i], (!needsCoding(event.opcode) && i + 1 == actualNumChunks)? 0 : ZMQ_SNDMORE);
         }
     }
 
@@ -346,7 +362,7 @@ unsigned long int IO::sendChunkEventMessage(zmq::socket_t &socket, const ChunkEv
     bytes += socket.send(&event.codingMeta.n, sizeof(event.codingMeta.n), ZMQ_SNDMORE);
     bytes += socket.send(&event.codingMeta.k, sizeof(event.codingMeta.k), ZMQ_SNDMORE);
     */
-    bytes += socket.send(&event.codingMeta.codingStateSize, sizeof(event.codingMeta.codingStateSize), event.codingMeta.codingStateSize > 0? ZMQ_SNDMORE : 0);
+    bytes += socket.send(&event.codingMeta.codingStateSize, sizeof(event.codingMeta.codingStateSize), (event.codingMeta.codingStateSize > 0 || hasRepairChunkInfo(event.opcode))? ZMQ_SNDMORE : 0);
     if (event.codingMeta.codingStateSize > 0)
         bytes += socket.send(event.codingMeta.codingState, event.codingMeta.codingStateSize, hasRepairChunkInfo(event.opcode)? ZMQ_SNDMORE : 0);
 
@@ -360,13 +376,32 @@ unsigned long int IO::sendChunkEventMessage(zmq::socket_t &socket, const ChunkEv
     bytes += socket.send(event.containerGroupMap, sizeof(int) * event.numInputChunks, ZMQ_SNDMORE);
     bytes += socket.send(event.agents.c_str(), event.agents.size(), ZMQ_SNDMORE);
 
-    bytes += socket.send(&event.repairUsingCAR, sizeof(bool), 0);
+    bytes += socket.send(&event.repairUsingCAR, sizeof(bool), hasSliceInfo(event.opcode)? ZMQ_SNDMORE : 0);
+
+    // slice info
+    if (hasSliceInfo(event.opcode)) {
+        bytes += socket.send(&event.sliceOffset, sizeof(event.sliceOffset), ZMQ_SNDMORE);
+        bytes += socket.send(&event.sliceLength, sizeof(event.sliceLength), 0);
+    }
     
     DLOG(INFO) << "Message sent (" << bytes << "B)";
 
     return bytes;
 }
 
+unsigned long int IO::sendChunkData(zmq::socket_t &socket, const Chunk &chunk, int flags) {
+    if (chunk.mapping == nullptr || chunk.size <= 0)
+        return socket.send(chunk.data, chunk.size, flags);
+
+    // hand the mapped data to zmq, which holds a reference on the mapping until the message is sent
+    zmq::message_t msg(chunk.data, chunk.size, IO::releaseChunkMapping, new std::shared_ptr<void>(chunk.mapping));
+    return socket.send(msg, flags)? chunk.size : 0;
+}
+
+void IO::releaseChunkMapping(void *data, void *hint) {
+    delete (std::shared_ptr<void> *) hint;
+}
+
 std::string IO::genAddr(std::string ip, unsigned port) {
     char portstr[8];
     portstr[0] = ':';
@@ -383,76 +418,3 @@ std::string IO::getAddrIP(std::string addr) {
     size_t end = addr.find_last_of(":");
     return addr.substr(start, end - start);
 }
-
-
-void *IO::sendChunkRequestToAgent(void *arg) {
-    const Config &config = Config::getInstance();
-    RequestMeta &meta = *((RequestMeta*) arg);
-
-    bool reuse = meta.isFromProxy && config.reuseDataConn();
-    MessageDirection msgDirection = meta.isFromProxy? PROXY_TO_AGENT : AGENT_TO_AGENT;
-    zmq::socket_t *socket = 0;
-    try {
-        if (reuse) {
-            socket = meta.socket;
-        } else {
-            // new a socket
-            socket = new zmq::socket_t(*meta.cxt, ZMQ_REQ);
-            // setup socket options (TCP keep alive and Agent timeout)
-            Util::setSocketOptions(socket, msgDirection);
-            int timeout = Config::getInstance().getFailureTimeout();
-            socket->setsockopt(ZMQ_SNDTIMEO, timeout);
-            socket->setsockopt(ZMQ_RCVTIMEO, timeout);
-            socket->setsockopt(ZMQ_LINGER, timeout);
-            // connect to the agent
-            socket->connect(meta.address);
-        }
-        
-        // boost::timer::cpu_timer mytimer;
-        
-        // send the chunk event request
-        unsigned long sent = IO::sendChunkEventMessage(*socket, *meta.request);
-        if (sent == 0) {
-            LOG(ERROR) << "Failed to send chunk event over socket at " << meta.address;
-            if (!reuse) {
-                socket->close();
-                delete socket;
-            }
-            return (void *) -1;
-        }
-        // boost::timer::cpu_times sentDuration = mytimer.elapsed();
-        // DLOG(INFO) << "Sent chunk event (container id = " << meta.containerId << ") to " << meta.address;
-        // mytimer.start();
-
-        // get the chunk event reply
-        unsigned long received = IO::getChunkEventMessage(*socket, *meta.reply);
-        if (received == 0) {
-            LOG(ERROR) << "Failed to get a chunk event reply over socket at " << meta.address;
-            if (!reuse) {
-                socket->close();
-                delete socket;
-            }
-            return (void *) -2;
-        }
-
-        // DLOG(INFO) << "Handle chunk event (container id = " << meta.containerId << ") to " 
-        //           << meta.address << ", send (" << (hasChunkData(meta.request->opcode)? "with" : "without")
-        //           << " chunks) in " << sentDuration.wall * 1.0 / 1e9 << " s, get reply ("
-        //           << (hasChunkData(meta.reply->opcode)? "with" : "without")
-        //           << " chunks) in " << mytimer.elapsed().wall * 1.0 / 1e9 << " s";
-        
-        if (!reuse) {
-            socket->close();
-            delete socket;
-        }
-    } catch (zmq::error_t &e) {
-        LOG(ERROR) << "Failed to connect agent to send the chunk request opcode = " << meta.request->opcode << ", " << e.what();
-        if (!reuse && socket != 0) {
-            socket->close();
-            delete socket;
-        }
-        return (void *) -1;
-    }
-
-    return NULL;
-}
@@ -48,21 +48,9 @@ public:
      **/
     static std::string getAddrIP(std::string addr);
 
-    /**
-     * Issue chunk request to agent
-     *
-     * @param arg pointer to a IO::RequestMeta structure
-     * @return whether the operation is successful, NULL if sucessful, non-NULL otherwise
-     **/
-    static void *sendChunkRequestToAgent(void *arg);
-
     typedef struct {
         int containerId;                  /**< id of the first container of the agent */
         bool isFromProxy;                 /**< whether this request is sent from Proxy */
-        struct {
-            zmq::context_t *cxt;          /**< zeromq context */
-            zmq::socket_t *socket;        /**< zeromq socket */
-        };
         std::string address;              /**< agent address (tcp://[ip]:[port]) */
         ChunkEvent *request;              /**< requested chunk event */
         ChunkEvent *reply;                /**< replied chunk event */
@@ -130,6 +118,15 @@ private:
      **/
     static bool hasRepairChunkInfo(unsigned short opcode);
 
+    /**
+     * Tell whether the chunk event message should contain the range of chunk slice
+     *
+     * @param opcode operation code of the chunk event
+     *
+     * @return whether the message should contain the range of chunk slice
+     **/
+    static bool hasSliceInfo(unsigned short opcode);
+
     /**
      * Tell the actual factor of incoming chunks
      *
@@ -138,6 +135,25 @@ private:
      * @return the factor on the number of incoming chunks w.r.t. that specified in event.numChunks
      **/
     static int getNumChunkFactor(unsigned short opcode);
+
+    /**
+     * Send the data of a chunk, without copying if the data is mapped from a chunk file
+     *
+     * @param socket socket to send the data
+     * @param chunk chunk with data to send
+     * @param flags flags for sending the data
+     *
+     * @return number of bytes sent
+     **/
+    static unsigned long int sendChunkData(zmq::socket_t &socket, const Chunk &chunk, int flags);
+
+    /**
+     * Release the reference on a chunk file mapping held by a message sent (on completion of the send)
+     *
+     * @param data data of the message
+     * @param hint reference on the mapping
+     **/
+    static void releaseChunkMapping(void *data, void *hint);
 };
 
 #endif // define __IO_HH__
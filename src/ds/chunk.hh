@@ -4,6 +4,7 @@
 #define __CHUNK_HH__
 
 #include <stdlib.h> // free()
+#include <memory>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -19,6 +20,7 @@ struct Chunk {
     unsigned char *data;         /**< chunk data */
     int size;                    /**< chunk size */
     bool freeData;               /**< whether to free data upon destruction */
+    std::shared_ptr<void> mapping; /**< memory mapping of the chunk file holding the data (if any), unmapped once no longer referenced */
 
     int fileVersion;             /**< file version number */
     char chunkVersion[CHUNK_VERSION_MAX_LEN];  /**< chunk version number for revert */
@@ -76,6 +78,7 @@ struct Chunk {
 
         // free any existing data buffer
         if (freeData) free(data);
+        mapping.reset();
 
         data = datat;
         size = sizet;
@@ -100,6 +103,7 @@ struct Chunk {
         data = src.data;
         size = src.size;
         freeData = src.freeData;
+        mapping = std::move(src.mapping);
         src.data = 0;
         src.freeData = false;
         return true;
@@ -176,6 +180,7 @@ struct Chunk {
         data = 0;
         size = 0;
         freeData = true;
+        mapping.reset();
         resetMD5();
     }
 
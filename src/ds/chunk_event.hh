@@ -30,6 +30,10 @@ struct ChunkEvent {
     int *containerGroupMap;            /**< container group mapping, in form [container id, ...], and its size is numInputChunks */
     std::string agents;                /**< agent address for chunk groups, ";" separated list of addresses ([address";"address";"..]), always ends with a ";" */
 
+    // slice info
+    unsigned long int sliceOffset;     /**< offset of the slice in chunks to encode */
+    int sliceLength;                   /**< length of the slice in chunks to encode, 0 for whole chunks */
+
     // benchmark
     TagPt p2a;                         /**< TagPt proxy to agent */
     TagPt a2p;                         /**< TagPt agent to proxy */
@@ -75,6 +79,8 @@ struct ChunkEvent {
         chunkGroupMap = 0;
         containerGroupMap = 0;
         repairUsingCAR = false;
+        sliceOffset = 0;
+        sliceLength = 0;
     }
 
 };
@@ -32,6 +32,20 @@ struct SysInfo {
     }
 };
 
+struct CacheStats {
+    unsigned long int hits;            /**< number of chunks served from the cache */
+    unsigned long int misses;          /**< number of chunks read from containers on cache miss */
+    unsigned long int size;            /**< size of chunks cached in memory */
+    unsigned long int capacity;        /**< capacity of the cache in memory, 0 if the cache is disabled */
+
+    CacheStats() {
+        hits = 0;
+        misses = 0;
+        size = 0;
+        capacity = 0;
+    }
+};
+
 struct CoordinatorEvent {
     unsigned short opcode;
 
@@ -44,6 +58,7 @@ struct CoordinatorEvent {
     unsigned long int *containerUsage;
     unsigned long int *containerCapacity;
     unsigned char *containerType;
+    CacheStats cacheStats;
 
     SysInfo sysinfo;
 
@@ -14,6 +14,7 @@
 #include <openssl/md5.h>
 
 #include "chunk.hh"
+#include "flat_map.hh"
 #include "../common/define.hh"
 #include "coding_meta.hh"
 
@@ -26,6 +27,9 @@
 
 class File {
 public:
+    typedef FlatMap<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> > UniqueBlockMap;    /**< logical block -> (fingerprint, physical in-stripe offset) */
+    typedef FlatMap<BlockLocation::InObjectLocation, Fingerprint> DuplicateBlockMap;                  /**< logical block -> fingerprint */
+
     File();
     ~File();
 
@@ -123,8 +127,8 @@ public:
     int reqId;                     // remark: use id instead of hash
 
     // for dedup
-    std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> > uniqueBlocks; /*<< logical block to fingerprint and physcial location (in-stripe offset) */
-    std::map<BlockLocation::InObjectLocation, Fingerprint> duplicateBlocks; /*<< logical block to fingerprint */
+    UniqueBlockMap uniqueBlocks;   /*<< logical block to fingerprint and physcial location (in-stripe offset) */
+    DuplicateBlockMap duplicateBlocks; /*<< logical block to fingerprint */
     std::vector<std::string> commitIds;
 
 private:
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __FLAT_MAP_HH__
+#define __FLAT_MAP_HH__
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * Ordered map kept as a sorted vector of (key, value) pairs
+ *
+ * Provides the subset of std::map operations used for block lists, with
+ * contiguous storage and binary-search lookups. Inserting keys in ascending
+ * order appends in O(1); inserting out of order shifts the following items.
+ **/
+template <class K, class V, class Compare = std::less<K> >
+class FlatMap {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    iterator begin() { return _items.begin(); }
+    iterator end() { return _items.end(); }
+    const_iterator begin() const { return _items.begin(); }
+    const_iterator end() const { return _items.end(); }
+
+    size_t size() const { return _items.size(); }
+    bool empty() const { return _items.empty(); }
+    void clear() { _items.clear(); }
+    void reserve(size_t n) { _items.reserve(n); }
+
+    std::pair<iterator, bool> insert(const value_type &item) {
+        // fast path for items inserted in key order
+        if (_items.empty() || _comp(_items.back().first, item.first)) {
+            _items.push_back(item);
+            return std::make_pair(std::prev(_items.end()), true);
+        }
+        iterator it = lower_bound(item.first);
+        if (it != _items.end() && !_comp(item.first, it->first))
+            return std::make_pair(it, false);
+        return std::make_pair(_items.insert(it, item), true);
+    }
+
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        size_t numExisting = _items.size();
+        _items.insert(_items.end(), first, last);
+        auto keyLess = [this] (const value_type &a, const value_type &b) { return _comp(a.first, b.first); };
+        auto keyEqual = [this] (const value_type &a, const value_type &b) { return !_comp(a.first, b.first) && !_comp(b.first, a.first); };
+        // merge the new items after the existing ones, and keep the first item of each key as std::map does
+        std::stable_sort(_items.begin() + numExisting, _items.end(), keyLess);
+        std::inplace_merge(_items.begin(), _items.begin() + numExisting, _items.end(), keyLess);
+        _items.erase(std::unique(_items.begin(), _items.end(), keyEqual), _items.end());
+    }
+
+    iterator emplace_hint(const_iterator hint, const value_type &item) {
+        return insert(item).first;
+    }
+
+    iterator lower_bound(const K &key) {
+        return std::lower_bound(_items.begin(), _items.end(), key, [this] (const value_type &a, const K &b) { return _comp(a.first, b); });
+    }
+
+    const_iterator lower_bound(const K &key) const {
+        return std::lower_bound(_items.begin(), _items.end(), key, [this] (const value_type &a, const K &b) { return _comp(a.first, b); });
+    }
+
+    iterator upper_bound(const K &key) {
+        return std::upper_bound(_items.begin(), _items.end(), key, [this] (const K &a, const value_type &b) { return _comp(a, b.first); });
+    }
+
+    const_iterator upper_bound(const K &key) const {
+        return std::upper_bound(_items.begin(), _items.end(), key, [this] (const K &a, const value_type &b) { return _comp(a, b.first); });
+    }
+
+    iterator find(const K &key) {
+        iterator it = lower_bound(key);
+        return it != _items.end() && !_comp(key, it->first)? it : _items.end();
+    }
+
+    const_iterator find(const K &key) const {
+        const_iterator it = lower_bound(key);
+        return it != _items.end() && !_comp(key, it->first)? it : _items.end();
+    }
+
+    size_t count(const K &key) const {
+        return find(key) != _items.end()? 1 : 0;
+    }
+
+    V &at(const K &key) {
+        iterator it = find(key);
+        if (it == _items.end())
+            throw std::out_of_range("FlatMap::at");
+        return it->second;
+    }
+
+    const V &at(const K &key) const {
+        const_iterator it = find(key);
+        if (it == _items.end())
+            throw std::out_of_range("FlatMap::at");
+        return it->second;
+    }
+
+    iterator erase(const_iterator it) {
+        return _items.erase(it);
+    }
+
+    size_t erase(const K &key) {
+        iterator it = find(key);
+        if (it == _items.end())
+            return 0;
+        _items.erase(it);
+        return 1;
+    }
+
+private:
+    std::vector<value_type> _items;           /**< items sorted by key */
+    Compare _comp;                            /**< key comparator */
+};
+
+#endif // define __FLAT_MAP_HH__
@@ -38,6 +38,8 @@ struct Request {
     struct {
         FileInfo *fileInfo;
         unsigned int numFiles;
+        std::string cursor;
+        unsigned int pageSize;
         ProxyCoordinator::AgentInfo *agentInfo;
         unsigned int numAgents;
         struct {
@@ -62,6 +64,7 @@ struct Request {
         stats.fileLimit = 0;
         list.fileInfo = 0;
         list.numFiles = 0;
+        list.pageSize = 0;
         list.agentInfo = 0;
         list.numAgents = 0;
         list.bgTasks.name = 0;
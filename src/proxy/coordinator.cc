@@ -10,6 +10,7 @@
 #include "../ds/coordinator_event.hh"
 
 #define AGENT_MONITOR_CONN_POINT "inproc://monitor-agent"
+#define CACHE_STATS_LOG_INTERVAL (300) // seconds
 
 ProxyCoordinator::ProxyCoordinator(std::map<int, std::string> *containerToAgentMap) : Coordinator() {
     _cxt = zmq::context_t(1);
@@ -499,6 +500,7 @@ bool ProxyCoordinator::registerAgent(CoordinatorEvent &event) {
         agentInfo.numContainers++;
         LOG(INFO) << "Add container " << event.containerIds[i] << " for agent at " << event.agentAddr;
     }
+    agentInfo.cacheStats = event.cacheStats;
     // mark the agent as alive if it can register successfully
     if (success) {
         std::string agentIP = IO::getAddrIP(event.agentAddr); 
@@ -630,6 +632,16 @@ void ProxyCoordinator::updateAgentStatus() {
                 DLOG(INFO) << "Agent add container " << event.containerIds[i] << " current usage = " << usage;
             }
             DLOG(INFO) << "Agent has " << a.second.utilizationMap.size() << " containers in utilization map";
+            // chunk cache statistics
+            a.second.cacheStats = event.cacheStats;
+            // report the hit rate of each agent every few minutes (instead of on every status update)
+            if (event.cacheStats.capacity > 0 && a.second.cacheStatsLogTime + CACHE_STATS_LOG_INTERVAL <= time(NULL)) {
+                unsigned long int lookups = event.cacheStats.hits + event.cacheStats.misses;
+                LOG(INFO) << "Agent " << a.first << " chunk cache hits = " << event.cacheStats.hits << " misses = " << event.cacheStats.misses
+                          << " hit rate = " << (lookups > 0? event.cacheStats.hits * 100.0 / lookups : 0.0) << "%"
+                          << " size = " << event.cacheStats.size << "/" << event.cacheStats.capacity;
+                a.second.cacheStatsLogTime = time(NULL);
+            }
             // warn if the update contains fewer containers than that in the existing record
             if (a.second.utilizationMap.size() != (size_t) event.numContainers) {
                 LOG(WARNING) << "Agent only sent updates on " << event.numContainers << " containers, expecting " << a.second.numContainers;
@@ -44,6 +44,8 @@ public:
         unsigned long int containerCapacity[NUM_MAX_CONTAINER_PER_AGENT]; /**< storage capacity of containers managed by agent */
         unsigned char containerType[NUM_MAX_CONTAINER_PER_AGENT];         /**< type of containers managed by agent */
         std::multimap<float, int> utilizationMap;                         /**< container index sorted by utilization */
+        CacheStats cacheStats;                                            /**< statistics of the chunk cache of agent */
+        time_t cacheStatsLogTime;                                         /**< last time the statistics of the chunk cache are logged */
         SysInfo sysinfo;
 
         AgentInfo() {
@@ -52,6 +54,7 @@ public:
             isNear = false;
             numContainers = 0;
             startingContainerIndex = 0;
+            cacheStatsLogTime = 0;
         }
 
         ~AgentInfo() {
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __DEDUP_FIXED_SIZE_CHUNKER_HH__
+#define __DEDUP_FIXED_SIZE_CHUNKER_HH__
+
+#include "chunker.hh"
+
+class FixedSizeChunker : public DedupChunker {
+public:
+
+    /**
+     * Chunker that cuts data into blocks of a fixed size
+     *
+     * @param[in] blockSize                size of a block
+     **/
+    FixedSizeChunker(unsigned int blockSize) {
+        _blockSize = blockSize > 0? blockSize : 1;
+    };
+    ~FixedSizeChunker() {};
+
+    unsigned int findOffsetToNextAnchor(const char *data, const unsigned int length) {
+        return length < _blockSize? length : _blockSize;
+    }
+
+protected:
+    unsigned int _blockSize;                  /**< size of a block */
+};
+
+#endif // define __DEDUP_FIXED_SIZE_CHUNKER_HH__
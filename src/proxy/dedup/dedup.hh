@@ -72,6 +72,38 @@ public:
      **/
     virtual std::string update(const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &oldLocations, const std::vector<BlockLocation> &newLocations) = 0;
 
+    /**
+     * Add references to a list of fingerprints, one reference per item in the list
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints referenced
+     *
+     * @return whether the references are recorded
+     **/
+    virtual bool addReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) = 0;
+
+    /**
+     * Remove references to a list of fingerprints, one reference per item in the list; fingerprints no longer referenced are removed from the index
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints no longer referenced
+     * @param[out] counts                  list of remaining reference counts ordered by the list of fingerprints
+     *
+     * @return whether the references are removed
+     **/
+    virtual bool removeReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) = 0;
+
+    /**
+     * Get the reference counts of a list of fingerprints
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints to query
+     * @param[out] counts                  list of reference counts ordered by the list of fingerprints
+     *
+     * @return whether the reference counts are retrieved
+     **/
+    virtual bool getReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) = 0;
+
 
 protected:
 
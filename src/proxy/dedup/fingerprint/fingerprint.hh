@@ -4,12 +4,16 @@
 #define __FINGERPRINT_HH__
 
 #include <string>
+#include <string.h>
+#include <algorithm>
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
 
+#define FINGERPRINT_MAX_SIZE (32)
+
 class Fingerprint {
 public:
     Fingerprint() {
@@ -19,49 +23,64 @@ public:
     ~Fingerprint() {}
 
     void reset() {
-        set("", 0);
+        _length = 0;
+        memset(_bytes, 0, FINGERPRINT_MAX_SIZE);
     }
 
     void set(const char *bytes, unsigned int length) {
-        _bytes = std::string(bytes, length);
+        // digests longer than the inline buffer are truncated
+        _length = length > FINGERPRINT_MAX_SIZE? FINGERPRINT_MAX_SIZE : length;
+        memcpy(_bytes, bytes, _length);
+        memset(_bytes + _length, 0, FINGERPRINT_MAX_SIZE - _length);
     }
 
     std::string get() const {
+        return std::string((const char *) _bytes, _length);
+    }
+
+    const unsigned char *data() const {
         return _bytes;
     }
 
+    unsigned int size() const {
+        return _length;
+    }
+
 
     //use SHA256 to compute fingerprint for each block
     std::string sha256(const std::string& str);
     
-    virtual bool computeFingerprint(const std::string& data, unsigned int length);
+    bool computeFingerprint(const std::string& data, unsigned int length);
 
     bool operator!=(const Fingerprint &rhs) const {
-        return _bytes != rhs._bytes;
+        return !(*this == rhs);
     }
 
     bool operator==(const Fingerprint &rhs) const {
-        return _bytes == rhs._bytes;
+        return _length == rhs._length && memcmp(_bytes, rhs._bytes, _length) == 0;
     }
 
     bool ifEqual(const Fingerprint &rhs) const {
-        return _bytes == rhs._bytes;
+        return *this == rhs;
     }
 
     bool operator<(const Fingerprint &rhs) const {
-        return _bytes < rhs._bytes;
+        int cmp = memcmp(_bytes, rhs._bytes, std::min(_length, rhs._length));
+        return cmp < 0 || (cmp == 0 && _length < rhs._length);
     }
 
-    virtual std::string toHex() const {
-        return toHex((unsigned char *) _bytes.data(), _bytes.size());
+    std::string toHex() const {
+        return toHex(_bytes, _length);
     }
 
-    virtual bool unHex(const std::string &hex) {
+    bool unHex(const std::string &hex) {
         size_t length = hex.size() / 2 + (hex.size() % 2);
-        unsigned char binary[length];
+        if (length > FINGERPRINT_MAX_SIZE)
+            return false;
+        unsigned char binary[FINGERPRINT_MAX_SIZE];
         bool okay = unHex(hex, binary, length);
         if (okay) {
-            _bytes = std::string((char *) binary, length);
+            set((const char *) binary, length);
         }
         return okay;
     }
@@ -91,7 +110,8 @@ public:
 
 protected:
 
-    std::string _bytes;
+    unsigned char _bytes[FINGERPRINT_MAX_SIZE];     /**< fingerprint bytes, zero-padded */
+    unsigned char _length;                          /**< number of valid bytes */
 
 };
 
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <future>
+#include <vector>
+
+#include "fingerprint_sha256.hh"
+
+// min. number of bytes to hash in each lane, before it is worth hashing in parallel
+#define MIN_BYTES_PER_LANE (256 << 10)
+
+static bool computeFingerprintsInLane(const unsigned char * const *data, const unsigned int *lengths, size_t start, size_t end, Fingerprint *fingerprints) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    bool okay = true;
+    for (size_t i = start; i < end; i++) {
+        if (SHA256(data[i], lengths[i], digest) != digest) {
+            okay = false;
+            continue;
+        }
+        fingerprints[i].set((const char *) digest, SHA256_DIGEST_LENGTH);
+    }
+    return okay;
+}
+
+bool SHA256Fingerprint::computeFingerprints(const unsigned char * const *data, const unsigned int *lengths, size_t numBlocks, Fingerprint *fingerprints, int numLanes) {
+    if (numBlocks == 0)
+        return true;
+
+    // limit the number of lanes by the amount of data to hash
+    unsigned long int totalBytes = 0;
+    for (size_t i = 0; i < numBlocks; i++)
+        totalBytes += lengths[i];
+    size_t lanes = numLanes > 1? numLanes : 1;
+    lanes = std::min(lanes, std::max(totalBytes / MIN_BYTES_PER_LANE, 1UL));
+    lanes = std::min(lanes, numBlocks);
+
+    if (lanes == 1)
+        return computeFingerprintsInLane(data, lengths, 0, numBlocks, fingerprints);
+
+    // hash a contiguous range of blocks in each lane, with the calling thread taking the first range
+    size_t blocksPerLane = numBlocks / lanes, remainder = numBlocks % lanes;
+    std::vector<std::future<bool> > results;
+    size_t start = 0, end = 0;
+    size_t firstEnd = blocksPerLane + (remainder > 0? 1 : 0);
+    start = firstEnd;
+    for (size_t i = 1; i < lanes; i++) {
+        end = start + blocksPerLane + (i < remainder? 1 : 0);
+        results.emplace_back(std::async(std::launch::async, computeFingerprintsInLane, data, lengths, start, end, fingerprints));
+        start = end;
+    }
+    bool okay = computeFingerprintsInLane(data, lengths, 0, firstEnd, fingerprints);
+    for (size_t i = 0; i < results.size(); i++)
+        okay = results.at(i).get() && okay;
+
+    return okay;
+}
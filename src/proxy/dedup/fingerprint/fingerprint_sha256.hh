@@ -8,14 +8,29 @@
 
 class SHA256Fingerprint : public Fingerprint {
 public:
+    using Fingerprint::computeFingerprint;
+
     bool computeFingerprint(const unsigned char *data, unsigned int length) {
         unsigned char digest[SHA256_DIGEST_LENGTH];
         bool okay = SHA256(data, length, digest) == digest;
         if (okay) {
-            _bytes = std::string((char *) digest, SHA256_DIGEST_LENGTH);
+            set((char *) digest, SHA256_DIGEST_LENGTH);
         }
         return okay;
     }
+
+    /**
+     * Compute the fingerprints of a batch of blocks in place, without copying the block data
+     *
+     * @param[in] data                     list of pointers to the block data
+     * @param[in] lengths                  list of block lengths
+     * @param[in] numBlocks                number of blocks in the batch
+     * @param[out] fingerprints            list of fingerprints to fill, must hold at least numBlocks fingerprints
+     * @param[in] numLanes                 max. number of blocks to hash in parallel
+     *
+     * @return whether all fingerprints are computed
+     **/
+    static bool computeFingerprints(const unsigned char * const *data, const unsigned int *lengths, size_t numBlocks, Fingerprint *fingerprints, int numLanes = 1);
 };
 
 #endif // ifndef __FINGERPRINT_SHA256_HH__
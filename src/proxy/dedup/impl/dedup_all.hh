@@ -1,3 +1,4 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "dedup_none.hh"
+#include "dedup_fixed_block.hh"
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <set>
+
+#include <glog/logging.h>
+
+#include "dedup_fixed_block.hh"
+#include "../chunking/fixed_size_chunker.hh"
+#include "../fingerprint/fingerprint_sha256.hh"
+#include "../../../common/config.hh"
+#include "../../../common/define.hh"
+
+DedupFixedBlock::DedupFixedBlock(MetaStore *metastore) {
+    Config &config = Config::getInstance();
+
+    _metastore = metastore;
+
+    _index = new FingerprintIndex(
+        _metastore
+        , config.getProxyDedupIndexNumShards()
+        , config.getProxyDedupIndexCacheCapacity()
+        , config.getProxyDedupBloomFilterCapacity()
+    );
+    _chunker = new FixedSizeChunker(config.getProxyDedupBlockSize());
+    _numFingerprintLanes = config.getProxyDedupNumFingerprintLanes();
+    _commitCounter = 0;
+
+    if (config.proxyDedupIndexWarmUp()) {
+        _index->warmUp(DEFAULT_NAMESPACE_ID);
+    }
+}
+
+DedupFixedBlock::~DedupFixedBlock() {
+    delete _index;
+}
+
+std::string DedupFixedBlock::scan(const unsigned char *data, const BlockLocation &dataInObjectLocation, std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, bool> >& blocks) {
+    blocks.clear();
+
+    unsigned char namespaceId = dataInObjectLocation.getObjectNamespaceId();
+    std::string name = dataInObjectLocation.getObjectName();
+    unsigned long int offset = dataInObjectLocation.getBlockOffset();
+    unsigned int length = dataInObjectLocation.getBlockLength();
+
+    // nothing to deduplicate for empty data
+    if (length == 0) {
+        blocks.insert(std::make_pair(dataInObjectLocation.getBlockRange(), std::make_pair(Fingerprint(), /* is duplicated */ false)));
+        return "0";
+    }
+
+    // cut data into blocks
+    std::vector<BlockLocation::InObjectLocation> ranges;
+    std::vector<const unsigned char *> blockData;
+    std::vector<unsigned int> blockLengths;
+    for (unsigned int pos = 0; pos < length;) {
+        unsigned int blockLength = _chunker->findOffsetToNextAnchor((const char *) data + pos, length - pos);
+        if (blockLength == 0 || blockLength > length - pos)
+            blockLength = length - pos;
+        ranges.emplace_back(offset + pos, blockLength);
+        blockData.push_back(data + pos);
+        blockLengths.push_back(blockLength);
+        pos += blockLength;
+    }
+
+    // compute the fingerprints of all blocks in one batch
+    std::vector<Fingerprint> fps(ranges.size());
+    if (!SHA256Fingerprint::computeFingerprints(blockData.data(), blockLengths.data(), ranges.size(), fps.data(), _numFingerprintLanes)) {
+        LOG(ERROR) << "Failed to compute fingerprints for blocks of object " << name;
+        return "";
+    }
+
+    // look up the fingerprints, treat all blocks as unique if the index is unavailable
+    std::vector<BlockLocation> existing;
+    if (_index->lookup(namespaceId, fps, existing) == -1) {
+        existing.clear();
+        existing.resize(fps.size());
+    }
+
+    PendingCommit pending;
+    pending.namespaceId = namespaceId;
+    std::set<Fingerprint> newFps;
+    BlockLocation loc;
+    loc.setObjectID(namespaceId, name, dataInObjectLocation.getObjectVersion());
+    for (size_t i = 0; i < fps.size(); i++) {
+        // skip blocks of the same object, which may be overwritten by this write
+        bool isDuplicate = !existing.at(i).isInvalid() && existing.at(i).getObjectName() != name;
+        if (!isDuplicate && newFps.insert(fps.at(i)).second) {
+            loc.setBlockRange(ranges.at(i));
+            pending.fingerprints.emplace_back(fps.at(i));
+            pending.locations.emplace_back(loc);
+        }
+        blocks.insert(std::make_pair(ranges.at(i), std::make_pair(fps.at(i), isDuplicate)));
+    }
+
+    return addPendingCommit(pending);
+}
+
+void DedupFixedBlock::commit(std::string commitId) {
+    PendingCommit pending;
+    {
+        std::lock_guard<std::mutex> lk(_pendingLock);
+        auto it = _pending.find(commitId);
+        if (it == _pending.end())
+            return;
+        pending = std::move(it->second);
+        _pending.erase(it);
+    }
+
+    // only update the fingerprints which still point to the old locations
+    if (!pending.oldLocations.empty()) {
+        std::vector<BlockLocation> current;
+        if (_index->lookup(pending.namespaceId, pending.fingerprints, current) == -1) {
+            LOG(ERROR) << "Failed to commit " << commitId << ", cannot look up the current block locations";
+            return;
+        }
+        std::vector<Fingerprint> fps;
+        std::vector<BlockLocation> locations;
+        for (size_t i = 0; i < pending.fingerprints.size(); i++) {
+            if (!(current.at(i) == pending.oldLocations.at(i)))
+                continue;
+            fps.emplace_back(pending.fingerprints.at(i));
+            locations.emplace_back(pending.locations.at(i));
+        }
+        pending.fingerprints.swap(fps);
+        pending.locations.swap(locations);
+    }
+
+    if (!_index->insert(pending.namespaceId, pending.fingerprints, pending.locations)) {
+        LOG(ERROR) << "Failed to commit " << commitId << " with " << pending.fingerprints.size() << " fingerprints";
+    }
+}
+
+void DedupFixedBlock::abort(std::string commitId) {
+    std::lock_guard<std::mutex> lk(_pendingLock);
+    _pending.erase(commitId);
+}
+
+std::vector<BlockLocation> DedupFixedBlock::query(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    std::vector<BlockLocation> locations;
+    if (_index->lookup(namespaceId, fingerprints, locations) == -1) {
+        // report a shorter list for the caller to detect the failure
+        locations.clear();
+    }
+    return locations;
+}
+
+std::string DedupFixedBlock::update(const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &oldLocations, const std::vector<BlockLocation> &newLocations) {
+    if (fingerprints.size() != oldLocations.size() || fingerprints.size() != newLocations.size()) {
+        LOG(ERROR) << "Failed to update fingerprints, the number of locations mismatches the number of fingerprints";
+        return "";
+    }
+
+    PendingCommit pending;
+    pending.namespaceId = newLocations.empty()? DEFAULT_NAMESPACE_ID : newLocations.front().getObjectNamespaceId();
+    pending.fingerprints = fingerprints;
+    pending.locations = newLocations;
+    pending.oldLocations = oldLocations;
+
+    return addPendingCommit(pending);
+}
+
+bool DedupFixedBlock::addReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    std::vector<long long> counts;
+    return updateReferences(namespaceId, fingerprints, 1, counts);
+}
+
+bool DedupFixedBlock::removeReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    if (!updateReferences(namespaceId, fingerprints, -1, counts))
+        return false;
+
+    // drop the index records of fingerprints no longer referenced
+    std::set<Fingerprint> unreferenced;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        if (counts.at(i) <= 0)
+            unreferenced.insert(fingerprints.at(i));
+    }
+    if (!unreferenced.empty() && !_index->remove(namespaceId, std::vector<Fingerprint>(unreferenced.begin(), unreferenced.end()))) {
+        LOG(WARNING) << "Failed to remove " << unreferenced.size() << " unreferenced fingerprints of namespace " << (int) namespaceId << " from the index";
+    }
+
+    return true;
+}
+
+bool DedupFixedBlock::getReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    return _metastore->getFingerprintRefCounts(namespaceId, fingerprints, counts);
+}
+
+bool DedupFixedBlock::updateReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, int delta, std::vector<long long> &counts) {
+    counts.clear();
+    if (fingerprints.empty())
+        return true;
+
+    // merge the changes on the same fingerprint, so each count is updated once per batch
+    std::map<Fingerprint, int> changes;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        changes[fingerprints.at(i)] += delta;
+    }
+    std::vector<Fingerprint> fps;
+    std::vector<int> deltas;
+    fps.reserve(changes.size());
+    deltas.reserve(changes.size());
+    for (auto it = changes.begin(); it != changes.end(); it++) {
+        fps.emplace_back(it->first);
+        deltas.emplace_back(it->second);
+    }
+
+    std::vector<long long> updated;
+    if (!_metastore->updateFingerprintRefCounts(namespaceId, fps, deltas, updated)) {
+        LOG(ERROR) << "Failed to update the reference counts of " << fps.size() << " fingerprints of namespace " << (int) namespaceId;
+        return false;
+    }
+
+    // report the counts in the order of the input list
+    counts.reserve(fingerprints.size());
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        size_t idx = std::lower_bound(fps.begin(), fps.end(), fingerprints.at(i)) - fps.begin();
+        counts.emplace_back(updated.at(idx));
+    }
+
+    return true;
+}
+
+std::string DedupFixedBlock::addPendingCommit(PendingCommit &pending) {
+    std::lock_guard<std::mutex> lk(_pendingLock);
+    std::string commitId = std::to_string(++_commitCounter);
+    _pending.insert(std::make_pair(commitId, std::move(pending)));
+    return commitId;
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __DEDUP_FIXED_BLOCK_HH__
+#define __DEDUP_FIXED_BLOCK_HH__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../dedup.hh"
+#include "../metastore/fingerprint_index.hh"
+
+class DedupFixedBlock : public DeduplicationModule {
+public:
+
+    /**
+     * Deduplication module that cuts data into fixed-size blocks, and finds duplicated blocks using a fingerprint index
+     *
+     * @param[in] metastore     metadata store of the proxy for persisting the fingerprint index (not owned by the module)
+     **/
+
+    DedupFixedBlock(MetaStore *metastore);
+    ~DedupFixedBlock();
+
+    /**
+     * refer to DeduplicationModule::scan()
+     **/
+    std::string scan(const unsigned char *data, const BlockLocation &dataInObjectLocation, std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, bool> >& blocks);
+
+    /**
+     * refer to DeduplicationModule::commit()
+     **/
+    void commit(std::string commitId);
+
+    /**
+     * refer to DeduplicationModule::abort()
+     **/
+    void abort(std::string commitId);
+
+    /**
+     * refer to DeduplicationModule::query()
+     **/
+    std::vector<BlockLocation> query(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * refer to DeduplicationModule::update()
+     **/
+    std::string update(const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &oldLocations, const std::vector<BlockLocation> &newLocations);
+
+    /**
+     * refer to DeduplicationModule::addReferences()
+     **/
+    bool addReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * refer to DeduplicationModule::removeReferences()
+     **/
+    bool removeReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
+    /**
+     * refer to DeduplicationModule::getReferences()
+     **/
+    bool getReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
+private:
+
+    struct PendingCommit {
+        unsigned char namespaceId;                    /**< namespace id of the fingerprints */
+        std::vector<Fingerprint> fingerprints;        /**< fingerprints to add or update */
+        std::vector<BlockLocation> locations;         /**< new block locations of the fingerprints */
+        std::vector<BlockLocation> oldLocations;      /**< expected current block locations for updates, empty for additions */
+    };
+
+    std::string addPendingCommit(PendingCommit &pending);
+    bool updateReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, int delta, std::vector<long long> &counts);
+
+    MetaStore *_metastore;                            /**< metadata store for persisting the fingerprint index (shared with the proxy) */
+    FingerprintIndex *_index;                         /**< fingerprint index */
+    int _numFingerprintLanes;                         /**< max. number of blocks to fingerprint in parallel */
+
+    std::mutex _pendingLock;                          /**< lock on the pending commits */
+    std::map<std::string, PendingCommit> _pending;    /**< commit id -> pending changes to the index */
+    unsigned long int _commitCounter;                 /**< counter for generating commit ids */
+};
+
+#endif // define __DEDUP_FIXED_BLOCK_HH__
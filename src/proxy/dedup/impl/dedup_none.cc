@@ -29,3 +29,20 @@ std::vector<BlockLocation> DedupNone::query(const unsigned char namespaceId, con
     ret.resize(fingerprints.size());
     return ret;
 }
+
+bool DedupNone::addReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    return true;
+}
+
+bool DedupNone::removeReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    // no block is shared without deduplication
+    counts.clear();
+    counts.resize(fingerprints.size(), 0);
+    return true;
+}
+
+bool DedupNone::getReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    counts.clear();
+    counts.resize(fingerprints.size(), 0);
+    return true;
+}
@@ -42,6 +42,21 @@ public:
      **/
     std::string update(const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &oldLocations, const std::vector<BlockLocation> &newLocations);
 
+    /**
+     * refer to DeduplicationModule::addReferences()
+     **/
+    bool addReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * refer to DeduplicationModule::removeReferences()
+     **/
+    bool removeReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
+    /**
+     * refer to DeduplicationModule::getReferences()
+     **/
+    bool getReferences(const unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
 private:
 };
 
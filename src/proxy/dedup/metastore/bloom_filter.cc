@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <string.h>
+
+#include "bloom_filter.hh"
+
+#define BLOOM_FILTER_SEED_1 (0x9e3779b97f4a7c15ULL)
+#define BLOOM_FILTER_SEED_2 (0xc2b2ae3d27d4eb4fULL)
+
+BloomFilter::BloomFilter(unsigned long int capacity, unsigned int bitsPerKey) {
+    if (capacity == 0) capacity = 1;
+    if (bitsPerKey == 0) bitsPerKey = 1;
+    _numWords = (capacity * bitsPerKey + 63) / 64;
+    _numBits = _numWords * 64;
+    // optimal number of hashes is (bits per key) * ln(2)
+    _numHashes = bitsPerKey * 69 / 100;
+    if (_numHashes < 1) _numHashes = 1;
+    if (_numHashes > 30) _numHashes = 30;
+    _bits = new std::atomic<uint64_t>[_numWords];
+    clear();
+}
+
+BloomFilter::~BloomFilter() {
+    delete [] _bits;
+}
+
+void BloomFilter::add(const std::string &key) {
+    const unsigned char *data = (const unsigned char *) key.data();
+    uint64_t h1 = hash(data, key.size(), BLOOM_FILTER_SEED_1);
+    uint64_t h2 = hash(data, key.size(), BLOOM_FILTER_SEED_2) | 1;
+    for (unsigned int i = 0; i < _numHashes; i++) {
+        uint64_t bit = (h1 + i * h2) % _numBits;
+        _bits[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+    }
+}
+
+bool BloomFilter::mayContain(const std::string &key) const {
+    const unsigned char *data = (const unsigned char *) key.data();
+    uint64_t h1 = hash(data, key.size(), BLOOM_FILTER_SEED_1);
+    uint64_t h2 = hash(data, key.size(), BLOOM_FILTER_SEED_2) | 1;
+    for (unsigned int i = 0; i < _numHashes; i++) {
+        uint64_t bit = (h1 + i * h2) % _numBits;
+        if ((_bits[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void BloomFilter::clear() {
+    for (unsigned long int i = 0; i < _numWords; i++)
+        _bits[i].store(0, std::memory_order_relaxed);
+}
+
+unsigned long int BloomFilter::getNumBits() const {
+    return _numBits;
+}
+
+uint64_t BloomFilter::hash(const unsigned char *data, size_t length, uint64_t seed) {
+    // 64-bit multiply-xorshift mixing over 8-byte words
+    const uint64_t m = 0xff51afd7ed558ccdULL;
+    uint64_t h = seed ^ (length * m);
+    uint64_t w = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        memcpy(&w, data + i, 8);
+        w *= m;
+        w ^= w >> 33;
+        h = (h ^ w) * m;
+    }
+    if (i < length) {
+        w = 0;
+        memcpy(&w, data + i, length - i);
+        w *= m;
+        w ^= w >> 33;
+        h = (h ^ w) * m;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __DEDUP_BLOOM_FILTER_HH__
+#define __DEDUP_BLOOM_FILTER_HH__
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+class BloomFilter {
+public:
+
+    /**
+     * Bloom filter for fast rejection of keys that were never added
+     *
+     * @param[in] capacity                 expected number of keys to hold
+     * @param[in] bitsPerKey               number of bits per key, the default gives ~1% false positive rate
+     **/
+    BloomFilter(unsigned long int capacity, unsigned int bitsPerKey = 10);
+    ~BloomFilter();
+
+    /**
+     * Add a key to the filter
+     *
+     * @param[in] key                      key to add
+     **/
+    void add(const std::string &key);
+
+    /**
+     * Check whether a key may have been added to the filter
+     *
+     * @param[in] key                      key to check
+     *
+     * @return false if the key is definitely not added; true if the key may be added
+     **/
+    bool mayContain(const std::string &key) const;
+
+    /**
+     * Remove all keys from the filter
+     **/
+    void clear();
+
+    /**
+     * Get the size of filter in bits
+     *
+     * @return size of filter in bits
+     **/
+    unsigned long int getNumBits() const;
+
+private:
+
+    static uint64_t hash(const unsigned char *data, size_t length, uint64_t seed);
+
+    std::atomic<uint64_t> *_bits;             /**< bit array */
+    unsigned long int _numWords;              /**< number of 64-bit words in the bit array */
+    unsigned long int _numBits;               /**< number of bits in the bit array */
+    unsigned int _numHashes;                  /**< number of hash functions */
+};
+
+#endif // define __DEDUP_BLOOM_FILTER_HH__
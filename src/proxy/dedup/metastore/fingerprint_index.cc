@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <glog/logging.h>
+
+#include "fingerprint_index.hh"
+
+#define FP_INDEX_WARM_UP_BATCH_SIZE (1024)
+
+FingerprintIndex::FingerprintIndex(MetaStore *metastore, int numShards, unsigned long int cacheCapacity, unsigned long int bloomFilterCapacity) :
+        _filter(bloomFilterCapacity) {
+    _metastore = metastore;
+    if (numShards < 1) numShards = 1;
+    for (int i = 0; i < numShards; i++) {
+        _shards.push_back(new CacheShard());
+    }
+    _shardCapacity = cacheCapacity / numShards;
+    for (int i = 0; i < 256; i++) {
+        _warmedUp[i] = false;
+    }
+    _numFiltered = 0;
+    _numCacheHits = 0;
+    _numStoreLookups = 0;
+}
+
+FingerprintIndex::~FingerprintIndex() {
+    for (size_t i = 0; i < _shards.size(); i++) {
+        delete _shards.at(i);
+    }
+    _shards.clear();
+}
+
+int FingerprintIndex::lookup(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) {
+    if (!ensureWarmedUp(namespaceId))
+        return -1;
+
+    size_t numFps = fingerprints.size();
+    locations.clear();
+    locations.resize(numFps);
+
+    int numFound = 0;
+    std::vector<size_t> missIdx;
+    std::vector<Fingerprint> misses;
+    std::vector<std::string> keys(numFps);
+
+    for (size_t i = 0; i < numFps; i++) {
+        keys.at(i) = genKey(namespaceId, fingerprints.at(i));
+        // definitely not in the index
+        if (!_filter.mayContain(keys.at(i))) {
+            _numFiltered++;
+            continue;
+        }
+        // hot fingerprint
+        if (getFromCache(keys.at(i), locations.at(i))) {
+            _numCacheHits++;
+            numFound++;
+            continue;
+        }
+        missIdx.push_back(i);
+        misses.push_back(fingerprints.at(i));
+    }
+
+    if (misses.empty())
+        return numFound;
+
+    // look up the remaining fingerprints from the metadata store in one batch
+    _numStoreLookups += misses.size();
+    std::vector<BlockLocation> missLocations;
+    if (_metastore->getFingerprints(namespaceId, misses, missLocations) == -1) {
+        LOG(ERROR) << "Failed to look up " << misses.size() << " fingerprints of namespace " << (int) namespaceId << " from the metadata store";
+        return -1;
+    }
+    for (size_t i = 0; i < missIdx.size() && i < missLocations.size(); i++) {
+        if (missLocations.at(i).isInvalid())
+            continue;
+        locations.at(missIdx.at(i)) = missLocations.at(i);
+        putToCache(keys.at(missIdx.at(i)), missLocations.at(i));
+        numFound++;
+    }
+
+    return numFound;
+}
+
+bool FingerprintIndex::insert(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations) {
+    if (fingerprints.size() != locations.size())
+        return false;
+    if (fingerprints.empty())
+        return true;
+
+    // persist first, so the in-memory copy never holds records that are absent in the metadata store
+    if (!_metastore->putFingerprints(namespaceId, fingerprints, locations)) {
+        LOG(ERROR) << "Failed to persist " << fingerprints.size() << " fingerprints of namespace " << (int) namespaceId;
+        return false;
+    }
+
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        std::string key = genKey(namespaceId, fingerprints.at(i));
+        _filter.add(key);
+        putToCache(key, locations.at(i));
+    }
+
+    return true;
+}
+
+bool FingerprintIndex::remove(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    if (fingerprints.empty())
+        return true;
+
+    // entries stay in the Bloom filter, which only costs a lookup on false positives
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        removeFromCache(genKey(namespaceId, fingerprints.at(i)));
+    }
+
+    return _metastore->deleteFingerprints(namespaceId, fingerprints);
+}
+
+bool FingerprintIndex::warmUp(unsigned char namespaceId) {
+    std::lock_guard<std::mutex> lk(_warmUpLock);
+
+    if (_warmedUp[namespaceId])
+        return true;
+
+    std::string cursor = "0";
+    unsigned long int numLoaded = 0;
+    std::vector<Fingerprint> fps;
+    std::vector<BlockLocation> locations;
+    do {
+        fps.clear();
+        locations.clear();
+        if (!_metastore->scanFingerprints(namespaceId, cursor, FP_INDEX_WARM_UP_BATCH_SIZE, fps, locations)) {
+            LOG(ERROR) << "Failed to load fingerprints of namespace " << (int) namespaceId << " after loading " << numLoaded << " fingerprints";
+            return false;
+        }
+        for (size_t i = 0; i < fps.size(); i++) {
+            std::string key = genKey(namespaceId, fps.at(i));
+            _filter.add(key);
+            putToCache(key, locations.at(i));
+        }
+        numLoaded += fps.size();
+    } while (cursor != "0");
+
+    _warmedUp[namespaceId] = true;
+
+    LOG(INFO) << "Loaded " << numLoaded << " fingerprints of namespace " << (int) namespaceId << " into the fingerprint index";
+
+    return true;
+}
+
+void FingerprintIndex::getStats(unsigned long int &numFiltered, unsigned long int &numCacheHits, unsigned long int &numStoreLookups) const {
+    numFiltered = _numFiltered;
+    numCacheHits = _numCacheHits;
+    numStoreLookups = _numStoreLookups;
+}
+
+std::string FingerprintIndex::genKey(unsigned char namespaceId, const Fingerprint &fingerprint) const {
+    std::string key;
+    key.reserve(fingerprint.size() + 1);
+    key.push_back((char) namespaceId);
+    key.append((const char *) fingerprint.data(), fingerprint.size());
+    return key;
+}
+
+FingerprintIndex::CacheShard &FingerprintIndex::getShard(const std::string &key) {
+    return *_shards.at(std::hash<std::string>{}(key) % _shards.size());
+}
+
+bool FingerprintIndex::getFromCache(const std::string &key, BlockLocation &location) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+        return false;
+
+    // move to the front of lru list
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+    location = it->second.first;
+    return true;
+}
+
+void FingerprintIndex::putToCache(const std::string &key, const BlockLocation &location) {
+    if (_shardCapacity == 0)
+        return;
+
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        it->second.first = location;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+        return;
+    }
+
+    // evict the least recently used fingerprint
+    if (shard.map.size() >= _shardCapacity) {
+        shard.map.erase(shard.lru.back());
+        shard.lru.pop_back();
+    }
+
+    shard.lru.push_front(key);
+    shard.map.insert(std::make_pair(key, std::make_pair(location, shard.lru.begin())));
+}
+
+void FingerprintIndex::removeFromCache(const std::string &key) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+        return;
+
+    shard.lru.erase(it->second.second);
+    shard.map.erase(it);
+}
+
+bool FingerprintIndex::ensureWarmedUp(unsigned char namespaceId) {
+    // the filter can only reject fingerprints after all persisted ones of the namespace are added
+    return _warmedUp[namespaceId] || warmUp(namespaceId);
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __DEDUP_FINGERPRINT_INDEX_HH__
+#define __DEDUP_FINGERPRINT_INDEX_HH__
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bloom_filter.hh"
+#include "../block_location.hh"
+#include "../fingerprint/fingerprint.hh"
+#include "../../metastore/metastore.hh"
+
+class FingerprintIndex {
+public:
+
+    /**
+     * Fingerprint-to-block-location index, with a Bloom filter to reject unique fingerprints without I/O,
+     * a sharded in-memory cache of hot fingerprints, and the metadata store as the persistent copy
+     *
+     * @param[in] metastore                metadata store to persist the index
+     * @param[in] numShards                number of shards in the in-memory cache
+     * @param[in] cacheCapacity            max. number of fingerprints to keep in memory
+     * @param[in] bloomFilterCapacity      expected number of fingerprints in the index
+     **/
+    FingerprintIndex(MetaStore *metastore, int numShards, unsigned long int cacheCapacity, unsigned long int bloomFilterCapacity);
+    ~FingerprintIndex();
+
+    /**
+     * Look up the block locations of a list of fingerprints
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints to look up
+     * @param[out] locations               list of block locations ordered by the list of fingerprints, invalid location if the fingerprint is not found
+     *
+     * @return number of fingerprints found, or -1 on error
+     **/
+    int lookup(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations);
+
+    /**
+     * Insert or overwrite the block locations of a list of fingerprints
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints to insert
+     * @param[in] locations                list of block locations ordered by the list of fingerprints
+     *
+     * @return whether the records are persisted
+     **/
+    bool insert(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations);
+
+    /**
+     * Remove a list of fingerprints
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints
+     * @param[in] fingerprints             list of fingerprints to remove
+     *
+     * @return whether the records are removed from the persistent copy
+     **/
+    bool remove(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * Load the fingerprints of a namespace from the metadata store into the Bloom filter and the in-memory cache;
+     * namespaces are otherwise loaded on first access
+     *
+     * @param[in] namespaceId              namespace id of the fingerprints to load
+     *
+     * @return whether the fingerprints are loaded
+     **/
+    bool warmUp(unsigned char namespaceId);
+
+    /**
+     * Get the lookup statistics
+     *
+     * @param[out] numFiltered             number of lookups rejected by the Bloom filter
+     * @param[out] numCacheHits            number of lookups served by the in-memory cache
+     * @param[out] numStoreLookups         number of lookups sent to the metadata store
+     **/
+    void getStats(unsigned long int &numFiltered, unsigned long int &numCacheHits, unsigned long int &numStoreLookups) const;
+
+private:
+
+    struct CacheShard {
+        std::mutex lock;                                            /**< lock on the shard */
+        std::list<std::string> lru;                                 /**< keys in least-recently-used order, most recent first */
+        std::unordered_map<std::string, std::pair<BlockLocation, std::list<std::string>::iterator> > map; /**< key -> (location, position in lru) */
+    };
+
+    std::string genKey(unsigned char namespaceId, const Fingerprint &fingerprint) const;
+    CacheShard &getShard(const std::string &key);
+
+    bool getFromCache(const std::string &key, BlockLocation &location);
+    void putToCache(const std::string &key, const BlockLocation &location);
+    void removeFromCache(const std::string &key);
+
+    bool ensureWarmedUp(unsigned char namespaceId);
+
+    MetaStore *_metastore;                                          /**< persistent copy of the index */
+    BloomFilter _filter;                                            /**< filter on fingerprints in the index */
+
+    std::vector<CacheShard*> _shards;                               /**< shards of the in-memory cache */
+    unsigned long int _shardCapacity;                               /**< max. number of fingerprints per shard */
+
+    std::mutex _warmUpLock;                                         /**< lock on loading namespaces */
+    std::atomic<bool> _warmedUp[256];                               /**< whether the namespace is loaded */
+
+    std::atomic<unsigned long int> _numFiltered;                    /**< number of lookups rejected by the filter */
+    std::atomic<unsigned long int> _numCacheHits;                   /**< number of lookups served by the cache */
+    std::atomic<unsigned long int> _numStoreLookups;                /**< number of lookups sent to the metadata store */
+};
+
+#endif // define __DEDUP_FINGERPRINT_INDEX_HH__
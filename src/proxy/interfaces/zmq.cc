@@ -403,7 +403,14 @@ void *ProxyZMQIntegration::handleRequests(void *arg) {
             break;
 
         case GET_FILE_LIST_REQ:
-            rep.list.numFiles = proxy->getFileList(&rep.list.fileInfo, /* withSize */ true, /* withVersions */ false, req.file.namespaceId, req.file.name);
+            if (req.list.pageSize > 0) {
+                // list files page by page, and return the token for the next page
+                rep.list.cursor = req.list.cursor.empty()? "0" : req.list.cursor;
+                rep.list.pageSize = req.list.pageSize;
+                rep.list.numFiles = proxy->getFileListPage(&rep.list.fileInfo, rep.list.cursor, rep.list.pageSize, /* withSize */ true, req.file.namespaceId, req.file.name);
+            } else {
+                rep.list.numFiles = proxy->getFileList(&rep.list.fileInfo, /* withSize */ true, /* withVersions */ false, req.file.namespaceId, req.file.name);
+            }
             rep.opcode = ClientOpcode::GET_FILE_LIST_REP_SUCCESS;
             break;
 
@@ -511,6 +518,16 @@ int ProxyZMQIntegration::getRequest(zmq::socket_t &socket, Request &req) {
     req.file.name = std::string((char *) msg.data(), msg.size());
     DLOG(INFO) << "Name = " << req.file.name;
 
+    if (req.opcode == GET_FILE_LIST_REQ && msg.more()) {
+        // continuation token and page size (optional), for listing files page by page
+        getNextMsg();
+        req.list.cursor = std::string((char *) msg.data(), msg.size());
+        if (!msg.more()) return 1;
+        getNextMsg();
+        req.list.pageSize = *((unsigned int *) msg.data());
+        DLOG(INFO) << "Cursor = " << req.list.cursor << " page size = " << req.list.pageSize;
+    }
+
     if (req.opcode == GET_READ_SIZE_REQ || req.opcode == GET_FILE_LIST_REQ)
         return 0;
     
@@ -645,9 +662,11 @@ bool ProxyZMQIntegration::sendReply(zmq::socket_t &socket, Reply &rep) {
         }
         DLOG(INFO) << "file limit = " << rep.stats.fileLimit;
     } else if (replyFileList(rep.opcode)) {
+        // the token for the next page follows the list of files, if the files are listed page by page
+        bool isPaged = rep.list.pageSize > 0;
         // file list count
         msgLength = sizeof(rep.list.numFiles);
-        if (socket.send(&rep.list.numFiles, msgLength, rep.list.numFiles > 0? ZMQ_SNDMORE : 0) != msgLength) {
+        if (socket.send(&rep.list.numFiles, msgLength, rep.list.numFiles > 0 || isPaged? ZMQ_SNDMORE : 0) != msgLength) {
             LOG(ERROR) << "Failed to send file list count on reply";
             return false;
         }
@@ -680,12 +699,21 @@ bool ProxyZMQIntegration::sendReply(zmq::socket_t &socket, Reply &rep) {
             }
             // file last modified time
             msgLength = sizeof(rep.list.fileInfo[i].mtime);
-            if (socket.send(&rep.list.fileInfo[i].mtime, msgLength, isLast? 0 : ZMQ_SNDMORE) != msgLength) {
+            if (socket.send(&rep.list.fileInfo[i].mtime, msgLength, isLast && !isPaged? 0 : ZMQ_SNDMORE) != msgLength) {
                 LOG(ERROR) << "Failed to send file last modified time on list (" << i <<  ") on reply";
                 return false;
             }
             DLOG(INFO) << "file " << i << " name = " << rep.list.fileInfo[i].name << " size = " << rep.list.fileInfo[i].size << " {c,a,m}times (" << rep.list.fileInfo[i].ctime << "," << rep.list.fileInfo[i].atime << "," << rep.list.fileInfo[i].mtime << ")";
         }
+        if (isPaged) {
+            // token for the next page
+            msgLength = rep.list.cursor.size();
+            if (socket.send(rep.list.cursor.data(), msgLength, 0) != msgLength) {
+                LOG(ERROR) << "Failed to send the file list cursor on reply";
+                return false;
+            }
+            DLOG(INFO) << "next cursor = " << rep.list.cursor;
+        }
     } else if (rep.opcode == GET_APPEND_SIZE_REP_SUCCESS || rep.opcode == GET_READ_SIZE_REP_SUCCESS) {
         // append length 
         msgLength = sizeof(rep.file.length);
@@ -24,14 +24,9 @@ ProxyIO::~ProxyIO() {
 void *ProxyIO::sendChunkRequestToAgent(void *arg) {
     RequestMeta &meta = *((RequestMeta*) arg);
 
-    // convert the request metadata from ProxyIO::RequestMeta to IO::RequestMeta
-    IO::RequestMeta ioMeta;
-    ioMeta.isFromProxy = true;
-    ioMeta.reply = meta.reply;
-    ioMeta.request = meta.request;
-    ioMeta.containerId = meta.containerId;
+    std::string address;
     try {
-        ioMeta.address = meta.io->_containerToAgentMap->at(meta.containerId);
+        address = meta.io->_containerToAgentMap->at(meta.containerId);
     } catch (std::exception &e) {
         LOG(ERROR) << "Failed to find agent addresss, container id = " << meta.containerId;
         return (void *) -1;
@@ -42,27 +37,39 @@ void *ProxyIO::sendChunkRequestToAgent(void *arg) {
         meta.network->markStart();
     }
 
-    if (Config::getInstance().reuseDataConn()) {
-        meta.io->_lock.lock();
-        try {
-            ioMeta.socket = meta.io->_containerToSocketMap.at(meta.containerId);
-        } catch (std::exception &e) {
-            ioMeta.socket = new zmq::socket_t(meta.io->_cxt, ZMQ_REQ);
-            meta.io->_containerToSocketMap.insert(std::pair<int, zmq::socket_t*>(meta.containerId, ioMeta.socket));
-            Util::setSocketOptions(ioMeta.socket, PROXY_TO_AGENT);
-            int timeout = Config::getInstance().getFailureTimeout();
-            ioMeta.socket->setsockopt(ZMQ_SNDTIMEO, timeout);
-            ioMeta.socket->setsockopt(ZMQ_RCVTIMEO, timeout);
-            ioMeta.socket->setsockopt(ZMQ_LINGER, timeout);
-            ioMeta.socket->connect(ioMeta.address);
+    bool reuse = Config::getInstance().reuseDataConn();
+    zmq::socket_t *socket = 0;
+    void *retVal = NULL;
+    try {
+        if (reuse) {
+            meta.io->_lock.lock();
+            try {
+                socket = meta.io->_containerToSocketMap.at(meta.containerId);
+            } catch (std::exception &e) {
+                socket = meta.io->connect(address);
+                meta.io->_containerToSocketMap.insert(std::pair<int, zmq::socket_t*>(meta.containerId, socket));
+            }
+            meta.io->_lock.unlock();
+        } else {
+            socket = meta.io->connect(address);
         }
-        meta.io->_lock.unlock();
-    } else {
-        ioMeta.cxt = &meta.io->_cxt;
-    }
 
-    void *retVal = IO::sendChunkRequestToAgent((void*) &ioMeta);
-    // return IO::sendChunkRequestToAgent((void*) &ioMeta);
+        // send the chunk event request, and get the reply
+        if (IO::sendChunkEventMessage(*socket, *meta.request) == 0) {
+            LOG(ERROR) << "Failed to send chunk event over socket at " << address;
+            retVal = (void *) -1;
+        } else if (IO::getChunkEventMessage(*socket, *meta.reply) == 0) {
+            LOG(ERROR) << "Failed to get a chunk event reply over socket at " << address;
+            retVal = (void *) -2;
+        }
+    } catch (zmq::error_t &e) {
+        LOG(ERROR) << "Failed to connect agent to send the chunk request opcode = " << meta.request->opcode << ", " << e.what();
+        retVal = (void *) -1;
+    }
+    if (!reuse && socket != 0) {
+        socket->close();
+        delete socket;
+    }
 
     // TAGPT (end): network
     if (meta.network != NULL) {
@@ -72,3 +79,14 @@ void *ProxyIO::sendChunkRequestToAgent(void *arg) {
     pthread_exit(retVal);
 }
 
+zmq::socket_t *ProxyIO::connect(const std::string &address) {
+    zmq::socket_t *socket = new zmq::socket_t(_cxt, ZMQ_REQ);
+    // setup socket options (TCP keep alive and Agent timeout)
+    Util::setSocketOptions(socket, PROXY_TO_AGENT);
+    int timeout = Config::getInstance().getFailureTimeout();
+    socket->setsockopt(ZMQ_SNDTIMEO, timeout);
+    socket->setsockopt(ZMQ_RCVTIMEO, timeout);
+    socket->setsockopt(ZMQ_LINGER, timeout);
+    socket->connect(address);
+    return socket;
+}
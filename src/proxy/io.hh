@@ -50,6 +50,14 @@ public:
     static void *sendChunkRequestToAgent(void *arg);
 
 private:
+    /**
+     * Connect a new socket to an agent
+     *
+     * @param address agent address (tcp://[ip]:[port])
+     * @return the socket connected
+     **/
+    zmq::socket_t *connect(const std::string &address);
+
     std::map<int, std::string> *_containerToAgentMap;           /**< container id to agent address mapping */
     std::map<int, zmq::socket_t*> _containerToSocketMap;        /**< container id to socket mapping */
     std::mutex _lock;
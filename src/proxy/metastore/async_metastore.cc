@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <glog/logging.h>
+
+#include "async_metastore.hh"
+
+AsyncMetaStore::AsyncMetaStore(MetaStore *metastore, int numWorkers) {
+    _metastore = metastore;
+    _running = true;
+    if (numWorkers < 1) numWorkers = 1;
+    for (int i = 0; i < numWorkers; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, AsyncMetaStore::run, this) != 0) {
+            LOG(ERROR) << "Failed to start metadata store worker " << i;
+            continue;
+        }
+        _workers.push_back(t);
+    }
+}
+
+AsyncMetaStore::~AsyncMetaStore() {
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _running = false;
+    }
+    _cv.notify_all();
+    // workers drain the queue before exit, so no pending future is left unresolved
+    for (size_t i = 0; i < _workers.size(); i++) {
+        pthread_join(_workers.at(i), NULL);
+    }
+}
+
+std::future<bool> AsyncMetaStore::getMeta(File &f, int getBlocks) {
+    return submit([&f, getBlocks] (MetaStore *ms) { return ms->getMeta(f, getBlocks); });
+}
+
+std::future<bool> AsyncMetaStore::putMeta(const File &f) {
+    return submit([&f] (MetaStore *ms) { return ms->putMeta(f); });
+}
+
+std::future<bool> AsyncMetaStore::updateTimestamps(const File &f) {
+    std::shared_ptr<File> cf = std::make_shared<File>();
+    if (!cf->copyName(f))
+        return submit([] (MetaStore *ms) { return false; });
+    cf->version = f.version;
+    cf->setTimeStamps(f.ctime, f.mtime, f.atime, f.tctime);
+    return submit([cf] (MetaStore *ms) { return ms->updateTimestamps(*cf); });
+}
+
+std::future<bool> AsyncMetaStore::markFileAsRepaired(const File &f) {
+    return submit([&f] (MetaStore *ms) { return ms->markFileAsRepaired(f); });
+}
+
+std::future<bool> AsyncMetaStore::markFileAsNeedsRepair(const File &f) {
+    return submit([&f] (MetaStore *ms) { return ms->markFileAsNeedsRepair(f); });
+}
+
+std::future<bool> AsyncMetaStore::markFileAsWrittenToCloud(const File &f, bool removePending) {
+    return submit([&f, removePending] (MetaStore *ms) { return ms->markFileAsWrittenToCloud(f, removePending); });
+}
+
+std::future<bool> AsyncMetaStore::submit(std::function<bool (MetaStore *)> op) {
+    std::shared_ptr<std::packaged_task<bool ()> > task = std::make_shared<std::packaged_task<bool ()> >(std::bind(op, _metastore));
+    std::future<bool> result = task->get_future();
+
+    // run in place if no worker is available
+    if (_workers.empty()) {
+        (*task)();
+        return result;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _tasks.emplace_back([task] () { (*task)(); });
+    }
+    _cv.notify_one();
+
+    return result;
+}
+
+MetaStore *AsyncMetaStore::getMetaStore() const {
+    return _metastore;
+}
+
+void *AsyncMetaStore::run(void *arg) {
+    AsyncMetaStore *self = (AsyncMetaStore *) arg;
+
+    while (true) {
+        std::function<void ()> task;
+        {
+            std::unique_lock<std::mutex> lk(self->_lock);
+            self->_cv.wait(lk, [self] { return !self->_tasks.empty() || !self->_running; });
+            if (self->_tasks.empty())
+                break;
+            task = std::move(self->_tasks.front());
+            self->_tasks.pop_front();
+        }
+        task();
+    }
+
+    return NULL;
+}
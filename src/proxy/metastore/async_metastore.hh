@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __ASYNC_METASTORE_HH__
+#define __ASYNC_METASTORE_HH__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pthread.h>
+
+#include "metastore.hh"
+
+class AsyncMetaStore {
+public:
+
+    /**
+     * Asynchronous interface over a metadata store
+     *
+     * Operations are queued and run by a set of workers on the metadata store, so independent
+     * operations of a request, and of concurrent requests, are in flight at the same time.
+     * Unless stated otherwise, the file structures passed in must stay valid until the returned future is ready.
+     *
+     * @param[in] metastore                metadata store to run the operations on
+     * @param[in] numWorkers               number of operations to run concurrently
+     **/
+    AsyncMetaStore(MetaStore *metastore, int numWorkers);
+    ~AsyncMetaStore();
+
+    /**
+     * See MetaStore::getMeta()
+     **/
+    std::future<bool> getMeta(File &f, int getBlocks = 3);
+
+    /**
+     * See MetaStore::putMeta()
+     **/
+    std::future<bool> putMeta(const File &f);
+
+    /**
+     * See MetaStore::updateTimestamps(); the name and timestamps are copied, so the file structure can be released right after the call
+     **/
+    std::future<bool> updateTimestamps(const File &f);
+
+    /**
+     * See MetaStore::markFileAsRepaired()
+     **/
+    std::future<bool> markFileAsRepaired(const File &f);
+
+    /**
+     * See MetaStore::markFileAsNeedsRepair()
+     **/
+    std::future<bool> markFileAsNeedsRepair(const File &f);
+
+    /**
+     * See MetaStore::markFileAsWrittenToCloud()
+     **/
+    std::future<bool> markFileAsWrittenToCloud(const File &f, bool removePending = false);
+
+    /**
+     * Run an operation on the metadata store asynchronously
+     *
+     * @param[in] op                       operation to run
+     *
+     * @return the result of the operation once it completes
+     **/
+    std::future<bool> submit(std::function<bool (MetaStore *)> op);
+
+    /**
+     * Get the underlying metadata store for synchronous operations
+     *
+     * @return the metadata store
+     **/
+    MetaStore *getMetaStore() const;
+
+private:
+    static void *run(void *arg);
+
+    MetaStore *_metastore;                                          /**< underlying metadata store */
+
+    std::vector<pthread_t> _workers;                                /**< worker threads */
+    std::deque<std::function<void ()> > _tasks;                     /**< operations pending to run */
+    std::mutex _lock;                                               /**< lock on the operation queue */
+    std::condition_variable _cv;                                    /**< signal on new operations and termination */
+    bool _running;                                                  /**< whether the workers should keep running */
+};
+
+#endif // define __ASYNC_METASTORE_HH__
@@ -0,0 +1,1448 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <limits>  // std::numeric_limits
+#include <map>
+#include <set>
+#include <stdint.h>  // SIZE_MAX
+#include <stdlib.h>  // exit(), malloc(), strtol()
+#include <string.h>  // memcpy(), strchr(), strrchr()
+#include <time.h>  // time()
+#include <boost/uuid/uuid_io.hpp>
+
+#include <glog/logging.h>
+
+#include "local_metastore.hh"
+#include "meta_codec.hh"
+#include "../../common/config.hh"
+#include "../../common/define.hh"
+
+// tags of the keys in the store: the first character tells the type of a record
+#define FILE_KEY_TAG               "f"   // current version of a file, followed by the file key
+#define VERSIONED_FILE_KEY_TAG     "v"   // previous or retired version of a file, followed by the versioned file key
+#define VERSION_LIST_KEY_TAG       "l"   // summary of a previous version, followed by the file key and the version
+#define FILE_UUID_KEY_TAG          "u"   // file name of a file uuid
+#define PREFIX_KEY_TAG             "p"   // file in a directory, followed by the directory prefix and the file key
+#define DIR_KEY_TAG                "d"   // directory with files, followed by the directory prefix
+#define BG_TASK_KEY_TAG            "b"   // number of pending background tasks of a file
+#define FP_INDEX_KEY_TAG           "i"   // location of a fingerprint, followed by the namespace id and the fingerprint
+#define FP_REF_COUNT_KEY_TAG       "c"   // reference count of a fingerprint, followed by the namespace id and the fingerprint
+#define JOURNAL_KEY_TAG            "j"   // journal record of a chunk, followed by the versioned file key, chunk id and container id
+#define RETIRED_VER_KEY_TAG        "q"   // most recent retired version of a file
+// sets of versioned file keys
+#define SET_KEY_TAG_LENGTH         (2)
+#define FILE_REPAIR_SET            "sr"
+#define FILE_PENDING_WRITE_SET     "sw"
+#define FILE_PENDING_WRITE_COMP_SET "sc"
+#define JOURNAL_SET                "sj"
+#define FILE_DEDUP_RETIRED_SET     "sx"
+
+// number of keys to visit in each scan step when listing files
+#define FILE_LIST_SCAN_BATCH_SIZE  (1000)
+
+// journal record: chunk size, checksum, operation type, and whether the record is pre-operation
+#define JOURNAL_RECORD_SIZE        (sizeof(int) + MD5_DIGEST_LENGTH + 2)
+// version summary: size, modification time, checksum, deletion mark and number of chunks
+#define VERSION_SUMMARY_SIZE       (sizeof(unsigned long int) + sizeof(time_t) + MD5_DIGEST_LENGTH + 1 + sizeof(int))
+
+// big-endian integers keep the keys of chunks and versions in numeric order
+static std::string encodeKeyInt(uint32_t value) {
+    char bytes[4] = { (char) (value >> 24), (char) (value >> 16), (char) (value >> 8), (char) value };
+    return std::string(bytes, 4);
+}
+
+static uint32_t decodeKeyInt(const char *bytes) {
+    const unsigned char *b = (const unsigned char *) bytes;
+    return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+static std::string encodeVersionSummary(const File &f) {
+    char isDeleted = f.size == 0? f.isDeleted : 0;
+    std::string value;
+    value.reserve(VERSION_SUMMARY_SIZE);
+    value.append((const char *) &f.size, sizeof(unsigned long int));
+    value.append((const char *) &f.mtime, sizeof(time_t));
+    value.append((const char *) f.md5, MD5_DIGEST_LENGTH);
+    value.push_back(isDeleted);
+    value.append((const char *) &f.numChunks, sizeof(int));
+    return value;
+}
+
+static bool decodeVersionSummary(const std::string &value, VersionInfo &info) {
+    if (value.size() != VERSION_SUMMARY_SIZE)
+        return false;
+    const char *ofs = value.data();
+    memcpy(&info.size, ofs, sizeof(unsigned long int));
+    ofs += sizeof(unsigned long int);
+    memcpy(&info.mtime, ofs, sizeof(time_t));
+    ofs += sizeof(time_t);
+    memcpy(info.md5, ofs, MD5_DIGEST_LENGTH);
+    ofs += MD5_DIGEST_LENGTH;
+    info.isDeleted = ofs[0];
+    ofs += 1;
+    memcpy(&info.numChunks, ofs, sizeof(int));
+    return true;
+}
+
+static std::string encodeJournalRecord(const Chunk &chunk, bool isWrite, bool isPre) {
+    std::string value;
+    value.reserve(JOURNAL_RECORD_SIZE);
+    value.append((const char *) &chunk.size, sizeof(int));
+    value.append((const char *) chunk.md5, MD5_DIGEST_LENGTH);
+    value.push_back(isWrite? 'w' : 'd');
+    value.push_back(isPre? 1 : 0);
+    return value;
+}
+
+LocalMetaStore::Shared::Shared(const std::string &path, unsigned long int segmentSize, bool sync, int compactionInterval, int compactionThreshold) :
+        store(path, segmentSize, sync, compactionInterval, compactionThreshold) {
+    numFiles = 0;
+    lockToken = 0;
+}
+
+void LocalMetaStore::Record::set(const File &f) {
+    version = f.version;
+    meta.clear();
+    MetaCodec::encodeFile(f, meta, /* with summary */ true);
+    // keep all blocks in one list, as the record is read and written as a whole
+    std::vector<std::string> lists;
+    MetaCodec::encodeUniqueBlockLists(f.uniqueBlocks, lists, SIZE_MAX);
+    uniqueBlocks = lists.empty()? "" : lists.front();
+    lists.clear();
+    MetaCodec::encodeDuplicateBlockLists(f.duplicateBlocks, lists, SIZE_MAX);
+    duplicateBlocks = lists.empty()? "" : lists.front();
+}
+
+std::string LocalMetaStore::Record::encode() const {
+    std::string value;
+    value.reserve(sizeof(int) + 3 * sizeof(uint32_t) + meta.size() + uniqueBlocks.size() + duplicateBlocks.size());
+    value.append((const char *) &version, sizeof(int));
+    for (const std::string *field : { &meta, &uniqueBlocks, &duplicateBlocks }) {
+        uint32_t length = field->size();
+        value.append((const char *) &length, sizeof(uint32_t));
+        value.append(*field);
+    }
+    return value;
+}
+
+bool LocalMetaStore::Record::decode(const std::string &value) {
+    if (value.size() < sizeof(int))
+        return false;
+    memcpy(&version, value.data(), sizeof(int));
+    size_t ofs = sizeof(int);
+    for (std::string *field : { &meta, &uniqueBlocks, &duplicateBlocks }) {
+        uint32_t length = 0;
+        if (value.size() - ofs < sizeof(uint32_t))
+            return false;
+        memcpy(&length, value.data() + ofs, sizeof(uint32_t));
+        ofs += sizeof(uint32_t);
+        if (value.size() - ofs < length)
+            return false;
+        field->assign(value.data() + ofs, length);
+        ofs += length;
+    }
+    return ofs == value.size();
+}
+
+LocalMetaStore::LocalMetaStore() :
+        _shared(getShared()), _store(_shared->store) {
+    LOG(INFO) << "Local metastore init, path = " << Config::getInstance().getProxyMetaStorePath() << ", number of files = " << _shared->numFiles;
+}
+
+LocalMetaStore::~LocalMetaStore() {
+}
+
+std::shared_ptr<LocalMetaStore::Shared> LocalMetaStore::getShared() {
+    static std::mutex registryLock;
+    static std::map<std::string, std::weak_ptr<Shared> > registry;
+
+    Config &config = Config::getInstance();
+    std::string path = config.getProxyMetaStorePath();
+
+    // a store can only be opened once, so instances in the same process share it
+    std::lock_guard<std::mutex> lk(registryLock);
+    std::shared_ptr<Shared> shared = registry[path].lock();
+    if (shared != nullptr)
+        return shared;
+
+    shared = std::make_shared<Shared>(
+        path
+        , config.getProxyMetaStoreSegmentSize()
+        , config.proxyMetaStoreSyncOnCommit()
+        , config.getProxyMetaStoreCompactionInterval()
+        , config.getProxyMetaStoreCompactionThreshold()
+    );
+    if (!shared->store.open()) {
+        LOG(ERROR) << "Failed to open the local metastore at " << path;
+        exit(1);
+    }
+    shared->numFiles = shared->store.count(FILE_KEY_TAG);
+    registry[path] = shared;
+
+    return shared;
+}
+
+bool LocalMetaStore::putMeta(const File &f) {
+    std::string filename = genFileKey(f.namespaceId, f.name, f.nameLength);
+    std::string key = FILE_KEY_TAG + filename;
+
+    Record record;
+    record.set(f);
+
+    Config &config = Config::getInstance();
+    bool keepVersion = !config.overwriteFiles();
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // find the current version
+    int curVersion = -1;
+    std::string value;
+    Record cur;
+    if (_store.get(key, value)) {
+        if (!cur.decode(value)) {
+            LOG(ERROR) << "Failed to get the current version of file " << f.name << ", metadata is corrupted";
+            return false;
+        }
+        curVersion = cur.version;
+    }
+
+    // backup the metadata of previous version first if versioning is enabled and version is newer than the current one
+    if (keepVersion && curVersion != -1 && f.version > curVersion) {
+        File prev;
+        prev.namespaceId = f.namespaceId;
+        if (!decodeRecord(cur, prev, /* no blocks */ 0)) {
+            LOG(ERROR) << "Failed to backup the previous version " << f.version - 1 << " metadata for file " << f.name;
+            return false;
+        }
+        batch.put(VERSIONED_FILE_KEY_TAG + genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version - 1), value);
+        batch.put(genVersionListKey(filename, f.version - 1), encodeVersionSummary(prev));
+    }
+
+    // operate on previous versions, and only allow such operations if the version exists
+    if (keepVersion && curVersion != -1 && f.version < curVersion) {
+        if (!_store.exists(genVersionListKey(filename, f.version))) {
+            LOG(ERROR) << "Failed to find the previous version " << f.version << " record for file " << f.name;
+            return false;
+        }
+        key = VERSIONED_FILE_KEY_TAG + genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version);
+    }
+
+    batch.put(key, record.encode());
+    // add uuid-to-file-name mapping
+    batch.put(FILE_UUID_KEY_TAG + genFileUuidKey(f.namespaceId, f.uuid), std::string(f.name, f.nameLength));
+    // update the directory of this file
+    addPrefixRecord(batch, filename);
+
+    // count the file if the metadata is created for a new file name
+    if (!commit(batch, lk, curVersion == -1? 1 : 0)) {
+        LOG(ERROR) << "Failed to write the metadata of file " << f.name;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::getMeta(File &f, int getBlocks) {
+    Record record;
+    if (!getRecord(f, record)) {
+        LOG(INFO) << "Metadata of file " << f.name << " version " << f.version << " not found (file not exist?)";
+        return false;
+    }
+    return decodeRecord(record, f, getBlocks);
+}
+
+bool LocalMetaStore::deleteMeta(File &f) {
+    std::string filename = genFileKey(f.namespaceId, f.name, f.nameLength);
+    std::string key = FILE_KEY_TAG + filename;
+
+    int versionToDelete = f.version;
+
+    Config &config = Config::getInstance();
+    bool isVersioned = !config.overwriteFiles();
+
+    DLOG(INFO) << "Delete file " << f.name << " version " << f.version;
+
+    if (!getMeta(f)) {
+        LOG(WARNING) << "Deleting a non-existing file " << f.name;
+        return false;
+    }
+
+    // versioning enabled and version not specified, add a deleter marker
+    if (isVersioned && versionToDelete == -1) {
+        f.isDeleted = true;
+        f.size = 0;
+        f.version += 1;
+        f.numChunks = 0;
+        f.numStripes = 0;
+        f.mtime = time(NULL);
+        memset(f.md5, 0, MD5_DIGEST_LENGTH);
+        bool ret = putMeta(f);
+        // tell the caller not to remove the data
+        f.version = -1;
+        return ret;
+    }
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // delete a specific version
+    if (isVersioned && versionToDelete != -1) {
+        std::string value;
+        Record cur;
+        if (!_store.get(key, value) || !cur.decode(value)) {
+            LOG(ERROR) << "Failed to find current version number of file " << f.name << " with previous version " << f.version;
+            return false;
+        }
+        std::vector<std::string> versions;
+        _store.scan(genVersionListKey(filename), "", 0, versions);
+
+        int versionToRemove = -1;
+        if (cur.version == f.version) { // delete the current version
+            // make the 2nd latest version the current one
+            if (!versions.empty()) {
+                versionToRemove = decodeKeyInt(versions.back().data() + versions.back().size() - 4);
+                std::string vkey = VERSIONED_FILE_KEY_TAG + genVersionedFileKey(f.namespaceId, f.name, f.nameLength, versionToRemove);
+                if (!_store.get(vkey, value)) {
+                    LOG(ERROR) << "Failed to find 2nd latest version of file " << f.name << " for replacing the current version";
+                    return false;
+                }
+                batch.put(key, value);
+                batch.remove(vkey);
+                DLOG(INFO) << "Update the current version of file " << f.name << " to " << versionToRemove;
+            }
+        } else { // operates on the previous versions
+            if (versions.empty())
+                return false;
+            versionToRemove = f.version;
+            batch.remove(VERSIONED_FILE_KEY_TAG + genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version));
+        }
+        if (versionToRemove != -1) {
+            batch.remove(genVersionListKey(filename, versionToRemove));
+            if (!commit(batch, lk)) {
+                LOG(ERROR) << "Failed to delete version " << f.version << " of file " << f.name;
+                return false;
+            }
+            // let the caller handle the data (deletion), without removing the reverted index
+            return true;
+        }
+    }
+
+    // remove the metadata and uncount the file
+    if (!_store.exists(key)) {
+        LOG(ERROR) << "Failed to delete file metadata of file " << f.name;
+        return false;
+    }
+    batch.remove(key);
+
+    // TODO remove workaround for renamed file
+    f.genUUID();
+    batch.remove(FILE_UUID_KEY_TAG + genFileUuidKey(f.namespaceId, f.uuid));
+
+    // remove the file from its directory
+    removePrefixRecord(batch, filename);
+
+    if (!commit(batch, lk, -1)) {
+        LOG(ERROR) << "Failed to delete file metadata of file " << f.name;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::renameMeta(File &sf, File &df) {
+    std::string sfname = genFileKey(sf.namespaceId, sf.name, sf.nameLength);
+    std::string dfname = genFileKey(df.namespaceId, df.name, df.nameLength);
+
+    sf.genUUID();
+    df.genUUID();
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    std::string value;
+    bool exists = _store.get(FILE_KEY_TAG + sfname, value);
+    if (!exists || _store.exists(FILE_KEY_TAG + dfname)) {
+        LOG(ERROR) << "Failed to rename file from " << sf.name << " (" << (int) sf.namespaceId << ") to " << df.name << " (" << (int) df.namespaceId << "), " << (!exists? "source file not found" : "target name already exists");
+        return false;
+    }
+
+    // move the metadata to the new name with the new uuid
+    Record record;
+    File f;
+    f.namespaceId = df.namespaceId;
+    if (!record.decode(value) || !decodeRecord(record, f, /* no blocks */ 0)) {
+        LOG(ERROR) << "Failed to rename file from " << sf.name << " (" << (int) sf.namespaceId << ") to " << df.name << " (" << (int) df.namespaceId << "), metadata is corrupted";
+        return false;
+    }
+    f.uuid = df.uuid;
+    record.meta.clear();
+    MetaCodec::encodeFile(f, record.meta, /* with summary */ true);
+
+    batch.remove(FILE_KEY_TAG + sfname);
+    batch.put(FILE_KEY_TAG + dfname, record.encode());
+    batch.remove(FILE_UUID_KEY_TAG + genFileUuidKey(sf.namespaceId, sf.uuid));
+    batch.put(FILE_UUID_KEY_TAG + genFileUuidKey(df.namespaceId, df.uuid), std::string(df.name, df.nameLength));
+    removePrefixRecord(batch, sfname);
+    addPrefixRecord(batch, dfname);
+
+    // TODO update the background task pending list
+
+    if (!commit(batch, lk)) {
+        LOG(ERROR) << "Failed to rename file from " << sf.name << " (" << (int) sf.namespaceId << ") to " << df.name << " (" << (int) df.namespaceId << ")";
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::updateTimestamps(const File &f) {
+    int ret = updateMeta(f, [&f] (File &cur) {
+        cur.atime = f.atime;
+        cur.mtime = f.mtime;
+        cur.tctime = f.tctime;
+        return true;
+    });
+
+    if (ret != 0) {
+        LOG(ERROR) << "Failed to update timestamps of file " << f.name << " (" << (int) f.namespaceId << "), " << (ret == 1? "file not found" : "error");
+        return false;
+    }
+
+    return true;
+}
+
+int LocalMetaStore::updateChunks(const File &f, int version) {
+    int ret = updateMeta(f, [&f] (File &cur) {
+        for (int i = 0; i < f.numChunks; i++) {
+            int chunkId = f.chunks[i].getChunkId();
+            if (chunkId < 0 || chunkId >= cur.numChunks) {
+                LOG(ERROR) << "Failed to update chunk " << chunkId << " of file " << f.name << " in background, file has only " << cur.numChunks << " chunks";
+                return false;
+            }
+            cur.containerIds[chunkId] = f.containerIds[i];
+            cur.chunks[chunkId].size = f.chunks[i].size;
+        }
+        return true;
+    }, /* check version */ true);
+
+    LOG_IF(ERROR, ret == 1) << "Failed to operate on metadata of file " << f.name << " in background, version " << f.version << " is not the current one";
+    LOG_IF(ERROR, ret == 2) << "Failed to operate on metadata of file " << f.name << " in background";
+
+    return ret;
+}
+
+bool LocalMetaStore::getFileName(boost::uuids::uuid fuuid, File &f) {
+    std::string fidKey = FILE_UUID_KEY_TAG + genFileUuidKey(f.namespaceId, fuuid);
+    std::string name;
+    if (!_store.get(fidKey, name)) {
+        LOG(ERROR) << "Failed to get file name of " << fidKey.substr(1);
+        return false;
+    }
+    f.nameLength = name.size();
+    f.name = (char *) malloc (name.size() + 1);
+    memcpy(f.name, name.data(), name.size());
+    f.name[name.size()] = 0;
+    return true;
+}
+
+unsigned int LocalMetaStore::getFileList(FileInfo **list, unsigned char namespaceId, bool withSize, bool withTime, bool withVersions, std::string prefix) {
+    if (namespaceId == INVALID_NAMESPACE_ID)
+        namespaceId = Config::getInstance().getProxyNamespaceId();
+
+    std::vector<std::string> keys;
+    std::string cursor = "0";
+    do {
+        if (!scanFileKeys(namespaceId, prefix, cursor, FILE_LIST_SCAN_BATCH_SIZE, keys))
+            break;
+    } while (cursor != "0");
+
+    if (keys.empty())
+        return 0;
+
+    *list = new FileInfo[keys.size()];
+    return getFileInfoOfKeys(keys, *list, withSize, withTime, withVersions);
+}
+
+unsigned int LocalMetaStore::getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, unsigned char namespaceId, bool withSize, bool withTime, bool withVersions, std::string prefix) {
+    if (namespaceId == INVALID_NAMESPACE_ID)
+        namespaceId = Config::getInstance().getProxyNamespaceId();
+    if (pageSize == 0)
+        pageSize = FILE_LIST_SCAN_BATCH_SIZE;
+
+    std::vector<std::string> keys;
+    if (!scanFileKeys(namespaceId, prefix, cursor, pageSize, keys) || keys.empty())
+        return 0;
+
+    *list = new FileInfo[keys.size()];
+    return getFileInfoOfKeys(keys, *list, withSize, withTime, withVersions);
+}
+
+bool LocalMetaStore::scanFileKeys(unsigned char namespaceId, const std::string &prefix, std::string &cursor, unsigned int count, std::vector<std::string> &keys) {
+    // visit keys of the namespace with the prefix, or the files in the directory
+    std::string scanPrefix, keyPrefix;
+    if (prefix == "" || prefix.back() != '/') {
+        keyPrefix = FILE_KEY_TAG;
+        scanPrefix = keyPrefix + std::to_string(namespaceId) + "_" + prefix;
+    } else {
+        keyPrefix = std::string(PREFIX_KEY_TAG).append(getFilePrefix((std::to_string(namespaceId) + "_" + prefix).c_str()));
+        keyPrefix.push_back('\0');
+        scanPrefix = keyPrefix;
+    }
+
+    // the cursor is the last file key returned ("0" at start and end), which never clashes as file keys always contain '_'
+    std::vector<std::string> found;
+    bool more = _store.scan(scanPrefix, cursor == "0"? "" : keyPrefix + cursor, count, found);
+
+    size_t ofs = keyPrefix.size();
+    for (size_t i = 0; i < found.size(); i++) {
+        keys.emplace_back(found.at(i), ofs);
+    }
+    cursor = more && !found.empty()? found.back().substr(ofs) : "0";
+
+    return true;
+}
+
+unsigned int LocalMetaStore::getFileInfoOfKeys(const std::vector<std::string> &keys, FileInfo *list, bool withSize, bool withTime, bool withVersions) {
+    bool withMeta = withSize || withTime || withVersions;
+
+    unsigned int numFiles = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        FileInfo &cur = list[numFiles];
+        // full name in form of "namespaceId_filename"
+        if (!getNameFromFileKey(keys.at(i).data(), keys.at(i).size(), &cur.name, cur.nameLength, cur.namespaceId))
+            continue;
+        if (withMeta) {
+            std::string value;
+            Record record;
+            File f;
+            f.namespaceId = cur.namespaceId;
+            if (!_store.get(FILE_KEY_TAG + keys.at(i), value) || !record.decode(value) || !MetaCodec::decodeFile(record.meta.data(), record.meta.size(), f)) {
+                LOG(WARNING) << "Cannot get file size and time of file " << cur.name;
+                free(cur.name);
+                cur.reset();
+                continue;
+            }
+            cur.size = f.size;
+            cur.ctime = f.ctime;
+            cur.atime = f.atime;
+            cur.mtime = f.mtime;
+            cur.version = f.version;
+            cur.isDeleted = f.size == 0? f.isDeleted : 0;
+            memcpy(cur.md5, f.md5, MD5_DIGEST_LENGTH);
+            cur.numChunks = f.numChunks;
+            cur.storageClass = f.storageClass;
+            // use staged file info if staged file is more updated
+            if (f.staged.mtime > cur.mtime) {
+                cur.mtime = f.staged.mtime;
+                cur.atime = f.staged.mtime;
+                cur.size = f.staged.size;
+            }
+        }
+        // do not add delete marker to the list unless for queries on versions
+        if (!withVersions && cur.isDeleted) {
+            free(cur.name);
+            cur.reset();
+            continue;
+        }
+        numFiles++;
+    }
+
+    if (!withVersions)
+        return numFiles;
+
+    // get the version summaries of files with previous versions
+    for (unsigned int i = 0; i < numFiles; i++) {
+        FileInfo &cur = list[i];
+        if (cur.version <= 0)
+            continue;
+        std::vector<std::string> vkeys, values;
+        _store.scan(genVersionListKey(genFileKey(cur.namespaceId, cur.name, cur.nameLength)), "", 0, vkeys, &values);
+        if (vkeys.empty())
+            continue;
+        cur.numVersions = vkeys.size();
+        cur.versions = new VersionInfo[vkeys.size()];
+        for (size_t vi = 0; vi < vkeys.size(); vi++) {
+            cur.versions[vi].version = decodeKeyInt(vkeys.at(vi).data() + vkeys.at(vi).size() - 4);
+            LOG_IF(WARNING, !decodeVersionSummary(values.at(vi), cur.versions[vi])) << "Invalid summary of version " << cur.versions[vi].version << " of file " << cur.name;
+        }
+    }
+
+    return numFiles;
+}
+
+unsigned int LocalMetaStore::getFolderList(std::vector<std::string> &list, unsigned char namespaceId, std::string prefix, bool skipSubfolders) {
+    // generate the prefix for directory searching
+    prefix.append("a");
+    std::string filename = genFileKey(namespaceId, prefix.c_str(), prefix.size());
+    std::string pattern = std::string(DIR_KEY_TAG).append(getFilePrefix(filename.c_str(), /* no ending slash */ true));
+
+    std::vector<std::string> dirs;
+    _store.scan(pattern, "", 0, dirs);
+
+    // add the matching folders
+    unsigned int count = 0;
+    for (size_t i = 0; i < dirs.size(); i++) {
+        // skip subfolders
+        if (skipSubfolders && dirs.at(i).find('/', pattern.size()) != std::string::npos)
+            continue;
+        list.push_back(dirs.at(i).substr(pattern.size()));
+        count++;
+    }
+
+    return count;
+}
+
+unsigned long int LocalMetaStore::getMaxNumKeysSupported() {
+    // keys are only limited by memory and disk space
+    return std::numeric_limits<unsigned long int>::max();
+}
+
+unsigned long int LocalMetaStore::getNumFiles() {
+    return _shared->numFiles;
+}
+
+unsigned long int LocalMetaStore::getNumFilesToRepair() {
+    return _store.count(FILE_REPAIR_SET);
+}
+
+int LocalMetaStore::getFilesToRepair(int numFiles, File files[]) {
+    if (numFiles <= 0)
+        return 0;
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // pop up files to repair
+    std::vector<std::string> keys;
+    _store.scan(FILE_REPAIR_SET, "", numFiles, keys);
+
+    int numFilesToRepair = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        File &f = files[numFilesToRepair];
+        free(f.name);
+        f.name = 0;
+        if (!getNameFromFileKey(keys.at(i).data() + SET_KEY_TAG_LENGTH, keys.at(i).size() - SET_KEY_TAG_LENGTH, &f.name, f.nameLength, f.namespaceId, &f.version))
+            continue;
+        batch.remove(keys.at(i));
+        numFilesToRepair++;
+    }
+
+    if (!batch.empty() && !commit(batch, lk)) {
+        LOG(ERROR) << "Failed to get files to repair";
+        return 0;
+    }
+
+    return numFilesToRepair;
+}
+
+bool LocalMetaStore::markFileAsRepaired(const File &file) {
+    return markFileStatus(file, FILE_REPAIR_SET, false, "repair");
+}
+
+bool LocalMetaStore::markFileAsNeedsRepair(const File &file) {
+    return markFileStatus(file, FILE_REPAIR_SET, true, "repair");
+}
+
+bool LocalMetaStore::markFileAsPendingWriteToCloud(const File &file) {
+    return markFileStatus(file, FILE_PENDING_WRITE_SET, true, "pending write to cloud");
+}
+
+bool LocalMetaStore::markFileAsWrittenToCloud(const File &file, bool removePending) {
+    return markFileStatus(file, FILE_PENDING_WRITE_COMP_SET, false, "pending completing write to cloud") &&
+            (!removePending || markFileStatus(file, FILE_PENDING_WRITE_SET, false, "pending write to cloud"));
+}
+
+bool LocalMetaStore::markFileStatus(const File &file, const char *setName, bool set, const char *opName) {
+    std::string key = std::string(setName).append(genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version));
+    LogStore::WriteBatch batch;
+    if (set) {
+        batch.put(key, "");
+    } else {
+        batch.remove(key);
+    }
+    if (!_store.commit(batch)) {
+        LOG(ERROR) << "Failed to " << (set? "add" : "remove") << " file " << file.name << " " << (set? "to" : "from") << " the " << opName << " list";
+        return false;
+    }
+    return true;
+}
+
+int LocalMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
+    if (numFiles <= 0)
+        return 0;
+
+    // one scan over the set at a time
+    std::lock_guard<std::mutex> slk(_scanLock);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // continue from the last file visited, and mark the end of set iteration by returning no file
+    std::vector<std::string> keys;
+    _store.scan(FILE_PENDING_WRITE_SET, _pendingWriteScanIt, 1, keys);
+    if (keys.empty()) {
+        _pendingWriteScanIt.clear();
+        return 0;
+    }
+    std::string key = keys.front();
+    _pendingWriteScanIt = key;
+
+    // mark the file as pending to complete for write
+    batch.remove(key);
+    batch.put(std::string(FILE_PENDING_WRITE_COMP_SET).append(key, SET_KEY_TAG_LENGTH, std::string::npos), "");
+    if (!commit(batch, lk)) {
+        LOG(ERROR) << "Failed to mark file " << key.substr(SET_KEY_TAG_LENGTH) << " as pending to complete write to cloud";
+        return 0;
+    }
+
+    return getNameFromFileKey(key.data() + SET_KEY_TAG_LENGTH, key.size() - SET_KEY_TAG_LENGTH, &files[0].name, files[0].nameLength, files[0].namespaceId, &files[0].version)? 1 : 0;
+}
+
+bool LocalMetaStore::updateFileStatus(const File &file) {
+    std::string key = BG_TASK_KEY_TAG + genFileKey(file.namespaceId, file.name, file.nameLength);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    std::string value;
+    long long count = 0;
+    bool exists = _store.get(key, value) && value.size() == sizeof(long long);
+    if (exists)
+        memcpy(&count, value.data(), sizeof(long long));
+
+    bool ret = false;
+    if (file.status == FileStatus::PART_BG_TASK_COMPLETED) {
+        // decrement number of task by 1, and remove the file is the number of pending task drops to 0
+        count--;
+        ret = true;
+    } else if (file.status == FileStatus::BG_TASK_PENDING) {
+        // increment number of task by 1
+        count++;
+        ret = true;
+    } else if (file.status == FileStatus::ALL_BG_TASKS_COMPLETED) {
+        ret = exists;
+        count = 0;
+    }
+    if (ret && count == 0) {
+        batch.remove(key);
+    } else if (ret) {
+        batch.put(key, std::string((const char *) &count, sizeof(long long)));
+    }
+    if (!batch.empty() && !commit(batch, lk))
+        ret = false;
+    if (lk.owns_lock())
+        lk.unlock();
+
+    // update the last task check time
+    time_t tctime = time(NULL);
+    updateMeta(file, [tctime] (File &cur) {
+        cur.tctime = tctime;
+        return true;
+    });
+
+    LOG_IF(ERROR, !ret) << "Failed to update status of file " << file.name;
+
+    return ret;
+}
+
+bool LocalMetaStore::getNextFileForTaskCheck(File &file) {
+    // one scan over the set at a time
+    std::lock_guard<std::mutex> lk(_scanLock);
+
+    // continue from the last file visited, and start over after reaching the end
+    std::vector<std::string> keys;
+    _store.scan(BG_TASK_KEY_TAG, _taskScanIt, 1, keys);
+    if (keys.empty()) {
+        _taskScanIt.clear();
+        return false;
+    }
+    _taskScanIt = keys.front();
+
+    if (!getNameFromFileKey(_taskScanIt.data() + 1, _taskScanIt.size() - 1, &file.name, file.nameLength, file.namespaceId))
+        return false;
+
+    DLOG(INFO) << "Next file to check: " << file.name << ", " << (int) file.namespaceId;
+    return true;
+}
+
+bool LocalMetaStore::lockFile(const File &file, bool shared) {
+    return lockFile(file, true, shared);
+}
+
+bool LocalMetaStore::unlockFile(const File &file, bool shared) {
+    return lockFile(file, false, shared);
+}
+
+unsigned long int LocalMetaStore::getLockToken(const File &file) {
+    std::string filename = genFileKey(file.namespaceId, file.name, file.nameLength);
+
+    std::lock_guard<std::mutex> lk(_shared->fileLock);
+    auto it = _shared->lockedFiles.find(filename);
+    return it != _shared->lockedFiles.end() && it->second.first == -1? it->second.second : 0;
+}
+
+bool LocalMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int containerId, bool isWrite) {
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+    std::string chunkPrefix = genJournalKeyPrefix(vfilename).append(encodeKeyInt(chunk.getChunkId()));
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // first, set all previous write to delete
+    std::vector<std::string> keys, values;
+    _store.scan(chunkPrefix, "", 0, keys, &values);
+    bool skipAdding = false;
+    int numModifiedRecords = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::string &value = values.at(i);
+        if (value.size() != JOURNAL_RECORD_SIZE || value[JOURNAL_RECORD_SIZE - 2] != 'w')
+            continue;
+        value[JOURNAL_RECORD_SIZE - 2] = 'd';
+        batch.put(keys.at(i), value);
+        numModifiedRecords++;
+        // if any previous write is to be superseded by a deletion
+        if ((int) decodeKeyInt(keys.at(i).data() + keys.at(i).size() - 4) == containerId && !isWrite)
+            skipAdding = true;
+    }
+    DLOG(INFO) << "Modified " << numModifiedRecords << " records before adding a journal record of file " << file.name << " with namespace " << (int) file.namespaceId;
+
+    // second, set the latest record
+    if (!skipAdding) {
+        batch.put(chunkPrefix + encodeKeyInt(containerId), encodeJournalRecord(chunk, isWrite, /* is pre */ true));
+        batch.put(JOURNAL_SET + vfilename, "");
+    }
+
+    if (!batch.empty() && !commit(batch, lk)) {
+        LOG(ERROR) << "Failed to add the journal record of chunk " << chunk.getChunkId() << " of file " << file.name << " with namespace " << (int) file.namespaceId;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk, bool isWrite, bool deleteRecord, int containerId) {
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+    std::string prefix = genJournalKeyPrefix(vfilename);
+    std::string key = prefix + encodeKeyInt(chunk.getChunkId()) + encodeKeyInt(containerId);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    bool success = false;
+    if (deleteRecord) {
+        // delete the record; if no record is left, remove the file from the set of files with journal
+        batch.remove(key);
+        std::vector<std::string> keys;
+        _store.scan(prefix, "", 2, keys);
+        bool othersRemain = false;
+        for (size_t i = 0; i < keys.size(); i++) {
+            othersRemain = othersRemain || keys.at(i) != key;
+        }
+        if (othersRemain) {
+            success = true;
+        } else {
+            success = _store.exists(JOURNAL_SET + vfilename);
+            batch.remove(JOURNAL_SET + vfilename);
+        }
+    } else {
+        // update the record if it already exists
+        std::string value;
+        if (_store.get(key, value) && value.size() == JOURNAL_RECORD_SIZE) {
+            value[JOURNAL_RECORD_SIZE - 2] = isWrite? 'w' : 'd';
+            value[JOURNAL_RECORD_SIZE - 1] = 0;
+            batch.put(key, value);
+            success = true;
+        }
+    }
+
+    if (success)
+        success = commit(batch, lk);
+
+    if (!success) {
+        LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal record of chunk " << chunk.getChunkId() << " of file " << file.name << " with namespace " << (int) file.namespaceId << " version " << file.version << " in container " << containerId;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::addChunksToJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite) {
+    if (chunks.size() != containerIds.size()) {
+        LOG(ERROR) << "Failed to add the journal records of file " << file.name << " with namespace " << (int) file.namespaceId << ", number of chunks (" << chunks.size() << ") and containers (" << containerIds.size() << ") mismatch";
+        return false;
+    }
+
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+    std::string prefix = genJournalKeyPrefix(vfilename);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // records modified or added by the batch, which are not visible in the store until commit
+    std::map<std::string, std::string> records;
+    bool added = false;
+    for (size_t ci = 0; ci < chunks.size(); ci++) {
+        std::string chunkPrefix = prefix + encodeKeyInt(chunks.at(ci).getChunkId());
+        std::vector<std::string> keys, values;
+        _store.scan(chunkPrefix, "", 0, keys, &values);
+        for (auto it = records.lower_bound(chunkPrefix); it != records.end() && it->first.compare(0, chunkPrefix.size(), chunkPrefix) == 0; it++) {
+            keys.push_back(it->first);
+            values.push_back(it->second);
+        }
+
+        // set all previous write to delete
+        bool skipAdding = false;
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::string &value = records.count(keys.at(i)) > 0? records.at(keys.at(i)) : values.at(i);
+            if (value.size() != JOURNAL_RECORD_SIZE || value[JOURNAL_RECORD_SIZE - 2] != 'w')
+                continue;
+            value[JOURNAL_RECORD_SIZE - 2] = 'd';
+            records[keys.at(i)] = value;
+            if ((int) decodeKeyInt(keys.at(i).data() + keys.at(i).size() - 4) == containerIds.at(ci) && !isWrite)
+                skipAdding = true;
+        }
+
+        if (!skipAdding) {
+            records[chunkPrefix + encodeKeyInt(containerIds.at(ci))] = encodeJournalRecord(chunks.at(ci), isWrite, /* is pre */ true);
+            added = true;
+        }
+    }
+
+    for (auto &record : records)
+        batch.put(record.first, record.second);
+    if (added)
+        batch.put(JOURNAL_SET + vfilename, "");
+
+    if (!batch.empty() && !commit(batch, lk)) {
+        LOG(ERROR) << "Failed to add the journal records of " << chunks.size() << " chunks of file " << file.name << " with namespace " << (int) file.namespaceId;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::updateChunksInJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite, bool deleteRecord) {
+    if (chunks.size() != containerIds.size()) {
+        LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal records of file " << file.name << " with namespace " << (int) file.namespaceId << ", number of chunks (" << chunks.size() << ") and containers (" << containerIds.size() << ") mismatch";
+        return false;
+    }
+    if (chunks.empty())
+        return true;
+
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+    std::string prefix = genJournalKeyPrefix(vfilename);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    bool success = true;
+    std::set<std::string> removed;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        std::string key = prefix + encodeKeyInt(chunks.at(i).getChunkId()) + encodeKeyInt(containerIds.at(i));
+        std::string value;
+        if (deleteRecord) {
+            batch.remove(key);
+            removed.insert(key);
+        } else if (_store.get(key, value) && value.size() == JOURNAL_RECORD_SIZE) {
+            value[JOURNAL_RECORD_SIZE - 2] = isWrite? 'w' : 'd';
+            value[JOURNAL_RECORD_SIZE - 1] = 0;
+            batch.put(key, value);
+        } else {
+            success = false;
+        }
+    }
+
+    // if no record is left, remove the file from the set of files with journal
+    if (deleteRecord) {
+        std::vector<std::string> keys;
+        _store.scan(prefix, "", removed.size() + 1, keys);
+        bool othersRemain = false;
+        for (size_t i = 0; i < keys.size() && !othersRemain; i++)
+            othersRemain = removed.count(keys.at(i)) == 0;
+        if (!othersRemain) {
+            success = _store.exists(JOURNAL_SET + vfilename);
+            batch.remove(JOURNAL_SET + vfilename);
+        }
+    }
+
+    if (success)
+        success = commit(batch, lk);
+
+    if (!success) {
+        LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal records of " << chunks.size() << " chunks of file " << file.name << " with namespace " << (int) file.namespaceId << " version " << file.version;
+        return false;
+    }
+
+    return true;
+}
+
+void LocalMetaStore::getFileJournal(const FileInfo &file, std::vector<std::tuple<Chunk, int /* container id*/, bool /* isWrite */, bool /* isPre */>> &records) {
+    std::string prefix = genJournalKeyPrefix(genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version));
+
+    std::vector<std::string> keys, values;
+    _store.scan(prefix, "", 0, keys, &values);
+
+    DLOG(INFO) << "File " << file.name << " version " << file.version << " in namespace " << (int) file.namespaceId << " number of chunk journal records = " << keys.size() << ".";
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        const std::string &key = keys.at(i);
+        const std::string &value = values.at(i);
+        if (key.size() != prefix.size() + 8 || value.size() != JOURNAL_RECORD_SIZE)
+            continue;
+        records.resize(records.size() + 1);
+        auto &rec = records.back();
+        std::get<0>(rec).setChunkId(decodeKeyInt(key.data() + prefix.size()));
+        memcpy(&std::get<0>(rec).size, value.data(), sizeof(int));
+        memcpy(std::get<0>(rec).md5, value.data() + sizeof(int), MD5_DIGEST_LENGTH);
+        std::get<1>(rec) = decodeKeyInt(key.data() + prefix.size() + 4);
+        std::get<2>(rec) = value[JOURNAL_RECORD_SIZE - 2] == 'w';
+        std::get<3>(rec) = value[JOURNAL_RECORD_SIZE - 1] != 0;
+    }
+}
+
+int LocalMetaStore::getFilesWithJounal(FileInfo **list) {
+    std::vector<std::string> keys;
+    _store.scan(JOURNAL_SET, "", 0, keys);
+
+    // early return for an empty list
+    if (keys.empty())
+        return 0;
+
+    int numFiles = 0;
+    *list = new FileInfo[keys.size()];
+    for (size_t i = 0; i < keys.size(); i++) {
+        FileInfo *info = &(*list)[numFiles];
+        if (!getNameFromFileKey(keys.at(i).data() + SET_KEY_TAG_LENGTH, keys.at(i).size() - SET_KEY_TAG_LENGTH, &info->name, info->nameLength, info->namespaceId, &info->version))
+            continue;
+        numFiles++;
+    }
+
+    return numFiles;
+}
+
+bool LocalMetaStore::fileHasJournal(const File &file) {
+    return _store.exists(JOURNAL_SET + genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version));
+}
+
+bool LocalMetaStore::putFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations) {
+    if (fingerprints.size() != locations.size()) {
+        LOG(ERROR) << "Failed to store fingerprints, number of locations (" << locations.size() << ") mismatches the number of fingerprints (" << fingerprints.size() << ")";
+        return false;
+    }
+
+    LogStore::WriteBatch batch;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        batch.put(genFingerprintKey(namespaceId, fingerprints.at(i), /* ref count */ false), encodeBlockLocation(locations.at(i)));
+    }
+
+    if (!batch.empty() && !_store.commit(batch)) {
+        LOG(ERROR) << "Failed to store fingerprints of namespace " << (int) namespaceId;
+        return false;
+    }
+
+    return true;
+}
+
+int LocalMetaStore::getFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) {
+    locations.clear();
+    locations.resize(fingerprints.size());
+
+    int numFound = 0;
+    std::string value;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        if (_store.get(genFingerprintKey(namespaceId, fingerprints.at(i), /* ref count */ false), value) && decodeBlockLocation(namespaceId, value.data(), value.size(), locations.at(i)))
+            numFound++;
+    }
+
+    return numFound;
+}
+
+bool LocalMetaStore::deleteFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    LogStore::WriteBatch batch;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        batch.remove(genFingerprintKey(namespaceId, fingerprints.at(i), /* ref count */ false));
+    }
+
+    if (!batch.empty() && !_store.commit(batch)) {
+        LOG(ERROR) << "Failed to remove fingerprints of namespace " << (int) namespaceId;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::scanFingerprints(unsigned char namespaceId, std::string &cursor, int batchSize, std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) {
+    std::string prefix(FP_INDEX_KEY_TAG);
+    prefix.push_back((char) namespaceId);
+
+    // the cursor is the last key visited ("0" at start and end)
+    std::vector<std::string> keys, values;
+    bool more = _store.scan(prefix, cursor == "0"? "" : cursor, batchSize > 0? batchSize : 0, keys, &values);
+    cursor = more && !keys.empty()? keys.back() : "0";
+
+    Fingerprint fp;
+    BlockLocation loc;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!decodeBlockLocation(namespaceId, values.at(i).data(), values.at(i).size(), loc))
+            continue;
+        fp.set(keys.at(i).data() + prefix.size(), keys.at(i).size() - prefix.size());
+        fingerprints.emplace_back(fp);
+        locations.emplace_back(loc);
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::updateFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<int> &deltas, std::vector<long long> &counts) {
+    if (fingerprints.size() != deltas.size()) {
+        LOG(ERROR) << "Failed to update fingerprint reference counts, number of changes (" << deltas.size() << ") mismatches the number of fingerprints (" << fingerprints.size() << ")";
+        return false;
+    }
+
+    counts.clear();
+    counts.resize(fingerprints.size(), 0);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // update and drop the counts in one batch, with repeated fingerprints applied in order
+    std::map<std::string, long long> updated;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        std::string key = genFingerprintKey(namespaceId, fingerprints.at(i), /* ref count */ true);
+        auto it = updated.find(key);
+        long long count = 0;
+        std::string value;
+        if (it != updated.end()) {
+            count = it->second;
+        } else if (_store.get(key, value) && value.size() == sizeof(long long)) {
+            memcpy(&count, value.data(), sizeof(long long));
+        }
+        count += deltas.at(i);
+        updated[key] = count;
+        counts.at(i) = count;
+        if (count <= 0) {
+            batch.remove(key);
+            updated[key] = 0;
+        } else {
+            batch.put(key, std::string((const char *) &count, sizeof(long long)));
+        }
+    }
+
+    if (!batch.empty() && !commit(batch, lk)) {
+        LOG(ERROR) << "Failed to update fingerprint reference counts of namespace " << (int) namespaceId;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::getFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    counts.clear();
+    counts.resize(fingerprints.size(), 0);
+
+    std::string value;
+    for (size_t i = 0; i < fingerprints.size(); i++) {
+        if (_store.get(genFingerprintKey(namespaceId, fingerprints.at(i), /* ref count */ true), value) && value.size() == sizeof(long long))
+            memcpy(&counts.at(i), value.data(), sizeof(long long));
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::putRetiredMeta(const File &file) {
+    std::string filename = genFileKey(file.namespaceId, file.name, file.nameLength);
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+    std::string verKey = RETIRED_VER_KEY_TAG + filename;
+
+    Record record;
+    record.set(file);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    // keep the metadata under the versioned key, which is not listed but remains accessible by name and version
+    batch.put(VERSIONED_FILE_KEY_TAG + vfilename, record.encode());
+    batch.put(FILE_DEDUP_RETIRED_SET + vfilename, "");
+
+    // record the most recent retired version, so that new files of the same name do not reuse the version (and chunk names)
+    std::string value;
+    int version = -1;
+    if (_store.get(verKey, value) && value.size() == sizeof(int))
+        memcpy(&version, value.data(), sizeof(int));
+    if (version < file.version)
+        batch.put(verKey, std::string((const char *) &file.version, sizeof(int)));
+
+    if (!commit(batch, lk)) {
+        LOG(ERROR) << "Failed to keep the metadata of retired file " << file.name << " version " << file.version;
+        return false;
+    }
+
+    return true;
+}
+
+bool LocalMetaStore::deleteRetiredMeta(const File &file) {
+    std::string vfilename = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version);
+
+    LogStore::WriteBatch batch;
+    batch.remove(VERSIONED_FILE_KEY_TAG + vfilename);
+    batch.remove(FILE_DEDUP_RETIRED_SET + vfilename);
+
+    if (!_store.commit(batch)) {
+        LOG(ERROR) << "Failed to remove the metadata of retired file " << file.name << " version " << file.version;
+        return false;
+    }
+
+    return true;
+}
+
+int LocalMetaStore::getRetiredFiles(std::string &cursor, int numFiles, File files[]) {
+    if (numFiles <= 0)
+        return 0;
+
+    // the cursor is the last key visited ("0" at start and end)
+    std::vector<std::string> keys;
+    bool more = _store.scan(FILE_DEDUP_RETIRED_SET, cursor == "0"? "" : cursor, numFiles, keys);
+    cursor = more && !keys.empty()? keys.back() : "0";
+
+    int num = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        free(files[num].name);
+        files[num].name = 0;
+        if (!getNameFromFileKey(keys.at(i).data() + SET_KEY_TAG_LENGTH, keys.at(i).size() - SET_KEY_TAG_LENGTH, &files[num].name, files[num].nameLength, files[num].namespaceId, &files[num].version))
+            continue;
+        num++;
+    }
+
+    return num;
+}
+
+unsigned long int LocalMetaStore::getNumRetiredFiles() {
+    return _store.count(FILE_DEDUP_RETIRED_SET);
+}
+
+int LocalMetaStore::getLastRetiredVersion(const File &file) {
+    std::string value;
+    int version = -1;
+    if (_store.get(RETIRED_VER_KEY_TAG + genFileKey(file.namespaceId, file.name, file.nameLength), value) && value.size() == sizeof(int))
+        memcpy(&version, value.data(), sizeof(int));
+    return version;
+}
+
+std::string LocalMetaStore::genFileKey(unsigned char namespaceId, const char *name, int nameLength) {
+    return std::to_string(namespaceId).append("_").append(name, nameLength);
+}
+
+std::string LocalMetaStore::genVersionedFileKey(unsigned char namespaceId, const char *name, int nameLength, int version) {
+    return std::string("/").append(genFileKey(namespaceId, name, nameLength)).append("\n").append(std::to_string(version));
+}
+
+std::string LocalMetaStore::genFileUuidKey(unsigned char namespaceId, boost::uuids::uuid uuid) {
+    return std::to_string(namespaceId).append("-").append(boost::uuids::to_string(uuid));
+}
+
+std::string LocalMetaStore::genVersionListKey(const std::string &filename, int version) {
+    std::string key = std::string(VERSION_LIST_KEY_TAG).append(filename).append("\n");
+    return version < 0? key : key.append(encodeKeyInt(version));
+}
+
+std::string LocalMetaStore::genFingerprintKey(unsigned char namespaceId, const Fingerprint &fp, bool refCount) {
+    std::string key(refCount? FP_REF_COUNT_KEY_TAG : FP_INDEX_KEY_TAG);
+    key.push_back((char) namespaceId);
+    return key.append((const char *) fp.data(), fp.size());
+}
+
+std::string LocalMetaStore::genJournalKeyPrefix(const std::string &vfilename) {
+    std::string prefix = std::string(JOURNAL_KEY_TAG).append(vfilename);
+    prefix.push_back('\0');
+    return prefix;
+}
+
+std::string LocalMetaStore::getFilePrefix(const char name[], bool noEndingSlash) {
+    const char *slash = strrchr(name, '/'), *us = strchr(name, '_');
+    std::string prefix("//pf_");
+    // file on root directory, or root directory (ends with one '/')
+    if (slash == NULL || us + 1 == slash) {
+        prefix.append(name, us - name + 1);
+        return noEndingSlash? prefix : prefix.append("/");
+    }
+    // sub-directory
+    return prefix.append(name, slash - name);
+}
+
+bool LocalMetaStore::getNameFromFileKey(const char *str, size_t len, char **name, int &nameLength, unsigned char &namespaceId, int *version) {
+    // full name in form of "namespaceId_filename", or "/namespaceId_filename\nversion" for a versioned key
+    int ofs = len > 0 && str[0] == '/'? 1 : 0;
+    std::string fullname(str + ofs, len - ofs);
+    size_t dpos = fullname.find_first_of("_");
+    if (dpos == std::string::npos)
+        return false;
+    size_t epos = fullname.find_first_of("\n");
+    if (epos == std::string::npos) {
+        epos = fullname.size();
+    } else if (version) {
+        *version = atoi(fullname.c_str() + epos + 1);
+    }
+
+    // fill in the namespace id, file name length and file name
+    namespaceId = strtol(fullname.c_str(), NULL, 10) % 256;
+    nameLength = epos - dpos - 1;
+    *name = (char *) malloc (nameLength + 1);
+    memcpy(*name, fullname.data() + dpos + 1, nameLength);
+    (*name)[nameLength] = 0;
+
+    return true;
+}
+
+bool LocalMetaStore::getRecord(const File &f, Record &record, bool *isCurrentVersion) {
+    std::string value;
+
+    // check if the requested version is the current one
+    if (_store.get(FILE_KEY_TAG + genFileKey(f.namespaceId, f.name, f.nameLength), value) && record.decode(value) && (f.version == -1 || record.version == f.version)) {
+        if (isCurrentVersion)
+            *isCurrentVersion = true;
+        return true;
+    }
+    if (f.version == -1)
+        return false;
+
+    // find the metadata using versioned key instead
+    if (isCurrentVersion)
+        *isCurrentVersion = false;
+    return _store.get(VERSIONED_FILE_KEY_TAG + genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version), value) && record.decode(value);
+}
+
+bool LocalMetaStore::decodeRecord(const Record &record, File &f, int getBlocks) {
+    if (!MetaCodec::decodeFile(record.meta.data(), record.meta.size(), f)) {
+        LOG(ERROR) << "Failed to decode the packed metadata of file " << f.name;
+        return false;
+    }
+
+    bool getUniqueBlocks = getBlocks == 1 || getBlocks == 3;
+    bool getDuplicateBlocks = getBlocks == 2 || getBlocks == 3;
+    if (
+        (getUniqueBlocks && !record.uniqueBlocks.empty() && !MetaCodec::decodeUniqueBlockList(record.uniqueBlocks.data(), record.uniqueBlocks.size(), f.uniqueBlocks))
+        || (getDuplicateBlocks && !record.duplicateBlocks.empty() && !MetaCodec::decodeDuplicateBlockList(record.duplicateBlocks.data(), record.duplicateBlocks.size(), f.duplicateBlocks))
+    ) {
+        LOG(ERROR) << "Failed to decode the block lists of file " << f.name;
+        return false;
+    }
+
+    return true;
+}
+
+int LocalMetaStore::updateMeta(const File &f, const std::function<bool (File &cur)> &update, bool checkVersion) {
+    std::string key = FILE_KEY_TAG + genFileKey(f.namespaceId, f.name, f.nameLength);
+
+    LogStore::WriteBatch batch;
+    std::unique_lock<std::mutex> lk(_shared->lock);
+
+    std::string value;
+    Record record;
+    if (!_store.get(key, value))
+        return 1;
+    if (!record.decode(value))
+        return 2;
+    if (checkVersion && record.version != f.version)
+        return 1;
+
+    // only the packed metadata changes, the block lists are kept as is
+    File cur;
+    cur.namespaceId = f.namespaceId;
+    if (!decodeRecord(record, cur, /* no blocks */ 0) || !update(cur))
+        return 2;
+    record.meta.clear();
+    MetaCodec::encodeFile(cur, record.meta, /* with summary */ true);
+    batch.put(key, record.encode());
+
+    return commit(batch, lk)? 0 : 2;
+}
+
+bool LocalMetaStore::commit(const LogStore::WriteBatch &batch, std::unique_lock<std::mutex> &lk, long int fileCountChange) {
+    // apply the changes under the lock, and wait for the flush without holding it
+    unsigned long int seq = _store.write(batch);
+    if (seq == 0)
+        return false;
+    _shared->numFiles += fileCountChange;
+    lk.unlock();
+    return _store.sync(seq);
+}
+
+void LocalMetaStore::addPrefixRecord(LogStore::WriteBatch &batch, const std::string &filename) {
+    std::string prefix = getFilePrefix(filename.c_str());
+    std::string member = std::string(PREFIX_KEY_TAG).append(prefix);
+    member.push_back('\0');
+    batch.put(member.append(filename), "");
+    batch.put(DIR_KEY_TAG + prefix, "");
+}
+
+void LocalMetaStore::removePrefixRecord(LogStore::WriteBatch &batch, const std::string &filename) {
+    std::string prefix = getFilePrefix(filename.c_str());
+    std::string members = std::string(PREFIX_KEY_TAG).append(prefix);
+    members.push_back('\0');
+    std::string member = members + filename;
+    batch.remove(member);
+
+    // remove the directory if the file is the last one in it
+    std::vector<std::string> keys;
+    _store.scan(members, "", 2, keys);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys.at(i) != member)
+            return;
+    }
+    batch.remove(DIR_KEY_TAG + prefix);
+}
+
+bool LocalMetaStore::lockFile(const File &file, bool lock, bool shared) {
+    std::string filename = genFileKey(file.namespaceId, file.name, file.nameLength);
+
+    // locks are only held in memory, and go away with the proxy, so they need no expiry
+    std::lock_guard<std::mutex> lk(_shared->fileLock);
+    auto it = _shared->lockedFiles.find(filename);
+    bool ret = false;
+    if (lock) {
+        if (it == _shared->lockedFiles.end()) {
+            _shared->lockedFiles.emplace(filename, std::make_pair(shared? 1 : -1, ++_shared->lockToken));
+            ret = true;
+        } else if (shared && it->second.first > 0) {
+            it->second.first++;
+            ret = true;
+        }
+    } else if (it != _shared->lockedFiles.end() && (it->second.first == -1) != shared) {
+        if (!shared || --it->second.first == 0)
+            _shared->lockedFiles.erase(it);
+        ret = true;
+    }
+    LOG_IF(ERROR, !ret) << "Failed to " << (lock? "" : "un") << "lock file " << file.name << (shared? " (shared)" : "") << ", " << (lock? "already locked" : "not locked");
+
+    return ret;
+}
+
+std::string LocalMetaStore::encodeBlockLocation(const BlockLocation &loc) {
+    // version, offset, length, followed by object name
+    int version = loc.getObjectVersion();
+    unsigned long int offset = loc.getBlockOffset();
+    unsigned int length = loc.getBlockLength();
+    std::string name = loc.getObjectName();
+    std::string value;
+    value.reserve(sizeof(int) + sizeof(unsigned long int) + sizeof(unsigned int) + name.size());
+    value.append((char *) &version, sizeof(int));
+    value.append((char *) &offset, sizeof(unsigned long int));
+    value.append((char *) &length, sizeof(unsigned int));
+    value.append(name);
+    return value;
+}
+
+bool LocalMetaStore::decodeBlockLocation(unsigned char namespaceId, const char *value, size_t len, BlockLocation &loc) {
+    const size_t hsize = sizeof(int) + sizeof(unsigned long int) + sizeof(unsigned int);
+    if (len < hsize)
+        return false;
+    int version = 0;
+    unsigned long int offset = 0;
+    unsigned int length = 0;
+    memcpy(&version, value, sizeof(int));
+    memcpy(&offset, value + sizeof(int), sizeof(unsigned long int));
+    memcpy(&length, value + sizeof(int) + sizeof(unsigned long int), sizeof(unsigned int));
+    loc.setObjectID(namespaceId, std::string(value + hsize, len - hsize), version);
+    loc.setBlockRange(offset, length);
+    return true;
+}
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __LOCAL_METASTORE_HH__
+#define __LOCAL_METASTORE_HH__
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "metastore.hh"
+#include "log_store.hh"
+
+#include <boost/uuid/uuid.hpp>
+
+/**
+ * Metadata store embedded in the proxy, which keeps the metadata in a local log-structured store
+ * instead of an external server; the store is shared by all instances in the same process with
+ * the same path, and file locks are only held in memory as the store serves a single proxy
+ **/
+class LocalMetaStore : public MetaStore {
+public:
+    LocalMetaStore();
+    ~LocalMetaStore();
+
+    /**
+     * See MetaStore::putMeta()
+     **/
+    bool putMeta(const File &f);
+
+    /**
+     * See MetaStore::getMeta()
+     **/
+    bool getMeta(File &f, int getBlocks = 3);
+
+    /**
+     * See MetaStore::deleteMeta()
+     **/
+    bool deleteMeta(File &f);
+
+    /**
+     * See MetaStore::renameMeta()
+     **/
+    bool renameMeta(File &sf, File &df);
+
+    /**
+     * See MetaStore::updateTimestamps()
+     **/
+    bool updateTimestamps(const File &f);
+
+    /**
+     * See MetaStore::updateChunks()
+     **/
+    int updateChunks(const File &f, int version);
+
+    /**
+     * See MetaStore::getFileName(boost::uuids::uuid, File)
+     **/
+    bool getFileName(boost::uuids::uuid fuuid, File &f);
+
+    /**
+     * See MetaStore::getFileList()
+     **/
+    unsigned int getFileList(FileInfo **list, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "");
+
+    /**
+     * See MetaStore::getFileListPage()
+     **/
+    unsigned int getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "");
+
+    /**
+     * See MetaStore::getFolderList()
+     **/
+    unsigned int getFolderList(std::vector<std::string> &list, unsigned char namespaceId = INVALID_NAMESPACE_ID, std::string prefix = "", bool skipSubfolders = true);
+
+    /**
+     * See MetaStore::getMaxNumKeysSupported()
+     **/
+    unsigned long int getMaxNumKeysSupported();
+
+    /**
+     * See MetaStore::getNumFiles()
+     **/
+    unsigned long int getNumFiles();
+
+    /**
+     * See MetaStore::getNumFilesToRepair()
+     **/
+    unsigned long int getNumFilesToRepair();
+
+    /**
+     * See MetaStore::getFilesToRepair()
+     **/
+    int getFilesToRepair(int numFiles, File files[]);
+
+    /**
+     * See MetaStore::markFileAsNeedsRepair()
+     **/
+    bool markFileAsNeedsRepair(const File &file);
+
+    /**
+     * See MetaStore::markFileAsRepaired()
+     **/
+    bool markFileAsRepaired(const File &file);
+
+    /**
+     * See MetaStore::markFileAsPendingWriteToCloud()
+     **/
+    bool markFileAsPendingWriteToCloud(const File &file);
+
+    /**
+     * See MetaStore::markFileAsWrittenToCloud()
+     **/
+    bool markFileAsWrittenToCloud(const File &file, bool removePending = false);
+
+    /**
+     * See MetaStore::getFilesPendingWriteToCloud()
+     **/
+    int getFilesPendingWriteToCloud(int numFiles, File files[]);
+
+    /**
+     * See MetaStore::updateFileStatus()
+     **/
+    bool updateFileStatus(const File &file);
+
+    /**
+     * See MetaStore::getNextFileForTaskCheck()
+     **/
+    bool getNextFileForTaskCheck(File &file);
+
+    /**
+     * See MetaStore::lockFile()
+     **/
+    bool lockFile(const File &file, bool shared = false);
+
+    /**
+     * See MetaStore::unlockFile()
+     **/
+    bool unlockFile(const File &file, bool shared = false);
+
+    /**
+     * See MetaStore::getLockToken()
+     **/
+    unsigned long int getLockToken(const File &file);
+
+    /**
+     * See MetaStore::addChunkToJournal()
+     **/
+    bool addChunkToJournal(const File &file, const Chunk &chunk, int containerId, bool isWrite);
+
+    /**
+     * See MetaStore::updateChunkInJournal()
+     **/
+    bool updateChunkInJournal(const File &file, const Chunk &chunk, bool isWrite, bool deleteRecord, int containerId);
+
+    /**
+     * See MetaStore::addChunksToJournal()
+     **/
+    bool addChunksToJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite);
+
+    /**
+     * See MetaStore::updateChunksInJournal()
+     **/
+    bool updateChunksInJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite, bool deleteRecord);
+
+    /**
+     * See MetaStore::getFileJournal()
+     **/
+    void getFileJournal(const FileInfo &file, std::vector<std::tuple<Chunk, int /* container id*/, bool /* isWrite */, bool /* isPre */>> &records);
+
+    /**
+     * See MetaStore::getFilesWithJournal()
+     **/
+    int getFilesWithJounal(FileInfo **list);
+
+    /**
+     * See MetaStore::fileHasJournal()
+     **/
+    bool fileHasJournal(const File &file);
+
+    /**
+     * See MetaStore::putFingerprints()
+     **/
+    bool putFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::getFingerprints()
+     **/
+    int getFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::deleteFingerprints()
+     **/
+    bool deleteFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * See MetaStore::scanFingerprints()
+     **/
+    bool scanFingerprints(unsigned char namespaceId, std::string &cursor, int batchSize, std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::updateFingerprintRefCounts()
+     **/
+    bool updateFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<int> &deltas, std::vector<long long> &counts);
+
+    /**
+     * See MetaStore::getFingerprintRefCounts()
+     **/
+    bool getFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
+    /**
+     * See MetaStore::putRetiredMeta()
+     **/
+    bool putRetiredMeta(const File &file);
+
+    /**
+     * See MetaStore::deleteRetiredMeta()
+     **/
+    bool deleteRetiredMeta(const File &file);
+
+    /**
+     * See MetaStore::getRetiredFiles()
+     **/
+    int getRetiredFiles(std::string &cursor, int numFiles, File files[]);
+
+    /**
+     * See MetaStore::getNumRetiredFiles()
+     **/
+    unsigned long int getNumRetiredFiles();
+
+    /**
+     * See MetaStore::getLastRetiredVersion()
+     **/
+    int getLastRetiredVersion(const File &file);
+
+private:
+    /**
+     * Store and in-memory states shared by all instances on the same path
+     **/
+    struct Shared {
+        LogStore store;                                /**< key-value store of the metadata */
+        std::mutex lock;                               /**< lock on read-modify-write operations */
+        std::atomic<unsigned long int> numFiles;       /**< number of file names */
+        std::mutex fileLock;                           /**< lock on the locked files */
+        std::map<std::string, std::pair<int, unsigned long int> > lockedFiles; /**< locked files -> (number of shared holders or -1 if locked exclusively, fencing token) */
+        unsigned long int lockToken;                   /**< fencing token of the last lock granted */
+
+        Shared(const std::string &path, unsigned long int segmentSize, bool sync, int compactionInterval, int compactionThreshold);
+    };
+
+    /**
+     * Metadata record of a file version
+     **/
+    struct Record {
+        int version;                                   /**< file version */
+        std::string meta;                              /**< file metadata packed by MetaCodec, with the summary */
+        std::string uniqueBlocks;                      /**< packed list of unique blocks */
+        std::string duplicateBlocks;                   /**< packed list of duplicate blocks */
+
+        void set(const File &f);
+        std::string encode() const;
+        bool decode(const std::string &value);
+    };
+
+    static std::shared_ptr<Shared> getShared();
+
+    std::string genFileKey(unsigned char namespaceId, const char *name, int nameLength);
+    std::string genVersionedFileKey(unsigned char namespaceId, const char *name, int nameLength, int version);
+    std::string genFileUuidKey(unsigned char namespaceId, boost::uuids::uuid uuid);
+    std::string genVersionListKey(const std::string &filename, int version = -1);
+    std::string genFingerprintKey(unsigned char namespaceId, const Fingerprint &fp, bool refCount);
+    std::string genJournalKeyPrefix(const std::string &vfilename);
+    std::string getFilePrefix(const char name[], bool noEndingSlash = false);
+    bool getNameFromFileKey(const char *str, size_t len, char **name, int &nameLength, unsigned char &namespaceId, int *version = 0);
+
+    bool getRecord(const File &f, Record &record, bool *isCurrentVersion = 0);
+    bool decodeRecord(const Record &record, File &f, int getBlocks);
+    int updateMeta(const File &f, const std::function<bool (File &cur)> &update, bool checkVersion = false);
+    bool commit(const LogStore::WriteBatch &batch, std::unique_lock<std::mutex> &lk, long int fileCountChange = 0);
+    void addPrefixRecord(LogStore::WriteBatch &batch, const std::string &filename);
+    void removePrefixRecord(LogStore::WriteBatch &batch, const std::string &filename);
+    unsigned int getFileInfoOfKeys(const std::vector<std::string> &keys, FileInfo *list, bool withSize, bool withTime, bool withVersions);
+    bool scanFileKeys(unsigned char namespaceId, const std::string &prefix, std::string &cursor, unsigned int count, std::vector<std::string> &keys);
+    bool markFileStatus(const File &file, const char *setName, bool set, const char *opName);
+    bool lockFile(const File &file, bool lock, bool shared);
+
+    std::string encodeBlockLocation(const BlockLocation &loc);
+    bool decodeBlockLocation(unsigned char namespaceId, const char *value, size_t len, BlockLocation &loc);
+
+    std::shared_ptr<Shared> _shared;                   /**< store and in-memory states shared with other instances */
+    LogStore &_store;                                  /**< key-value store of the metadata */
+
+    std::mutex _scanLock;                              /**< lock on the scan states below */
+    std::string _taskScanIt;                           /**< last file visited for task checking */
+    std::string _pendingWriteScanIt;                   /**< last file visited for pending writes to cloud */
+};
+
+#endif // define __LOCAL_METASTORE_HH__
@@ -0,0 +1,581 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>  // std::max(), std::sort()
+#include <chrono>
+#include <dirent.h>  // opendir(), readdir()
+#include <errno.h>
+#include <fcntl.h>  // open()
+#include <stdio.h>  // snprintf(), sscanf()
+#include <string.h>  // memcpy(), memset(), strerror()
+#include <sys/mman.h>  // mmap(), msync(), munmap()
+#include <sys/stat.h>  // fstat(), mkdir()
+#include <time.h>
+#include <unistd.h>  // close(), ftruncate(), fsync(), sysconf(), unlink()
+
+#include <boost/crc.hpp>
+#include <glog/logging.h>
+
+#include "log_store.hh"
+
+// record header: checksum and length of the payload
+#define LOG_RECORD_HEADER_SIZE   (2 * sizeof(uint32_t))
+// operation header: type, key length and value length
+#define LOG_OP_HEADER_SIZE       (1 + 2 * sizeof(uint32_t))
+#define LOG_OP_PUT               (1)
+#define LOG_OP_REMOVE            (2)
+#define LOG_SEGMENT_NAME_FORMAT  "%08u.log"
+
+static uint32_t checksum(const char *data, size_t length) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, length);
+    return crc.checksum();
+}
+
+// parse the operation at 'ofs' of a record payload, return the size of the operation, or 0 if the operation is malformed
+static size_t parseOp(const char *payload, size_t length, size_t ofs, int &type, size_t &keyOffset, size_t &keyLength, size_t &valueOffset, size_t &valueLength) {
+    if (length - ofs < LOG_OP_HEADER_SIZE)
+        return 0;
+    uint32_t klen = 0, vlen = 0;
+    type = payload[ofs];
+    memcpy(&klen, payload + ofs + 1, sizeof(uint32_t));
+    memcpy(&vlen, payload + ofs + 1 + sizeof(uint32_t), sizeof(uint32_t));
+    if ((type != LOG_OP_PUT && type != LOG_OP_REMOVE) || length - ofs - LOG_OP_HEADER_SIZE < (size_t) klen + vlen)
+        return 0;
+    keyOffset = ofs + LOG_OP_HEADER_SIZE;
+    keyLength = klen;
+    valueOffset = keyOffset + klen;
+    valueLength = vlen;
+    return LOG_OP_HEADER_SIZE + klen + vlen;
+}
+
+static bool createDirectories(const std::string &dir) {
+    for (size_t pos = 1; pos <= dir.size(); pos++) {
+        if (pos != dir.size() && dir[pos] != '/')
+            continue;
+        std::string path = dir.substr(0, pos);
+        if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+LogStore::WriteBatch::WriteBatch() {
+}
+
+void LogStore::WriteBatch::put(const std::string &key, const std::string &value) {
+    Op op;
+    uint32_t klen = key.size(), vlen = value.size();
+    op.isPut = true;
+    op.keyOffset = _payload.size() + LOG_OP_HEADER_SIZE;
+    op.keyLength = klen;
+    op.valueOffset = op.keyOffset + klen;
+    op.valueLength = vlen;
+    _payload.push_back((char) LOG_OP_PUT);
+    _payload.append((const char *) &klen, sizeof(uint32_t));
+    _payload.append((const char *) &vlen, sizeof(uint32_t));
+    _payload.append(key);
+    _payload.append(value);
+    _ops.push_back(op);
+}
+
+void LogStore::WriteBatch::remove(const std::string &key) {
+    Op op;
+    uint32_t klen = key.size(), vlen = 0;
+    op.isPut = false;
+    op.keyOffset = _payload.size() + LOG_OP_HEADER_SIZE;
+    op.keyLength = klen;
+    op.valueOffset = op.keyOffset + klen;
+    op.valueLength = 0;
+    _payload.push_back((char) LOG_OP_REMOVE);
+    _payload.append((const char *) &klen, sizeof(uint32_t));
+    _payload.append((const char *) &vlen, sizeof(uint32_t));
+    _payload.append(key);
+    _ops.push_back(op);
+}
+
+bool LogStore::WriteBatch::empty() const {
+    return _ops.empty();
+}
+
+void LogStore::WriteBatch::clear() {
+    _payload.clear();
+    _ops.clear();
+}
+
+LogStore::Segment::Segment() {
+    id = 0;
+    fd = -1;
+    base = 0;
+    capacity = 0;
+    used = 0;
+    synced = 0;
+    live = 0;
+}
+
+LogStore::Segment::~Segment() {
+    if (base)
+        munmap(base, capacity);
+    if (fd != -1)
+        close(fd);
+}
+
+LogStore::LogStore(const std::string &dir, unsigned long int segmentSize, bool syncOnCommit, int compactionInterval, int compactionThreshold) {
+    _dir = dir;
+    _segmentSize = std::max(segmentSize, (unsigned long int) sysconf(_SC_PAGESIZE));
+    _syncOnCommit = syncOnCommit;
+    _compactionInterval = compactionInterval;
+    _compactionThreshold = compactionThreshold;
+    _seq = 0;
+    _syncing = false;
+    _syncedSeq = 0;
+    _compactorStarted = false;
+    _running = true;
+}
+
+LogStore::~LogStore() {
+    if (_compactorStarted) {
+        {
+            std::lock_guard<std::mutex> lk(_compactionLock);
+            _running = false;
+        }
+        _compactionCv.notify_all();
+        pthread_join(_compactor, NULL);
+    }
+    unsigned long int seq = 0;
+    {
+        std::shared_lock<std::shared_mutex> lk(_lock);
+        seq = _seq;
+    }
+    LOG_IF(ERROR, seq > 0 && !persist(seq)) << "Failed to flush the metadata log in " << _dir << " on close";
+    _active.reset();
+    _segments.clear();
+}
+
+bool LogStore::open() {
+    if (!createDirectories(_dir)) {
+        LOG(ERROR) << "Failed to create the metadata log directory " << _dir << ", " << strerror(errno);
+        return false;
+    }
+
+    // find the existing segments
+    std::vector<unsigned int> ids;
+    DIR *d = opendir(_dir.c_str());
+    if (d == NULL) {
+        LOG(ERROR) << "Failed to open the metadata log directory " << _dir << ", " << strerror(errno);
+        return false;
+    }
+    struct dirent *entry = 0;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned int id = 0;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%u.%7s", &id, suffix) == 2 && strcmp(suffix, "log") == 0)
+            ids.push_back(id);
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+
+    // rebuild the index by replaying the segments in order
+    std::unique_lock<std::shared_mutex> lk(_lock);
+    for (size_t i = 0; i < ids.size(); i++) {
+        std::shared_ptr<Segment> segment = openSegment(ids.at(i), 0, /* create */ false);
+        if (segment == nullptr)
+            return false;
+        _segments.insert(std::make_pair(segment->id, segment));
+        // only the last segment may end with a record torn by a crash, any corruption in a sealed segment loses committed metadata
+        bool last = i + 1 == ids.size();
+        if (!replaySegment(*segment, last) && !last) {
+            LOG(ERROR) << "Corrupted record in sealed metadata log segment " << segment->path << " at offset " << segment->used << ", refuse to open the metadata log";
+            _index.clear();
+            _segments.clear();
+            _seq = 0;
+            return false;
+        }
+    }
+    // continue appending to the last segment
+    if (!_segments.empty())
+        _active = _segments.rbegin()->second;
+    _syncedSeq = _seq;
+
+    LOG(INFO) << "Metadata log opened in " << _dir << ", number of segments = " << _segments.size() << ", number of keys = " << _index.size();
+
+    lk.unlock();
+
+    if (_compactionInterval > 0) {
+        if (pthread_create(&_compactor, NULL, LogStore::runCompaction, this) != 0) {
+            LOG(WARNING) << "Failed to start the metadata log compaction";
+        } else {
+            _compactorStarted = true;
+        }
+    }
+
+    return true;
+}
+
+bool LogStore::get(const std::string &key, std::string &value) const {
+    std::shared_lock<std::shared_mutex> lk(_lock);
+    auto it = _index.find(key);
+    if (it == _index.end())
+        return false;
+    const Segment &segment = *_segments.at(it->second.segment);
+    value.assign(segment.base + it->second.offset, it->second.length);
+    return true;
+}
+
+bool LogStore::exists(const std::string &key) const {
+    std::shared_lock<std::shared_mutex> lk(_lock);
+    return _index.count(key) > 0;
+}
+
+unsigned long int LogStore::write(const WriteBatch &batch) {
+    if (batch.empty())
+        return 0;
+    std::unique_lock<std::shared_mutex> lk(_lock);
+    return append(batch);
+}
+
+bool LogStore::sync(unsigned long int seq) {
+    return !_syncOnCommit || persist(seq);
+}
+
+bool LogStore::persist(unsigned long int seq) {
+    std::unique_lock<std::mutex> lk(_syncLock);
+    while (_syncedSeq < seq) {
+        // let the ongoing flush cover this batch, or flush for all waiting batches
+        if (_syncing) {
+            _syncCv.wait(lk);
+            continue;
+        }
+        _syncing = true;
+        lk.unlock();
+        unsigned long int flushed = 0;
+        bool okay = flush(flushed);
+        lk.lock();
+        _syncing = false;
+        if (okay && flushed > _syncedSeq)
+            _syncedSeq = flushed;
+        _syncCv.notify_all();
+        if (!okay)
+            return false;
+    }
+    return true;
+}
+
+bool LogStore::commit(const WriteBatch &batch) {
+    if (batch.empty())
+        return true;
+    unsigned long int seq = write(batch);
+    if (seq == 0)
+        return false;
+    return sync(seq);
+}
+
+bool LogStore::scan(const std::string &prefix, const std::string &startAfter, size_t maxNumKeys, std::vector<std::string> &keys, std::vector<std::string> *values) const {
+    std::shared_lock<std::shared_mutex> lk(_lock);
+    auto it = startAfter.empty() || startAfter < prefix? _index.lower_bound(prefix) : _index.upper_bound(startAfter);
+    size_t num = 0;
+    for (; it != _index.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++) {
+        if (maxNumKeys > 0 && num >= maxNumKeys)
+            return true;
+        keys.push_back(it->first);
+        if (values) {
+            const Segment &segment = *_segments.at(it->second.segment);
+            values->emplace_back(segment.base + it->second.offset, it->second.length);
+        }
+        num++;
+    }
+    return false;
+}
+
+unsigned long int LogStore::count(const std::string &prefix) const {
+    std::shared_lock<std::shared_mutex> lk(_lock);
+    unsigned long int num = 0;
+    for (auto it = _index.lower_bound(prefix); it != _index.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++)
+        num++;
+    return num;
+}
+
+int LogStore::compact() {
+    // pick the sealed segments with little live data
+    std::vector<unsigned int> candidates;
+    {
+        std::shared_lock<std::shared_mutex> lk(_lock);
+        for (auto it = _segments.begin(); it != _segments.end(); it++) {
+            const Segment &segment = *it->second;
+            if (it->second == _active)
+                continue;
+            if (segment.live == 0 || segment.live * 100 < segment.used * _compactionThreshold)
+                candidates.push_back(segment.id);
+        }
+    }
+
+    int numRemoved = 0;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (compactSegment(candidates.at(i)))
+            numRemoved++;
+    }
+
+    LOG_IF(INFO, numRemoved > 0) << "Compacted " << numRemoved << " metadata log segments in " << _dir;
+
+    return numRemoved;
+}
+
+void *LogStore::runCompaction(void *arg) {
+    LogStore *self = (LogStore *) arg;
+    std::unique_lock<std::mutex> lk(self->_compactionLock);
+    while (self->_running) {
+        self->_compactionCv.wait_for(lk, std::chrono::seconds(self->_compactionInterval));
+        if (!self->_running)
+            break;
+        lk.unlock();
+        self->compact();
+        lk.lock();
+    }
+    return NULL;
+}
+
+std::shared_ptr<LogStore::Segment> LogStore::openSegment(unsigned int id, size_t minCapacity, bool create) {
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    segment->id = id;
+    segment->path = genSegmentPath(id);
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | (create? O_CREAT | O_EXCL : 0), 0644);
+    if (segment->fd == -1) {
+        LOG(ERROR) << "Failed to open metadata log segment " << segment->path << ", " << strerror(errno);
+        return nullptr;
+    }
+
+    // preallocate new segments, and also segments left empty by an interrupted creation
+    struct stat sbuf;
+    if (fstat(segment->fd, &sbuf) != 0) {
+        LOG(ERROR) << "Failed to get the size of metadata log segment " << segment->path << ", " << strerror(errno);
+        return nullptr;
+    }
+    segment->capacity = sbuf.st_size;
+    if (segment->capacity < LOG_RECORD_HEADER_SIZE) {
+        segment->capacity = std::max(_segmentSize, minCapacity);
+        if (ftruncate(segment->fd, segment->capacity) != 0) {
+            LOG(ERROR) << "Failed to allocate metadata log segment " << segment->path << ", " << strerror(errno);
+            return nullptr;
+        }
+        if (_syncOnCommit && fsync(segment->fd) != 0) {
+            LOG(ERROR) << "Failed to persist metadata log segment " << segment->path << ", " << strerror(errno);
+            return nullptr;
+        }
+    }
+
+    void *base = mmap(NULL, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (base == MAP_FAILED) {
+        LOG(ERROR) << "Failed to map metadata log segment " << segment->path << ", " << strerror(errno);
+        return nullptr;
+    }
+    segment->base = (char *) base;
+
+    return segment;
+}
+
+bool LogStore::replaySegment(Segment &segment, bool last) {
+    size_t ofs = 0;
+    bool intact = true;
+    while (segment.capacity - ofs >= LOG_RECORD_HEADER_SIZE) {
+        uint32_t crc = 0, length = 0;
+        memcpy(&crc, segment.base + ofs, sizeof(uint32_t));
+        memcpy(&length, segment.base + ofs + sizeof(uint32_t), sizeof(uint32_t));
+        // end of the appended records
+        if (crc == 0 && length == 0)
+            break;
+        // torn or corrupted record
+        const char *payload = segment.base + ofs + LOG_RECORD_HEADER_SIZE;
+        if (length > segment.capacity - ofs - LOG_RECORD_HEADER_SIZE || checksum(payload, length) != crc) {
+            intact = false;
+            break;
+        }
+        // validate all operations before applying the record as a whole
+        int type = 0;
+        size_t keyOffset = 0, keyLength = 0, valueOffset = 0, valueLength = 0, opSize = 0;
+        for (size_t pos = 0; pos < length; pos += opSize) {
+            opSize = parseOp(payload, length, pos, type, keyOffset, keyLength, valueOffset, valueLength);
+            if (opSize == 0) {
+                intact = false;
+                break;
+            }
+        }
+        if (!intact)
+            break;
+        for (size_t pos = 0; pos < length; pos += opSize) {
+            opSize = parseOp(payload, length, pos, type, keyOffset, keyLength, valueOffset, valueLength);
+            std::string key(payload + keyOffset, keyLength);
+            if (type == LOG_OP_PUT) {
+                Location loc;
+                loc.segment = segment.id;
+                loc.offset = ofs + LOG_RECORD_HEADER_SIZE + valueOffset;
+                loc.length = valueLength;
+                loc.recordSize = opSize;
+                applyPut(key, loc);
+            } else {
+                applyRemove(key);
+            }
+        }
+        ofs += LOG_RECORD_HEADER_SIZE + length;
+        _seq++;
+    }
+
+    // drop the torn tail of the last segment, so that new records are not mixed up with it; sealed segments are never written
+    if (!intact && last)
+        memset(segment.base + ofs, 0, segment.capacity - ofs);
+
+    segment.used = ofs;
+    segment.synced = ofs;
+
+    return intact;
+}
+
+unsigned long int LogStore::append(const WriteBatch &batch) {
+    size_t recordSize = LOG_RECORD_HEADER_SIZE + batch._payload.size();
+
+    // start a new segment if the active one is full, large enough for the record
+    if (_active == nullptr || _active->capacity - _active->used < recordSize) {
+        unsigned int id = _segments.empty()? 0 : _segments.rbegin()->first + 1;
+        std::shared_ptr<Segment> segment = openSegment(id, recordSize, /* create */ true);
+        if (segment == nullptr)
+            return 0;
+        _segments.insert(std::make_pair(id, segment));
+        _active = segment;
+    }
+
+    Segment &segment = *_active;
+    size_t ofs = segment.used;
+    uint32_t length = batch._payload.size();
+    uint32_t crc = checksum(batch._payload.data(), batch._payload.size());
+    memcpy(segment.base + ofs + LOG_RECORD_HEADER_SIZE, batch._payload.data(), length);
+    memcpy(segment.base + ofs + sizeof(uint32_t), &length, sizeof(uint32_t));
+    memcpy(segment.base + ofs, &crc, sizeof(uint32_t));
+    segment.used += recordSize;
+
+    for (size_t i = 0; i < batch._ops.size(); i++) {
+        const WriteBatch::Op &op = batch._ops.at(i);
+        std::string key(batch._payload.data() + op.keyOffset, op.keyLength);
+        if (op.isPut) {
+            Location loc;
+            loc.segment = segment.id;
+            loc.offset = ofs + LOG_RECORD_HEADER_SIZE + op.valueOffset;
+            loc.length = op.valueLength;
+            loc.recordSize = LOG_OP_HEADER_SIZE + op.keyLength + op.valueLength;
+            applyPut(key, loc);
+        } else {
+            applyRemove(key);
+        }
+    }
+
+    return ++_seq;
+}
+
+bool LogStore::flush(unsigned long int &seq) {
+    // find the appended ranges not yet on disk
+    std::vector<std::pair<std::shared_ptr<Segment>, size_t> > dirty;
+    {
+        std::shared_lock<std::shared_mutex> lk(_lock);
+        seq = _seq;
+        for (auto it = _segments.begin(); it != _segments.end(); it++) {
+            if (it->second->synced < it->second->used)
+                dirty.emplace_back(it->second, it->second->used);
+        }
+    }
+
+    // flush the ranges without blocking appends
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < dirty.size(); i++) {
+        Segment &segment = *dirty.at(i).first;
+        size_t end = dirty.at(i).second;
+        size_t start = segment.synced / pageSize * pageSize;
+        if (msync(segment.base + start, end - start, MS_SYNC) != 0) {
+            LOG(ERROR) << "Failed to flush metadata log segment " << segment.path << ", " << strerror(errno);
+            return false;
+        }
+        segment.synced = end;
+    }
+
+    return true;
+}
+
+bool LogStore::compactSegment(unsigned int id) {
+    std::shared_ptr<Segment> segment;
+    unsigned long int seq = 0;
+    {
+        std::unique_lock<std::shared_mutex> lk(_lock);
+        auto sit = _segments.find(id);
+        if (sit == _segments.end() || sit->second == _active)
+            return false;
+        segment = sit->second;
+        // removals only need to be kept while older segments may still hold the removed keys
+        bool hasOlderSegments = _segments.begin()->first < id;
+
+        // move the live records to the active segment
+        WriteBatch batch;
+        for (size_t ofs = 0; ofs < segment->used; ) {
+            uint32_t length = 0;
+            memcpy(&length, segment->base + ofs + sizeof(uint32_t), sizeof(uint32_t));
+            const char *payload = segment->base + ofs + LOG_RECORD_HEADER_SIZE;
+            int type = 0;
+            size_t keyOffset = 0, keyLength = 0, valueOffset = 0, valueLength = 0, opSize = 0;
+            for (size_t pos = 0; pos < length; pos += opSize) {
+                opSize = parseOp(payload, length, pos, type, keyOffset, keyLength, valueOffset, valueLength);
+                std::string key(payload + keyOffset, keyLength);
+                auto it = _index.find(key);
+                if (type == LOG_OP_PUT) {
+                    if (it != _index.end() && it->second.segment == id && it->second.offset == ofs + LOG_RECORD_HEADER_SIZE + valueOffset)
+                        batch.put(key, std::string(payload + valueOffset, valueLength));
+                } else if (hasOlderSegments && it == _index.end()) {
+                    batch.remove(key);
+                }
+            }
+            ofs += LOG_RECORD_HEADER_SIZE + length;
+        }
+        if (!batch.empty()) {
+            seq = append(batch);
+            if (seq == 0)
+                return false;
+        }
+    }
+
+    // the moved records must be on disk before the segment is gone
+    if (seq > 0 && !persist(seq))
+        return false;
+
+    {
+        std::unique_lock<std::shared_mutex> lk(_lock);
+        _segments.erase(id);
+    }
+    if (unlink(segment->path.c_str()) != 0) {
+        LOG(WARNING) << "Failed to remove metadata log segment " << segment->path << ", " << strerror(errno);
+    }
+
+    return true;
+}
+
+void LogStore::applyPut(const std::string &key, const Location &loc) {
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        auto sit = _segments.find(it->second.segment);
+        if (sit != _segments.end())
+            sit->second->live -= it->second.recordSize;
+        it->second = loc;
+    } else {
+        _index.insert(std::make_pair(key, loc));
+    }
+    _segments.at(loc.segment)->live += loc.recordSize;
+}
+
+void LogStore::applyRemove(const std::string &key) {
+    auto it = _index.find(key);
+    if (it == _index.end())
+        return;
+    auto sit = _segments.find(it->second.segment);
+    if (sit != _segments.end())
+        sit->second->live -= it->second.recordSize;
+    _index.erase(it);
+}
+
+std::string LogStore::genSegmentPath(unsigned int id) const {
+    char name[32];
+    snprintf(name, sizeof(name), LOG_SEGMENT_NAME_FORMAT, id);
+    return std::string(_dir).append("/").append(name);
+}
@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __LOG_STORE_HH__
+#define __LOG_STORE_HH__
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+/**
+ * Embedded key-value store on an append-only log of memory-mapped segment files
+ *
+ * Each write batch is appended to the active segment as one checksummed record, and applied
+ * to an in-memory ordered index of the keys and the locations of their values in the segments.
+ * Values are read directly from the mapped segments. The index is rebuilt by replaying the
+ * segments on start. Segments that are mostly overwritten or removed are compacted in background,
+ * by moving the remaining live records to the active segment and removing the segment files.
+ **/
+class LogStore {
+public:
+
+    /**
+     * Set of changes which are applied atomically
+     **/
+    class WriteBatch {
+    public:
+        WriteBatch();
+
+        /**
+         * Set the value of a key
+         *
+         * @param[in] key                  key to set
+         * @param[in] value                value of the key
+         **/
+        void put(const std::string &key, const std::string &value);
+
+        /**
+         * Remove a key
+         *
+         * @param[in] key                  key to remove
+         **/
+        void remove(const std::string &key);
+
+        /**
+         * Tell whether the batch has no changes
+         *
+         * @return whether the batch has no changes
+         **/
+        bool empty() const;
+
+        /**
+         * Drop all changes in the batch
+         **/
+        void clear();
+
+    private:
+        friend class LogStore;
+
+        struct Op {
+            bool isPut;                        /**< whether the operation is a put (or a removal otherwise) */
+            size_t keyOffset;                  /**< offset of the key in the payload */
+            size_t keyLength;                  /**< length of the key */
+            size_t valueOffset;                /**< offset of the value in the payload */
+            size_t valueLength;                /**< length of the value */
+        };
+
+        std::string _payload;                  /**< encoded operations */
+        std::vector<Op> _ops;                  /**< operations in the order of appending */
+    };
+
+    /**
+     * Constructor
+     *
+     * @param[in] dir                          directory to keep the segment files
+     * @param[in] segmentSize                  size of each segment file in bytes
+     * @param[in] syncOnCommit                 whether commits wait for the appended records to be flushed to disk
+     * @param[in] compactionInterval           time between compaction checks in seconds, 0 to disable compaction
+     * @param[in] compactionThreshold          compact sealed segments with less than this percentage of live data
+     **/
+    LogStore(const std::string &dir, unsigned long int segmentSize, bool syncOnCommit, int compactionInterval, int compactionThreshold);
+    ~LogStore();
+
+    /**
+     * Open the store, and rebuild the index from existing segments
+     *
+     * @return whether the store is ready for use
+     **/
+    bool open();
+
+    /**
+     * Get the value of a key
+     *
+     * @param[in] key                          key to get
+     * @param[out] value                       value of the key
+     *
+     * @return whether the key exists
+     **/
+    bool get(const std::string &key, std::string &value) const;
+
+    /**
+     * Tell whether a key exists
+     *
+     * @param[in] key                          key to check
+     *
+     * @return whether the key exists
+     **/
+    bool exists(const std::string &key) const;
+
+    /**
+     * Append a batch of changes, which are visible to readers upon return
+     *
+     * @param[in] batch                        changes to append
+     *
+     * @return sequence number of the batch for sync(), or 0 on failure
+     **/
+    unsigned long int write(const WriteBatch &batch);
+
+    /**
+     * Wait until a batch is flushed to disk if sync on commit is enabled; concurrent callers are served by a single flush
+     *
+     * @param[in] seq                          sequence number of the batch returned by write()
+     *
+     * @return whether the batch is persisted
+     **/
+    bool sync(unsigned long int seq);
+
+    /**
+     * Append a batch of changes, and wait until they are persisted if sync on commit is enabled
+     *
+     * @param[in] batch                        changes to commit
+     *
+     * @return whether the changes are committed
+     **/
+    bool commit(const WriteBatch &batch);
+
+    /**
+     * Get the keys with a prefix, and optionally their values, in key order
+     *
+     * @param[in] prefix                       prefix of keys
+     * @param[in] startAfter                   only return keys ordered after this key, empty to start from the first key
+     * @param[in] maxNumKeys                   max. number of keys to return, 0 for no limit
+     * @param[out] keys                        keys found (appended)
+     * @param[out] values                      values of the keys found (appended), NULL if not needed
+     *
+     * @return whether more keys with the prefix remain after the returned ones
+     **/
+    bool scan(const std::string &prefix, const std::string &startAfter, size_t maxNumKeys, std::vector<std::string> &keys, std::vector<std::string> *values = 0) const;
+
+    /**
+     * Count the keys with a prefix
+     *
+     * @param[in] prefix                       prefix of keys
+     *
+     * @return number of keys with the prefix
+     **/
+    unsigned long int count(const std::string &prefix) const;
+
+    /**
+     * Compact the sealed segments with too little live data
+     *
+     * @return number of segments removed
+     **/
+    int compact();
+
+private:
+    struct Segment {
+        unsigned int id;                       /**< segment id */
+        std::string path;                      /**< path of the segment file */
+        int fd;                                /**< file descriptor of the segment file */
+        char *base;                            /**< start of the mapped segment file */
+        size_t capacity;                       /**< size of the segment file */
+        size_t used;                           /**< number of bytes appended */
+        size_t synced;                         /**< number of bytes flushed to disk */
+        size_t live;                           /**< number of bytes of records still referenced by the index */
+
+        Segment();
+        ~Segment();
+    };
+
+    struct Location {
+        unsigned int segment;                  /**< id of the segment holding the value */
+        size_t offset;                         /**< offset of the value in the segment */
+        size_t length;                         /**< length of the value */
+        size_t recordSize;                     /**< size of the operation holding the key and value */
+    };
+
+    static void *runCompaction(void *arg);
+
+    std::shared_ptr<Segment> openSegment(unsigned int id, size_t minCapacity, bool create);
+    bool replaySegment(Segment &segment, bool last);
+    unsigned long int append(const WriteBatch &batch);
+    bool persist(unsigned long int seq);
+    bool flush(unsigned long int &seq);
+    bool compactSegment(unsigned int id);
+    void applyPut(const std::string &key, const Location &loc);
+    void applyRemove(const std::string &key);
+    std::string genSegmentPath(unsigned int id) const;
+
+    std::string _dir;                          /**< directory of the segment files */
+    size_t _segmentSize;                       /**< size of a new segment file */
+    bool _syncOnCommit;                        /**< whether commits wait for the flush to disk */
+    int _compactionInterval;                   /**< time between compaction checks in seconds */
+    int _compactionThreshold;                  /**< percentage of live data below which a sealed segment is compacted */
+
+    mutable std::shared_mutex _lock;           /**< lock on the index and segments */
+    std::map<std::string, Location> _index;    /**< key -> location of the value */
+    std::map<unsigned int, std::shared_ptr<Segment> > _segments; /**< segment id -> segment */
+    std::shared_ptr<Segment> _active;          /**< segment to append to */
+    unsigned long int _seq;                    /**< sequence number of the last batch appended */
+
+    std::mutex _syncLock;                      /**< lock on the flush state */
+    std::condition_variable _syncCv;           /**< signal on flush completion */
+    bool _syncing;                             /**< whether a flush is in progress */
+    unsigned long int _syncedSeq;              /**< sequence number of the last batch flushed */
+
+    pthread_t _compactor;                      /**< background compaction thread */
+    bool _compactorStarted;                    /**< whether the compaction thread is running */
+    std::mutex _compactionLock;                /**< lock on the compaction state */
+    std::condition_variable _compactionCv;     /**< signal on termination */
+    bool _running;                             /**< whether the compaction thread keeps running */
+};
+
+#endif // define __LOG_STORE_HH__
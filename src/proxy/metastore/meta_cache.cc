@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <functional>
+
+#include "meta_cache.hh"
+
+MetaCache::MetaCache(unsigned long int capacity, int ttl, int numShards) {
+    if (numShards < 1) numShards = 1;
+    for (int i = 0; i < numShards; i++) {
+        _shards.push_back(new CacheShard());
+        _shards.back()->epoch = 0;
+    }
+    _shardCapacity = (capacity + numShards - 1) / numShards;
+    _ttl = ttl > 0? ttl : 0;
+    _numHits = 0;
+    _numMisses = 0;
+}
+
+MetaCache::~MetaCache() {
+    clear();
+    for (size_t i = 0; i < _shards.size(); i++) {
+        delete _shards.at(i);
+    }
+    _shards.clear();
+}
+
+bool MetaCache::get(const std::string &key, File &f, int getBlocks) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    auto it = shard.map.find(key);
+    if (it == shard.map.end()) {
+        _numMisses++;
+        return false;
+    }
+
+    // drop expired entries
+    if (it->second.expiry != 0 && it->second.expiry <= time(NULL)) {
+        removeEntry(shard, it);
+        _numMisses++;
+        return false;
+    }
+
+    // only the current version is cached
+    if (f.version != -1 && f.version != it->second.file->version) {
+        _numMisses++;
+        return false;
+    }
+
+    // move to the front of lru list
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruIt);
+    copyMeta(*it->second.file, f, getBlocks);
+    _numHits++;
+    return true;
+}
+
+unsigned long int MetaCache::getEpoch(const std::string &key) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    return shard.epoch;
+}
+
+void MetaCache::put(const std::string &key, const File &f, unsigned long int epoch) {
+    if (_shardCapacity == 0)
+        return;
+
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    // the metadata read may be stale if the shard is invalidated since
+    if (shard.epoch != epoch)
+        return;
+
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        removeEntry(shard, it);
+    }
+
+    // evict the least recently used file
+    if (shard.map.size() >= _shardCapacity) {
+        removeEntry(shard, shard.map.find(shard.lru.back()));
+    }
+
+    Entry entry;
+    entry.file = new File();
+    copyMeta(f, *entry.file, /* all blocks */ 3);
+    entry.expiry = _ttl > 0? time(NULL) + _ttl : 0;
+    shard.lru.push_front(key);
+    entry.lruIt = shard.lru.begin();
+    shard.map.insert(std::make_pair(key, entry));
+}
+
+void MetaCache::updateTimestamps(const std::string &key, const File &f) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    auto it = shard.map.find(key);
+    if (it == shard.map.end())
+        return;
+
+    File *cf = it->second.file;
+    cf->atime = f.atime;
+    cf->mtime = f.mtime;
+    cf->tctime = f.tctime;
+}
+
+void MetaCache::invalidate(const std::string &key) {
+    CacheShard &shard = getShard(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+
+    shard.epoch++;
+
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        removeEntry(shard, it);
+    }
+}
+
+void MetaCache::clear() {
+    for (size_t i = 0; i < _shards.size(); i++) {
+        CacheShard &shard = *_shards.at(i);
+        std::lock_guard<std::mutex> lk(shard.lock);
+        shard.epoch++;
+        for (auto it = shard.map.begin(); it != shard.map.end(); it++) {
+            delete it->second.file;
+        }
+        shard.map.clear();
+        shard.lru.clear();
+    }
+}
+
+void MetaCache::getStats(unsigned long int &numHits, unsigned long int &numMisses) const {
+    numHits = _numHits;
+    numMisses = _numMisses;
+}
+
+MetaCache::CacheShard &MetaCache::getShard(const std::string &key) {
+    return *_shards.at(std::hash<std::string>{}(key) % _shards.size());
+}
+
+void MetaCache::removeEntry(CacheShard &shard, std::unordered_map<std::string, Entry>::iterator it) {
+    if (it == shard.map.end())
+        return;
+    delete it->second.file;
+    shard.lru.erase(it->second.lruIt);
+    shard.map.erase(it);
+}
+
+void MetaCache::copyMeta(const File &src, File &dst, int getBlocks) {
+    dst.uuid = src.uuid;
+    dst.size = src.size;
+    dst.numStripes = src.numStripes;
+    dst.isDeleted = src.isDeleted;
+    dst.copyVersionControlInfo(src);
+    dst.copyTimeStamps(src);
+    dst.copyFileChecksum(src);
+    dst.storageClass = src.storageClass;
+    dst.codingMeta.copyMeta(src.codingMeta);
+    // copy the staged info by fields, as the staged coding state is not shared
+    dst.staged.size = src.staged.size;
+    dst.staged.storageClass = src.staged.storageClass;
+    dst.staged.mtime = src.staged.mtime;
+    dst.staged.codingMeta.copyMeta(src.staged.codingMeta, /* parameters only */ true);
+    dst.copyChunkInfo(src);
+    if (getBlocks == 1 || getBlocks == 3)
+        dst.uniqueBlocks = src.uniqueBlocks;
+    if (getBlocks == 2 || getBlocks == 3)
+        dst.duplicateBlocks = src.duplicateBlocks;
+}
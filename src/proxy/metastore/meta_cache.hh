@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __META_CACHE_HH__
+#define __META_CACHE_HH__
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <time.h>
+
+#include "../../ds/file.hh"
+
+class MetaCache {
+public:
+
+    /**
+     * Bounded in-memory cache of the metadata of the current version of files
+     *
+     * Entries are invalidated by the metadata store on changes; an optional time-to-live bounds
+     * the staleness in case an invalidation is missed.
+     *
+     * @param[in] capacity                 max. number of files to cache
+     * @param[in] ttl                      max. time to keep an entry (in seconds), 0 to keep until invalidated or evicted
+     * @param[in] numShards                number of shards in the cache
+     **/
+    MetaCache(unsigned long int capacity, int ttl, int numShards = 16);
+    ~MetaCache();
+
+    /**
+     * Get the metadata of a file
+     *
+     * @param[in] key                      cache key of the file
+     * @param[in,out] f                    file with the version to get (-1 for the current one), and other fields are filled on cache hit
+     * @param[in] getBlocks                type of blocks fingerprints to get, see MetaStore::getMeta()
+     *
+     * @return whether the metadata is found in the cache
+     **/
+    bool get(const std::string &key, File &f, int getBlocks);
+
+    /**
+     * Get the invalidation epoch of a file, to capture before reading the metadata from the metadata store
+     *
+     * @param[in] key                      cache key of the file
+     *
+     * @return the invalidation epoch
+     **/
+    unsigned long int getEpoch(const std::string &key);
+
+    /**
+     * Add the metadata of the current version of a file, with all blocks, unless it is invalidated since the epoch
+     *
+     * @param[in] key                      cache key of the file
+     * @param[in] f                        metadata of the file
+     * @param[in] epoch                    invalidation epoch captured before reading the metadata
+     **/
+    void put(const std::string &key, const File &f, unsigned long int epoch);
+
+    /**
+     * Update the timestamps of a cached file, without invalidating the entry
+     *
+     * @param[in] key                      cache key of the file
+     * @param[in] f                        file with the new timestamps
+     **/
+    void updateTimestamps(const std::string &key, const File &f);
+
+    /**
+     * Remove the metadata of a file
+     *
+     * @param[in] key                      cache key of the file
+     **/
+    void invalidate(const std::string &key);
+
+    /**
+     * Remove the metadata of all files
+     **/
+    void clear();
+
+    /**
+     * Get the cache statistics
+     *
+     * @param[out] numHits                 number of lookups served by the cache
+     * @param[out] numMisses               number of lookups not served by the cache
+     **/
+    void getStats(unsigned long int &numHits, unsigned long int &numMisses) const;
+
+private:
+
+    struct Entry {
+        File *file;                                                 /**< cached metadata */
+        time_t expiry;                                              /**< time to expire, 0 for never */
+        std::list<std::string>::iterator lruIt;                     /**< position in lru list */
+    };
+
+    struct CacheShard {
+        std::mutex lock;                                            /**< lock on the shard */
+        std::list<std::string> lru;                                 /**< keys in least-recently-used order, most recent first */
+        std::unordered_map<std::string, Entry> map;                 /**< key -> entry */
+        unsigned long int epoch;                                    /**< number of invalidations on the shard */
+    };
+
+    CacheShard &getShard(const std::string &key);
+    void removeEntry(CacheShard &shard, std::unordered_map<std::string, Entry>::iterator it);
+
+    static void copyMeta(const File &src, File &dst, int getBlocks);
+
+    std::vector<CacheShard*> _shards;                               /**< shards of the cache */
+    unsigned long int _shardCapacity;                               /**< max. number of files per shard */
+    int _ttl;                                                       /**< time-to-live of entries (in seconds) */
+
+    std::atomic<unsigned long int> _numHits;                        /**< number of lookups served by the cache */
+    std::atomic<unsigned long int> _numMisses;                      /**< number of lookups not served by the cache */
+};
+
+#endif // define __META_CACHE_HH__
@@ -0,0 +1,335 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>  // std::min()
+
+#include "meta_codec.hh"
+
+// version of the file metadata encoding
+#define META_CODEC_FILE_VERSION        (1)
+// version of the block list encoding
+#define META_CODEC_BLOCK_LIST_VERSION  (1)
+// flags of the file metadata encoding
+#define META_CODEC_FLAG_SUMMARY        (0x1)
+// max. length of a varint
+#define MAX_VARINT_LENGTH              (10)
+
+void MetaCodec::encodeFile(const File &f, std::string &out, bool withSummary) {
+    int numChunks = f.numChunks > 0? f.numChunks : 0;
+    bool isEmptyFile = f.size == 0;
+    int codingStateSize = isEmptyFile || f.codingMeta.codingState == NULL? 0 : f.codingMeta.codingStateSize;
+
+    out.reserve(out.size() + 128 + f.storageClass.size() + f.staged.storageClass.size() + codingStateSize + numChunks * (MD5_DIGEST_LENGTH + 2 * MAX_VARINT_LENGTH + 1));
+
+    out.push_back((char) META_CODEC_FILE_VERSION);
+    out.push_back((char) (withSummary? META_CODEC_FLAG_SUMMARY : 0));
+
+    if (withSummary) {
+        putVarint(out, f.size);
+        putSignedVarint(out, f.version);
+        putSignedVarint(out, f.ctime);
+        putSignedVarint(out, f.atime);
+        putSignedVarint(out, f.mtime);
+        putSignedVarint(out, f.tctime);
+        out.append((const char *) f.md5, MD5_DIGEST_LENGTH);
+        out.push_back((char) (isEmptyFile? f.isDeleted : 0));
+        out.append((const char *) f.uuid.data, f.uuid.size());
+        putString(out, f.storageClass);
+        putVarint(out, f.staged.size);
+        putSignedVarint(out, f.staged.mtime);
+    }
+
+    // storage policy
+    putSignedVarint(out, f.numStripes);
+    putCodingParameters(out, f.codingMeta);
+    putVarint(out, codingStateSize);
+    if (codingStateSize > 0)
+        out.append((const char *) f.codingMeta.codingState, codingStateSize);
+    putString(out, f.staged.storageClass);
+    putCodingParameters(out, f.staged.codingMeta);
+
+    // chunks: container ids (as deltas), sizes, checksums, and corrupted flags (as a bitmap)
+    putVarint(out, numChunks);
+    int prevContainerId = 0;
+    for (int i = 0; i < numChunks; i++) {
+        putSignedVarint(out, (long int) f.containerIds[i] - prevContainerId);
+        prevContainerId = f.containerIds[i];
+    }
+    for (int i = 0; i < numChunks; i++) {
+        putSignedVarint(out, f.chunks[i].size);
+    }
+    for (int i = 0; i < numChunks; i++) {
+        out.append((const char *) f.chunks[i].md5, MD5_DIGEST_LENGTH);
+    }
+    for (int i = 0; i < numChunks; i += 8) {
+        unsigned char bits = 0;
+        for (int j = 0; j < 8 && i + j < numChunks; j++) {
+            if (f.chunksCorrupted && f.chunksCorrupted[i + j])
+                bits |= 1 << j;
+        }
+        out.push_back((char) bits);
+    }
+}
+
+bool MetaCodec::decodeFile(const char *in, size_t length, File &f) {
+    const char *end = in + length;
+
+    if (length < 2 || in[0] != META_CODEC_FILE_VERSION)
+        return false;
+    bool withSummary = in[1] & META_CODEC_FLAG_SUMMARY;
+    in += 2;
+
+    if (withSummary) {
+        unsigned char isDeleted = 0;
+        if (
+            !getVarintAs(in, end, f.size)
+            || !getSignedVarintAs(in, end, f.version)
+            || !getSignedVarintAs(in, end, f.ctime)
+            || !getSignedVarintAs(in, end, f.atime)
+            || !getSignedVarintAs(in, end, f.mtime)
+            || !getSignedVarintAs(in, end, f.tctime)
+            || !getBytes(in, end, f.md5, MD5_DIGEST_LENGTH)
+            || !getBytes(in, end, &isDeleted, 1)
+            || !getBytes(in, end, f.uuid.data, f.uuid.size())
+            || !getString(in, end, f.storageClass)
+            || !getVarintAs(in, end, f.staged.size)
+            || !getSignedVarintAs(in, end, f.staged.mtime)
+        )
+            return false;
+        f.isDeleted = isDeleted;
+    }
+
+    // storage policy
+    int codingStateSize = 0;
+    if (
+        !getSignedVarintAs(in, end, f.numStripes)
+        || !getCodingParameters(in, end, f.codingMeta)
+        || !getVarintAs(in, end, codingStateSize)
+        || codingStateSize < 0
+        || end - in < codingStateSize
+    )
+        return false;
+    delete [] f.codingMeta.codingState;
+    f.codingMeta.codingState = 0;
+    f.codingMeta.codingStateSize = codingStateSize;
+    if (codingStateSize > 0) {
+        f.codingMeta.codingState = new unsigned char [codingStateSize];
+        getBytes(in, end, f.codingMeta.codingState, codingStateSize);
+    }
+    if (!getString(in, end, f.staged.storageClass) || !getCodingParameters(in, end, f.staged.codingMeta))
+        return false;
+
+    // chunks
+    unsigned long int numChunks = 0;
+    if (!getVarint(in, end, numChunks) || numChunks > (unsigned long int) (end - in))
+        return false;
+    f.numChunks = numChunks;
+    if (!f.initChunksAndContainerIds())
+        return false;
+    long int containerId = 0, delta = 0;
+    for (int i = 0; i < f.numChunks; i++) {
+        if (!getSignedVarint(in, end, delta))
+            return false;
+        containerId += delta;
+        f.containerIds[i] = containerId;
+    }
+    for (int i = 0; i < f.numChunks; i++) {
+        if (!getSignedVarintAs(in, end, f.chunks[i].size))
+            return false;
+    }
+    for (int i = 0; i < f.numChunks; i++) {
+        if (!getBytes(in, end, f.chunks[i].md5, MD5_DIGEST_LENGTH))
+            return false;
+    }
+    for (int i = 0; i < f.numChunks; i += 8) {
+        unsigned char bits = 0;
+        if (!getBytes(in, end, &bits, 1))
+            return false;
+        for (int j = 0; j < 8 && i + j < f.numChunks; j++) {
+            f.chunksCorrupted[i + j] = bits & (1 << j);
+        }
+    }
+    for (int i = 0; i < f.numChunks; i++) {
+        f.chunks[i].setId(f.namespaceId, f.uuid, i);
+        f.chunks[i].data = 0;
+        f.chunks[i].freeData = true;
+        f.chunks[i].fileVersion = f.version;
+    }
+
+    return in == end;
+}
+
+void MetaCodec::encodeUniqueBlockLists(const File::UniqueBlockMap &blocks, std::vector<std::string> &lists, size_t segmentSize) {
+    size_t bid = 0;
+    unsigned long int prevEnd = 0;
+    long int prevPhysicalEnd = 0;
+    for (auto it = blocks.begin(); it != blocks.end(); it++, bid++) {
+        // each segment is decoded independently
+        if (bid % segmentSize == 0) {
+            lists.emplace_back();
+            lists.back().reserve(1 + std::min(blocks.size() - bid, segmentSize) * (FINGERPRINT_MAX_SIZE + 4));
+            lists.back().push_back((char) META_CODEC_BLOCK_LIST_VERSION);
+            prevEnd = 0;
+            prevPhysicalEnd = 0;
+        }
+        std::string &list = lists.back();
+        const Fingerprint &fp = it->second.first;
+        putSignedVarint(list, (long int) (it->first._offset - prevEnd));
+        putVarint(list, it->first._length);
+        list.push_back((char) fp.size());
+        list.append((const char *) fp.data(), fp.size());
+        putSignedVarint(list, (long int) it->second.second - prevPhysicalEnd);
+        prevEnd = it->first._offset + it->first._length;
+        prevPhysicalEnd = (long int) it->second.second + it->first._length;
+    }
+}
+
+void MetaCodec::encodeDuplicateBlockLists(const File::DuplicateBlockMap &blocks, std::vector<std::string> &lists, size_t segmentSize) {
+    size_t bid = 0;
+    unsigned long int prevEnd = 0;
+    for (auto it = blocks.begin(); it != blocks.end(); it++, bid++) {
+        // each segment is decoded independently
+        if (bid % segmentSize == 0) {
+            lists.emplace_back();
+            lists.back().reserve(1 + std::min(blocks.size() - bid, segmentSize) * (FINGERPRINT_MAX_SIZE + 3));
+            lists.back().push_back((char) META_CODEC_BLOCK_LIST_VERSION);
+            prevEnd = 0;
+        }
+        std::string &list = lists.back();
+        putSignedVarint(list, (long int) (it->first._offset - prevEnd));
+        putVarint(list, it->first._length);
+        list.push_back((char) it->second.size());
+        list.append((const char *) it->second.data(), it->second.size());
+        prevEnd = it->first._offset + it->first._length;
+    }
+}
+
+bool MetaCodec::decodeUniqueBlockList(const char *list, size_t length, File::UniqueBlockMap &blocks) {
+    const char *end = list + length;
+    if (length < 1 || list[0] != META_CODEC_BLOCK_LIST_VERSION)
+        return false;
+    list++;
+
+    BlockLocation::InObjectLocation loc;
+    Fingerprint fp;
+    unsigned long int prevEnd = 0;
+    long int prevPhysicalEnd = 0, delta = 0, physicalDelta = 0;
+    unsigned char fpLength = 0;
+    char fpBytes[FINGERPRINT_MAX_SIZE];
+    while (list < end) {
+        if (
+            !getSignedVarint(list, end, delta)
+            || !getVarintAs(list, end, loc._length)
+            || !getBytes(list, end, &fpLength, 1)
+            || fpLength > FINGERPRINT_MAX_SIZE
+            || !getBytes(list, end, fpBytes, fpLength)
+            || !getSignedVarint(list, end, physicalDelta)
+        )
+            return false;
+        loc._offset = prevEnd + delta;
+        fp.set(fpBytes, fpLength);
+        int pOffset = prevPhysicalEnd + physicalDelta;
+        blocks.emplace_hint(blocks.end(), std::make_pair(loc, std::make_pair(fp, pOffset)));
+        prevEnd = loc._offset + loc._length;
+        prevPhysicalEnd = (long int) pOffset + loc._length;
+    }
+    return true;
+}
+
+bool MetaCodec::decodeDuplicateBlockList(const char *list, size_t length, File::DuplicateBlockMap &blocks) {
+    const char *end = list + length;
+    if (length < 1 || list[0] != META_CODEC_BLOCK_LIST_VERSION)
+        return false;
+    list++;
+
+    BlockLocation::InObjectLocation loc;
+    Fingerprint fp;
+    unsigned long int prevEnd = 0;
+    long int delta = 0;
+    unsigned char fpLength = 0;
+    char fpBytes[FINGERPRINT_MAX_SIZE];
+    while (list < end) {
+        if (
+            !getSignedVarint(list, end, delta)
+            || !getVarintAs(list, end, loc._length)
+            || !getBytes(list, end, &fpLength, 1)
+            || fpLength > FINGERPRINT_MAX_SIZE
+            || !getBytes(list, end, fpBytes, fpLength)
+        )
+            return false;
+        loc._offset = prevEnd + delta;
+        fp.set(fpBytes, fpLength);
+        blocks.emplace_hint(blocks.end(), std::make_pair(loc, fp));
+        prevEnd = loc._offset + loc._length;
+    }
+    return true;
+}
+
+void MetaCodec::putVarint(std::string &out, unsigned long int value) {
+    while (value >= 0x80) {
+        out.push_back((char) ((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char) value);
+}
+
+void MetaCodec::putSignedVarint(std::string &out, long int value) {
+    // zig-zag encoding keeps small negative values short
+    putVarint(out, ((unsigned long int) value << 1) ^ (unsigned long int) (value >> 63));
+}
+
+void MetaCodec::putString(std::string &out, const std::string &value) {
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+void MetaCodec::putCodingParameters(std::string &out, const CodingMeta &meta) {
+    out.push_back((char) meta.coding);
+    putSignedVarint(out, meta.n);
+    putSignedVarint(out, meta.k);
+    putSignedVarint(out, meta.f);
+    putSignedVarint(out, meta.maxChunkSize);
+}
+
+bool MetaCodec::getVarint(const char *&in, const char *end, unsigned long int &value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 7 * MAX_VARINT_LENGTH; shift += 7) {
+        unsigned char byte = *in++;
+        value |= (unsigned long int) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool MetaCodec::getSignedVarint(const char *&in, const char *end, long int &value) {
+    unsigned long int v = 0;
+    if (!getVarint(in, end, v))
+        return false;
+    value = (long int) (v >> 1) ^ -(long int) (v & 1);
+    return true;
+}
+
+bool MetaCodec::getBytes(const char *&in, const char *end, void *value, size_t length) {
+    if ((size_t) (end - in) < length)
+        return false;
+    memcpy(value, in, length);
+    in += length;
+    return true;
+}
+
+bool MetaCodec::getString(const char *&in, const char *end, std::string &value) {
+    unsigned long int length = 0;
+    if (!getVarint(in, end, length) || (unsigned long int) (end - in) < length)
+        return false;
+    value.assign(in, length);
+    in += length;
+    return true;
+}
+
+bool MetaCodec::getCodingParameters(const char *&in, const char *end, CodingMeta &meta) {
+    return getBytes(in, end, &meta.coding, 1)
+        && getSignedVarintAs(in, end, meta.n)
+        && getSignedVarintAs(in, end, meta.k)
+        && getSignedVarintAs(in, end, meta.f)
+        && getSignedVarintAs(in, end, meta.maxChunkSize);
+}
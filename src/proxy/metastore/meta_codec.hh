@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __META_CODEC_HH__
+#define __META_CODEC_HH__
+
+#include <string>
+#include <vector>
+
+#include "../../ds/file.hh"
+
+/**
+ * Compact binary encoding of file metadata
+ *
+ * Integers are stored as (zig-zag) varints, container ids as deltas to the previous chunk,
+ * chunk checksums back-to-back and the corrupted chunk flags as a bitmap. Block lists store
+ * offsets as deltas to the end of the previous block. Every encoded value starts with the
+ * version of the encoding.
+ **/
+class MetaCodec {
+public:
+
+    /**
+     * Encode the metadata of a file
+     *
+     * The metadata includes the number of stripes, coding metadata (current and staged), staged
+     * storage class, and chunk information. The summary (size, version, timestamps, checksum,
+     * deletion mark, uuid, storage class, staged size and modification time) is optional for
+     * stores which keep these fields elsewhere.
+     *
+     * @param[in] f                        file metadata to encode
+     * @param[out] out                     encoded metadata (appended)
+     * @param[in] withSummary              whether to include the summary of the file
+     **/
+    static void encodeFile(const File &f, std::string &out, bool withSummary = false);
+
+    /**
+     * Decode the metadata of a file
+     *
+     * The chunks and container ids of the file are (re-)allocated, and chunk ids are set using
+     * the namespace id and uuid of the file.
+     *
+     * @param[in] in                       encoded metadata
+     * @param[in] length                   length of the encoded metadata
+     * @param[in,out] f                    file to fill in
+     *
+     * @return whether the metadata is decoded successfully
+     **/
+    static bool decodeFile(const char *in, size_t length, File &f);
+
+    /**
+     * Encode the unique blocks of a file into segments of block lists
+     *
+     * @param[in] blocks                   unique blocks of a file
+     * @param[out] lists                   encoded block lists (appended)
+     * @param[in] segmentSize              max. number of blocks in each list
+     **/
+    static void encodeUniqueBlockLists(const File::UniqueBlockMap &blocks, std::vector<std::string> &lists, size_t segmentSize);
+
+    /**
+     * Encode the duplicate blocks of a file into segments of block lists
+     *
+     * @param[in] blocks                   duplicate blocks of a file
+     * @param[out] lists                   encoded block lists (appended)
+     * @param[in] segmentSize              max. number of blocks in each list
+     **/
+    static void encodeDuplicateBlockLists(const File::DuplicateBlockMap &blocks, std::vector<std::string> &lists, size_t segmentSize);
+
+    /**
+     * Decode a list of unique blocks
+     *
+     * @param[in] list                     encoded block list
+     * @param[in] length                   length of the encoded block list
+     * @param[in,out] blocks               unique blocks to add the decoded blocks to
+     *
+     * @return whether the list is decoded successfully
+     **/
+    static bool decodeUniqueBlockList(const char *list, size_t length, File::UniqueBlockMap &blocks);
+
+    /**
+     * Decode a list of duplicate blocks
+     *
+     * @param[in] list                     encoded block list
+     * @param[in] length                   length of the encoded block list
+     * @param[in,out] blocks               duplicate blocks to add the decoded blocks to
+     *
+     * @return whether the list is decoded successfully
+     **/
+    static bool decodeDuplicateBlockList(const char *list, size_t length, File::DuplicateBlockMap &blocks);
+
+private:
+    static void putVarint(std::string &out, unsigned long int value);
+    static void putSignedVarint(std::string &out, long int value);
+    static void putString(std::string &out, const std::string &value);
+    static void putCodingParameters(std::string &out, const CodingMeta &meta);
+
+    static bool getVarint(const char *&in, const char *end, unsigned long int &value);
+    static bool getSignedVarint(const char *&in, const char *end, long int &value);
+    static bool getBytes(const char *&in, const char *end, void *value, size_t length);
+    static bool getString(const char *&in, const char *end, std::string &value);
+    static bool getCodingParameters(const char *&in, const char *end, CodingMeta &meta);
+
+    template <typename T> static bool getVarintAs(const char *&in, const char *end, T &value) {
+        unsigned long int v = 0;
+        if (!getVarint(in, end, v)) return false;
+        value = (T) v;
+        return true;
+    }
+
+    template <typename T> static bool getSignedVarintAs(const char *&in, const char *end, T &value) {
+        long int v = 0;
+        if (!getSignedVarint(in, end, v)) return false;
+        value = (T) v;
+        return true;
+    }
+};
+
+#endif // define __META_CODEC_HH__
@@ -34,6 +34,25 @@ public:
      **/
     virtual bool getMeta(File &f, int getBlocks = 3) = 0;
 
+    /**
+     * Get the metadata of multiple files, in as few round trips to the metadata store as possible
+     *
+     * @param[in,out] files the file structures containing the names and namespace ids of the files to get, and other fields would be filled with info from the metadata store
+     * @param[out] found whether the metadata of each file is retrieved
+     * @param[in] getBlocks type of blocks fingerprints to get, see getMeta()
+     *
+     * @return number of files with metadata retrieved
+     **/
+    virtual int getMetaMulti(const std::vector<File *> &files, std::vector<bool> &found, int getBlocks = 3) {
+        int numFound = 0;
+        found.assign(files.size(), false);
+        for (size_t i = 0; i < files.size(); i++) {
+            found.at(i) = getMeta(*files.at(i), getBlocks);
+            numFound += found.at(i)? 1 : 0;
+        }
+        return numFound;
+    }
+
     /**
      * Delete the file metadata from the metadata store
      *
@@ -96,6 +115,22 @@ public:
      **/
     virtual unsigned int getFileList(FileInfo **list, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "") = 0;
 
+    /**
+     * Get a page of file names, for listing files incrementally
+     *
+     * @param[out] list        address of the pointer, which will hold the allocated list of file info (name and size)
+     * @param[in,out] cursor   continuation token, start with "0" and the listing completes when "0" is returned
+     * @param[in]  pageSize    hint on the number of files to return
+     * @param[in]  namespaceId the namespace id of the files to list
+     * @param[in]  withSize    whether to include file size in the list
+     * @param[in]  withTime    whether to include file timestamps in the list
+     * @param[in]  withVersions  whether to include versions in the file info record
+     * @param[in]  prefix      the prefix of files to list
+     *
+     * @return the number of files in the list
+     **/
+    virtual unsigned int getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "") = 0;
+
     /**
      * Get a list of all folder names
      *
@@ -204,22 +239,52 @@ public:
     virtual bool getNextFileForTaskCheck(File &file) = 0;
 
     /**
-     * Lock file
+     * Lock file, either exclusively for modifications, or shared with other readers
      *
      * @param[in] file          file structure containing the name and namespace id of file to lock
+     * @param[in] shared        whether to take a shared lock, which is compatible with other shared locks but not an exclusive one
      *
      * @return whether the file is locked
      **/
-    virtual bool lockFile(const File &file) = 0;
+    virtual bool lockFile(const File &file, bool shared = false) = 0;
+
+    /**
+     * Lock multiple files, in as few round trips to the metadata store as possible
+     *
+     * @param[in] files         file structures containing the names and namespace ids of files to lock
+     * @param[out] locked       whether each file is locked
+     *
+     * @return number of files locked
+     **/
+    virtual int lockFilesMulti(const std::vector<File *> &files, std::vector<bool> &locked) {
+        int numLocked = 0;
+        locked.assign(files.size(), false);
+        for (size_t i = 0; i < files.size(); i++) {
+            locked.at(i) = lockFile(*files.at(i));
+            numLocked += locked.at(i)? 1 : 0;
+        }
+        return numLocked;
+    }
 
     /**
      * Unlock file
      *
      * @param[in] file          file structure containing the name and namespace id of file to unlock
+     * @param[in] shared        whether the lock to release is a shared one
      *
      * @return whether the file is unlocked
      **/
-    virtual bool unlockFile(const File &file) = 0;
+    virtual bool unlockFile(const File &file, bool shared = false) = 0;
+
+    /**
+     * Get the fencing token of the exclusive lock held on a file; tokens increase with every lock granted,
+     * so a smaller token identifies a holder whose lock has been taken over since
+     *
+     * @param[in] file          file structure containing the name and namespace id of the locked file
+     *
+     * @return fencing token of the lock, or 0 if the file is not exclusively locked by this store instance
+     **/
+    virtual unsigned long int getLockToken(const File &file) { return 0; }
 
     /**
      * Add a chunk modification to the file journal
@@ -246,6 +311,41 @@ public:
      **/
     virtual bool updateChunkInJournal(const File &file, const Chunk &chunk, bool isWrite, bool deleteRecord, int containerId) = 0;
 
+    /**
+     * Add the modifications of a group of chunks, e.g., a stripe or all chunks of a request, to the file journal in one operation
+     *
+     * @param[in] file          file structure containing the name, namespace id, and version of a file
+     * @param[in] chunks        chunk structures containing the chunk ids, checksums, and sizes
+     * @param[in] containerIds  container ids of the chunks
+     * @param[in] isWrite       whether the operations are writes (or deletes otherwise)
+     *
+     * @return true if all journaling records are added successfully; false otherwise
+     **/
+    virtual bool addChunksToJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite) {
+        bool okay = chunks.size() == containerIds.size();
+        for (size_t i = 0; okay && i < chunks.size(); i++)
+            okay = addChunkToJournal(file, chunks.at(i), containerIds.at(i), isWrite);
+        return okay;
+    }
+
+    /**
+     * Update/Remove the modification records of a group of chunks in the file journal in one operation
+     *
+     * @param[in] file          file structure containing the name, namespace id, and version of a file
+     * @param[in] chunks        chunk structures containing the chunk ids, checksums, and sizes
+     * @param[in] containerIds  container ids of the chunks
+     * @param[in] isWrite       whether the operations are writes (or deletes otherwise)
+     * @param[in] deleteRecord  whether the records should be deleted instead of updated
+     *
+     * @return true if all journaling records are updated/removed successfully; false otherwise
+     **/
+    virtual bool updateChunksInJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite, bool deleteRecord) {
+        bool okay = chunks.size() == containerIds.size();
+        for (size_t i = 0; i < chunks.size() && i < containerIds.size(); i++)
+            okay = updateChunkInJournal(file, chunks.at(i), isWrite, deleteRecord, containerIds.at(i)) && okay;
+        return okay;
+    }
+
     /**
      * Get the list of journaled chunk modifications of a file
      *
@@ -271,6 +371,120 @@ public:
      **/
     virtual bool fileHasJournal(const File &file) = 0;
 
+    /**
+     * Store the block locations of a list of fingerprints in the deduplication index
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in] fingerprints  list of fingerprints to store
+     * @param[in] locations     list of block locations ordered by the list of fingerprints
+     *
+     * @return true if all records are stored successfully; false otherwise
+     **/
+    virtual bool putFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations) = 0;
+
+    /**
+     * Get the block locations of a list of fingerprints from the deduplication index
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in] fingerprints  list of fingerprints to get
+     * @param[out] locations    list of block locations ordered by the list of fingerprints, invalid locations for fingerprints not found
+     *
+     * @return the number of fingerprints found, or -1 on error
+     **/
+    virtual int getFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) = 0;
+
+    /**
+     * Remove a list of fingerprints from the deduplication index
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in] fingerprints  list of fingerprints to remove
+     *
+     * @return true if all records are removed successfully; false otherwise
+     **/
+    virtual bool deleteFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) = 0;
+
+    /**
+     * Scan the deduplication index of a namespace incrementally
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in,out] cursor    scan cursor, start with "0" and the scan completes when "0" is returned
+     * @param[in] batchSize     hint on the number of records to return
+     * @param[out] fingerprints list of fingerprints scanned
+     * @param[out] locations    list of block locations ordered by the list of fingerprints
+     *
+     * @return whether the scan is successful
+     **/
+    virtual bool scanFingerprints(unsigned char namespaceId, std::string &cursor, int batchSize, std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) = 0;
+
+    /**
+     * Update the reference counts of a list of fingerprints; the count of a fingerprint is removed once it drops to zero
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in] fingerprints  list of fingerprints to update
+     * @param[in] deltas        list of changes to the reference counts ordered by the list of fingerprints
+     * @param[out] counts       list of reference counts after the update ordered by the list of fingerprints
+     *
+     * @return true if all counts are updated successfully; false otherwise
+     **/
+    virtual bool updateFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<int> &deltas, std::vector<long long> &counts) = 0;
+
+    /**
+     * Get the reference counts of a list of fingerprints
+     *
+     * @param[in] namespaceId   namespace id of the fingerprints
+     * @param[in] fingerprints  list of fingerprints to get
+     * @param[out] counts       list of reference counts ordered by the list of fingerprints, 0 for fingerprints not referenced
+     *
+     * @return true if all counts are retrieved successfully; false otherwise
+     **/
+    virtual bool getFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) = 0;
+
+    /**
+     * Keep the metadata of a removed file version whose blocks are still referenced by other files;
+     * the metadata remains accessible via getMeta() with the version specified, but the file is not listed
+     *
+     * @param[in] file          file structure containing the metadata of the removed file version
+     *
+     * @return whether the metadata is kept
+     **/
+    virtual bool putRetiredMeta(const File &file) = 0;
+
+    /**
+     * Remove the metadata of a retired file version
+     *
+     * @param[in] file          file structure containing the name, namespace id and version of the retired file
+     *
+     * @return whether the metadata is removed
+     **/
+    virtual bool deleteRetiredMeta(const File &file) = 0;
+
+    /**
+     * Get the retired file versions incrementally
+     *
+     * @param[in,out] cursor    scan cursor, start with "0" and the scan completes when "0" is returned
+     * @param[in] numFiles      max. number of files to return
+     * @param[out] files        pointer to an array of pre-allocated file structures in size numFiles, which will hold the name, namespace id and version of retired files
+     *
+     * @return the number of files returned, or -1 on error
+     **/
+    virtual int getRetiredFiles(std::string &cursor, int numFiles, File files[]) = 0;
+
+    /**
+     * Tell the number of retired file versions
+     *
+     * @return number of retired file versions
+     **/
+    virtual unsigned long int getNumRetiredFiles() = 0;
+
+    /**
+     * Tell the most recent version ever retired for a file name
+     *
+     * @param[in] file          file structure containing the name and namespace id of the file
+     *
+     * @return the most recent retired version, or -1 if none
+     **/
+    virtual int getLastRetiredVersion(const File &file) = 0;
+
 private:
 
 };
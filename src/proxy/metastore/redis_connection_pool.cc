@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <glog/logging.h>
+
+#include "redis_connection_pool.hh"
+
+RedisConnectionPool::RedisConnectionPool(const std::string &ip, unsigned short port, int numConnections) {
+    _connected = true;
+    if (numConnections < 1) numConnections = 1;
+    for (int i = 0; i < numConnections; i++) {
+        redisContext *cxt = redisConnect(ip.c_str(), port);
+        if (cxt == NULL || cxt->err) {
+            if (cxt) {
+                LOG(ERROR) << "Redis connection error " << cxt->errstr;
+                redisFree(cxt);
+            } else {
+                LOG(ERROR) << "Failed to allocate Redis context";
+            }
+            _connected = false;
+            break;
+        }
+        _connections.push_back(cxt);
+    }
+    _idle = _connections;
+}
+
+RedisConnectionPool::~RedisConnectionPool() {
+    for (size_t i = 0; i < _connections.size(); i++) {
+        redisFree(_connections.at(i));
+    }
+    _connections.clear();
+    _idle.clear();
+}
+
+redisContext *RedisConnectionPool::acquire() {
+    std::unique_lock<std::mutex> lk(_lock);
+    _cv.wait(lk, [this] { return !_idle.empty(); });
+    redisContext *cxt = _idle.back();
+    _idle.pop_back();
+    return cxt;
+}
+
+void RedisConnectionPool::release(redisContext *cxt) {
+    if (cxt == NULL)
+        return;
+
+    // recover the broken connection before others use it
+    if (cxt->err) {
+        LOG(WARNING) << "Reconnect to Redis after connection error " << cxt->errstr;
+        if (redisReconnect(cxt) != REDIS_OK) {
+            LOG(ERROR) << "Failed to reconnect to Redis, " << cxt->errstr;
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(_lock);
+    _idle.push_back(cxt);
+    _cv.notify_one();
+}
+
+bool RedisConnectionPool::isConnected() const {
+    return _connected;
+}
+
+int RedisConnectionPool::getNumConnections() const {
+    return _connections.size();
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __REDIS_CONNECTION_POOL_HH__
+#define __REDIS_CONNECTION_POOL_HH__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <hiredis/hiredis.h>
+
+class RedisConnectionPool {
+public:
+
+    /**
+     * Pool of Redis connections to share among threads
+     *
+     * @param[in] ip                       IP address of the Redis server
+     * @param[in] port                     port of the Redis server
+     * @param[in] numConnections           number of connections to open
+     **/
+    RedisConnectionPool(const std::string &ip, unsigned short port, int numConnections);
+    ~RedisConnectionPool();
+
+    /**
+     * Check out an idle connection, wait until one is returned if all are in use
+     *
+     * @return a connection for exclusive use until released
+     **/
+    redisContext *acquire();
+
+    /**
+     * Return a connection to the pool, reconnect first if the connection is broken
+     *
+     * @param[in] cxt                      connection to return
+     **/
+    void release(redisContext *cxt);
+
+    /**
+     * Check if all connections are opened
+     *
+     * @return whether all connections are opened
+     **/
+    bool isConnected() const;
+
+    /**
+     * Get the number of connections in the pool
+     *
+     * @return number of connections
+     **/
+    int getNumConnections() const;
+
+private:
+    std::vector<redisContext *> _connections;         /**< all connections */
+    std::vector<redisContext *> _idle;                /**< connections not checked out */
+    std::mutex _lock;                                 /**< lock on the idle connection list */
+    std::condition_variable _cv;                      /**< signal on connection return */
+    bool _connected;                                  /**< whether all connections are opened */
+};
+
+class RedisConnection {
+public:
+
+    /**
+     * Connection checked out from a pool for the life time of this object
+     *
+     * @param[in] pool                     pool to check out a connection from
+     **/
+    RedisConnection(RedisConnectionPool &pool) : _pool(pool) {
+        _cxt = _pool.acquire();
+    }
+
+    ~RedisConnection() {
+        _pool.release(_cxt);
+    }
+
+    RedisConnection(const RedisConnection &) = delete;
+    RedisConnection &operator= (const RedisConnection &) = delete;
+
+    operator redisContext *() const {
+        return _cxt;
+    }
+
+    redisContext *operator-> () const {
+        return _cxt;
+    }
+
+private:
+    RedisConnectionPool &_pool;                       /**< pool of the connection */
+    redisContext *_cxt;                               /**< connection checked out */
+};
+
+#endif // define __REDIS_CONNECTION_POOL_HH__
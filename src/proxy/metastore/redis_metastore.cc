@@ -1,20 +1,28 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>  // std::sort(), std::unique()
+#include <chrono>
+#include <tuple>
 #include <stdlib.h>  // exit(), strtol()
 #include <stdio.h> // sprintf()
+#include <unistd.h>  // sleep()
+#include <sys/socket.h>  // shutdown()
 #include <boost/uuid/uuid_io.hpp>
 
 #include <glog/logging.h>
 
 #include "redis_metastore.hh"
+#include "meta_codec.hh"
 #include "../../common/config.hh"
 #include "../../common/define.hh"
 
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
-#define NUM_RESERVED_SYSTEM_KEYS   (8)
+#define NUM_RESERVED_SYSTEM_KEYS   (12)
 #define FILE_LOCK_KEY              "//snccFLock"
+#define FILE_SHARED_LOCK_KEY       "//snccFSLock"
+#define FILE_LOCK_TOKEN_KEY        "//snccFLockToken"
 #define FILE_PIN_STAGED_KEY        "//snccFPinStaged"
 #define FILE_REPAIR_KEY            "//snccFRepair"
 #define FILE_PENDING_WRITE_KEY     "//snccFPendingWrite"
@@ -22,36 +30,231 @@
 #define BG_TASK_PENDING_KEY        "//snccFBgTask"
 #define DIR_LIST_KEY               "//snccDirList"
 #define JL_LIST_KEY                "//snccJournalFSet"
+#define FP_INDEX_KEY_PREFIX        "//snccFpIndex"
+#define FP_REF_COUNT_KEY_PREFIX    "//snccFpRef"
+#define FILE_DEDUP_RETIRED_KEY     "//snccFDedupRetired"
+#define FILE_DEDUP_RETIRED_VER_KEY "//snccFDedupRetiredVer"
+#define FILE_COUNT_KEY             "//snccFCount"
+// pub/sub channel of file metadata cache invalidations
+#define META_CACHE_CHANNEL         "//snccMetaCache"
 
 #define MAX_KEY_SIZE (64)
 #define NUM_REQ_FIELDS (10)
+// max. number of attempts to update the packed chunk metadata under concurrent changes
+#define MAX_UPDATE_CHUNKS_ATTEMPTS (5)
+// number of keys to visit in each scan step when listing files
+#define FILE_LIST_SCAN_BATCH_SIZE (1000)
+
+// block list format: one hash field per block (legacy), compact binary lists of blocks (legacy), or lists packed by MetaCodec
+#define BLOCK_LIST_FORMAT_PER_BLOCK  (0)
+#define BLOCK_LIST_FORMAT_COMPACT    (1)
+#define BLOCK_LIST_FORMAT_PACKED     (2)
+// number of blocks per compact block list segment
+#define BLOCK_LIST_SEGMENT_SIZE      (65536)
+// record sizes in the compact block lists: logical offset, length, fingerprint length, fingerprint (, physical offset)
+#define DUPLICATE_BLOCK_RECORD_SIZE  (sizeof(unsigned long int) + sizeof(unsigned int) + 1 + FINGERPRINT_MAX_SIZE)
+#define UNIQUE_BLOCK_RECORD_SIZE     (DUPLICATE_BLOCK_RECORD_SIZE + sizeof(int))
+
+// file lock leases; KEYS = [exclusive lease, shared leases, token counter], ARGV = [shared ? 1 : 0, token, ttl in ms]
+// an exclusive lease is a key holding its fencing token, and shared leases are a sorted set of tokens scored by their expiry time
+#define LEASE_SCRIPT_NOW "redis.replicate_commands(); local t = redis.call('TIME'); local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000); "
+static const char LEASE_ACQUIRE_SCRIPT[] = LEASE_SCRIPT_NOW "\
+    redis.call('ZREMRANGEBYSCORE', KEYS[2], '-inf', now); \
+    if redis.call('EXISTS', KEYS[1]) == 1 then return 0 end \
+    if ARGV[1] == '0' and redis.call('ZCARD', KEYS[2]) > 0 then return 0 end \
+    local token = redis.call('INCR', KEYS[3]); \
+    if ARGV[1] == '0' then \
+        redis.call('SET', KEYS[1], token, 'PX', ARGV[3]); \
+    else \
+        redis.call('ZADD', KEYS[2], now + tonumber(ARGV[3]), token); \
+        redis.call('PEXPIRE', KEYS[2], ARGV[3]); \
+    end \
+    return token;";
+static const char LEASE_RENEW_SCRIPT[] = LEASE_SCRIPT_NOW "\
+    if ARGV[1] == '0' then \
+        if redis.call('GET', KEYS[1]) == ARGV[2] then return redis.call('PEXPIRE', KEYS[1], ARGV[3]) end \
+        return 0; \
+    end \
+    local expiry = redis.call('ZSCORE', KEYS[2], ARGV[2]); \
+    if not expiry or tonumber(expiry) < now then return 0 end \
+    redis.call('ZADD', KEYS[2], now + tonumber(ARGV[3]), ARGV[2]); \
+    redis.call('PEXPIRE', KEYS[2], ARGV[3]); \
+    return 1;";
+static const char LEASE_RELEASE_SCRIPT[] = "\
+    if ARGV[1] == '0' then \
+        if redis.call('GET', KEYS[1]) == ARGV[2] then return redis.call('DEL', KEYS[1]) end \
+        return 0; \
+    end \
+    return redis.call('ZREM', KEYS[2], ARGV[2]);";
+// metadata changes fenced by the exclusive leases of files; KEYS = [exclusive leases, keys of the commands],
+// ARGV = [number of leases, fencing tokens, min. time left on the leases in ms, commands]
+// each command is (flag, number of keys, number of other arguments, command name, other arguments), see RedisMetaStore::CommandBatch::Flag,
+// and takes its keys from KEYS in order; the commands run in order until the first error, and the replies of the commands run (0 for those skipped) are returned
+static const char FENCED_WRITE_SCRIPT[] = "\
+    local numLeases = tonumber(ARGV[1]); \
+    for i = 1, numLeases do \
+        if redis.call('GET', KEYS[i]) ~= ARGV[i + 1] or redis.call('PTTL', KEYS[i]) < tonumber(ARGV[numLeases + 2]) then \
+            return redis.error_reply('FENCED lease ' .. KEYS[i] .. ' is not held'); \
+        end \
+    end \
+    local function succeeded(r) return (type(r) == 'number' and r > 0) or (type(r) == 'table' and r.ok ~= nil) end \
+    local replies = {}; \
+    local prev = nil; \
+    local k = numLeases + 1; \
+    local i = numLeases + 3; \
+    while i <= #ARGV do \
+        local flag = ARGV[i]; \
+        local numKeys = tonumber(ARGV[i + 1]); \
+        local numArgs = tonumber(ARGV[i + 2]); \
+        local args = { ARGV[i + 3] }; \
+        for j = 0, numKeys - 1 do args[#args + 1] = KEYS[k + j] end \
+        for j = 1, numArgs do args[#args + 1] = ARGV[i + 3 + j] end \
+        k = k + numKeys; \
+        i = i + numArgs + 4; \
+        local r = 0; \
+        if flag ~= 'c' or succeeded(prev) then r = redis.pcall(unpack(args)) end \
+        replies[#replies + 1] = r; \
+        if (type(r) == 'table' and r.err) or (flag == 'r' and not succeeded(r)) then break end \
+        prev = r; \
+    end \
+    return replies;";
+// max. number of arguments of a fenced command, well below the limit of values unpacked in a Lua script (LUAI_MAXCSTACK)
+#define FENCED_WRITE_MAX_COMMAND_ARGS (4096)
+
+// journal records of a group of chunks; KEYS = [file journal, set of files with journal]
+// ARGV = [versioned file key, op type, followed by (chunk prefix, container id, size, checksum) of each chunk]
+// previous writes of the chunks are turned into deletes, and a delete superseding a write of the same chunk in the same container is not added
+static const char JOURNAL_ADD_SCRIPT[] = "\
+    local fields = redis.call('HGETALL', KEYS[1]); \
+    local ops = {}; \
+    for i = 1, #fields, 2 do \
+        if string.find(fields[i], '-op-', 1, true) then ops[fields[i]] = fields[i + 1] end \
+    end \
+    local numAdded = 0; \
+    for i = 3, #ARGV, 4 do \
+        local prefix = ARGV[i] .. '-op-'; \
+        local skip = false; \
+        for field, op in pairs(ops) do \
+            if op == 'w' and string.sub(field, 1, #prefix) == prefix then \
+                redis.call('HSET', KEYS[1], field, 'd'); \
+                ops[field] = 'd'; \
+                if ARGV[2] == 'd' and string.sub(field, #prefix + 1) == ARGV[i + 1] then skip = true end \
+            end \
+        end \
+        if not skip then \
+            local cid = '-' .. ARGV[i + 1]; \
+            redis.call('HMSET', KEYS[1], ARGV[i] .. '-size' .. cid, ARGV[i + 2], ARGV[i] .. '-md5' .. cid, ARGV[i + 3], prefix .. ARGV[i + 1], ARGV[2], ARGV[i] .. '-status' .. cid, 'pre'); \
+            ops[prefix .. ARGV[i + 1]] = ARGV[2]; \
+            numAdded = numAdded + 1; \
+        end \
+    end \
+    if numAdded > 0 then redis.call('SADD', KEYS[2], ARGV[1]) end \
+    return numAdded;";
+// KEYS = [file journal, set of files with journal], ARGV = [versioned file key, op type, followed by (chunk prefix, container id) of each chunk]
+// returns the number of removed fields, or -1 if the file is not in the set after removing its last record
+static const char JOURNAL_REMOVE_SCRIPT[] = "\
+    local numRemoved = 0; \
+    for i = 3, #ARGV, 2 do \
+        local cid = '-' .. ARGV[i + 1]; \
+        numRemoved = numRemoved + redis.call('HDEL', KEYS[1], ARGV[i] .. '-size' .. cid, ARGV[i] .. '-md5' .. cid, ARGV[i] .. '-op' .. cid, ARGV[i] .. '-status' .. cid); \
+    end \
+    if redis.call('HLEN', KEYS[1]) == 0 and redis.call('SREM', KEYS[2], ARGV[1]) == 0 then return -1 end \
+    return numRemoved;";
+// returns the number of records updated, records not found are skipped
+static const char JOURNAL_UPDATE_SCRIPT[] = "\
+    local numUpdated = 0; \
+    for i = 3, #ARGV, 2 do \
+        local opField = ARGV[i] .. '-op-' .. ARGV[i + 1]; \
+        local statusField = ARGV[i] .. '-status-' .. ARGV[i + 1]; \
+        if redis.call('HEXISTS', KEYS[1], opField) == 1 and redis.call('HEXISTS', KEYS[1], statusField) == 1 then \
+            redis.call('HMSET', KEYS[1], opField, ARGV[2], statusField, 'post'); \
+            numUpdated = numUpdated + 1; \
+        end \
+    end \
+    return numUpdated;";
 
 static std::tuple<int, std::string, int> extractJournalFieldKeyParts(const char *field, size_t fieldLength);
+static bool decodeUniqueBlockList(const char *list, size_t length, File::UniqueBlockMap &blocks);
+static bool decodeDuplicateBlockList(const char *list, size_t length, File::DuplicateBlockMap &blocks);
 
-RedisMetaStore::RedisMetaStore() {
-    Config &config = Config::getInstance();
-    _cxt = NULL;
-    _cxt = redisConnect(config.getProxyMetaStoreIP().c_str(), config.getProxyMetaStorePort());
-    if (_cxt == NULL || _cxt->err) {
-        if (_cxt) {
-            LOG(ERROR) << "Redis connection error " << _cxt->errstr;
-            redisFree(_cxt);
-        } else {
-            LOG(ERROR) << "Failed to allocate Redis context";
-        }
+RedisMetaStore::RedisMetaStore() :
+        _pool(Config::getInstance().getProxyMetaStoreIP(), Config::getInstance().getProxyMetaStorePort(), Config::getInstance().getProxyMetaStoreNumConnections()) {
+    if (!_pool.isConnected()) {
         exit(1);
     }
     _taskScanIt = "0";
     _endOfPendingWriteSet = true;
-    LOG(INFO) << "Redis metastore connection init";
+    {
+        RedisConnection cxt(_pool);
+        if (!initFileCount(cxt)) {
+            exit(1);
+        }
+        // load the script of metadata changes once, to run it by its digest afterwards
+        redisReply *r = (redisReply *) redisCommand(cxt, "SCRIPT LOAD %b", FENCED_WRITE_SCRIPT, sizeof(FENCED_WRITE_SCRIPT) - 1);
+        if (r != NULL && r->type == REDIS_REPLY_STRING) {
+            _fencedWriteSha.assign(r->str, r->len);
+        } else {
+            LOG(WARNING) << "Failed to load the script of metadata changes, send the script along with each change instead";
+        }
+        freeReplyObject(r);
+    }
+
+    // cache file metadata, and drop cached entries on changes notified by any proxy
+    Config &config = Config::getInstance();
+    _cache = 0;
+    _subscriber = 0;
+    _running = true;
+    if (config.getProxyMetaStoreCacheSize() > 0) {
+        _cache = new MetaCache(config.getProxyMetaStoreCacheSize(), config.getProxyMetaStoreCacheTTL());
+        if (!subscribeCacheInvalidations() || pthread_create(&_cacheInvalidator, NULL, RedisMetaStore::listenCacheInvalidations, this) != 0) {
+            LOG(WARNING) << "Failed to listen to metadata cache invalidations, disable the metadata cache";
+            redisFree(_subscriber);
+            _subscriber = 0;
+            delete _cache;
+            _cache = 0;
+        }
+    }
+
+    // keep the file locks held alive until released
+    _lockTTL = config.getProxyMetaStoreLockTTL() * 1000;
+    _renewLeases = true;
+    if (pthread_create(&_leaseRenewer, NULL, RedisMetaStore::renewLeases, this) != 0) {
+        LOG(ERROR) << "Failed to start the renewer of file locks";
+        exit(1);
+    }
+
+    LOG(INFO) << "Redis metastore connection init, number of connections = " << _pool.getNumConnections() << ", metadata cache " << (_cache? "enabled" : "disabled");
 }
 
 RedisMetaStore::~RedisMetaStore() {
-    redisFree(_cxt);
+    {
+        std::lock_guard<std::mutex> lk(_leaseLock);
+        _renewLeases = false;
+    }
+    _leaseCv.notify_all();
+    pthread_join(_leaseRenewer, NULL);
+
+    if (_cache) {
+        _running = false;
+        // wake the listener up from waiting for messages
+        {
+            std::lock_guard<std::mutex> lk(_subscriberLock);
+            if (_subscriber)
+                shutdown(_subscriber->fd, SHUT_RDWR);
+        }
+        pthread_join(_cacheInvalidator, NULL);
+        redisFree(_subscriber);
+        _subscriber = 0;
+        unsigned long int numHits = 0, numMisses = 0;
+        _cache->getStats(numHits, numMisses);
+        LOG(INFO) << "Metadata cache hits = " << numHits << " misses = " << numMisses;
+        delete _cache;
+        _cache = 0;
+    }
 }
 
 bool RedisMetaStore::putMeta(const File &f) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char filename[PATH_MAX], vfilename[PATH_MAX], vlname[PATH_MAX];
     int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, filename);
@@ -61,7 +264,7 @@ bool RedisMetaStore::putMeta(const File &f) {
 
     // find the current version
     redisReply *vr = (redisReply*) redisCommand(
-        _cxt
+        cxt
         , "HGET %b ver"
         , filename, (size_t) nameLength
     );
@@ -71,47 +274,40 @@ bool RedisMetaStore::putMeta(const File &f) {
     } else if (vr == NULL) {
         LOG(ERROR) << "Failed to get the current version of file " << f.name << " due to Redis connection error";
         freeReplyObject(vr);
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
         return false;
     }
 
     freeReplyObject(vr);
     vr = 0;
 
+    // all changes are applied together, under the lock on the file
+    CommandBatch batch;
+
     // backup the metadata of previous version first if versioning is enabled and verison is newer than the current one
     Config &config = Config::getInstance();
     bool keepVersion = !config.overwriteFiles();
     if (keepVersion && curVersion != -1 && f.version > curVersion) {
         int vnameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version - 1, vfilename);
         // TODO clone instead of put after rename
-        // TODO these steps need to be an atomic transaction with HMSET, otherwise metadata can be inconsistent
         redisReply *r = (redisReply*) redisCommand(
-            _cxt
-            , "RENAME %b %b"
+            cxt
+            , "HMGET %b size mtime md5 dm numC"
             , filename, (size_t) nameLength
-            , vfilename, (size_t) vnameLength
         );
-        if (r == NULL || strncmp(r->str,"OK", 2) != 0) {
-            if (r == NULL)
-                redisReconnect(_cxt);
-            LOG(ERROR) << "Failed to backup the previous version " << f.version - 1 << " metadata for file " << f.name;
-            freeReplyObject(r);
+        if (r == NULL) {
+            LOG(ERROR) << "Failed to get the summary of the previous version " << f.version - 1 << " of file " << f.name << " due to Redis connection error";
+            redisReconnect(cxt);
             return false;
         }
-        freeReplyObject(r);
-        r = (redisReply*) redisCommand(
-            _cxt
-            , "HMGET %b size mtime md5 dm numC"
-            , vfilename, (size_t) vnameLength
-        );
         // create a set of versions (version_list [verison] -> "version size timestamp md5 dm") for this file name
         vlnameLength = genFileVersionListKey(f.namespaceId, f.name, f.nameLength, vlname);
         std::string fsummary;
         fsummary.append(std::to_string(f.version - 1)).append(" ");
-        if (r && r->type == REDIS_REPLY_ARRAY) {
+        if (r->type == REDIS_REPLY_ARRAY) {
             size_t total = 5;
             for (size_t i = 0; i < total; i++) {
-                if (r->elements >= i && r->element[i]->type == REDIS_REPLY_STRING) {
+                if (r->elements > i && r->element[i]->type == REDIS_REPLY_STRING) {
                     fsummary.append(r->element[i]->str, r->element[i]->len);
                 } else {
                     fsummary.append("-");
@@ -120,15 +316,17 @@ bool RedisMetaStore::putMeta(const File &f) {
             }
         }
         freeReplyObject(r);
-        r = (redisReply*) redisCommand(
-            _cxt
-            , "ZADD %b %d %b"
-            , vlname, (size_t) vlnameLength
-            , f.version - 1
-            , fsummary.c_str(), fsummary.size()
-        );
         LOG(INFO) << "File summary of " << vlname << " version " << f.version << " is >" << fsummary.c_str() << "<";
-        freeReplyObject(r);
+
+        batch.add(CommandBatch::REQUIRED, /* numKeys */ 2);
+        batch.arg("RENAME");
+        batch.arg(filename, nameLength);
+        batch.arg(vfilename, vnameLength);
+        batch.add();
+        batch.arg("ZADD");
+        batch.arg(vlname, vlnameLength);
+        batch.copyArg(std::to_string(f.version - 1));
+        batch.copyArg(std::move(fsummary));
     }
 
     // operate on previous versions
@@ -136,226 +334,310 @@ bool RedisMetaStore::putMeta(const File &f) {
         // check and only allow such operations if the version exists
         vlnameLength = genFileVersionListKey(f.namespaceId, f.name, f.nameLength, vlname);
         vr = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "ZRANGEBYSCORE %b %d %d"
             , vlname, (size_t) vlnameLength
             , f.version, f.version
         );
         if (vr == NULL || vr->type != REDIS_REPLY_ARRAY || vr->elements < 1) {
-            LOG(ERROR) << "Failed to find the previous version " << f.version << " record for file " << f.name << ", type " << (int) vr->type << " elements " << vr->elements;
+            LOG(ERROR) << "Failed to find the previous version " << f.version << " record for file " << f.name;
             freeReplyObject(vr);
             if (vr == NULL)
-                redisReconnect(_cxt);
+                redisReconnect(cxt);
             return false;
         }
+        freeReplyObject(vr);
+        vr = 0;
         // use the versioned file key
         nameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version, filename);
     }
 
-    bool isEmptyFile = f.size == 0;
-    unsigned char *codingState = isEmptyFile || f.codingMeta.codingState == NULL? (unsigned char *) "" : f.codingMeta.codingState;
-    int deleted = isEmptyFile? f.isDeleted : 0;
-    size_t numUniqueBlocks = f.uniqueBlocks.size();
-    size_t numDuplicateBlocks = f.duplicateBlocks.size();
-    redisAppendCommand(
-        _cxt
-        ,   "HMSET %b"
-            " name %b uuid %s size %b numC %b"
-            " sc %s cs %b n %b k %b f %b maxCS %b codingStateS %b codingState %b"
-            " numS %b ver %b"
-            " ctime %b atime %b mtime %b tctime %b"
-            " md5 %b"
-            " sg_size %b sg_sc %s sg_cs %b sg_n %b sg_k %b sg_f %b sg_maxCS %b sg_mtime %b"
-            " dm %d"
-            " numUB %b numDB %b"
-        , filename, (size_t) nameLength
-
-        , f.name, (size_t) f.nameLength
-        , boost::uuids::to_string(f.uuid).c_str()
-        , &f.size, (size_t) sizeof(unsigned long int)
-        , &f.numChunks, (size_t) sizeof(int)
-
-        , f.storageClass.c_str()
-        , &f.codingMeta.coding, (size_t) sizeof(f.codingMeta.coding)
-        , &f.codingMeta.n, (size_t) sizeof(f.codingMeta.n)
-        , &f.codingMeta.k, (size_t) sizeof(f.codingMeta.k)
-        , &f.codingMeta.f, (size_t) sizeof(f.codingMeta.f)
-        , &f.codingMeta.maxChunkSize, (size_t) sizeof(f.codingMeta.maxChunkSize)
-        , &f.codingMeta.codingStateSize, (size_t) sizeof(f.codingMeta.codingStateSize)
-        , codingState, (size_t) f.codingMeta.codingStateSize
-
-        , &f.numStripes, (size_t) sizeof(int) 
-        , &f.version, (size_t) sizeof(int)
-
-        , &f.ctime, (size_t) sizeof(time_t)
-        , &f.atime, (size_t) sizeof(time_t)
-        , &f.mtime, (size_t) sizeof(time_t)
-        , &f.tctime, (size_t) sizeof(time_t)
-
-        , &f.md5, MD5_DIGEST_LENGTH
-
-        , &f.staged.size, (size_t) sizeof(unsigned long int)
-        , f.staged.storageClass.c_str()
-        , &f.staged.codingMeta.coding, (size_t) sizeof(f.staged.codingMeta.coding)
-        , &f.staged.codingMeta.n, (size_t) sizeof(f.staged.codingMeta.n)
-        , &f.staged.codingMeta.k, (size_t) sizeof(f.staged.codingMeta.k)
-        , &f.staged.codingMeta.f, (size_t) sizeof(f.staged.codingMeta.f)
-        , &f.staged.codingMeta.maxChunkSize, (size_t) sizeof(f.staged.codingMeta.maxChunkSize)
-        , &f.staged.mtime, (size_t) sizeof(time_t)
-        , deleted
-
-        , &numUniqueBlocks, (size_t) sizeof(size_t)
-        , &numDuplicateBlocks, (size_t) sizeof(size_t)
-    );
-
-    // container ids
-    char cname[MAX_KEY_SIZE];
-    for (int i = 0; i < f.numChunks; i++) {
-        genChunkKeyPrefix(f.chunks[i].getChunkId(), cname);
-        redisAppendCommand(
-            _cxt
-            , "HMSET %b %s-cid %b %s-size %b %s-md5 %b %s-bad %d"
-            , filename, (size_t) nameLength
-            , cname
-            , &f.containerIds[i], (size_t) sizeof(int)
-            , cname
-            , &f.chunks[i].size, (size_t) sizeof(int)
-            , cname
-            , f.chunks[i].md5, MD5_DIGEST_LENGTH
-            , cname
-            , (f.chunksCorrupted? f.chunksCorrupted[i] : 0)
-        );
+    // count the file if the metadata is created for a new file name
+    if (curVersion == -1) {
+        batch.add();
+        batch.arg("HSETNX");
+        batch.arg(filename, nameLength);
+        batch.arg("name");
+        batch.arg(f.name, f.nameLength);
+        batch.add(CommandBatch::IF_PREVIOUS);
+        batch.arg("INCR");
+        batch.arg(FILE_COUNT_KEY);
     }
+    addPutMetaCommand(batch, f, filename, nameLength);
 
-    // deduplication fingerprints and block mapping
-    char bname[MAX_KEY_SIZE];
-    size_t bid = 0;
-    for (auto it = f.uniqueBlocks.begin(); it != f.uniqueBlocks.end(); it++, bid++) {
-        genBlockKey(bid, bname, /* is unique */ true);
-        std::string fp = it->second.first.get();
-        redisAppendCommand(
-            _cxt
-            , "HMSET %b %s %b%b%b%b"  // logical offset, length, fingerprint, physical offset
-            , filename, (size_t) nameLength
-            , bname
-            , &it->first._offset, (size_t) sizeof(unsigned long int)
-            , &it->first._length, (size_t) sizeof(unsigned int)
-            , fp.data(), fp.size()
-            , &it->second.second, (size_t) sizeof(int)
-        );
-    }
-    bid = 0;
-    for (auto it = f.duplicateBlocks.begin(); it != f.duplicateBlocks.end(); it++, bid++) {
-        genBlockKey(bid, bname, /* is unique */ false);
-        std::string fp = it->second.get();
-        redisAppendCommand(
-            _cxt
-            , "HMSET %b %s %b%b%b"  // logical offset, length, fingerprint
-            , filename, (size_t) nameLength
-            , bname
-            , &it->first._offset, (size_t) sizeof(unsigned long int)
-            , &it->first._length, (size_t) sizeof(unsigned int)
-            , fp.data(), fp.size()
-        );
-    }
-    
     char fidKey[MAX_KEY_SIZE + 64];
-    int setKey = 0;
 
     // add uuid-to-file-name maping
     if (genFileUuidKey(f.namespaceId, f.uuid, fidKey) == false) {
         LOG(WARNING) << "File uuid " << boost::uuids::to_string(f.uuid) << " is too long to generate a reverse key mapping";
     } else {
-        redisAppendCommand(
-            _cxt
-            , "SET %s %b"
-            , fidKey
-            , f.name, (size_t) f.nameLength
-        );
-        setKey += 1;
+        batch.add();
+        batch.arg("SET");
+        batch.arg(fidKey);
+        batch.arg(f.name, f.nameLength);
     }
     // update the corresponding directory prefix set of this file
-    redisAppendCommand(
-        _cxt
-        , "SADD %s %b"
-        , prefix.c_str()
-        , filename, (size_t) nameLength
-    );
+    batch.add();
+    batch.arg("SADD");
+    batch.arg(prefix.c_str());
+    batch.arg(filename, nameLength);
     // update global directory list
-    redisAppendCommand(
-        _cxt
-        , "SADD %s %s"
-        , DIR_LIST_KEY, prefix.c_str()
-    );
-    setKey += 2;
+    batch.add();
+    batch.arg("SADD");
+    batch.arg(DIR_LIST_KEY);
+    batch.arg(prefix.c_str());
 
     // issue all commands and check their replies
     redisReply *r = 0;
-    for (size_t i = 0; i < f.numChunks + numUniqueBlocks + numDuplicateBlocks + 1 + setKey; i++) {
-        if (redisGetReply(_cxt, (void**) &r) != REDIS_OK) {
-            LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
-            if (r == NULL) {
-                redisReconnect(_cxt);
-            }
-            freeReplyObject(r);
-            r = 0;
-            return false;
+    if (!runFencedWrite(cxt, { &f }, batch, "metadata update", &r))
+        return false;
+
+    bool okay = r->elements == batch.commands.size();
+    for (size_t i = 0; i < r->elements; i++) {
+        if (r->element[i]->type == REDIS_REPLY_ERROR) {
+            LOG(ERROR) << "Redis reply with error, " << r->element[i]->str;
+            okay = false;
         }
-        freeReplyObject(r);
-        r = 0;
     }
+    LOG_IF(ERROR, !okay) << "Failed to update the metadata of file " << f.name << ", " << r->elements << " of " << batch.commands.size() << " changes applied";
+    freeReplyObject(r);
+    r = 0;
+    if (!okay)
+        return false;
+
+    invalidateCachedMeta(cxt, f);
+
     return true;
 }
 
+void RedisMetaStore::addPutMetaCommand(CommandBatch &batch, const File &f, const char *filename, int nameLength) {
+    bool isEmptyFile = f.size == 0;
+    int deleted = isEmptyFile? f.isDeleted : 0;
+
+    // write all metadata of the file in one command,
+    // while keeping the fields used for file listing, version summary and timestamp updates as individual fields
+    auto addField = [&batch] (const char *field, const void *value, size_t len) {
+        batch.arg(field);
+        batch.arg(value, len);
+    };
+    auto copyField = [&batch] (const char *field, std::string value) {
+        batch.arg(field);
+        batch.copyArg(std::move(value));
+    };
+    batch.add();
+    batch.arg("HMSET");
+    batch.arg(filename, nameLength);
+    addField("name", f.name, f.nameLength);
+    copyField("uuid", boost::uuids::to_string(f.uuid));
+    addField("size", &f.size, sizeof(unsigned long int));
+    addField("numC", &f.numChunks, sizeof(int));
+    addField("sc", f.storageClass.c_str(), f.storageClass.size());
+    addField("ver", &f.version, sizeof(int));
+    addField("ctime", &f.ctime, sizeof(time_t));
+    addField("atime", &f.atime, sizeof(time_t));
+    addField("mtime", &f.mtime, sizeof(time_t));
+    addField("tctime", &f.tctime, sizeof(time_t));
+    addField("md5", f.md5, MD5_DIGEST_LENGTH);
+    addField("sg_size", &f.staged.size, sizeof(unsigned long int));
+    addField("sg_mtime", &f.staged.mtime, sizeof(time_t));
+    copyField("dm", std::to_string(deleted));
+    size_t numUniqueBlocks = f.uniqueBlocks.size();
+    size_t numDuplicateBlocks = f.duplicateBlocks.size();
+    copyField("numUB", std::string((const char *) &numUniqueBlocks, sizeof(size_t)));
+    copyField("numDB", std::string((const char *) &numDuplicateBlocks, sizeof(size_t)));
+    copyField("blf", std::to_string(BLOCK_LIST_FORMAT_PACKED));
+
+    // storage policy and chunks, packed into one field
+    std::string meta;
+    MetaCodec::encodeFile(f, meta);
+    copyField("meta", std::move(meta));
+
+    // deduplication fingerprints and block mapping, as segments of packed block lists
+    std::vector<std::string> uniqueBlockLists, duplicateBlockLists;
+    MetaCodec::encodeUniqueBlockLists(f.uniqueBlocks, uniqueBlockLists, BLOCK_LIST_SEGMENT_SIZE);
+    MetaCodec::encodeDuplicateBlockLists(f.duplicateBlocks, duplicateBlockLists, BLOCK_LIST_SEGMENT_SIZE);
+    // continue in another command once the arguments of the current one reach the limit of a fenced command
+    auto addBlockList = [this, &batch, filename, nameLength] (size_t i, bool isUnique, std::string &list) {
+        if (batch.commands.back().argv.size() + 2 > FENCED_WRITE_MAX_COMMAND_ARGS) {
+            batch.add();
+            batch.arg("HMSET");
+            batch.arg(filename, nameLength);
+        }
+        char bname[MAX_KEY_SIZE];
+        genBlockListKey(i, bname, isUnique);
+        batch.copyArg(bname);
+        batch.copyArg(std::move(list));
+    };
+    for (size_t i = 0; i < uniqueBlockLists.size(); i++)
+        addBlockList(i, /* is unique */ true, uniqueBlockLists.at(i));
+    for (size_t i = 0; i < duplicateBlockLists.size(); i++)
+        addBlockList(i, /* is unique */ false, duplicateBlockLists.at(i));
+}
+
+// fields of the file metadata, of both the packed and the legacy layout
+static const char *META_FIELDS[] = {
+    "size", "numC", "uuid", "ver", "ctime",
+    "atime", "mtime", "tctime", "md5", "sg_size",
+    "sg_mtime", "dm", "sc", "numUB", "numDB",
+    "blf", "meta", "numS", "cs", "n",
+    "k", "f", "maxCS", "codingStateS", "codingState",
+    "sg_sc", "sg_cs", "sg_n", "sg_k", "sg_f",
+    "sg_maxCS"
+};
+static const size_t NUM_META_FIELDS = sizeof(META_FIELDS) / sizeof(META_FIELDS[0]);
+
 bool RedisMetaStore::getMeta(File &f, int getBlocks) {
-    std::lock_guard<std::mutex> lk(_lock);
+    std::vector<File *> files(1, &f);
+    std::vector<bool> found;
+    return getMetaMulti(files, found, getBlocks) == 1;
+}
+
+int RedisMetaStore::getMetaMulti(const std::vector<File *> &files, std::vector<bool> &found, int getBlocks) {
+    size_t numFiles = files.size();
+    int numFound = 0;
+    found.assign(numFiles, false);
 
     char filename[PATH_MAX];
-    int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, filename);
+    std::vector<std::string> keys(numFiles), versionedKeys(numFiles);
+    std::vector<unsigned long int> cacheEpochs(numFiles, 0);
+    std::vector<size_t> misses;
+    misses.reserve(numFiles);
+
+    for (size_t i = 0; i < numFiles; i++) {
+        File &f = *files.at(i);
+        int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, filename);
+        keys.at(i).assign(filename, nameLength);
+        // serve hot files from the cache without going to Redis
+        if (_cache) {
+            if (_cache->get(keys.at(i), f, getBlocks)) {
+                found.at(i) = true;
+                numFound++;
+                continue;
+            }
+            cacheEpochs.at(i) = _cache->getEpoch(keys.at(i));
+        }
+        misses.push_back(i);
+    }
 
-    size_t numUniqueBlocks = 0, numDuplicateBlocks = 0;
+    if (misses.empty())
+        return numFound;
 
-    // a version is specified
-    if (f.version != -1) {
-        redisReply *r = (redisReply *) redisCommand(
-            _cxt
-            , "HGET %b ver"
-            , filename, (size_t) nameLength
-        );
-        // check if the version is the latest (current) one
-        int version = -1;
-        if (r != NULL && r->type == REDIS_REPLY_STRING) {
-            memcpy(&version, r->str, sizeof(int));
+    RedisConnection cxt(_pool);
+
+    // pipeline the metadata requests of all files; for a specific version, request both the
+    // current and the versioned key, and tell which one holds the version upon replies
+    for (size_t i : misses) {
+        File &f = *files.at(i);
+        appendGetMetaCommand(cxt, keys.at(i).c_str(), keys.at(i).size(), getBlocks);
+        if (f.version != -1) {
+            int nameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version, filename);
+            versionedKeys.at(i).assign(filename, nameLength);
+            appendGetMetaCommand(cxt, versionedKeys.at(i).c_str(), versionedKeys.at(i).size(), getBlocks);
         }
-        // if it is not the current one, find the metadata using versioned key instead
-        if (version != f.version)
-            nameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version, filename);
-        freeReplyObject(r);
     }
 
-    redisReply *r = (redisReply *) redisCommand(
-        _cxt
-        , "HMGET %b"
-        " size numC numS uuid sc"
-        " cs n k f maxCS"
-        " codingStateS codingState ver ctime atime"
-        " mtime tctime md5 sg_size sg_sc"
-        " sg_cs sg_n sg_k sg_f sg_maxCS"
-        " sg_mtime dm numUB numDB"
-        , filename, (size_t) nameLength
-    );
+    // read all replies before parsing, as parsing may issue further commands on the connection
+    std::vector<redisReply *> replies(numFiles, 0), versionedReplies(numFiles, 0);
+    bool okay = true;
+    for (size_t i : misses) {
+        if (
+            redisGetReply(cxt, (void **) &replies.at(i)) != REDIS_OK
+            || (files.at(i)->version != -1 && redisGetReply(cxt, (void **) &versionedReplies.at(i)) != REDIS_OK)
+        ) {
+            LOG(WARNING) << "Failed to get metadata for file " << files.at(i)->name;
+            redisReconnect(cxt);
+            okay = false;
+            break;
+        }
+    }
+    if (!okay) {
+        for (size_t i : misses) {
+            freeReplyObject(replies.at(i));
+            freeReplyObject(versionedReplies.at(i));
+        }
+        return numFound;
+    }
 
-    // check if get is successful
-    if (r == NULL) {
-        redisReconnect(_cxt);
-        LOG(WARNING) << "Failed to get metadata for file " << f.name;
-        return false;
+    for (size_t i : misses) {
+        File &f = *files.at(i);
+        redisReply *r = replies.at(i);
+        const std::string *key = &keys.at(i);
+        bool isCurrentVersion = f.version == -1;
+
+        if (!isCurrentVersion) {
+            // a version is specified, check if the version is the latest (current) one
+            int version = -1;
+            if (r->type == REDIS_REPLY_ARRAY && r->elements > 3 && r->element[3]->type == REDIS_REPLY_STRING && r->element[3]->len == sizeof(int)) {
+                memcpy(&version, r->element[3]->str, sizeof(int));
+            }
+            if (version == f.version) {
+                isCurrentVersion = true;
+                freeReplyObject(versionedReplies.at(i));
+            } else {
+                // if it is not the current one, use the metadata under the versioned key instead
+                freeReplyObject(r);
+                r = versionedReplies.at(i);
+                key = &versionedKeys.at(i);
+            }
+        }
+
+        if (!parseMeta(cxt, r, f, getBlocks, key->c_str(), key->size()))
+            continue;
+
+        found.at(i) = true;
+        numFound++;
+
+        // only cache the current version with all blocks, which serves requests of any block type
+        if (_cache && isCurrentVersion && getBlocks == 3)
+            _cache->put(keys.at(i), f, cacheEpochs.at(i));
+    }
+
+    return numFound;
+}
+
+void RedisMetaStore::appendGetMetaCommand(redisContext *cxt, const char *filename, int nameLength, int getBlocks) {
+    bool getUniqueBlocks = getBlocks == 1 || getBlocks == 3;
+    bool getDuplicateBlocks = getBlocks == 2 || getBlocks == 3;
+
+    // get all fields (of both the packed and the legacy layout), and the first block list segments in one command
+    char ublname[MAX_KEY_SIZE], dblname[MAX_KEY_SIZE];
+    genBlockListKey(0, ublname, /* is unique */ true);
+    genBlockListKey(0, dblname, /* is unique */ false);
+
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+    argv.push_back("HMGET");
+    argvlen.push_back(5);
+    argv.push_back(filename);
+    argvlen.push_back(nameLength);
+    for (size_t i = 0; i < NUM_META_FIELDS; i++) {
+        argv.push_back(META_FIELDS[i]);
+        argvlen.push_back(strlen(META_FIELDS[i]));
     }
+    if (getUniqueBlocks) {
+        argv.push_back(ublname);
+        argvlen.push_back(strlen(ublname));
+    }
+    if (getDuplicateBlocks) {
+        argv.push_back(dblname);
+        argvlen.push_back(strlen(dblname));
+    }
+
+    redisAppendCommandArgv(cxt, argv.size(), argv.data(), argvlen.data());
+}
+
+bool RedisMetaStore::parseMeta(redisContext *cxt, redisReply *r, File &f, int getBlocks, const char *filename, int nameLength) {
+    size_t numUniqueBlocks = 0, numDuplicateBlocks = 0;
+    int blockListFormat = BLOCK_LIST_FORMAT_PER_BLOCK;
+    bool getUniqueBlocks = getBlocks == 1 || getBlocks == 3;
+    bool getDuplicateBlocks = getBlocks == 2 || getBlocks == 3;
+    size_t numFields = NUM_META_FIELDS;
+    size_t ublIdx = numFields, dblIdx = numFields + (getUniqueBlocks? 1 : 0);
 
     LOG_IF(ERROR, r->type != REDIS_REPLY_ARRAY || r->elements < NUM_REQ_FIELDS) << "Not enough field for file metadata (" << r->elements << ", " << r->type << ")";
 
     // reply is not as expected, no / corrupted file metadata
-    if (r->type != REDIS_REPLY_ARRAY || r->elements <= NUM_REQ_FIELDS) {
+    if (r->type != REDIS_REPLY_ARRAY || r->elements < numFields) {
         LOG(INFO) << "Unexpected metadata found (file not exist?), file [" << filename << "]";
         freeReplyObject(r);
         r = 0;
@@ -412,192 +694,268 @@ bool RedisMetaStore::getMeta(File &f, int getBlocks) {
 
     check_and_copy_field(&f.size, 0, sizeof(unsigned long int));
     check_and_copy_field(&f.numChunks, 1, sizeof(int));
-    check_and_copy_field(&f.numStripes, 2, sizeof(int));
-    if (f.setUUID(std::string(r->element[3]->str, r->element[3]->len)) == false) {
-        LOG(ERROR) << "Invalid UUID in metadata " << r->element[3]->str;
+    if (f.setUUID(std::string(r->element[2]->str, r->element[2]->len)) == false) {
+        LOG(ERROR) << "Invalid UUID in metadata " << r->element[2]->str;
         freeReplyObject(r);
         r = 0;
         return false;
     }
-    // storage policy
-    check_and_copy_string(f.storageClass, 4, 1);
-    check_and_copy_field(&f.codingMeta.coding, 5, sizeof(f.codingMeta.coding));
-    check_and_copy_field(&f.codingMeta.n, 6, sizeof(f.codingMeta.n));
-    check_and_copy_field(&f.codingMeta.k, 7, sizeof(f.codingMeta.k));
-    check_and_copy_field(&f.codingMeta.f, 8, sizeof(f.codingMeta.f));
-    check_and_copy_field(&f.codingMeta.maxChunkSize, 9, sizeof(f.codingMeta.maxChunkSize));
-    check_and_copy_field(&f.codingMeta.codingStateSize, 10, sizeof(f.codingMeta.codingStateSize));
-    if (f.codingMeta.codingStateSize > 0) {
-        f.codingMeta.codingState = new unsigned char [f.codingMeta.codingStateSize];
-        check_and_copy_field(f.codingMeta.codingState, 11, f.codingMeta.codingStateSize);
-    }
     // version control
-    check_and_copy_field(&f.version, 12, sizeof(int));
-    check_and_copy_or_set_field(&f.ctime, 13, sizeof(time_t), 0);
-    check_and_copy_or_set_field(&f.atime, 14, sizeof(time_t), 0);
-    check_and_copy_or_set_field(&f.mtime, 15, sizeof(time_t), 0);
-    check_and_copy_or_set_field(&f.tctime, 16, sizeof(time_t), 0);
+    check_and_copy_field(&f.version, 3, sizeof(int));
+    check_and_copy_or_set_field(&f.ctime, 4, sizeof(time_t), 0);
+    check_and_copy_or_set_field(&f.atime, 5, sizeof(time_t), 0);
+    check_and_copy_or_set_field(&f.mtime, 6, sizeof(time_t), 0);
+    check_and_copy_or_set_field(&f.tctime, 7, sizeof(time_t), 0);
     // checksum
-    check_and_copy_or_set_field(f.md5, 17, MD5_DIGEST_LENGTH, 0);
+    check_and_copy_or_set_field(f.md5, 8, MD5_DIGEST_LENGTH, 0);
     // staging
-    check_and_copy_or_set_field(&f.staged.size, 18, sizeof(f.staged.size), INVALID_FILE_OFFSET);
-    check_and_copy_string(f.staged.storageClass, 19, 1);
-    check_and_copy_field(&f.staged.codingMeta.coding, 20, sizeof(f.staged.codingMeta.coding));
-    check_and_copy_field(&f.staged.codingMeta.n, 21, sizeof(f.staged.codingMeta.n));
-    check_and_copy_field(&f.staged.codingMeta.k, 22, sizeof(f.staged.codingMeta.k));
-    check_and_copy_field(&f.staged.codingMeta.f, 23, sizeof(f.staged.codingMeta.f));
-    check_and_copy_field(&f.staged.codingMeta.maxChunkSize, 24, sizeof(f.staged.codingMeta.maxChunkSize));
-    check_and_copy_or_set_field(&f.staged.mtime, 25, sizeof(time_t), 0);
+    check_and_copy_or_set_field(&f.staged.size, 9, sizeof(f.staged.size), INVALID_FILE_OFFSET);
+    check_and_copy_or_set_field(&f.staged.mtime, 10, sizeof(time_t), 0);
     // deletion mark
-    check_and_convert_or_set_field(&f.isDeleted, 26, 1, atoi, 0);
+    check_and_convert_or_set_field(&f.isDeleted, 11, 1, atoi, 0);
+    // storage policy
+    check_and_copy_string(f.storageClass, 12, 1);
     // blocks under deduplication
-    check_and_copy_or_set_field(&numUniqueBlocks, 27, sizeof(size_t), 0);
-    check_and_copy_or_set_field(&numDuplicateBlocks, 28, sizeof(size_t), 0);
-
-    freeReplyObject(r);
-    r = 0;
-
-    // get container ids and attributes
-    if (!f.initChunksAndContainerIds()) {
-        LOG(ERROR) << "Failed to allocate space for container ids";
-        return false;
-    }
-
-    char cname[MAX_KEY_SIZE];
-    for (int i = 0; i < f.numChunks; i++) {
-        genChunkKeyPrefix(i, cname);
-        redisAppendCommand(
-            _cxt
-            , "HMGET %b %s-cid %s-size %s-md5 %s-bad"
-            , filename, (size_t) nameLength
-            , cname
-            , cname
-            , cname
-            , cname
-        );
-    }
-
-
-    for (int i = 0; i < f.numChunks; i++) {
-        if (redisGetReply(_cxt, (void**) &r) != REDIS_OK) {
-            LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
-            if (r == NULL) {
-                redisReconnect(_cxt);
-            }
+    check_and_copy_or_set_field(&numUniqueBlocks, 13, sizeof(size_t), 0);
+    check_and_copy_or_set_field(&numDuplicateBlocks, 14, sizeof(size_t), 0);
+    check_and_convert_or_set_field(&blockListFormat, 15, 1, atoi, BLOCK_LIST_FORMAT_PER_BLOCK);
+
+    bool isPacked = r->element[16]->type == REDIS_REPLY_STRING;
+    if (isPacked) {
+        // storage policy and chunks
+        int numChunks = f.numChunks;
+        if (!MetaCodec::decodeFile(r->element[16]->str, r->element[16]->len, f) || f.numChunks != numChunks) {
+            LOG(ERROR) << "Failed to decode the packed metadata of file " << f.name;
             freeReplyObject(r);
             r = 0;
             return false;
         }
-
-        if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) {
-            freeReplyObject(r);
-            r = 0;
-            LOG(ERROR) << "Not enough field for chunk metadata (" << r->elements << ", " << r->type << ")";
-            return false;
+    } else {
+        // storage policy in the legacy layout
+        check_and_copy_field(&f.numStripes, 17, sizeof(int));
+        check_and_copy_field(&f.codingMeta.coding, 18, sizeof(f.codingMeta.coding));
+        check_and_copy_field(&f.codingMeta.n, 19, sizeof(f.codingMeta.n));
+        check_and_copy_field(&f.codingMeta.k, 20, sizeof(f.codingMeta.k));
+        check_and_copy_field(&f.codingMeta.f, 21, sizeof(f.codingMeta.f));
+        check_and_copy_field(&f.codingMeta.maxChunkSize, 22, sizeof(f.codingMeta.maxChunkSize));
+        check_and_copy_field(&f.codingMeta.codingStateSize, 23, sizeof(f.codingMeta.codingStateSize));
+        if (f.codingMeta.codingStateSize > 0) {
+            f.codingMeta.codingState = new unsigned char [f.codingMeta.codingStateSize];
+            check_and_copy_field(f.codingMeta.codingState, 24, f.codingMeta.codingStateSize);
         }
-
-        check_and_copy_field(&f.containerIds[i], 0, sizeof(int));
-        check_and_copy_field(&f.chunks[i].size, 1, sizeof(int));
-        check_and_copy_or_set_field(f.chunks[i].md5, 2, MD5_DIGEST_LENGTH, 0);
-        f.chunksCorrupted[i] = r->elements <= 3? false : (bool) atoi(r->element[3]->str);
-        f.chunks[i].setId(f.namespaceId, f.uuid, i);
-        f.chunks[i].data = 0;
-        f.chunks[i].freeData = true;
-        f.chunks[i].fileVersion = f.version;
+        check_and_copy_string(f.staged.storageClass, 25, 1);
+        check_and_copy_field(&f.staged.codingMeta.coding, 26, sizeof(f.staged.codingMeta.coding));
+        check_and_copy_field(&f.staged.codingMeta.n, 27, sizeof(f.staged.codingMeta.n));
+        check_and_copy_field(&f.staged.codingMeta.k, 28, sizeof(f.staged.codingMeta.k));
+        check_and_copy_field(&f.staged.codingMeta.f, 29, sizeof(f.staged.codingMeta.f));
+        check_and_copy_field(&f.staged.codingMeta.maxChunkSize, 30, sizeof(f.staged.codingMeta.maxChunkSize));
+    }
+
+    // the first segments of block lists come with the file metadata
+    bool isBlockListSegmented = blockListFormat == BLOCK_LIST_FORMAT_PACKED || blockListFormat == BLOCK_LIST_FORMAT_COMPACT;
+    size_t numUniqueLists = isBlockListSegmented && getUniqueBlocks? (numUniqueBlocks + BLOCK_LIST_SEGMENT_SIZE - 1) / BLOCK_LIST_SEGMENT_SIZE : 0;
+    size_t numDuplicateLists = isBlockListSegmented && getDuplicateBlocks? (numDuplicateBlocks + BLOCK_LIST_SEGMENT_SIZE - 1) / BLOCK_LIST_SEGMENT_SIZE : 0;
+    if (numUniqueLists > 0) { f.uniqueBlocks.reserve(numUniqueBlocks); }
+    if (numDuplicateLists > 0) { f.duplicateBlocks.reserve(numDuplicateBlocks); }
+    auto decodeBlockList = [&f, blockListFormat] (bool isUnique, redisReply *list) {
+        if (list->type != REDIS_REPLY_STRING)
+            return false;
+        if (blockListFormat == BLOCK_LIST_FORMAT_PACKED)
+            return isUnique?
+                    MetaCodec::decodeUniqueBlockList(list->str, list->len, f.uniqueBlocks) :
+                    MetaCodec::decodeDuplicateBlockList(list->str, list->len, f.duplicateBlocks);
+        return isUnique?
+                decodeUniqueBlockList(list->str, list->len, f.uniqueBlocks) :
+                decodeDuplicateBlockList(list->str, list->len, f.duplicateBlocks);
+    };
+    if (
+        (numUniqueLists > 0 && !decodeBlockList(/* is unique */ true, r->element[ublIdx]))
+        || (numDuplicateLists > 0 && !decodeBlockList(/* is unique */ false, r->element[dblIdx]))
+    ) {
+        LOG(ERROR) << "Failed to get metadata for the first block list of file " << f.name;
         freeReplyObject(r);
         r = 0;
+        return false;
     }
 
-    // get block attributes for deduplication
-    BlockLocation::InObjectLocation loc;
-    Fingerprint fp;
-    char bname[MAX_KEY_SIZE];
-    if (getBlocks == 1 || getBlocks == 3) { // unique blocks
+    freeReplyObject(r);
+    r = 0;
 
-        int pOffset = 0;
-        for (size_t i = 0; i < numUniqueBlocks; i++) {
-            genBlockKey(i, bname, /* is unique */ true);
+    // get container ids and attributes in the legacy layout
+    if (!isPacked) {
+        if (!f.initChunksAndContainerIds()) {
+            LOG(ERROR) << "Failed to allocate space for container ids";
+            return false;
+        }
+
+        char cname[MAX_KEY_SIZE];
+        for (int i = 0; i < f.numChunks; i++) {
+            genChunkKeyPrefix(i, cname);
             redisAppendCommand(
-                _cxt
-                , "HMGET %b %s"
+                cxt
+                , "HMGET %b %s-cid %s-size %s-md5 %s-bad"
                 , filename, (size_t) nameLength
-                , bname
+                , cname
+                , cname
+                , cname
+                , cname
             );
         }
 
-        int noFpOfs = sizeof(unsigned long int) + sizeof(unsigned int);
-        int hasFpOfs = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH;
-        int lengthWithFp = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH + sizeof(int);
-        for (size_t i = 0; i < numUniqueBlocks; i++) {
-            if (redisGetReply(_cxt, (void**) &r) != REDIS_OK) {
+        for (int i = 0; i < f.numChunks; i++) {
+            if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
                 LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
                 if (r == NULL) {
-                    redisReconnect(_cxt);
+                    redisReconnect(cxt);
                 }
                 freeReplyObject(r);
                 r = 0;
                 return false;
             }
-            if (r->type != REDIS_REPLY_ARRAY || r->elements != 1) {
-                LOG(ERROR) << "Failed to get metadata for block " << i << " of file " << f.name << ", type = " << r->type << " num = " << r->elements;
+
+            if (r->type != REDIS_REPLY_ARRAY || r->elements < 2) {
                 freeReplyObject(r);
                 r = 0;
+                LOG(ERROR) << "Not enough field for chunk metadata (" << r->elements << ", " << r->type << ")";
                 return false;
             }
-            check_and_copy_field_at_offset(&loc._offset, 0, 0, sizeof(unsigned long int));
-            check_and_copy_field_at_offset(&loc._length, 0, sizeof(unsigned long int), sizeof(unsigned int));
-            if (r->element[0]->len >= lengthWithFp) {
-                fp.set(r->element[0]->str + noFpOfs, SHA256_DIGEST_LENGTH);
-                check_and_copy_field_at_offset(&pOffset, 0, hasFpOfs, sizeof(int));
-            } else {
-                check_and_copy_field_at_offset(&pOffset, 0, noFpOfs, sizeof(int));
-            }
-            auto followIt = f.uniqueBlocks.end(); // hint is the item after the element to insert for c++11, and before the element for c++98
-            f.uniqueBlocks.emplace_hint(followIt, std::make_pair(loc, std::make_pair(fp, pOffset)));
 
+            check_and_copy_field(&f.containerIds[i], 0, sizeof(int));
+            check_and_copy_field(&f.chunks[i].size, 1, sizeof(int));
+            check_and_copy_or_set_field(f.chunks[i].md5, 2, MD5_DIGEST_LENGTH, 0);
+            f.chunksCorrupted[i] = r->elements <= 3? false : (bool) atoi(r->element[3]->str);
+            f.chunks[i].setId(f.namespaceId, f.uuid, i);
+            f.chunks[i].data = 0;
+            f.chunks[i].freeData = true;
+            f.chunks[i].fileVersion = f.version;
             freeReplyObject(r);
             r = 0;
         }
     }
-    if (getBlocks == 2 || getBlocks == 3) { // duplicate blocks
-        for (size_t i = 0; i < numDuplicateBlocks; i++) {
-            genBlockKey(i, bname, /* is unique */ false);
+
+    // get the remaining block attributes for deduplication
+    char bname[MAX_KEY_SIZE];
+    if (isBlockListSegmented) {
+        size_t numRemainingUniqueLists = numUniqueLists > 0? numUniqueLists - 1 : 0;
+        size_t numRemainingDuplicateLists = numDuplicateLists > 0? numDuplicateLists - 1 : 0;
+        for (size_t i = 0; i < numRemainingUniqueLists + numRemainingDuplicateLists; i++) {
+            bool isUnique = i < numRemainingUniqueLists;
+            genBlockListKey(isUnique? i + 1 : i - numRemainingUniqueLists + 1, bname, isUnique);
             redisAppendCommand(
-                _cxt
-                , "HMGET %b %s"
+                cxt
+                , "HGET %b %s"
                 , filename, (size_t) nameLength
                 , bname
             );
         }
-
-        int noFpOfs = sizeof(unsigned long int) + sizeof(unsigned int);
-        int lengthWithFp = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH;
-        for (size_t i = 0; i < numDuplicateBlocks; i++) {
-            if (redisGetReply(_cxt, (void**) &r) != REDIS_OK) {
+        // read all replies before returning, to keep the connection in sync
+        bool okay = true;
+        for (size_t i = 0; i < numRemainingUniqueLists + numRemainingDuplicateLists; i++) {
+            if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
                 LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
-                if (r == NULL) {
-                    redisReconnect(_cxt);
-                }
-                freeReplyObject(r);
-                r = 0;
+                redisReconnect(cxt);
                 return false;
             }
-            if (r->type != REDIS_REPLY_ARRAY || r->elements != 1) {
-                LOG(ERROR) << "Failed to get metadata for block " << i << " of file " << f.name << ", type = " << r->type << " num = " << r->elements;
+            bool isUnique = i < numRemainingUniqueLists;
+            if (okay && !decodeBlockList(isUnique, r)) {
+                LOG(ERROR) << "Failed to get metadata for " << (isUnique? "unique" : "duplicate") << " block list " << (isUnique? i + 1 : i - numRemainingUniqueLists + 1) << " of file " << f.name << ", type = " << r->type;
+                okay = false;
+            }
+            freeReplyObject(r);
+            r = 0;
+        }
+        if (!okay)
+            return false;
+    } else {
+        BlockLocation::InObjectLocation loc;
+        Fingerprint fp;
+        if (getBlocks == 1 || getBlocks == 3) { // unique blocks
+
+            int pOffset = 0;
+            for (size_t i = 0; i < numUniqueBlocks; i++) {
+                genBlockKey(i, bname, /* is unique */ true);
+                redisAppendCommand(
+                    cxt
+                    , "HMGET %b %s"
+                    , filename, (size_t) nameLength
+                    , bname
+                );
+            }
+
+            int noFpOfs = sizeof(unsigned long int) + sizeof(unsigned int);
+            int hasFpOfs = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH;
+            int lengthWithFp = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH + sizeof(int);
+            for (size_t i = 0; i < numUniqueBlocks; i++) {
+                if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+                    LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
+                    if (r == NULL) {
+                        redisReconnect(cxt);
+                    }
+                    freeReplyObject(r);
+                    r = 0;
+                    return false;
+                }
+                if (r->type != REDIS_REPLY_ARRAY || r->elements != 1) {
+                    LOG(ERROR) << "Failed to get metadata for block " << i << " of file " << f.name << ", type = " << r->type << " num = " << r->elements;
+                    freeReplyObject(r);
+                    r = 0;
+                    return false;
+                }
+                check_and_copy_field_at_offset(&loc._offset, 0, 0, sizeof(unsigned long int));
+                check_and_copy_field_at_offset(&loc._length, 0, sizeof(unsigned long int), sizeof(unsigned int));
+                if (r->element[0]->len >= lengthWithFp) {
+                    fp.set(r->element[0]->str + noFpOfs, SHA256_DIGEST_LENGTH);
+                    check_and_copy_field_at_offset(&pOffset, 0, hasFpOfs, sizeof(int));
+                } else {
+                    check_and_copy_field_at_offset(&pOffset, 0, noFpOfs, sizeof(int));
+                }
+                auto followIt = f.uniqueBlocks.end(); // hint is the item after the element to insert for c++11, and before the element for c++98
+                f.uniqueBlocks.emplace_hint(followIt, std::make_pair(loc, std::make_pair(fp, pOffset)));
+
                 freeReplyObject(r);
                 r = 0;
-                return false;
             }
-            check_and_copy_field_at_offset(&loc._offset, 0, 0, sizeof(unsigned long int));
-            check_and_copy_field_at_offset(&loc._length, 0, sizeof(unsigned long int), sizeof(unsigned int));
-            if (r->element[0]->len >= lengthWithFp) {
-                fp.set(r->element[0]->str + noFpOfs, SHA256_DIGEST_LENGTH);
+        }
+        if (getBlocks == 2 || getBlocks == 3) { // duplicate blocks
+            for (size_t i = 0; i < numDuplicateBlocks; i++) {
+                genBlockKey(i, bname, /* is unique */ false);
+                redisAppendCommand(
+                    cxt
+                    , "HMGET %b %s"
+                    , filename, (size_t) nameLength
+                    , bname
+                );
             }
-            auto followIt = f.duplicateBlocks.end(); // hint is the item after the element to insert for c++11, and before the element for c++98
-            f.duplicateBlocks.emplace_hint(followIt, std::make_pair(loc, fp));
 
-            freeReplyObject(r);
-            r = 0;
+            int noFpOfs = sizeof(unsigned long int) + sizeof(unsigned int);
+            int lengthWithFp = sizeof(unsigned long int) + sizeof(unsigned int) + SHA256_DIGEST_LENGTH;
+            for (size_t i = 0; i < numDuplicateBlocks; i++) {
+                if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+                    LOG(ERROR) << "Redis reply with error, " << (r? r->str : "NULL");
+                    if (r == NULL) {
+                        redisReconnect(cxt);
+                    }
+                    freeReplyObject(r);
+                    r = 0;
+                    return false;
+                }
+                if (r->type != REDIS_REPLY_ARRAY || r->elements != 1) {
+                    LOG(ERROR) << "Failed to get metadata for block " << i << " of file " << f.name << ", type = " << r->type << " num = " << r->elements;
+                    freeReplyObject(r);
+                    r = 0;
+                    return false;
+                }
+                check_and_copy_field_at_offset(&loc._offset, 0, 0, sizeof(unsigned long int));
+                check_and_copy_field_at_offset(&loc._length, 0, sizeof(unsigned long int), sizeof(unsigned int));
+                if (r->element[0]->len >= lengthWithFp) {
+                    fp.set(r->element[0]->str + noFpOfs, SHA256_DIGEST_LENGTH);
+                }
+                auto followIt = f.duplicateBlocks.end(); // hint is the item after the element to insert for c++11, and before the element for c++98
+                f.duplicateBlocks.emplace_hint(followIt, std::make_pair(loc, fp));
+
+                freeReplyObject(r);
+                r = 0;
+            }
         }
     }
 
@@ -650,19 +1008,24 @@ bool RedisMetaStore::deleteMeta(File &f) {
         return ret;
     }
 
+    RedisConnection cxt(_pool);
+
+    // all changes are applied together, under the lock on the file
+    CommandBatch batch;
+
     // delete a specific version
     if (isVersioned && versionToDelete != -1) {
         int curVersion = -1, numVersions = 0, versionToRemove = -1;
         // find the current version
         redisReply *vr = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "HGET %b ver" 
             , filename, (size_t) nameLength
         );
         if (vr == NULL || vr->type != REDIS_REPLY_STRING) {
             LOG(ERROR) << "Failed to find current version number of file " << f.name << " with previous version " << f.version;
             if (vr == NULL) {
-                redisReconnect(_cxt);
+                redisReconnect(cxt);
             }
             freeReplyObject(vr);
             return false;
@@ -671,7 +1034,7 @@ bool RedisMetaStore::deleteMeta(File &f) {
         freeReplyObject(vr);
         // find the number of versions
         vr = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "ZCARD %b"
             , vlname, (size_t) vlnameLength
         );
@@ -685,38 +1048,27 @@ bool RedisMetaStore::deleteMeta(File &f) {
             if (numVersions > 0) {
                 // find the 2nd latest version
                 vr = (redisReply*) redisCommand(
-                    _cxt
+                    cxt
                     , "ZREVRANGEBYSCORE %b +inf -inf WITHSCORES LIMIT 0 1"
                     , vlname, (size_t) vlnameLength
                 );
                 if (vr == NULL || vr->type != REDIS_REPLY_ARRAY || vr->elements < 2 || vr->element[0]->type != REDIS_REPLY_STRING) {
                     LOG(ERROR) << "Failed to find 2nd latest version of file " << f.name << " for replacing the current version";
                     if (vr == NULL) {
-                        redisReconnect(_cxt);
+                        redisReconnect(cxt);
                     }
                     freeReplyObject(vr);
                     return false;
                 }
                 versionToRemove = atoi(vr->element[0]->str);
                 freeReplyObject(vr);
+                vr = 0;
                 // rename 2nd latest version as the current one
                 vnameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, versionToRemove, vfilename);
-                vr = (redisReply*) redisCommand(
-                    _cxt
-                    , "RENAME %b %b"
-                    , vfilename, (size_t) vnameLength
-                    , filename, (size_t) nameLength
-                );
-                if (vr == NULL || strncmp(vr->str, "OK", 2) != 0) {
-                    LOG(ERROR) << "Failed to rename 2nd latest version of file " << f.name << " to the current version, reply = " << (void*) vr << " result " << (vr? vr->str : "NIL");
-                    if (vr == NULL) {
-                        redisReconnect(_cxt);
-                    }
-                    freeReplyObject(vr);
-                    return false;
-                }
-                freeReplyObject(vr);
-                DLOG(INFO) << "Update the current version of file " << f.name << " to " << versionToRemove;
+                batch.add(CommandBatch::REQUIRED, /* numKeys */ 2);
+                batch.arg("RENAME");
+                batch.arg(vfilename, vnameLength);
+                batch.arg(filename, nameLength);
             }
         } else { // operates on the previous versions
             if (numVersions == 0) {
@@ -729,41 +1081,50 @@ bool RedisMetaStore::deleteMeta(File &f) {
         }
         if (versionToRemove != -1) {
             // remove the version from version list
-            vr = (redisReply*) redisCommand(
-                _cxt
-                , "ZREMRANGEBYSCORE %b %d %d"
-                , vlname, (size_t) vlnameLength
-                , versionToRemove, versionToRemove
-            );
-            DLOG(INFO) << "Remove version " << versionToRemove << " from version list of file " << f.name;
-            freeReplyObject(vr);
+            batch.add();
+            batch.arg("ZREMRANGEBYSCORE");
+            batch.arg(vlname, vlnameLength);
+            batch.copyArg(std::to_string(versionToRemove));
+            batch.copyArg(std::to_string(versionToRemove));
             // remove old version if not renamed to the current one
             if (curVersion != f.version) {
                 vnameLength = genVersionedFileKey(f.namespaceId, f.name, f.nameLength, f.version, vfilename);
-                vr = (redisReply*) redisCommand(
-                    _cxt
-                    , "DEL %b"
-                    , vfilename, (size_t) vnameLength
-                );
-                freeReplyObject(vr);
+                batch.add();
+                batch.arg("DEL");
+                batch.arg(vfilename, vnameLength);
             }
+            if (!runFencedWrite(cxt, { &f }, batch, "metadata deletion", &vr))
+                return false;
+            bool renamed = curVersion != f.version || (vr->elements > 0 && vr->element[0]->type == REDIS_REPLY_STATUS);
+            bool okay = renamed && vr->elements == batch.commands.size();
+            LOG_IF(ERROR, !renamed) << "Failed to rename 2nd latest version of file " << f.name << " to the current version, result " << (vr->elements > 0 && vr->element[0]->str? vr->element[0]->str : "NIL");
+            LOG_IF(ERROR, renamed && !okay) << "Failed to remove version " << versionToRemove << " of file " << f.name;
+            freeReplyObject(vr);
+            vr = 0;
+            if (!okay)
+                return false;
+            DLOG_IF(INFO, curVersion == f.version) << "Update the current version of file " << f.name << " to " << versionToRemove;
+            DLOG(INFO) << "Remove version " << versionToRemove << " from version list of file " << f.name;
+            invalidateCachedMeta(cxt, f);
             // let the caller handle the data (deletion), without removing the reverted index
             return true;
         }
     }
 
-    std::lock_guard<std::mutex> lk(_lock);
-    redisReply *r = (redisReply *) redisCommand(
-        _cxt
-        , "DEL %b"
-        , filename, (size_t) nameLength
-    );
+    // remove the metadata and uncount the file
+    batch.add();
+    batch.arg("DEL");
+    batch.arg(filename, nameLength);
+    batch.add(CommandBatch::IF_PREVIOUS);
+    batch.arg("DECR");
+    batch.arg(FILE_COUNT_KEY);
 
-    if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
+    redisReply *r = 0;
+    if (!runFencedWrite(cxt, { &f }, batch, "metadata deletion", &r))
+        return false;
+
+    if (r->elements < 1 || r->element[0]->type != REDIS_REPLY_INTEGER || r->element[0]->integer <= 0) {
         LOG(ERROR) << "Failed to delete file metadata of file " << f.name;
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
         freeReplyObject(r);
         r = 0;
         return false;
@@ -771,6 +1132,8 @@ bool RedisMetaStore::deleteMeta(File &f) {
     freeReplyObject(r);
     r = 0;
 
+    // clean up the reverse mapping and the directory listing of the file removed
+
     char fidKey[MAX_KEY_SIZE + 64];
 
     // TODO remove workaround for renamed file
@@ -780,7 +1143,7 @@ bool RedisMetaStore::deleteMeta(File &f) {
         LOG(WARNING) << "File uuid" << boost::uuids::to_string(f.uuid) << " is too long to generate a reverse key mapping";
     } else {
         r = (redisReply *) redisCommand(
-            _cxt
+            cxt
             , "DEL %s"
             , fidKey
         );
@@ -788,7 +1151,7 @@ bool RedisMetaStore::deleteMeta(File &f) {
     if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
         LOG(WARNING) << "Failed to delete reverse mapping of file " << f.name << " (" << fidKey;
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
         //ret = false;
     }
@@ -808,7 +1171,7 @@ bool RedisMetaStore::deleteMeta(File &f) {
     ;
     // remove file from prefix set
     r = (redisReply *) redisCommand(
-        _cxt
+        cxt
         , "EVAL %s 2 %s %s %b"
         , script.c_str()
         , prefix.c_str()
@@ -819,13 +1182,15 @@ bool RedisMetaStore::deleteMeta(File &f) {
     if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
         LOG(WARNING) << "Failed to delete the prefix record (" << prefix << ") of file " << f.name << " (" << filename << ")";
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
         //ret = false;
     }
     freeReplyObject(r);
     r = 0;
 
+    invalidateCachedMeta(cxt, f);
+
     return ret;
 }
 
@@ -846,124 +1211,75 @@ bool RedisMetaStore::renameMeta(File &sf, File &df) {
     if (!genFileUuidKey(df.namespaceId, df.uuid, dfidKey))
         return false;
 
-    // update file names
-    std::lock_guard<std::mutex> lk(_lock);
-    redisReply *r = (redisReply *) redisCommand(
-        _cxt
-        , "RENAMENX %b %b"
-        , sfname, (size_t) snameLength
-        , dfname, (size_t) dnameLength
-    );
-    if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer != 1) {
-        LOG(ERROR) << "Failed to rename file from " << sf.name << " (" << (int) sf.namespaceId << ") to " << df.name << " (" << (int) df.namespaceId << "), " << (r == NULL || r->type != REDIS_REPLY_INTEGER? "error" : "target name already exists");
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
-        freeReplyObject(r);
-        r = 0;
-        return false;
-    }
-
-    freeReplyObject(r);
-    r = 0;
+    RedisConnection cxt(_pool);
 
+    // all changes are applied together, under the locks on both files
+    std::string duuid = boost::uuids::to_string(df.uuid);
+    CommandBatch batch;
+    // update file names
+    batch.add(CommandBatch::REQUIRED, /* numKeys */ 2);
+    batch.arg("RENAMENX");
+    batch.arg(sfname, snameLength);
+    batch.arg(dfname, dnameLength);
     // create a uuid key to the new file name
-    r = (redisReply *) redisCommand(
-        _cxt
-        , "SET %s %b"
-        , dfidKey
-        , dfname, (size_t) dnameLength
-    );
+    batch.add();
+    batch.arg("SET");
+    batch.arg(dfidKey);
+    batch.arg(dfname, dnameLength);
+    // also update uuids
+    batch.add();
+    batch.arg("DEL");
+    batch.arg(sfidKey);
+    batch.add();
+    batch.arg("HSET");
+    batch.arg(dfname, dnameLength);
+    batch.arg("uuid");
+    batch.arg(duuid.c_str(), duuid.size());
+    // remove file from prefix set
+    batch.add();
+    batch.arg("SREM");
+    batch.arg(sprefix.c_str());
+    batch.arg(sfname, snameLength);
+    // add file to new prefix set
+    batch.add();
+    batch.arg("SADD");
+    batch.arg(dprefix.c_str());
+    batch.arg(dfname, dnameLength);
 
-    DLOG(INFO) << "Add reverse mapping (" << dfidKey << ") for file " << dfname;
+    redisReply *r = 0;
+    if (!runFencedWrite(cxt, { &sf, &df }, batch, "metadata rename", &r))
+        return false;
 
-    if (r != NULL && r->type != REDIS_REPLY_ERROR) {
-        freeReplyObject(r);
-        r = 0;
-        // also update uuids 
-        r = (redisReply *) redisCommand(
-            _cxt
-            , "DEL %s"
-            , sfidKey
-        );
-    } else {
-        freeReplyObject(r);
-        r = 0;
-        // undo the rename of file
-        r = (redisReply *) redisCommand(
-            _cxt
-            , "RENAME %b %b"
-            , dfname, (size_t) dnameLength
-            , sfname, (size_t) snameLength
-        );
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
+    if (r->elements < 1 || r->element[0]->type != REDIS_REPLY_INTEGER || r->element[0]->integer != 1) {
+        LOG(ERROR) << "Failed to rename file from " << sf.name << " (" << (int) sf.namespaceId << ") to " << df.name << " (" << (int) df.namespaceId << "), " << (r->elements < 1 || r->element[0]->type != REDIS_REPLY_INTEGER? "error" : "target name already exists");
         freeReplyObject(r);
         r = 0;
         return false;
     }
 
-    freeReplyObject(r);
-    r = 0;
-
-    r = (redisReply *) redisCommand(
-        _cxt
-        , "HSET %b uuid %s"
-        , dfname, (size_t) dnameLength
-        , boost::uuids::to_string(df.uuid).c_str()
-    );
+    DLOG(INFO) << "Add reverse mapping (" << dfidKey << ") for file " << dfname;
 
-    if (r == NULL || r->type == REDIS_REPLY_ERROR) {
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
-        // undo the rename of file
-        r = (redisReply *) redisCommand(
-            _cxt
-            , "RENAME %b %b"
-            , dfname, (size_t) dnameLength
-            , sfname, (size_t) snameLength
-        );
+    // undo the rename of file if the uuids are not updated, where the changes stop at the first error
+    if (r->elements < 4 || r->element[3]->type == REDIS_REPLY_ERROR) {
+        LOG(ERROR) << "Failed to update the uuid of file " << df.name << " (" << (int) df.namespaceId << ") after rename, " << r->element[r->elements - 1]->str;
         freeReplyObject(r);
         r = 0;
+        CommandBatch undo;
+        undo.add(CommandBatch::ALWAYS, /* numKeys */ 2);
+        undo.arg("RENAME");
+        undo.arg(dfname, dnameLength);
+        undo.arg(sfname, snameLength);
+        if (runFencedWrite(cxt, { &sf, &df }, undo, "undo of metadata rename", &r))
+            freeReplyObject(r);
+        r = 0;
         return false;
     }
 
-    freeReplyObject(r);
-    r = 0;
-
-    // remove file from prefix set
-    r = (redisReply *) redisCommand(
-        _cxt
-        , "SREM %s %b"
-        , sprefix.c_str()
-        , sfname, (size_t) snameLength 
-    );
-
-    if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
+    if (r->elements < 5 || r->element[4]->type != REDIS_REPLY_INTEGER || r->element[4]->integer <= 0) {
         LOG(ERROR) << "Failed to delete the prefix record of source file " << sfname << " (" << sfidKey;
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
     }
-
-    freeReplyObject(r);
-    r = 0;
-
-    // add file to new prefix set
-    r = (redisReply *) redisCommand(
-        _cxt
-        , "SADD %s %b"
-        , dprefix.c_str()
-        , dfname, (size_t) dnameLength
-    );
-
-    if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer <= 0) {
+    if (r->elements < 6 || r->element[5]->type != REDIS_REPLY_INTEGER || r->element[5]->integer <= 0) {
         LOG(ERROR) << "Failed to add the prefix record of dest file " << dfname << " (" << dfidKey;
-        if (r == NULL) {
-            redisReconnect(_cxt);
-        }
     }
 
     freeReplyObject(r);
@@ -971,17 +1287,20 @@ bool RedisMetaStore::renameMeta(File &sf, File &df) {
 
     // TODO update the background task pending list
 
+    invalidateCachedMeta(cxt, sf);
+    invalidateCachedMeta(cxt, df);
+
     return true;
 }
 
 bool RedisMetaStore::updateTimestamps(const File &f) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char fname[PATH_MAX];
     int fnameLength = genFileKey(f.namespaceId, f.name, f.nameLength, fname);
 
     redisReply *r = (redisReply *) redisCommand(
-        _cxt
+        cxt
         , "HMSET %b atime %b mtime %b tctime %b"
         , fname, (size_t) fnameLength
         , &f.atime, (size_t) sizeof(time_t)
@@ -992,7 +1311,7 @@ bool RedisMetaStore::updateTimestamps(const File &f) {
     if (r == NULL || r->type != REDIS_REPLY_STATUS || r->len != 2 || strncmp("OK", r->str, 2) != 0) {
         LOG(ERROR) << "Failed to update timestamps of file " << f.name << " (" << (int) f.namespaceId << "), " << (r == NULL || r->type != REDIS_REPLY_STATUS? "error" : "reply is not \"OK\"");
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
         freeReplyObject(r);
         r = 0;
@@ -1002,17 +1321,112 @@ bool RedisMetaStore::updateTimestamps(const File &f) {
     freeReplyObject(r);
     r = 0;
 
+    // timestamps are advisory, so only the local copy is updated without invalidating other proxies
+    if (_cache) {
+        _cache->updateTimestamps(std::string(fname, fnameLength), f);
+    }
+
     return true;
 }
 
 int RedisMetaStore::updateChunks(const File &f, int version) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char fname[PATH_MAX];
-    //int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, fname);
-    genFileKey(f.namespaceId, f.name, f.nameLength, fname);
+    int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, fname);
+
+    // patch the packed chunk metadata, and only write it back if neither the version nor the packed metadata changes since read
+    bool isPacked = true;
+    for (int attempt = 0; isPacked && attempt < MAX_UPDATE_CHUNKS_ATTEMPTS; attempt++) {
+        redisReply *r = (redisReply *) redisCommand(
+            cxt
+            , "HMGET %b ver meta"
+            , fname, (size_t) nameLength
+        );
+        if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2) {
+            LOG(ERROR) << "Failed to get metadata of file " << f.name << " (" << fname << ") for updating chunks in background";
+            if (r == NULL) {
+                redisReconnect(cxt);
+            }
+            freeReplyObject(r);
+            return 2;
+        }
+        int curVersion = -1;
+        if (r->element[0]->type == REDIS_REPLY_STRING && r->element[0]->len == sizeof(int)) {
+            memcpy(&curVersion, r->element[0]->str, sizeof(int));
+        }
+        if (curVersion != f.version) {
+            LOG(ERROR) << "Failed to operate on metadata of file " << f.name << " (" << fname << ") in background, version " << f.version << " is not the current one " << curVersion;
+            freeReplyObject(r);
+            return 1;
+        }
+        isPacked = r->element[1]->type == REDIS_REPLY_STRING;
+        if (!isPacked) {
+            freeReplyObject(r);
+            break;
+        }
+
+        File cur;
+        cur.namespaceId = f.namespaceId;
+        cur.uuid = f.uuid;
+        cur.version = curVersion;
+        std::string meta(r->element[1]->str, r->element[1]->len), newMeta;
+        freeReplyObject(r);
+        r = 0;
+        if (!MetaCodec::decodeFile(meta.data(), meta.size(), cur)) {
+            LOG(ERROR) << "Failed to decode the packed metadata of file " << f.name << " (" << fname << ") for updating chunks in background";
+            return 2;
+        }
+        for (int i = 0; i < f.numChunks; i++) {
+            int chunkId = f.chunks[i].getChunkId();
+            if (chunkId < 0 || chunkId >= cur.numChunks) {
+                LOG(ERROR) << "Failed to update chunk " << chunkId << " of file " << f.name << " (" << fname << ") in background, file has only " << cur.numChunks << " chunks";
+                return 2;
+            }
+            cur.containerIds[chunkId] = f.containerIds[i];
+            cur.chunks[chunkId].size = f.chunks[i].size;
+        }
+        MetaCodec::encodeFile(cur, newMeta);
+
+        r = (redisReply *) redisCommand(
+            cxt
+            , "EVAL %s 1 %b %d %b %b"
+            , "local v = redis.call('HGET', KEYS[1], 'ver'); \
+            if v == false or struct.unpack('I', v) ~= tonumber(ARGV[1]) then \
+                return 1; \
+            end \
+            if redis.call('HGET', KEYS[1], 'meta') ~= ARGV[2] then \
+                return 3; \
+            end \
+            redis.call('HSET', KEYS[1], 'meta', ARGV[3]); \
+            return 0;"
+            , fname, (size_t) nameLength
+            , f.version
+            , meta.data(), meta.size()
+            , newMeta.data(), newMeta.size()
+        );
+        int ret = r != NULL && r->type == REDIS_REPLY_INTEGER? r->integer : 2;
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+        freeReplyObject(r);
+        r = 0;
+        // retry if the chunk metadata is changed concurrently
+        if (ret == 3)
+            continue;
+        if (ret == 0) {
+            invalidateCachedMeta(cxt, f);
+        } else {
+            LOG(ERROR) << "Failed to operate on metadata of file " << f.name << " (" << fname << ") in background, ret = " << ret;
+        }
+        return ret;
+    }
+    if (isPacked) {
+        LOG(ERROR) << "Failed to operate on metadata of file " << f.name << " (" << fname << ") in background, chunk metadata keeps changing";
+        return 2;
+    }
 
-    // check the version and set the chunk metadata if match
+    // legacy layout: check the version and set the chunk metadata if match
     std::string script = 
         "local v = struct.unpack('I', redis.call('hget', KEYS[1], 'ver')); \
             if v == tonumber(ARGV[1]) then \
@@ -1044,7 +1458,7 @@ int RedisMetaStore::updateChunks(const File &f, int version) {
     DLOG(INFO) << "Lua Script: " << script;
     // container ids
     redisReply *r = (redisReply *) redisCommand(
-            _cxt, 
+            cxt, 
             "EVAL %s 1 %s %d"
             , script.c_str()
             , fname
@@ -1060,218 +1474,313 @@ int RedisMetaStore::updateChunks(const File &f, int version) {
     }
     freeReplyObject(r);
     r = 0;
+    if (ret == 0) {
+        invalidateCachedMeta(cxt, f);
+    }
     return ret;
 }
 
 bool RedisMetaStore::getFileName(boost::uuids::uuid fuuid, File &f) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char fidKey[MAX_KEY_SIZE + 64];
     if (!genFileUuidKey(f.namespaceId, fuuid, fidKey))
         return false;
-    return getFileName(fidKey, f);
+    return getFileName(cxt, fidKey, f);
 }
 
 unsigned int RedisMetaStore::getFileList(FileInfo **list, unsigned char namespaceId, bool withSize, bool withTime, bool withVersions, std::string prefix) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     if (namespaceId == INVALID_NAMESPACE_ID)
         namespaceId = Config::getInstance().getProxyNamespaceId();
 
-    std::string sprefix;
-    sprefix.append(std::to_string(namespaceId)).append("_").append(prefix);
-    sprefix = getFilePrefix(sprefix.c_str());
-    DLOG(INFO) << "prefix = " << prefix << " sprefix = " << sprefix;
+    // scan the keys incrementally instead of using KEYS, which blocks Redis until all keys are visited
+    std::vector<std::string> keys;
+    std::string cursor = "0";
+    do {
+        if (!scanFileKeys(cxt, namespaceId, prefix, cursor, FILE_LIST_SCAN_BATCH_SIZE, keys))
+            break;
+    } while (cursor != "0");
+
+    // a full scan may return a key more than once
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
 
-    int numFiles = 0;
+    if (keys.empty())
+        return 0;
+
+    *list = new FileInfo[keys.size()];
+    return getFileInfoOfKeys(cxt, keys, *list, withSize, withTime, withVersions);
+}
+
+unsigned int RedisMetaStore::getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, unsigned char namespaceId, bool withSize, bool withTime, bool withVersions, std::string prefix) {
+    RedisConnection cxt(_pool);
+
+    if (namespaceId == INVALID_NAMESPACE_ID)
+        namespaceId = Config::getInstance().getProxyNamespaceId();
+    if (pageSize == 0)
+        pageSize = FILE_LIST_SCAN_BATCH_SIZE;
+
+    // a scan step may return few or no matching keys, continue until the page is filled or the scan completes
+    std::vector<std::string> keys;
+    do {
+        if (!scanFileKeys(cxt, namespaceId, prefix, cursor, pageSize, keys))
+            break;
+    } while (keys.size() < pageSize && cursor != "0");
+
+    if (keys.empty())
+        return 0;
+
+    *list = new FileInfo[keys.size()];
+    return getFileInfoOfKeys(cxt, keys, *list, withSize, withTime, withVersions);
+}
+
+bool RedisMetaStore::scanFileKeys(redisContext *cxt, unsigned char namespaceId, const std::string &prefix, std::string &cursor, unsigned int count, std::vector<std::string> &keys) {
     redisReply *r = 0;
     if (prefix == "" || prefix.back() != '/') {
-        // search all keys
+        // match all keys of the namespace with the prefix, glob characters in the prefix are matched literally
+        std::string pattern = std::to_string(namespaceId).append("_");
+        for (char c : prefix) {
+            if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')
+                pattern.push_back('\\');
+            pattern.push_back(c);
+        }
+        pattern.push_back('*');
         r = (redisReply *) redisCommand(
-            _cxt,
-            "KEYS %d_%s*",
-            (int) namespaceId, 
-            prefix.c_str()
+            cxt
+            , "SCAN %s MATCH %b COUNT %u"
+            , cursor.c_str()
+            , pattern.data(), pattern.size()
+            , count
         );
     } else {
         // search prefix set
+        std::string sprefix;
+        sprefix.append(std::to_string(namespaceId)).append("_").append(prefix);
+        sprefix = getFilePrefix(sprefix.c_str());
         r = (redisReply *) redisCommand(
-            _cxt,
-            "SMEMBERS %s",
-            sprefix.c_str()
+            cxt
+            , "SSCAN %s %s COUNT %u"
+            , sprefix.c_str()
+            , cursor.c_str()
+            , count
         );
     }
-    if (r != NULL && r->type != REDIS_REPLY_ERROR) {
-        if (r->elements > 0)
-            *list = new FileInfo[r->elements];
-        for (size_t i = 0; i < r->elements; i++) {
-            if (r->element[i]->type != REDIS_REPLY_STRING)
-                continue;
-            if (isSystemKey(r->element[i]->str))
-                continue;
-            // full name in form of "namespaceId_filename"
-            if (!getNameFromFileKey(
-                r->element[i]->str, r->element[i]->len,
-                &list[0][numFiles].name,
-                list[0][numFiles].nameLength,
-                list[0][numFiles].namespaceId
-            )) {
+
+    // the reply has two parts, the cursor for next scan, and an array of keys
+    if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[1]->type != REDIS_REPLY_ARRAY) {
+        LOG(ERROR) << "Failed to scan file names of namespace " << (int) namespaceId << " with prefix " << prefix;
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+        freeReplyObject(r);
+        return false;
+    }
+
+    cursor = std::string(r->element[0]->str, r->element[0]->len);
+
+    redisReply **listr = r->element[1]->element;
+    for (size_t i = 0; i < r->element[1]->elements; i++) {
+        if (listr[i]->type != REDIS_REPLY_STRING || isSystemKey(listr[i]->str))
+            continue;
+        keys.emplace_back(listr[i]->str, listr[i]->len);
+    }
+
+    freeReplyObject(r);
+
+    return true;
+}
+
+unsigned int RedisMetaStore::getFileInfoOfKeys(redisContext *cxt, const std::vector<std::string> &keys, FileInfo *list, bool withSize, bool withTime, bool withVersions) {
+    bool withMeta = withSize || withTime || withVersions;
+
+    // get file size and time if requested, for all files in one round trip
+    if (withMeta) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            redisAppendCommand(
+                cxt
+                , "HMGET %b size ctime atime mtime ver dm md5 numC sg_size sg_mtime sc"
+                , keys.at(i).data(), keys.at(i).size()
+            );
+        }
+    }
+
+    unsigned int numFiles = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        redisReply *metar = 0;
+        if (withMeta && redisGetReply(cxt, (void**) &metar) != REDIS_OK) {
+            LOG(ERROR) << "Failed to get file size and time of " << keys.size() - i << " files, Redis reply with error";
+            redisReconnect(cxt);
+            break;
+        }
+        FileInfo &cur = list[numFiles];
+        // full name in form of "namespaceId_filename"
+        if (!getNameFromFileKey(keys.at(i).c_str(), keys.at(i).size(), &cur.name, cur.nameLength, cur.namespaceId)) {
+            freeReplyObject(metar);
+            continue;
+        }
+        if (withMeta) {
+            if (metar == NULL || metar->type != REDIS_REPLY_ARRAY || metar->elements < 1) {
+                LOG(WARNING) << "Cannot get file size and time of file " << cur.name << ", reply type = " << (metar == NULL? -1 : metar->type);
+                freeReplyObject(metar);
+                free(cur.name);
+                cur.reset();
                 continue;
-            }
-            FileInfo &cur = list[0][numFiles];
-            // get file size and time if requested
-            if (withSize || withTime || withVersions) {
-                redisReply *metar = (redisReply *) redisCommand(
-                    _cxt,
-                    "HMGET %s size ctime atime mtime ver dm md5 numC sg_size sg_mtime sc",
-                    r->element[i]->str
-                );
-                if (metar == NULL || metar->type != REDIS_REPLY_ARRAY || metar->elements < 1) {
-                    LOG(WARNING) << "Cannot get file size and time of file " << cur.name << ", reply type = " << (metar == NULL? -1 : metar->type);
-                    freeReplyObject(metar);
-                    metar = 0;
-                    continue;
-                } else {
-                    unsigned long int stagedSize = 0; 
-                    // size
-                    if (metar->element[0]->type == REDIS_REPLY_STRING && metar->element[0]->len == sizeof(unsigned long int))
-                        memcpy(&cur.size, metar->element[0]->str, sizeof(unsigned long int));
-                    else
-                        cur.size = 0;
-                    // creation time
-                    if (metar->elements >= 2 && metar->element[1]->type == REDIS_REPLY_STRING && metar->element[1]->len == sizeof(time_t))
-                        memcpy(&cur.ctime, metar->element[1]->str, sizeof(time_t));
-                    else
-                        cur.ctime = 0;
-                    // last access time
-                    if (metar->elements >= 3 && metar->element[2]->type == REDIS_REPLY_STRING && metar->element[2]->len == sizeof(time_t))
-                        memcpy(&cur.atime, metar->element[2]->str, sizeof(time_t));
-                    else
-                        cur.atime = 0;
-                    // last modify time
-                    if (metar->elements >= 4 && metar->element[3]->type == REDIS_REPLY_STRING && metar->element[3]->len == sizeof(time_t))
-                        memcpy(&cur.mtime, metar->element[3]->str, sizeof(time_t));
-                    else
-                        cur.mtime = 0;
-                    // file version 
-                    if (metar->elements >= 5 && metar->element[4]->type == REDIS_REPLY_STRING && metar->element[4]->len == sizeof(int))
-                        memcpy(&cur.version, metar->element[4]->str, sizeof(int));
-                    else
-                        cur.version = 0;
-                    // delete marker
-                    if (metar->elements >= 6 && metar->element[5]->type == REDIS_REPLY_STRING && metar->element[5]->len == 1)
-                        cur.isDeleted = atoi(metar->element[5]->str);
-                    else
-                        cur.isDeleted = 0;
-                    // md5 checksum
-                    if (metar->elements >= 7 && metar->element[6]->type == REDIS_REPLY_STRING && metar->element[6]->len == MD5_DIGEST_LENGTH)
-                        memcpy(&cur.md5, metar->element[6]->str, MD5_DIGEST_LENGTH);
-                    // number of chunks
-                    if (metar->elements >= 8 && metar->element[7]->type == REDIS_REPLY_STRING && metar->element[7]->len == sizeof(int))
-                        memcpy(&cur.numChunks, metar->element[7]->str, sizeof(int));
-                    // staged size
-                    if (metar->elements >= 9 && metar->element[8]->type == REDIS_REPLY_STRING && metar->element[8]->len == sizeof(unsigned long int))
-                        memcpy(&stagedSize, metar->element[8]->str, sizeof(unsigned long int));
-                    // staged last modified time
-                    if (metar->elements >= 10 && metar->element[9]->type == REDIS_REPLY_STRING && metar->element[9]->len == sizeof(time_t)) {
-                        time_t mtime = 0;
-                        memcpy(&mtime, metar->element[9]->str, sizeof(time_t));
-                        // use staged file info if staged file is more updated
-                        if (mtime > cur.mtime) {
-                            cur.mtime = mtime;
-                            cur.atime = mtime;
-                            cur.size = stagedSize;
-                        }
-                    }
-                    if (metar->elements >= 11 && metar->element[10]->type == REDIS_REPLY_STRING) {
-                        cur.storageClass = std::string(metar->element[10]->str, metar->element[10]->len);
+            } else {
+                unsigned long int stagedSize = 0; 
+                // size
+                if (metar->element[0]->type == REDIS_REPLY_STRING && metar->element[0]->len == sizeof(unsigned long int))
+                    memcpy(&cur.size, metar->element[0]->str, sizeof(unsigned long int));
+                else
+                    cur.size = 0;
+                // creation time
+                if (metar->elements >= 2 && metar->element[1]->type == REDIS_REPLY_STRING && metar->element[1]->len == sizeof(time_t))
+                    memcpy(&cur.ctime, metar->element[1]->str, sizeof(time_t));
+                else
+                    cur.ctime = 0;
+                // last access time
+                if (metar->elements >= 3 && metar->element[2]->type == REDIS_REPLY_STRING && metar->element[2]->len == sizeof(time_t))
+                    memcpy(&cur.atime, metar->element[2]->str, sizeof(time_t));
+                else
+                    cur.atime = 0;
+                // last modify time
+                if (metar->elements >= 4 && metar->element[3]->type == REDIS_REPLY_STRING && metar->element[3]->len == sizeof(time_t))
+                    memcpy(&cur.mtime, metar->element[3]->str, sizeof(time_t));
+                else
+                    cur.mtime = 0;
+                // file version 
+                if (metar->elements >= 5 && metar->element[4]->type == REDIS_REPLY_STRING && metar->element[4]->len == sizeof(int))
+                    memcpy(&cur.version, metar->element[4]->str, sizeof(int));
+                else
+                    cur.version = 0;
+                // delete marker
+                if (metar->elements >= 6 && metar->element[5]->type == REDIS_REPLY_STRING && metar->element[5]->len == 1)
+                    cur.isDeleted = atoi(metar->element[5]->str);
+                else
+                    cur.isDeleted = 0;
+                // md5 checksum
+                if (metar->elements >= 7 && metar->element[6]->type == REDIS_REPLY_STRING && metar->element[6]->len == MD5_DIGEST_LENGTH)
+                    memcpy(&cur.md5, metar->element[6]->str, MD5_DIGEST_LENGTH);
+                // number of chunks
+                if (metar->elements >= 8 && metar->element[7]->type == REDIS_REPLY_STRING && metar->element[7]->len == sizeof(int))
+                    memcpy(&cur.numChunks, metar->element[7]->str, sizeof(int));
+                // staged size
+                if (metar->elements >= 9 && metar->element[8]->type == REDIS_REPLY_STRING && metar->element[8]->len == sizeof(unsigned long int))
+                    memcpy(&stagedSize, metar->element[8]->str, sizeof(unsigned long int));
+                // staged last modified time
+                if (metar->elements >= 10 && metar->element[9]->type == REDIS_REPLY_STRING && metar->element[9]->len == sizeof(time_t)) {
+                    time_t mtime = 0;
+                    memcpy(&mtime, metar->element[9]->str, sizeof(time_t));
+                    // use staged file info if staged file is more updated
+                    if (mtime > cur.mtime) {
+                        cur.mtime = mtime;
+                        cur.atime = mtime;
+                        cur.size = stagedSize;
                     }
                 }
-                freeReplyObject(metar);
-                metar = 0;
-            }
-            // do not add delete marker to the list unless for queries on versions
-            if (!withVersions && cur.isDeleted) {
-                continue;
+                if (metar->elements >= 11 && metar->element[10]->type == REDIS_REPLY_STRING) {
+                    cur.storageClass = std::string(metar->element[10]->str, metar->element[10]->len);
+                }
             }
-            if (withVersions && cur.version > 0) {
-                char vlname[PATH_MAX];
-                int vlnameLength = genFileVersionListKey(cur.namespaceId, cur.name, cur.nameLength, vlname);
-                redisReply *metar = (redisReply *) redisCommand(
-                    _cxt
-                    , "ZRANGE %b 0 %d"
-                    , vlname, vlnameLength
-                    , cur.version
-                );
-                if (metar == NULL || metar->type != REDIS_REPLY_ARRAY || metar->elements < 1) {
-                    DLOG(INFO) << "No version summary " << cur.name << ", reply type = " << (metar == NULL? -1 : metar->type);
-                    if (metar == NULL) {
-                        redisReconnect(_cxt);
-                    }
-                } else {
-                    size_t total = metar->elements;
-                    cur.numVersions = total;
-                    try {
-                        cur.versions = new VersionInfo[total];
-                        for (size_t vi = 0; vi < total; vi++) {
-                            if (metar->element[vi]->type != REDIS_REPLY_STRING)
-                                continue;
-                            char *ofs = metar->element[vi]->str;
-                            char *end = metar->element[vi]->str + metar->element[vi]->len;
-                            for (int vj = 0; vj < 6 && ofs < end; vj++) {
-                                if (ofs[0] != '-') { // if the field is available (not blanked)
-                                    switch (vj) {
-                                    case 0: // version number
-                                        cur.versions[vi].version = atoi(ofs);
-                                        break;
-                                    case 1: // size
-                                        memcpy(&cur.versions[vi].size, ofs, sizeof(unsigned long int));
-                                        break;
-                                    case 2: // mtime
-                                        memcpy(&cur.versions[vi].mtime, ofs, sizeof(time_t));
-                                        break;
-                                    case 3: // md5
-                                        memcpy(cur.versions[vi].md5, ofs, MD5_DIGEST_LENGTH);
-                                        break;
-                                    case 4: // delete mark
-                                        cur.versions[vi].isDeleted = atoi(ofs);
-                                        break;
-                                    case 5: // number of chunks 
-                                        memcpy(&cur.versions[vi].numChunks, ofs, sizeof(int));
-                                        break;
-                                    }
-                                }
-                                // find the next whitespace
-                                ofs = vj == 5? NULL : (char*) memchr(ofs, ' ', metar->element[vi]->len - (metar->element[vi]->str - ofs));
-                                if (ofs == NULL || ofs >= end) {
-                                    break;
-                                }
-                                // skip the whitespace
-                                ofs += 1;
+            freeReplyObject(metar);
+            metar = 0;
+        }
+        // do not add delete marker to the list unless for queries on versions
+        if (!withVersions && cur.isDeleted) {
+            free(cur.name);
+            cur.reset();
+            continue;
+        }
+        numFiles++;
+    }
+
+    if (!withVersions)
+        return numFiles;
+
+    // get the version summaries of files with previous versions, also in one round trip
+    std::vector<unsigned int> filesWithVersions;
+    for (unsigned int i = 0; i < numFiles; i++) {
+        if (list[i].version <= 0)
+            continue;
+        char vlname[PATH_MAX];
+        int vlnameLength = genFileVersionListKey(list[i].namespaceId, list[i].name, list[i].nameLength, vlname);
+        redisAppendCommand(
+            cxt
+            , "ZRANGE %b 0 %d"
+            , vlname, (size_t) vlnameLength
+            , list[i].version
+        );
+        filesWithVersions.push_back(i);
+    }
+
+    for (size_t fi = 0; fi < filesWithVersions.size(); fi++) {
+        FileInfo &cur = list[filesWithVersions.at(fi)];
+        redisReply *metar = 0;
+        if (redisGetReply(cxt, (void**) &metar) != REDIS_OK) {
+            LOG(ERROR) << "Failed to get version summary of " << filesWithVersions.size() - fi << " files, Redis reply with error";
+            redisReconnect(cxt);
+            break;
+        }
+        if (metar == NULL || metar->type != REDIS_REPLY_ARRAY || metar->elements < 1) {
+            DLOG(INFO) << "No version summary " << cur.name << ", reply type = " << (metar == NULL? -1 : metar->type);
+        } else {
+            size_t total = metar->elements;
+            cur.numVersions = total;
+            try {
+                cur.versions = new VersionInfo[total];
+                for (size_t vi = 0; vi < total; vi++) {
+                    if (metar->element[vi]->type != REDIS_REPLY_STRING)
+                        continue;
+                    char *ofs = metar->element[vi]->str;
+                    char *end = metar->element[vi]->str + metar->element[vi]->len;
+                    for (int vj = 0; vj < 6 && ofs < end; vj++) {
+                        if (ofs[0] != '-') { // if the field is available (not blanked)
+                            switch (vj) {
+                            case 0: // version number
+                                cur.versions[vi].version = atoi(ofs);
+                                break;
+                            case 1: // size
+                                memcpy(&cur.versions[vi].size, ofs, sizeof(unsigned long int));
+                                break;
+                            case 2: // mtime
+                                memcpy(&cur.versions[vi].mtime, ofs, sizeof(time_t));
+                                break;
+                            case 3: // md5
+                                memcpy(cur.versions[vi].md5, ofs, MD5_DIGEST_LENGTH);
+                                break;
+                            case 4: // delete mark
+                                cur.versions[vi].isDeleted = atoi(ofs);
+                                break;
+                            case 5: // number of chunks 
+                                memcpy(&cur.versions[vi].numChunks, ofs, sizeof(int));
+                                break;
                             }
-                            DLOG(INFO) << "Add version " << cur.versions[vi].version << " size " << cur.versions[vi].size << " mtime " << cur.versions[vi].mtime << " deleted " << cur.versions[vi].isDeleted << " to version list of file " << cur.name; 
                         }
-                    } catch (std::exception &e) {
-                        LOG(ERROR) << "Cannot allocate memory for " << total << " version records";
-                        cur.versions = 0;
+                        // find the next whitespace
+                        ofs = vj == 5? NULL : (char*) memchr(ofs, ' ', metar->element[vi]->len - (metar->element[vi]->str - ofs));
+                        if (ofs == NULL || ofs >= end) {
+                            break;
+                        }
+                        // skip the whitespace
+                        ofs += 1;
                     }
+                    DLOG(INFO) << "Add version " << cur.versions[vi].version << " size " << cur.versions[vi].size << " mtime " << cur.versions[vi].mtime << " deleted " << cur.versions[vi].isDeleted << " to version list of file " << cur.name; 
                 }
-                freeReplyObject(metar);
-                metar = 0;
+            } catch (std::exception &e) {
+                LOG(ERROR) << "Cannot allocate memory for " << total << " version records";
+                cur.versions = 0;
             }
-            numFiles++;
         }
+        freeReplyObject(metar);
+        metar = 0;
     }
-    if (r == NULL) {
-        redisReconnect(_cxt);
-    }
-    freeReplyObject(r);
-    r = 0;
+
     return numFiles;
 }
 
 unsigned int RedisMetaStore::getFolderList(std::vector<std::string> &list, unsigned char namespaceId, std::string prefix, bool skipSubfolders) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
     
     // generate the prefix for pattern-based directory searching
     prefix.append("a");
@@ -1285,7 +1794,7 @@ unsigned int RedisMetaStore::getFolderList(std::vector<std::string> &list, unsig
     redisReply *r = 0;
     do {
         r = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "SSCAN %s %s MATCH %s"
             , DIR_LIST_KEY
             , cursor.c_str()
@@ -1295,7 +1804,7 @@ unsigned int RedisMetaStore::getFolderList(std::vector<std::string> &list, unsig
         if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[1]->type != REDIS_REPLY_ARRAY) {
             LOG(ERROR) << "Failed to scan metadata store for folders, r = " << (void *) r << " type = " << (r? r->type : -1) << " elements " << (r? r->elements : -1);
             if (r == NULL) {
-                redisReconnect(_cxt);
+                redisReconnect(cxt);
             }
             freeReplyObject(r);
             return count;
@@ -1339,41 +1848,22 @@ unsigned long int RedisMetaStore::getMaxNumKeysSupported() {
 }
 
 unsigned long int RedisMetaStore::getNumFiles() {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
     unsigned long int count = 0;
+    // read the counter maintained on metadata creation and deletion
     redisReply *r = (redisReply *) redisCommand(
-        _cxt
-        , "DBSIZE"
+        cxt
+        , "GET %s"
+        , FILE_COUNT_KEY
     );
-    if (r == NULL || r->type != REDIS_REPLY_INTEGER) {
+    if (r == NULL || r->type != REDIS_REPLY_STRING) {
         LOG(ERROR) << "Failed to get file count";
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
     } else {
-        count = r->integer;
-        freeReplyObject(r);
-        r = 0;
-        r = (redisReply *) redisCommand(
-            _cxt
-            , "SCARD %s"
-            , DIR_LIST_KEY
-        );
-        // exclude keys for directory sets
-        if (r != NULL && r->type == REDIS_REPLY_INTEGER) {
-            count -= r->integer;
-        }
-        freeReplyObject(r);
-        r = 0;
-        r = (redisReply *) redisCommand(
-            _cxt
-            , "KEYS //sncc*"
-        );
-        // exclude system keys
-        if (r != NULL && r->type == REDIS_REPLY_ARRAY) {
-            count -= r->elements;
-        }
-        count /= 2;
+        long long value = strtoll(r->str, NULL, 10);
+        count = value > 0? value : 0;
     }
 
     freeReplyObject(r);
@@ -1381,46 +1871,109 @@ unsigned long int RedisMetaStore::getNumFiles() {
     return count;
 }
 
-unsigned long int RedisMetaStore::getNumFilesToRepair() {
-    std::lock_guard<std::mutex> lk(_lock);
-    // pop up files to repair
+bool RedisMetaStore::initFileCount(redisContext *cxt) {
     redisReply *r = (redisReply *) redisCommand(
-        _cxt,
-        "SCARD %s",
-        FILE_REPAIR_KEY
+        cxt
+        , "EXISTS %s"
+        , FILE_COUNT_KEY
     );
-
-    bool okay = r != NULL && (r->type == REDIS_REPLY_NIL || r->type == REDIS_REPLY_INTEGER);
-    
-    unsigned long int count = okay? r->integer : -1;
-
-    if (r == NULL) {
-        redisReconnect(_cxt);
+    if (r == NULL || r->type != REDIS_REPLY_INTEGER) {
+        LOG(ERROR) << "Failed to check the file counter";
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+        freeReplyObject(r);
+        return false;
     }
-
+    bool exists = r->integer > 0;
     freeReplyObject(r);
     r = 0;
 
-    return count;
-}
-
-int RedisMetaStore::getFilesToRepair(int numFiles, File files[]) {
-    std::lock_guard<std::mutex> lk(_lock);
-
-    // pop up files to repair
-    redisReply *r = (redisReply *) redisCommand(
-        _cxt,
-        "SPOP %s %d",
-        FILE_REPAIR_KEY,
-        numFiles
-    );
+    if (exists)
+        return true;
+
+    // count the file keys (starting with the namespace id) once, for metadata stores created without the counter
+    unsigned long int count = 0;
+    std::string cursor = "0";
+    do {
+        r = (redisReply *) redisCommand(
+            cxt
+            , "SCAN %s MATCH [0-9]* COUNT %d"
+            , cursor.c_str()
+            , FILE_LIST_SCAN_BATCH_SIZE
+        );
+        if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[1]->type != REDIS_REPLY_ARRAY) {
+            LOG(ERROR) << "Failed to scan file names for initializing the file counter";
+            if (r == NULL) {
+                redisReconnect(cxt);
+            }
+            freeReplyObject(r);
+            return false;
+        }
+        cursor = std::string(r->element[0]->str, r->element[0]->len);
+        count += r->element[1]->elements;
+        freeReplyObject(r);
+        r = 0;
+    } while (cursor != "0");
+
+    r = (redisReply *) redisCommand(
+        cxt
+        , "SET %s %lu NX"
+        , FILE_COUNT_KEY
+        , count
+    );
+    bool success = r != NULL && r->type != REDIS_REPLY_ERROR;
+    if (r == NULL) {
+        redisReconnect(cxt);
+    }
+    freeReplyObject(r);
+    r = 0;
+
+    LOG(INFO) << "Initialize the file counter with " << count << " files";
+
+    return success;
+}
+
+unsigned long int RedisMetaStore::getNumFilesToRepair() {
+    RedisConnection cxt(_pool);
+    // pop up files to repair
+    redisReply *r = (redisReply *) redisCommand(
+        cxt,
+        "SCARD %s",
+        FILE_REPAIR_KEY
+    );
+
+    bool okay = r != NULL && (r->type == REDIS_REPLY_NIL || r->type == REDIS_REPLY_INTEGER);
+    
+    unsigned long int count = okay? r->integer : -1;
+
+    if (r == NULL) {
+        redisReconnect(cxt);
+    }
+
+    freeReplyObject(r);
+    r = 0;
+
+    return count;
+}
+
+int RedisMetaStore::getFilesToRepair(int numFiles, File files[]) {
+    RedisConnection cxt(_pool);
+
+    // pop up files to repair
+    redisReply *r = (redisReply *) redisCommand(
+        cxt,
+        "SPOP %s %d",
+        FILE_REPAIR_KEY,
+        numFiles
+    );
 
     // retry with legacy command upon error, SPOP only supports multiple items for Redis >=3.2
     if (r != NULL && r->type == REDIS_REPLY_ERROR) {
         freeReplyObject(r);
         r = 0;
         r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "SPOP %s",
             FILE_REPAIR_KEY
         );
@@ -1443,7 +1996,7 @@ int RedisMetaStore::getFilesToRepair(int numFiles, File files[]) {
         // put the extra files back back to queue (best effort)
         for (;i < r->elements; i++) {
             redisReply *br = (redisReply *) redisCommand(
-                _cxt,
+                cxt,
                 "SADD %s %s"
                 FILE_REPAIR_KEY,
                 r->element[i]->str
@@ -1458,7 +2011,7 @@ int RedisMetaStore::getFilesToRepair(int numFiles, File files[]) {
         } else {
             // not enough memory, skip the repair for time being
             redisReply *br = (redisReply *) redisCommand(
-                _cxt,
+                cxt,
                 "SADD %s %s"
                 FILE_REPAIR_KEY,
                 r->str
@@ -1476,7 +2029,7 @@ int RedisMetaStore::getFilesToRepair(int numFiles, File files[]) {
     }
 
     if (r == NULL) {
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
     }
 
     freeReplyObject(r);
@@ -1506,11 +2059,11 @@ bool RedisMetaStore::markFileAsWrittenToCloud(const File &file, bool removePendi
 }
 
 bool RedisMetaStore::markFileStatus(const File &file, const char *listName, bool set, const char *opName) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
     char filename[PATH_MAX];
     int nameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, filename);
     redisReply *r = (redisReply *) redisCommand(
-        _cxt,
+        cxt,
         "%s %s %b",
         set? "SADD" : "SREM",
         listName,
@@ -1521,7 +2074,7 @@ bool RedisMetaStore::markFileStatus(const File &file, const char *listName, bool
     if (!ret) {
         LOG(ERROR) << "Failed to " << (set? "add" : "remove") << " file " << file.name << " from the " << opName << " list, " << (r != NULL ? "reply is invalid" : "failed to get reply"); 
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
     } else if (r->integer != 1) {
         DLOG(INFO) << "File " << file.name << "(" << filename << ")" << (set? " already" : " not") << " in the " << opName << " list"; 
@@ -1537,12 +2090,14 @@ bool RedisMetaStore::markFileStatus(const File &file, const char *listName, bool
 }
 
 int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
+    // one scan over the set at a time
+    std::lock_guard<std::mutex> lk(_scanLock);
 
     int num = 0;
 
     redisReply *r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "SCARD %s_copy"
             , FILE_PENDING_WRITE_KEY
     );
@@ -1562,7 +2117,7 @@ int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
     // refill the set for scan
     if (empty) {
         r = (redisReply *) redisCommand(
-                _cxt,
+                cxt,
                 "SDIFFSTORE %s_copy %s %s_not_exists"
                 , FILE_PENDING_WRITE_KEY
                 , FILE_PENDING_WRITE_KEY
@@ -1586,7 +2141,7 @@ int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
 
     // try to pop a file name for write
     r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "SPOP %s_copy"
             , FILE_PENDING_WRITE_KEY
     );
@@ -1602,14 +2157,14 @@ int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
 
     if (!okay) {
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
         return num;
     }
 
     // mark the file as pending to complete for write
     r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "SMOVE %s %s %s"
             , FILE_PENDING_WRITE_KEY
             , FILE_PENDING_WRITE_COMP_KEY
@@ -1623,7 +2178,7 @@ int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
     }
 
     if (r == NULL) {
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
     }
 
     freeReplyObject(r);
@@ -1632,7 +2187,7 @@ int RedisMetaStore::getFilesPendingWriteToCloud(int numFiles, File files[]) {
 }
 
 bool RedisMetaStore::updateFileStatus(const File &file) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
     char filename[PATH_MAX];
     int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
     bool ret = false;
@@ -1648,7 +2203,7 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
             return v ~= false;"
         );
         r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "EVAL %s 1 %s %s"
             , script.c_str()
             , BG_TASK_PENDING_KEY
@@ -1660,7 +2215,7 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
     } else if (file.status == FileStatus::BG_TASK_PENDING) {
         // increment number of task by 1
         r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "ZINCRBY %s 1 %b"
             , BG_TASK_PENDING_KEY
             , filename, (size_t) nameLength
@@ -1670,7 +2225,7 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
             DLOG(INFO) << "File (task pending) " << file.name << " status updated bg task = " << r->str;
     } else if (file.status == FileStatus::ALL_BG_TASKS_COMPLETED) {
         r = (redisReply *) redisCommand(
-            _cxt,
+            cxt,
             "ZREM %s %b"
             , BG_TASK_PENDING_KEY
             , filename, (size_t) nameLength
@@ -1686,7 +2241,7 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
     // update the last task check time
     time_t tctime = time(NULL);
     r = (redisReply *) redisCommand(
-        _cxt ,
+        cxt ,
         "HSET %b tctime %b"
         , filename, (size_t) nameLength
         , &tctime, (size_t) sizeof(tctime)
@@ -1696,7 +2251,7 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
     if (ret == false) {
         LOG(ERROR) << "Failed to update status of file " << file.name << ", [" << (r == 0? -1 : r->type) << "] " << (r == 0? "(NIL)" : r->str);
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
     }
 
@@ -1707,9 +2262,11 @@ bool RedisMetaStore::updateFileStatus(const File &file) {
 }
 
 bool RedisMetaStore::getNextFileForTaskCheck(File &file) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
+    // one scan over the set at a time
+    std::lock_guard<std::mutex> lk(_scanLock);
     redisReply *r = (redisReply *) redisCommand(
-        _cxt,
+        cxt,
         "ZSCAN %s %s COUNT 1"
         , BG_TASK_PENDING_KEY
         , _taskScanIt.c_str()
@@ -1724,7 +2281,7 @@ bool RedisMetaStore::getNextFileForTaskCheck(File &file) {
     if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[0]->type != REDIS_REPLY_STRING) {
         LOG(ERROR) << "Failed to get a valid reply for next file to check";
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
     } else {
         // update the next iterator
@@ -1750,14 +2307,68 @@ bool RedisMetaStore::getNextFileForTaskCheck(File &file) {
     return ret;
 }
 
-bool RedisMetaStore::lockFile(const File &file) {
-    std::lock_guard<std::mutex> lk(_lock);
-    return getLockOnFile(file, true);
+bool RedisMetaStore::lockFile(const File &file, bool shared) {
+    RedisConnection cxt(_pool);
+    if (!getLockOnFile(cxt, file, true, shared))
+        return false;
+    // the lock holder always reads the latest metadata, even if an invalidation is still on its way
+    invalidateCachedMeta(cxt, file, /* publish */ false);
+    return true;
 }
 
-bool RedisMetaStore::unlockFile(const File &file) {
-    std::lock_guard<std::mutex> lk(_lock);
-    return getLockOnFile(file, false);
+int RedisMetaStore::lockFilesMulti(const std::vector<File *> &files, std::vector<bool> &locked) {
+    size_t numFiles = files.size();
+    int numLocked = 0;
+    locked.assign(numFiles, false);
+
+    if (numFiles == 0)
+        return 0;
+
+    RedisConnection cxt(_pool);
+
+    // pipeline the lock requests of all files
+    char filename[PATH_MAX];
+    std::vector<std::string> keys(numFiles);
+    for (size_t i = 0; i < numFiles; i++) {
+        int nameLength = genFileKey(files.at(i)->namespaceId, files.at(i)->name, files.at(i)->nameLength, filename);
+        keys.at(i).assign(filename, nameLength);
+        appendLeaseCommand(cxt, LEASE_ACQUIRE_SCRIPT, keys.at(i), /* shared */ false, /* token */ 0);
+    }
+
+    redisReply *r = 0;
+    for (size_t i = 0; i < numFiles; i++) {
+        if (redisGetReply(cxt, (void **) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to lock file " << files.at(i)->name << ", failed to get reply";
+            redisReconnect(cxt);
+            break;
+        }
+        locked.at(i) = r->type == REDIS_REPLY_INTEGER && r->integer > 0;
+        if (locked.at(i))
+            recordLease(keys.at(i), /* shared */ false, r->integer);
+        freeReplyObject(r);
+        r = 0;
+        if (!locked.at(i))
+            continue;
+        numLocked++;
+        // the lock holder always reads the latest metadata, even if an invalidation is still on its way
+        invalidateCachedMeta(cxt, *files.at(i), /* publish */ false);
+    }
+
+    return numLocked;
+}
+
+bool RedisMetaStore::unlockFile(const File &file, bool shared) {
+    RedisConnection cxt(_pool);
+    return getLockOnFile(cxt, file, false, shared);
+}
+
+unsigned long int RedisMetaStore::getLockToken(const File &file) {
+    char filename[PATH_MAX];
+    int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
+
+    std::lock_guard<std::mutex> lk(_leaseLock);
+    auto it = _exclusiveLeases.find(std::string(filename, nameLength));
+    return it != _exclusiveLeases.end()? it->second : 0;
 }
 
 std::tuple<int, std::string, int> extractJournalFieldKeyParts(const char *field, size_t fieldLength) {
@@ -1783,7 +2394,7 @@ std::tuple<int, std::string, int> extractJournalFieldKeyParts(const char *field,
 }
 
 bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int containerId, bool isWrite) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char key[MAX_KEY_SIZE];
     int keyLength = genFileJournalKey(file.namespaceId, file.name, file.nameLength, file.version, key);
@@ -1805,7 +2416,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
     do {
         // keep scanning previous for records
         r = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "HSCAN %b %d MATCH %s-op*"
             , key, (size_t) keyLength
             , cursor
@@ -1814,7 +2425,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
         if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements < 1) {
             LOG(ERROR) << "Failed to add the journal record of chunk " << chunk.getChunkId() << " of file " << file.name << " with namespace " << (int) file.namespaceId;
             freeReplyObject(r);
-            if (r == NULL) redisReconnect(_cxt);
+            if (r == NULL) redisReconnect(cxt);
             return false;
         }
         int numModifiedRecords = 0;
@@ -1840,7 +2451,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
                     continue;
                 }
                 redisAppendCommand(
-                    _cxt
+                    cxt
                     , "HSET %b %b %s"
                     , key, (size_t) keyLength
                     , preValue->str, preValue->len
@@ -1859,7 +2470,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
 
         bool allCompleted = true;
         for (int ri = 0; ri < numModifiedRecords; ri++) {
-            bool opCompleted = redisGetReply(_cxt, (void**) &r) == REDIS_OK;
+            bool opCompleted = redisGetReply(cxt, (void**) &r) == REDIS_OK;
             allCompleted = allCompleted && opCompleted;
             // mark that a previous write is changed into a deletion
             if (containerIdMatchedIdx == ri && opCompleted) {
@@ -1886,7 +2497,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
          return -1; \
     ";
     r = (redisReply*) redisCommand(
-        _cxt
+        cxt
         , "EVAL %s 2 %b %s %s-size-%d %b %s-md5-%d %b %s-op-%d %s %s-status-%d %s %b"
         , script.c_str()
         , key, (size_t) keyLength /* KEYS[1] */
@@ -1904,7 +2515,7 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
     if (r == NULL || r->type != REDIS_REPLY_INTEGER || r->integer == -1) {
         freeReplyObject(r);
         LOG(ERROR) << "Failed to add the journal record of chunk " << chunk.getChunkId() << " of file " << file.name << " with namespace " << (int) file.namespaceId;
-        if (r == NULL) redisReconnect(_cxt);
+        if (r == NULL) redisReconnect(cxt);
         return false;
     }
     freeReplyObject(r);
@@ -1912,6 +2523,8 @@ bool RedisMetaStore::addChunkToJournal(const File &file, const Chunk &chunk, int
 }
 
 bool RedisMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk, bool isWrite, bool deleteRecord, int containerId) {
+    RedisConnection cxt(_pool);
+
     char key[MAX_KEY_SIZE];
     int keyLength = genFileJournalKey(file.namespaceId, file.name, file.nameLength, file.version, key);
 
@@ -1937,7 +2550,7 @@ bool RedisMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk,
             return 2;"
         ;
         r = (redisReply *) redisCommand(
-            _cxt
+            cxt
             , "EVAL %s 3 %b %s %b %s-size-%d %s-md5-%d %s-op-%d %s-status-%d"
             , script.c_str()
             , key, (size_t) keyLength
@@ -1960,7 +2573,7 @@ bool RedisMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk,
             return "";"
         ;
         r = (redisReply*) redisCommand(
-            _cxt
+            cxt
             , "EVAL %s 1 %b %s-op-%d %s-status-%d %s %s"
             , script.c_str()
             , key, (size_t) keyLength
@@ -1975,7 +2588,7 @@ bool RedisMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk,
     if (!success) {
         freeReplyObject(r);
         LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal record of chunk " << chunk.getChunkId() << " of file " << file.name << " with namespace " << (int) file.namespaceId << " version " << file.version << " in container " << containerId;
-        if (r == NULL) redisReconnect(_cxt);
+        if (r == NULL) redisReconnect(cxt);
         return false;
     }
 
@@ -1983,20 +2596,131 @@ bool RedisMetaStore::updateChunkInJournal(const File &file, const Chunk &chunk,
     return true;
 }
 
+bool RedisMetaStore::addChunksToJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite) {
+    if (chunks.size() != containerIds.size()) {
+        LOG(ERROR) << "Failed to add the journal records of file " << file.name << " with namespace " << (int) file.namespaceId << ", number of chunks (" << chunks.size() << ") and containers (" << containerIds.size() << ") mismatch";
+        return false;
+    }
+    if (chunks.empty())
+        return true;
+
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFileJournalKey(file.namespaceId, file.name, file.nameLength, file.version, key);
+
+    char filename[PATH_MAX];
+    int nameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, filename);
+
+    // chunk prefixes and container ids of all chunks, prepared before taking pointers to them
+    std::vector<std::string> cnames(chunks.size()), cids(chunks.size());
+    char cname[MAX_KEY_SIZE];
+    for (size_t i = 0; i < chunks.size(); i++) {
+        cnames.at(i).assign(cname, genChunkKeyPrefix(chunks.at(i).getChunkId(), cname));
+        cids.at(i) = std::to_string(containerIds.at(i));
+    }
+
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+    auto addArg = [&argv, &argvlen](const void *arg, size_t length) {
+        argv.push_back((const char *) arg);
+        argvlen.push_back(length);
+    };
+    addArg("EVAL", 4);
+    addArg(JOURNAL_ADD_SCRIPT, sizeof(JOURNAL_ADD_SCRIPT) - 1);
+    addArg("2", 1);
+    addArg(key, keyLength);
+    addArg(JL_LIST_KEY, strlen(JL_LIST_KEY));
+    addArg(filename, nameLength);
+    addArg(isWrite? "w" : "d", 1);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        addArg(cnames.at(i).data(), cnames.at(i).size());
+        addArg(cids.at(i).data(), cids.at(i).size());
+        addArg(&chunks.at(i).size, sizeof(int));
+        addArg(chunks.at(i).md5, MD5_DIGEST_LENGTH);
+    }
+
+    redisReply *r = (redisReply *) redisCommandArgv(cxt, argv.size(), argv.data(), argvlen.data());
+    if (r == NULL || r->type != REDIS_REPLY_INTEGER) {
+        LOG(ERROR) << "Failed to add the journal records of " << chunks.size() << " chunks of file " << file.name << " with namespace " << (int) file.namespaceId;
+        freeReplyObject(r);
+        if (r == NULL) redisReconnect(cxt);
+        return false;
+    }
+    DLOG(INFO) << "Added " << r->integer << " of " << chunks.size() << " journal records of file " << file.name << " with namespace " << (int) file.namespaceId;
+    freeReplyObject(r);
+    return true;
+}
+
+bool RedisMetaStore::updateChunksInJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite, bool deleteRecord) {
+    if (chunks.size() != containerIds.size()) {
+        LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal records of file " << file.name << " with namespace " << (int) file.namespaceId << ", number of chunks (" << chunks.size() << ") and containers (" << containerIds.size() << ") mismatch";
+        return false;
+    }
+    if (chunks.empty())
+        return true;
+
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFileJournalKey(file.namespaceId, file.name, file.nameLength, file.version, key);
+
+    char filename[PATH_MAX];
+    int nameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, filename);
+
+    std::vector<std::string> cnames(chunks.size()), cids(chunks.size());
+    char cname[MAX_KEY_SIZE];
+    for (size_t i = 0; i < chunks.size(); i++) {
+        cnames.at(i).assign(cname, genChunkKeyPrefix(chunks.at(i).getChunkId(), cname));
+        cids.at(i) = std::to_string(containerIds.at(i));
+    }
+
+    const char *script = deleteRecord? JOURNAL_REMOVE_SCRIPT : JOURNAL_UPDATE_SCRIPT;
+    std::vector<const char *> argv;
+    std::vector<size_t> argvlen;
+    auto addArg = [&argv, &argvlen](const void *arg, size_t length) {
+        argv.push_back((const char *) arg);
+        argvlen.push_back(length);
+    };
+    addArg("EVAL", 4);
+    addArg(script, strlen(script));
+    addArg("2", 1);
+    addArg(key, keyLength);
+    addArg(JL_LIST_KEY, strlen(JL_LIST_KEY));
+    addArg(filename, nameLength);
+    addArg(isWrite? "w" : "d", 1);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        addArg(cnames.at(i).data(), cnames.at(i).size());
+        addArg(cids.at(i).data(), cids.at(i).size());
+    }
+
+    redisReply *r = (redisReply *) redisCommandArgv(cxt, argv.size(), argv.data(), argvlen.data());
+    // all records must be updated, while removals only fail if the file journal is inconsistent
+    bool success = r != NULL && r->type == REDIS_REPLY_INTEGER && (deleteRecord? r->integer >= 0 : r->integer == (long long) chunks.size());
+    if (!success) {
+        LOG(ERROR) << "Failed to " << (deleteRecord? "delete" : "update" ) << " the journal records of " << chunks.size() << " chunks of file " << file.name << " with namespace " << (int) file.namespaceId << " version " << file.version;
+        freeReplyObject(r);
+        if (r == NULL) redisReconnect(cxt);
+        return false;
+    }
+    freeReplyObject(r);
+    return true;
+}
+
 void RedisMetaStore::getFileJournal(const FileInfo &file, std::vector<std::tuple<Chunk, int /* container id*/, bool /* isWrite */, bool /* isPre */>> &records) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char key[MAX_KEY_SIZE];
     int keyLength = genFileJournalKey(file.namespaceId, file.name, file.nameLength, file.version, key);
 
     redisReply *r = (redisReply *) redisCommand(
-        _cxt
+        cxt
         , "HGETALL %b"
         , key, (size_t) keyLength
     );
     if (r == NULL) {
         LOG(ERROR) << "Failed to get the journal of file " << file.name << " in namespace " << (int) file.namespaceId;
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
         return;
     }
 
@@ -2058,16 +2782,16 @@ void RedisMetaStore::getFileJournal(const FileInfo &file, std::vector<std::tuple
 }
 
 int RedisMetaStore::getFilesWithJounal(FileInfo **list) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     redisReply *r = (redisReply *) redisCommand(
-        _cxt
+        cxt
         , "SMEMBERS %s"
         , JL_LIST_KEY
     );
 
     if (r == NULL || r->type != REDIS_REPLY_ARRAY) {
-        if (r == NULL) redisReconnect(_cxt);
+        if (r == NULL) redisReconnect(cxt);
         LOG(ERROR) << "Failed to get the list of files with journals, r = " << (void*) r << " reply type = " << (int)(r? r->type : -1) << ".";
         freeReplyObject(r);
         return -1;
@@ -2096,20 +2820,20 @@ int RedisMetaStore::getFilesWithJounal(FileInfo **list) {
 }
 
 bool RedisMetaStore::fileHasJournal(const File &file) {
-    std::lock_guard<std::mutex> lk(_lock);
+    RedisConnection cxt(_pool);
 
     char filename[PATH_MAX];
     int nameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, filename);
 
     redisReply *r = (redisReply *) redisCommand(
-        _cxt
+        cxt
         , "SISMEMBER %s %b"
         , JL_LIST_KEY
         , filename, (size_t) nameLength
     );
 
     if (r == NULL) { 
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
         return false;
     }
 
@@ -2120,6 +2844,522 @@ bool RedisMetaStore::fileHasJournal(const File &file) {
     return exists;
 }
 
+bool RedisMetaStore::putFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations) {
+    if (fingerprints.size() != locations.size()) {
+        LOG(ERROR) << "Failed to store fingerprints, number of locations (" << locations.size() << ") mismatches the number of fingerprints (" << fingerprints.size() << ")";
+        return false;
+    }
+
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintIndexKey(namespaceId, key);
+
+    size_t numRecords = fingerprints.size();
+    for (size_t i = 0; i < numRecords; i++) {
+        const Fingerprint &fp = fingerprints.at(i);
+        std::string loc = encodeBlockLocation(locations.at(i));
+        redisAppendCommand(
+            cxt
+            , "HSET %b %b %b"
+            , key, (size_t) keyLength
+            , fp.data(), (size_t) fp.size()
+            , loc.data(), loc.size()
+        );
+    }
+
+    // issue all commands and check their replies
+    bool okay = true;
+    redisReply *r = 0;
+    for (size_t i = 0; i < numRecords; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to store fingerprints of namespace " << (int) namespaceId << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        okay = okay && r->type == REDIS_REPLY_INTEGER;
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return okay;
+}
+
+int RedisMetaStore::getFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) {
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintIndexKey(namespaceId, key);
+
+    size_t numRecords = fingerprints.size();
+    for (size_t i = 0; i < numRecords; i++) {
+        const Fingerprint &fp = fingerprints.at(i);
+        redisAppendCommand(
+            cxt
+            , "HGET %b %b"
+            , key, (size_t) keyLength
+            , fp.data(), (size_t) fp.size()
+        );
+    }
+
+    locations.clear();
+    locations.resize(numRecords);
+
+    int numFound = 0;
+    redisReply *r = 0;
+    for (size_t i = 0; i < numRecords; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to get fingerprints of namespace " << (int) namespaceId << ", Redis reply with error";
+            redisReconnect(cxt);
+            return -1;
+        }
+        if (r->type == REDIS_REPLY_STRING && decodeBlockLocation(namespaceId, r->str, r->len, locations.at(i))) {
+            numFound++;
+        }
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return numFound;
+}
+
+bool RedisMetaStore::deleteFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints) {
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintIndexKey(namespaceId, key);
+
+    size_t numRecords = fingerprints.size();
+    for (size_t i = 0; i < numRecords; i++) {
+        const Fingerprint &fp = fingerprints.at(i);
+        redisAppendCommand(
+            cxt
+            , "HDEL %b %b"
+            , key, (size_t) keyLength
+            , fp.data(), (size_t) fp.size()
+        );
+    }
+
+    bool okay = true;
+    redisReply *r = 0;
+    for (size_t i = 0; i < numRecords; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to remove fingerprints of namespace " << (int) namespaceId << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        okay = okay && r->type == REDIS_REPLY_INTEGER;
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return okay;
+}
+
+bool RedisMetaStore::scanFingerprints(unsigned char namespaceId, std::string &cursor, int batchSize, std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations) {
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintIndexKey(namespaceId, key);
+
+    redisReply *r = (redisReply*) redisCommand(
+        cxt
+        , "HSCAN %b %s COUNT %d"
+        , key, (size_t) keyLength
+        , cursor.c_str()
+        , batchSize
+    );
+
+    // the reply has two parts, the cursor for next scan, and an array of fields and values
+    if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[1]->type != REDIS_REPLY_ARRAY) {
+        LOG(ERROR) << "Failed to scan fingerprints of namespace " << (int) namespaceId;
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+        freeReplyObject(r);
+        return false;
+    }
+
+    cursor = std::string(r->element[0]->str, r->element[0]->len);
+
+    Fingerprint fp;
+    BlockLocation loc;
+    redisReply **listr = r->element[1]->element;
+    for (size_t i = 0; i + 1 < r->element[1]->elements; i += 2) {
+        if (listr[i]->type != REDIS_REPLY_STRING || listr[i + 1]->type != REDIS_REPLY_STRING)
+            continue;
+        if (!decodeBlockLocation(namespaceId, listr[i + 1]->str, listr[i + 1]->len, loc))
+            continue;
+        fp.set(listr[i]->str, listr[i]->len);
+        fingerprints.emplace_back(fp);
+        locations.emplace_back(loc);
+    }
+
+    freeReplyObject(r);
+
+    return true;
+}
+
+bool RedisMetaStore::updateFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<int> &deltas, std::vector<long long> &counts) {
+    if (fingerprints.size() != deltas.size()) {
+        LOG(ERROR) << "Failed to update fingerprint reference counts, number of changes (" << deltas.size() << ") mismatches the number of fingerprints (" << fingerprints.size() << ")";
+        return false;
+    }
+
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintRefCountKey(namespaceId, key);
+
+    // update and drop the count in one step, so a concurrent increment is never lost
+    const char *script =
+        "local c = redis.call('HINCRBY', KEYS[1], ARGV[1], ARGV[2]); \
+        if c <= 0 then \
+            redis.call('HDEL', KEYS[1], ARGV[1]); \
+        end \
+        return c;"
+    ;
+
+    size_t numRecords = fingerprints.size();
+    for (size_t i = 0; i < numRecords; i++) {
+        const Fingerprint &fp = fingerprints.at(i);
+        redisAppendCommand(
+            cxt
+            , "EVAL %s 1 %b %b %d"
+            , script
+            , key, (size_t) keyLength
+            , fp.data(), (size_t) fp.size()
+            , deltas.at(i)
+        );
+    }
+
+    counts.clear();
+    counts.resize(numRecords, 0);
+
+    bool okay = true;
+    redisReply *r = 0;
+    for (size_t i = 0; i < numRecords; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to update fingerprint reference counts of namespace " << (int) namespaceId << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        if (r->type == REDIS_REPLY_INTEGER) {
+            counts.at(i) = r->integer;
+        } else {
+            okay = false;
+        }
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return okay;
+}
+
+bool RedisMetaStore::getFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts) {
+    RedisConnection cxt(_pool);
+
+    char key[MAX_KEY_SIZE];
+    int keyLength = genFingerprintRefCountKey(namespaceId, key);
+
+    size_t numRecords = fingerprints.size();
+    for (size_t i = 0; i < numRecords; i++) {
+        const Fingerprint &fp = fingerprints.at(i);
+        redisAppendCommand(
+            cxt
+            , "HGET %b %b"
+            , key, (size_t) keyLength
+            , fp.data(), (size_t) fp.size()
+        );
+    }
+
+    counts.clear();
+    counts.resize(numRecords, 0);
+
+    redisReply *r = 0;
+    for (size_t i = 0; i < numRecords; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to get fingerprint reference counts of namespace " << (int) namespaceId << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        if (r->type == REDIS_REPLY_STRING) {
+            counts.at(i) = strtoll(r->str, NULL, 10);
+        }
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return true;
+}
+
+bool RedisMetaStore::putRetiredMeta(const File &file) {
+    RedisConnection cxt(_pool);
+
+    char filename[PATH_MAX], vfilename[PATH_MAX];
+    int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
+    int vnameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, vfilename);
+
+    // keep the metadata under the versioned key, which is not listed but remains accessible by name and version
+    redisAppendCommand(
+        cxt
+        , "DEL %b"
+        , vfilename, (size_t) vnameLength
+    );
+    CommandBatch batch;
+    addPutMetaCommand(batch, file, vfilename, vnameLength);
+    for (CommandBatch::Command &put : batch.commands)
+        redisAppendCommandArgv(cxt, put.argv.size(), put.argv.data(), put.argvlen.data());
+    size_t numCommands = 1 + batch.commands.size();
+    redisAppendCommand(
+        cxt
+        , "SADD %s %b"
+        , FILE_DEDUP_RETIRED_KEY
+        , vfilename, (size_t) vnameLength
+    );
+    // record the most recent retired version, so that new files of the same name do not reuse the version (and chunk names)
+    redisAppendCommand(
+        cxt
+        , "EVAL %s 1 %s %b %d"
+        , "local v = redis.call('HGET', KEYS[1], ARGV[1]); \
+            if v == false or tonumber(v) < tonumber(ARGV[2]) then \
+                redis.call('HSET', KEYS[1], ARGV[1], ARGV[2]); \
+            end \
+            return 1;"
+        , FILE_DEDUP_RETIRED_VER_KEY
+        , filename, (size_t) nameLength
+        , file.version
+    );
+    numCommands += 2;
+
+    bool okay = true;
+    redisReply *r = 0;
+    for (size_t i = 0; i < numCommands; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to keep the metadata of retired file " << file.name << " version " << file.version << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        okay = okay && r->type != REDIS_REPLY_ERROR;
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return okay;
+}
+
+bool RedisMetaStore::deleteRetiredMeta(const File &file) {
+    RedisConnection cxt(_pool);
+
+    char vfilename[PATH_MAX];
+    int vnameLength = genVersionedFileKey(file.namespaceId, file.name, file.nameLength, file.version, vfilename);
+
+    redisAppendCommand(
+        cxt
+        , "DEL %b"
+        , vfilename, (size_t) vnameLength
+    );
+    redisAppendCommand(
+        cxt
+        , "SREM %s %b"
+        , FILE_DEDUP_RETIRED_KEY
+        , vfilename, (size_t) vnameLength
+    );
+
+    bool okay = true;
+    redisReply *r = 0;
+    for (int i = 0; i < 2; i++) {
+        if (redisGetReply(cxt, (void**) &r) != REDIS_OK) {
+            LOG(ERROR) << "Failed to remove the metadata of retired file " << file.name << " version " << file.version << ", Redis reply with error";
+            redisReconnect(cxt);
+            return false;
+        }
+        okay = okay && r->type == REDIS_REPLY_INTEGER;
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return okay;
+}
+
+int RedisMetaStore::getRetiredFiles(std::string &cursor, int numFiles, File files[]) {
+    RedisConnection cxt(_pool);
+
+    redisReply *r = (redisReply*) redisCommand(
+        cxt
+        , "SSCAN %s %s COUNT %d"
+        , FILE_DEDUP_RETIRED_KEY
+        , cursor.c_str()
+        , numFiles
+    );
+
+    // the reply has two parts, the cursor for next scan, and an array of members
+    if (r == NULL || r->type != REDIS_REPLY_ARRAY || r->elements != 2 || r->element[1]->type != REDIS_REPLY_ARRAY) {
+        LOG(ERROR) << "Failed to scan the retired files";
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+        freeReplyObject(r);
+        return -1;
+    }
+
+    cursor = std::string(r->element[0]->str, r->element[0]->len);
+
+    // members beyond the requested number are visited in the next full scan
+    int num = 0;
+    redisReply **listr = r->element[1]->element;
+    for (size_t i = 0; i < r->element[1]->elements && num < numFiles; i++) {
+        if (listr[i]->type != REDIS_REPLY_STRING)
+            continue;
+        free(files[num].name);
+        files[num].name = 0;
+        if (!getNameFromFileKey(listr[i]->str, listr[i]->len, &files[num].name, files[num].nameLength, files[num].namespaceId, &files[num].version))
+            continue;
+        num++;
+    }
+
+    freeReplyObject(r);
+
+    return num;
+}
+
+unsigned long int RedisMetaStore::getNumRetiredFiles() {
+    RedisConnection cxt(_pool);
+
+    redisReply *r = (redisReply *) redisCommand(
+        cxt,
+        "SCARD %s",
+        FILE_DEDUP_RETIRED_KEY
+    );
+
+    unsigned long int count = r != NULL && r->type == REDIS_REPLY_INTEGER? r->integer : 0;
+
+    if (r == NULL) {
+        redisReconnect(cxt);
+    }
+
+    freeReplyObject(r);
+    r = 0;
+
+    return count;
+}
+
+int RedisMetaStore::getLastRetiredVersion(const File &file) {
+    RedisConnection cxt(_pool);
+
+    char filename[PATH_MAX];
+    int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
+
+    redisReply *r = (redisReply *) redisCommand(
+        cxt,
+        "HGET %s %b",
+        FILE_DEDUP_RETIRED_VER_KEY,
+        filename, (size_t) nameLength
+    );
+
+    int version = r != NULL && r->type == REDIS_REPLY_STRING? atoi(r->str) : -1;
+
+    if (r == NULL) {
+        redisReconnect(cxt);
+    }
+
+    freeReplyObject(r);
+    r = 0;
+
+    return version;
+}
+
+void *RedisMetaStore::listenCacheInvalidations(void *arg) {
+    RedisMetaStore *self = (RedisMetaStore *) arg;
+
+    redisReply *r = 0;
+    while (self->_running) {
+        // resubscribe after connection errors, and drop all cached entries as invalidations may be missed in between
+        if (self->_subscriber == NULL || self->_subscriber->err) {
+            if (!self->subscribeCacheInvalidations()) {
+                sleep(1);
+                continue;
+            }
+            self->_cache->clear();
+            continue;
+        }
+        if (redisGetReply(self->_subscriber, (void **) &r) != REDIS_OK) {
+            if (self->_running) {
+                LOG(WARNING) << "Lost the subscription to metadata cache invalidations, " << self->_subscriber->errstr;
+            }
+            continue;
+        }
+        // message in form of ["message", channel, file key]
+        if (
+            r != NULL && r->type == REDIS_REPLY_ARRAY && r->elements == 3
+            && r->element[0]->type == REDIS_REPLY_STRING && strcmp(r->element[0]->str, "message") == 0
+            && r->element[2]->type == REDIS_REPLY_STRING
+        ) {
+            self->_cache->invalidate(std::string(r->element[2]->str, r->element[2]->len));
+        }
+        freeReplyObject(r);
+        r = 0;
+    }
+
+    return NULL;
+}
+
+bool RedisMetaStore::subscribeCacheInvalidations() {
+    Config &config = Config::getInstance();
+    redisContext *cxt = redisConnect(config.getProxyMetaStoreIP().c_str(), config.getProxyMetaStorePort());
+    if (cxt == NULL || cxt->err) {
+        LOG(ERROR) << "Failed to connect to Redis for metadata cache invalidations, " << (cxt? cxt->errstr : "cannot allocate Redis context");
+        redisFree(cxt);
+        return false;
+    }
+
+    redisReply *r = (redisReply *) redisCommand(
+        cxt
+        , "SUBSCRIBE %s"
+        , META_CACHE_CHANNEL
+    );
+    bool success = r != NULL && r->type == REDIS_REPLY_ARRAY;
+    freeReplyObject(r);
+    if (!success) {
+        LOG(ERROR) << "Failed to subscribe to metadata cache invalidations";
+        redisFree(cxt);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(_subscriberLock);
+    redisFree(_subscriber);
+    _subscriber = cxt;
+
+    return true;
+}
+
+void RedisMetaStore::invalidateCachedMeta(redisContext *cxt, const File &f, bool publish) {
+    if (_cache == NULL)
+        return;
+
+    char filename[PATH_MAX];
+    int nameLength = genFileKey(f.namespaceId, f.name, f.nameLength, filename);
+    _cache->invalidate(std::string(filename, nameLength));
+
+    if (!publish)
+        return;
+
+    // notify all proxies, including this one
+    redisReply *r = (redisReply *) redisCommand(
+        cxt
+        , "PUBLISH %s %b"
+        , META_CACHE_CHANNEL
+        , filename, (size_t) nameLength
+    );
+    if (r == NULL || r->type != REDIS_REPLY_INTEGER) {
+        LOG(WARNING) << "Failed to notify other proxies on metadata changes of file " << f.name;
+        if (r == NULL) {
+            redisReconnect(cxt);
+        }
+    }
+    freeReplyObject(r);
+}
+
 int RedisMetaStore::genFileKey(unsigned char namespaceId, const char *name, int nameLength, char key[]) {
 
     return snprintf(key, PATH_MAX, "%d_%*s", namespaceId, nameLength, name);
@@ -2137,6 +3377,44 @@ bool RedisMetaStore::genFileUuidKey(unsigned char namespaceId, boost::uuids::uui
     return snprintf(key, MAX_KEY_SIZE + 64, "//fu%d-%s", namespaceId, boost::uuids::to_string(uuid).c_str()) <= MAX_KEY_SIZE;
 } 
 
+int RedisMetaStore::genFingerprintIndexKey(unsigned char namespaceId, char key[]) {
+    return snprintf(key, MAX_KEY_SIZE, "%s%d", FP_INDEX_KEY_PREFIX, namespaceId);
+}
+
+int RedisMetaStore::genFingerprintRefCountKey(unsigned char namespaceId, char key[]) {
+    return snprintf(key, MAX_KEY_SIZE, "%s%d", FP_REF_COUNT_KEY_PREFIX, namespaceId);
+}
+
+std::string RedisMetaStore::encodeBlockLocation(const BlockLocation &loc) {
+    // version, offset, length, followed by object name
+    int version = loc.getObjectVersion();
+    unsigned long int offset = loc.getBlockOffset();
+    unsigned int length = loc.getBlockLength();
+    std::string name = loc.getObjectName();
+    std::string value;
+    value.reserve(sizeof(int) + sizeof(unsigned long int) + sizeof(unsigned int) + name.size());
+    value.append((char *) &version, sizeof(int));
+    value.append((char *) &offset, sizeof(unsigned long int));
+    value.append((char *) &length, sizeof(unsigned int));
+    value.append(name);
+    return value;
+}
+
+bool RedisMetaStore::decodeBlockLocation(unsigned char namespaceId, const char *value, size_t len, BlockLocation &loc) {
+    const size_t hsize = sizeof(int) + sizeof(unsigned long int) + sizeof(unsigned int);
+    if (len < hsize)
+        return false;
+    int version = 0;
+    unsigned long int offset = 0;
+    unsigned int length = 0;
+    memcpy(&version, value, sizeof(int));
+    memcpy(&offset, value + sizeof(int), sizeof(unsigned long int));
+    memcpy(&length, value + sizeof(int) + sizeof(unsigned long int), sizeof(unsigned int));
+    loc.setObjectID(namespaceId, std::string(value + hsize, len - hsize), version);
+    loc.setBlockRange(offset, length);
+    return true;
+}
+
 int RedisMetaStore::genChunkKeyPrefix(int chunkId, char prefix[]) {
     return snprintf(prefix, MAX_KEY_SIZE, "c%d", chunkId);
 }
@@ -2153,6 +3431,10 @@ int RedisMetaStore::genFileJournalKey(unsigned char namespaceId, const char *nam
     return snprintf(key + prefixLength, MAX_KEY_SIZE - prefixLength, "_%*s_%d", nameLength, name, version) + prefixLength;
 }
 
+int RedisMetaStore::genBlockListKey(int listId, char prefix[], bool unique) {
+    return snprintf(prefix, MAX_KEY_SIZE, "%sl%d", getBlockKeyPrefix(unique), listId);
+}
+
 const char *RedisMetaStore::getBlockKeyPrefix(bool unique) {
     return unique? "ub" : "db";
 }
@@ -2187,9 +3469,9 @@ bool RedisMetaStore::getNameFromFileKey(const char *str, size_t len, char **name
 }
 
 
-bool RedisMetaStore::getFileName(char name[], File &f) {
+bool RedisMetaStore::getFileName(redisContext *cxt, char name[], File &f) {
     redisReply *r = (redisReply *) redisCommand(
-        _cxt,
+        cxt,
         "GET %s",
         name
     );
@@ -2203,7 +3485,7 @@ bool RedisMetaStore::getFileName(char name[], File &f) {
         f.name[r->len] = 0;
     }
     if (r == NULL) {
-        redisReconnect(_cxt);
+        redisReconnect(cxt);
     }
     freeReplyObject(r);
     r = 0;
@@ -2236,19 +3518,261 @@ std::string RedisMetaStore::getFilePrefix(const char name[], bool noEndingSlash)
     return prefix.append(name, slash - name);
 }
 
-bool RedisMetaStore::getLockOnFile(const File &file, bool lock) {
-    return lockFile(file, lock, FILE_LOCK_KEY, "lock");
+bool RedisMetaStore::getLockOnFile(redisContext *cxt, const File &file, bool lock, bool shared) {
+    char filename[PATH_MAX];
+    int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
+    std::string key(filename, nameLength);
+
+    // find the lease to release
+    unsigned long int token = 0;
+    if (!lock) {
+        std::lock_guard<std::mutex> lk(_leaseLock);
+        if (shared) {
+            auto it = _sharedLeases.find(key);
+            if (it != _sharedLeases.end()) {
+                token = it->second;
+                _sharedLeases.erase(it);
+            }
+        } else {
+            auto it = _exclusiveLeases.find(key);
+            if (it != _exclusiveLeases.end()) {
+                token = it->second;
+                _exclusiveLeases.erase(it);
+            } else if (_lostLeases.erase(key) > 0) {
+                LOG(WARNING) << "Lock on file " << file.name << " expired before release";
+                return false;
+            }
+        }
+        if (token == 0) {
+            LOG(ERROR) << "Failed to unlock file " << file.name << ", not locked";
+            return false;
+        }
+    }
+
+    appendLeaseCommand(cxt, lock? LEASE_ACQUIRE_SCRIPT : LEASE_RELEASE_SCRIPT, key, shared, token);
+
+    redisReply *r = 0;
+    if (redisGetReply(cxt, (void **) &r) != REDIS_OK) {
+        LOG(ERROR) << "Failed to " << (lock? "" : "un") << "lock file " << file.name << ", failed to get reply";
+        redisReconnect(cxt);
+        return false;
+    }
+
+    bool ret = r->type == REDIS_REPLY_INTEGER && r->integer > 0;
+    if (ret && lock) {
+        recordLease(key, shared, r->integer);
+    } else if (!ret) {
+        LOG(ERROR) << "Failed to " << (lock? "" : "un") << "lock file " << file.name << (shared? " (shared)" : "") << ", "
+                << (r->type == REDIS_REPLY_INTEGER? (lock? "locked by others" : "lock expired") : "reply is invalid");
+    }
+
+    freeReplyObject(r);
+    r = 0;
+    return ret;
+}
+
+void RedisMetaStore::appendLeaseCommand(redisContext *cxt, const char *script, const std::string &filename, bool shared, unsigned long int token) {
+    std::string exclusiveKey = std::string(FILE_LOCK_KEY "_").append(filename);
+    std::string sharedKey = std::string(FILE_SHARED_LOCK_KEY "_").append(filename);
+    std::string tokenStr = std::to_string(token);
+    std::string ttl = std::to_string(_lockTTL);
+    redisAppendCommand(
+        cxt
+        , "EVAL %s 3 %b %b %s %s %s %s"
+        , script
+        , exclusiveKey.data(), exclusiveKey.size()
+        , sharedKey.data(), sharedKey.size()
+        , FILE_LOCK_TOKEN_KEY
+        , shared? "1" : "0"
+        , tokenStr.c_str()
+        , ttl.c_str()
+    );
 }
 
-bool RedisMetaStore::pinStagedFile(const File &file, bool lock) {
-    return lockFile(file, lock, FILE_PIN_STAGED_KEY, "pin");
+void RedisMetaStore::recordLease(const std::string &filename, bool shared, unsigned long int token) {
+    std::lock_guard<std::mutex> lk(_leaseLock);
+    if (shared) {
+        _sharedLeases.emplace(filename, token);
+    } else {
+        _exclusiveLeases[filename] = token;
+        _lostLeases.erase(filename);
+    }
+}
+
+bool RedisMetaStore::runFencedWrite(redisContext *cxt, const std::vector<const File *> &files, const CommandBatch &batch, const char *op, redisReply **reply) {
+    // only a holder of the exclusive locks may change the files
+    std::vector<std::string> leaseKeys, tokens;
+    {
+        std::lock_guard<std::mutex> lk(_leaseLock);
+        for (const File *file : files) {
+            char filename[PATH_MAX];
+            int nameLength = genFileKey(file->namespaceId, file->name, file->nameLength, filename);
+            std::string key(filename, nameLength);
+            auto it = _exclusiveLeases.find(key);
+            if (it == _exclusiveLeases.end()) {
+                LOG(ERROR) << "Reject " << op << " of file " << file->name << " as " << (_lostLeases.count(key) > 0? "its lock has expired" : "it is not locked");
+                return false;
+            }
+            leaseKeys.push_back(std::string(FILE_LOCK_KEY "_").append(key));
+            tokens.push_back(std::to_string(it->second));
+        }
+    }
+
+    // check the tokens and apply the changes in one script, leaving a margin for the changes to land before the leases expire;
+    // all keys touched go in KEYS, the lease keys first, followed by the keys of each command in order
+    std::vector<const char *> keys, args;
+    std::vector<size_t> keylens, arglens;
+    auto addKey = [&keys, &keylens] (const char *key, size_t len) {
+        keys.push_back(key);
+        keylens.push_back(len);
+    };
+    auto addArg = [&args, &arglens] (const char *arg, size_t len) {
+        args.push_back(arg);
+        arglens.push_back(len);
+    };
+    std::string numLeases = std::to_string(leaseKeys.size());
+    std::string minTTL = std::to_string(_lockTTL / 3);
+    std::deque<std::string> counts;
+    addArg(numLeases.data(), numLeases.size());
+    for (const std::string &key : leaseKeys)
+        addKey(key.data(), key.size());
+    for (const std::string &token : tokens)
+        addArg(token.data(), token.size());
+    addArg(minTTL.data(), minTTL.size());
+    for (const CommandBatch::Command &command : batch.commands) {
+        size_t numKeys = command.numKeys;
+        if (command.argv.size() < numKeys + 1 || command.argv.size() > FENCED_WRITE_MAX_COMMAND_ARGS) {
+            LOG(ERROR) << "Reject " << op << " of file " << files.front()->name << ", a command has " << command.argv.size() << " arguments";
+            return false;
+        }
+        counts.emplace_back(std::to_string(numKeys));
+        counts.emplace_back(std::to_string(command.argv.size() - numKeys - 1));
+        addArg(&command.flag, 1);
+        addArg(counts.at(counts.size() - 2).data(), counts.at(counts.size() - 2).size());
+        addArg(counts.back().data(), counts.back().size());
+        addArg(command.argv.at(0), command.argvlen.at(0));
+        for (size_t i = 1; i <= numKeys; i++)
+            addKey(command.argv.at(i), command.argvlen.at(i));
+        for (size_t i = numKeys + 1; i < command.argv.size(); i++)
+            addArg(command.argv.at(i), command.argvlen.at(i));
+    }
+
+    // run the script by its digest, and send the script itself if it is not loaded (e.g., after a restart of Redis)
+    std::string numKeys = std::to_string(keys.size());
+    auto runScript = [&] (bool bySha) {
+        std::vector<const char *> argv;
+        std::vector<size_t> argvlen;
+        argv.push_back(bySha? "EVALSHA" : "EVAL");
+        argvlen.push_back(strlen(argv.back()));
+        argv.push_back(bySha? _fencedWriteSha.data() : FENCED_WRITE_SCRIPT);
+        argvlen.push_back(bySha? _fencedWriteSha.size() : sizeof(FENCED_WRITE_SCRIPT) - 1);
+        argv.push_back(numKeys.data());
+        argvlen.push_back(numKeys.size());
+        argv.insert(argv.end(), keys.begin(), keys.end());
+        argvlen.insert(argvlen.end(), keylens.begin(), keylens.end());
+        argv.insert(argv.end(), args.begin(), args.end());
+        argvlen.insert(argvlen.end(), arglens.begin(), arglens.end());
+        return (redisReply *) redisCommandArgv(cxt, argv.size(), argv.data(), argvlen.data());
+    };
+    redisReply *r = runScript(/* bySha */ !_fencedWriteSha.empty());
+    if (r != NULL && r->type == REDIS_REPLY_ERROR && strncmp(r->str, "NOSCRIPT", 8) == 0) {
+        freeReplyObject(r);
+        r = runScript(/* bySha */ false);
+    }
+    if (r == NULL) {
+        LOG(ERROR) << "Failed to apply " << op << " of file " << files.front()->name << " due to Redis connection error";
+        redisReconnect(cxt);
+        return false;
+    }
+    if (r->type != REDIS_REPLY_ARRAY) {
+        LOG(ERROR) << "Reject " << op << " of file " << files.front()->name << ", " << (r->type == REDIS_REPLY_ERROR? r->str : "reply is invalid");
+        freeReplyObject(r);
+        return false;
+    }
+
+    *reply = r;
+    return true;
 }
 
-bool RedisMetaStore::lockFile(const File &file, bool lock, const char *type, const char *name) {
+void *RedisMetaStore::renewLeases(void *arg) {
+    RedisMetaStore *self = (RedisMetaStore *) arg;
+
+    std::unique_lock<std::mutex> lk(self->_leaseLock);
+    while (self->_renewLeases) {
+        // renew well before the leases expire
+        self->_leaseCv.wait_for(lk, std::chrono::milliseconds(self->_lockTTL / 3));
+        if (!self->_renewLeases)
+            break;
+
+        // file key, whether the lease is shared, token
+        std::vector<std::tuple<std::string, bool, unsigned long int> > leases;
+        for (auto &lease : self->_exclusiveLeases)
+            leases.emplace_back(lease.first, false, lease.second);
+        for (auto &lease : self->_sharedLeases)
+            leases.emplace_back(lease.first, true, lease.second);
+        if (leases.empty())
+            continue;
+
+        // renew all leases in one go, without blocking the lock and unlock operations
+        lk.unlock();
+        std::vector<int> renewed(leases.size(), -1); // -1: unknown, 0: lost, 1: renewed
+        {
+            RedisConnection cxt(self->_pool);
+            for (auto &lease : leases)
+                self->appendLeaseCommand(cxt, LEASE_RENEW_SCRIPT, std::get<0>(lease), std::get<1>(lease), std::get<2>(lease));
+            redisReply *r = 0;
+            for (size_t i = 0; i < leases.size(); i++) {
+                if (redisGetReply(cxt, (void **) &r) != REDIS_OK) {
+                    LOG(WARNING) << "Failed to renew file locks, failed to get reply";
+                    redisReconnect(cxt);
+                    break;
+                }
+                if (r->type == REDIS_REPLY_INTEGER)
+                    renewed.at(i) = r->integer == 1? 1 : 0;
+                freeReplyObject(r);
+                r = 0;
+            }
+        }
+        lk.lock();
+
+        // drop the leases lost, unless they are released or taken again in between
+        for (size_t i = 0; i < leases.size(); i++) {
+            if (renewed.at(i) != 0)
+                continue;
+            const std::string &key = std::get<0>(leases.at(i));
+            unsigned long int token = std::get<2>(leases.at(i));
+            if (std::get<1>(leases.at(i))) {
+                auto range = self->_sharedLeases.equal_range(key);
+                for (auto it = range.first; it != range.second; it++) {
+                    if (it->second != token)
+                        continue;
+                    self->_sharedLeases.erase(it);
+                    LOG(WARNING) << "Lost the shared lock on file " << key << " (token " << token << ")";
+                    break;
+                }
+            } else {
+                auto it = self->_exclusiveLeases.find(key);
+                if (it == self->_exclusiveLeases.end() || it->second != token)
+                    continue;
+                self->_exclusiveLeases.erase(it);
+                self->_lostLeases.insert(key);
+                LOG(ERROR) << "Lost the lock on file " << key << " (token " << token << "), further changes from the holder are rejected";
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool RedisMetaStore::pinStagedFile(redisContext *cxt, const File &file, bool lock) {
+    return lockFile(cxt, file, lock, FILE_PIN_STAGED_KEY, "pin");
+}
+
+bool RedisMetaStore::lockFile(redisContext *cxt, const File &file, bool lock, const char *type, const char *name) {
     char filename[PATH_MAX];
     int nameLength = genFileKey(file.namespaceId, file.name, file.nameLength, filename);
     redisReply *r = (redisReply *) redisCommand(
-        _cxt,
+        cxt,
         "%s %s %b",
         lock? "SADD" : "SREM",
         type,
@@ -2259,7 +3783,7 @@ bool RedisMetaStore::lockFile(const File &file, bool lock, const char *type, con
     if (!ret) {
         LOG(ERROR) << "Failed to " << (lock? "" : "un") << name << " file " << file.name << ", " << (r != NULL ? (r->type == REDIS_REPLY_INTEGER? "repeated operation" : "reply is invalid") : "failed to get reply"); 
         if (r == NULL) {
-            redisReconnect(_cxt);
+            redisReconnect(cxt);
         }
     }
 
@@ -2268,3 +3792,43 @@ bool RedisMetaStore::lockFile(const File &file, bool lock, const char *type, con
     return ret;
 }
 
+static bool decodeUniqueBlockList(const char *list, size_t length, File::UniqueBlockMap &blocks) {
+    if (length % UNIQUE_BLOCK_RECORD_SIZE != 0)
+        return false;
+    BlockLocation::InObjectLocation loc;
+    Fingerprint fp;
+    int pOffset = 0;
+    for (const char *rec = list; rec < list + length; rec += UNIQUE_BLOCK_RECORD_SIZE) {
+        const char *field = rec;
+        memcpy(&loc._offset, field, sizeof(unsigned long int));
+        field += sizeof(unsigned long int);
+        memcpy(&loc._length, field, sizeof(unsigned int));
+        field += sizeof(unsigned int);
+        unsigned char fpLength = *field;
+        field += 1;
+        fp.set(field, fpLength);
+        field += FINGERPRINT_MAX_SIZE;
+        memcpy(&pOffset, field, sizeof(int));
+        blocks.emplace_hint(blocks.end(), std::make_pair(loc, std::make_pair(fp, pOffset)));
+    }
+    return true;
+}
+
+static bool decodeDuplicateBlockList(const char *list, size_t length, File::DuplicateBlockMap &blocks) {
+    if (length % DUPLICATE_BLOCK_RECORD_SIZE != 0)
+        return false;
+    BlockLocation::InObjectLocation loc;
+    Fingerprint fp;
+    for (const char *rec = list; rec < list + length; rec += DUPLICATE_BLOCK_RECORD_SIZE) {
+        const char *field = rec;
+        memcpy(&loc._offset, field, sizeof(unsigned long int));
+        field += sizeof(unsigned long int);
+        memcpy(&loc._length, field, sizeof(unsigned int));
+        field += sizeof(unsigned int);
+        unsigned char fpLength = *field;
+        field += 1;
+        fp.set(field, fpLength);
+        blocks.emplace_hint(blocks.end(), std::make_pair(loc, fp));
+    }
+    return true;
+}
@@ -3,11 +3,21 @@
 #ifndef __REDIS_METASTORE_HH__
 #define __REDIS_METASTORE_HH__
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <set>
 #include <string>
+#include <vector>
+
+#include <pthread.h>
 
 #include <hiredis/hiredis.h>
 #include "metastore.hh"
+#include "meta_cache.hh"
+#include "redis_connection_pool.hh"
 
 #include <boost/uuid/uuid.hpp>
 
@@ -17,7 +27,7 @@ public:
     ~RedisMetaStore();
 
     /**
-     * See MetaStore::putMeta()
+     * See MetaStore::putMeta(); the change is rejected unless the file is exclusively locked by this store, with the lock checked atomically with the change
      **/
     bool putMeta(const File &f);
 
@@ -27,12 +37,17 @@ public:
     bool getMeta(File &f, int getBlocks = 3);
 
     /**
-     * See MetaStore::deleteMeta()
+     * See MetaStore::getMetaMulti()
+     **/
+    int getMetaMulti(const std::vector<File *> &files, std::vector<bool> &found, int getBlocks = 3);
+
+    /**
+     * See MetaStore::deleteMeta(); the change is rejected unless the file is exclusively locked by this store, with the lock checked atomically with the change
      **/
     bool deleteMeta(File &f);
 
     /**
-     * See MetaStore::renameMeta()
+     * See MetaStore::renameMeta(); the change is rejected unless the files are exclusively locked by this store, with the lock checked atomically with the change
      **/
     bool renameMeta(File &sf, File &df);
 
@@ -56,6 +71,11 @@ public:
      **/
     unsigned int getFileList(FileInfo **list, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "");
 
+    /**
+     * See MetaStore::getFileListPage()
+     **/
+    unsigned int getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, unsigned char namespaceId = INVALID_NAMESPACE_ID, bool withSize = true, bool withTime = true, bool withVersions = false, std::string prefix = "");
+
     /**
      * See MetaStore::getFolderList()
      **/
@@ -119,12 +139,22 @@ public:
     /**
      * See MetaStore::lockFile()
      **/
-    bool lockFile(const File &file);
+    bool lockFile(const File &file, bool shared = false);
+
+    /**
+     * See MetaStore::lockFilesMulti()
+     **/
+    int lockFilesMulti(const std::vector<File *> &files, std::vector<bool> &locked);
 
     /**
      * See MetaStore::unlockFile()
      **/
-    bool unlockFile(const File &file);
+    bool unlockFile(const File &file, bool shared = false);
+
+    /**
+     * See MetaStore::getLockToken()
+     **/
+    unsigned long int getLockToken(const File &file);
 
     /**
      * See MetaStore::addChunkToJournal()
@@ -136,6 +166,16 @@ public:
      **/
     bool updateChunkInJournal(const File &file, const Chunk &chunk, bool isWrite, bool deleteRecord, int containerId);
 
+    /**
+     * See MetaStore::addChunksToJournal()
+     **/
+    bool addChunksToJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite);
+
+    /**
+     * See MetaStore::updateChunksInJournal()
+     **/
+    bool updateChunksInJournal(const File &file, const std::vector<Chunk> &chunks, const std::vector<int> &containerIds, bool isWrite, bool deleteRecord);
+
     /**
      * See MetaStore::getFileJournal()
      **/
@@ -151,13 +191,129 @@ public:
      **/
     bool fileHasJournal(const File &file);
 
+    /**
+     * See MetaStore::putFingerprints()
+     **/
+    bool putFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::getFingerprints()
+     **/
+    int getFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::deleteFingerprints()
+     **/
+    bool deleteFingerprints(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints);
+
+    /**
+     * See MetaStore::scanFingerprints()
+     **/
+    bool scanFingerprints(unsigned char namespaceId, std::string &cursor, int batchSize, std::vector<Fingerprint> &fingerprints, std::vector<BlockLocation> &locations);
+
+    /**
+     * See MetaStore::updateFingerprintRefCounts()
+     **/
+    bool updateFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, const std::vector<int> &deltas, std::vector<long long> &counts);
+
+    /**
+     * See MetaStore::getFingerprintRefCounts()
+     **/
+    bool getFingerprintRefCounts(unsigned char namespaceId, const std::vector<Fingerprint> &fingerprints, std::vector<long long> &counts);
+
+    /**
+     * See MetaStore::putRetiredMeta()
+     **/
+    bool putRetiredMeta(const File &file);
+
+    /**
+     * See MetaStore::deleteRetiredMeta()
+     **/
+    bool deleteRetiredMeta(const File &file);
+
+    /**
+     * See MetaStore::getRetiredFiles()
+     **/
+    int getRetiredFiles(std::string &cursor, int numFiles, File files[]);
+
+    /**
+     * See MetaStore::getNumRetiredFiles()
+     **/
+    unsigned long int getNumRetiredFiles();
+
+    /**
+     * See MetaStore::getLastRetiredVersion()
+     **/
+    int getLastRetiredVersion(const File &file);
+
 private:
-    redisContext *_cxt;
-    std::mutex _lock;
-    
+    /**
+     * Commands to send in one go, with the arguments generated kept alive until sent
+     **/
+    struct CommandBatch {
+        enum Flag {
+            ALWAYS = '-',                 /**< run the command */
+            IF_PREVIOUS = 'c',            /**< run the command only if the previous one succeeds */
+            REQUIRED = 'r'                /**< stop the batch if the command fails */
+        };
+
+        struct Command {
+            char flag;                               /**< how the command depends on the others */
+            int numKeys;                             /**< number of keys following the command name */
+            std::vector<const char *> argv;          /**< arguments */
+            std::vector<size_t> argvlen;             /**< length of the arguments */
+        };
+
+        std::vector<Command> commands;               /**< commands in order */
+        std::deque<std::string> buffers;             /**< arguments generated */
+
+        void add(Flag flag = ALWAYS, int numKeys = 1) {
+            commands.emplace_back();
+            commands.back().flag = flag;
+            commands.back().numKeys = numKeys;
+        }
+
+        void arg(const void *arg, size_t len) {
+            commands.back().argv.push_back((const char *) arg);
+            commands.back().argvlen.push_back(len);
+        }
+
+        void arg(const char *arg) {
+            this->arg(arg, strlen(arg));
+        }
+
+        void copyArg(std::string arg) {
+            buffers.emplace_back(std::move(arg));
+            this->arg(buffers.back().data(), buffers.back().size());
+        }
+    };
+
+    RedisConnectionPool _pool;                        /**< connections to Redis */
+    std::mutex _scanLock;                             /**< lock on the scan states below */
+
     std::string _taskScanIt;
     bool _endOfPendingWriteSet;
 
+    MetaCache *_cache;                                /**< cache of file metadata, NULL if disabled */
+    pthread_t _cacheInvalidator;                      /**< listener of cache invalidations from all proxies */
+    std::atomic<bool> _running;                       /**< whether the invalidation listener keeps running */
+    redisContext *_subscriber;                        /**< connection subscribed to cache invalidations */
+    std::mutex _subscriberLock;                       /**< lock on replacing the subscriber connection */
+
+    int _lockTTL;                                     /**< time for a lock lease to expire unless renewed, in milliseconds */
+    std::string _fencedWriteSha;                      /**< SHA1 digest of the fenced write script loaded, empty if not loaded */
+    std::mutex _leaseLock;                            /**< lock on the lease states below */
+    std::map<std::string, unsigned long int> _exclusiveLeases;  /**< file key -> fencing token of the exclusive leases held */
+    std::multimap<std::string, unsigned long int> _sharedLeases; /**< file key -> tokens of the shared leases held */
+    std::set<std::string> _lostLeases;                /**< file keys of exclusive leases expired before release */
+    pthread_t _leaseRenewer;                          /**< renewer of the leases held */
+    std::condition_variable _leaseCv;                 /**< signal on termination of the renewer */
+    bool _renewLeases;                                /**< whether the renewer keeps running */
+
+    static void *listenCacheInvalidations(void *arg);
+    static void *renewLeases(void *arg);
+    bool subscribeCacheInvalidations();
+    void invalidateCachedMeta(redisContext *cxt, const File &f, bool publish = true);
 
     int genFileKey(unsigned char namespaceId, const char *name, int nameLength, char key[]);
     int genVersionedFileKey(unsigned char namespaceId, const char *name, int nameLength, int version, char key[]);
@@ -165,23 +321,37 @@ private:
     bool genFileUuidKey(unsigned char  namespaceId, boost::uuids::uuid uuid, char key[]);
     int genChunkKeyPrefix(int chunkId, char prefix[]);
     int genBlockKey(int blockId, char prefix[], bool unqiue);
+    int genBlockListKey(int listId, char prefix[], bool unique);
     int genFileJournalKeyPrefix(char key[], unsigned char namespaceId = 0);
     int genFileJournalKey(unsigned char namespaceId, const char *name, int nameLength, int version, char key[]);
+    int genFingerprintIndexKey(unsigned char namespaceId, char key[]);
+    int genFingerprintRefCountKey(unsigned char namespaceId, char key[]);
     const char *getBlockKeyPrefix(bool unique);
     bool getNameFromFileKey(const char *str, size_t len, char **name, int &nameLength, unsigned char &namespaceId, int *version = 0);
     bool markFileStatus(const File &file, const char *listName, bool set, const char *opName);
     bool markFileRepairStatus(const File &file, bool needsRepair);
-
-    bool getFileName(char name[], File &f);
+    void addPutMetaCommand(CommandBatch &batch, const File &f, const char *filename, int nameLength);
+    void appendGetMetaCommand(redisContext *cxt, const char *filename, int nameLength, int getBlocks);
+    bool parseMeta(redisContext *cxt, redisReply *r, File &f, int getBlocks, const char *filename, int nameLength);
+    bool scanFileKeys(redisContext *cxt, unsigned char namespaceId, const std::string &prefix, std::string &cursor, unsigned int count, std::vector<std::string> &keys);
+    unsigned int getFileInfoOfKeys(redisContext *cxt, const std::vector<std::string> &keys, FileInfo *list, bool withSize, bool withTime, bool withVersions);
+    bool initFileCount(redisContext *cxt);
+
+    bool getFileName(redisContext *cxt, char name[], File &f);
+    std::string encodeBlockLocation(const BlockLocation &loc);
+    bool decodeBlockLocation(unsigned char namespaceId, const char *value, size_t len, BlockLocation &loc);
     bool isSystemKey(const char *key);
     bool isVersionedFileKey(const char *key);
 
     std::string getFilePrefix(const char name[], bool noEndingSlash = false);
 
-    bool getLockOnFile(const File &file, bool lock);
-    bool pinStagedFile(const File &file, bool pine);
+    bool getLockOnFile(redisContext *cxt, const File &file, bool lock, bool shared = false);
+    void appendLeaseCommand(redisContext *cxt, const char *script, const std::string &filename, bool shared, unsigned long int token);
+    void recordLease(const std::string &filename, bool shared, unsigned long int token);
+    bool runFencedWrite(redisContext *cxt, const std::vector<const File *> &files, const CommandBatch &batch, const char *op, redisReply **reply);
+    bool pinStagedFile(redisContext *cxt, const File &file, bool pine);
 
-    bool lockFile(const File &file, bool lock, const char *type, const char *name);
+    bool lockFile(redisContext *cxt, const File &file, bool lock, const char *type, const char *name);
 };
 
 #endif // define __REDIS_METASTORE_HH__
@@ -14,6 +14,7 @@
 #include "../common/checksum_calculator.hh"
 
 #define BG_WRITE_TO_CLOUD_TAG "<BG WRITE TO CLOUD> "
+#define DEDUP_GC_TASK_NAME "dedup-gc"
 
 Proxy::Proxy() : Proxy(0, 0) {
 }
@@ -40,25 +41,31 @@ Proxy::Proxy(ProxyCoordinator *coordinator, std::map<int, std::string> *map, BgC
     _tcio =  new ProxyIO(_containerToAgentMap);
     _bgio =  new ProxyIO(_containerToAgentMap);
 
-    // deduplication
-    _releaseDedupModule = true;
-    if (dedup) {
-        _dedup = dedup;
-        _releaseDedupModule = false;
-    } else {
-      LOG(INFO) << "No dedup mod provided";
-      _dedup = new DedupNone();
-    }
-
     // metadata store
     switch (config.getProxyMetaStoreType()) {
         case MetaStoreType::REDIS:
             _metastore = new RedisMetaStore();
             break;
+        case MetaStoreType::LOCAL:
+            _metastore = new LocalMetaStore();
+            break;
         default:
             _metastore = new RedisMetaStore();
             break;
     }
+    _asyncMetastore = new AsyncMetaStore(_metastore, config.getProxyMetaStoreNumConnections());
+
+    // deduplication, which shares the metadata store of the proxy
+    _releaseDedupModule = true;
+    if (dedup) {
+        _dedup = dedup;
+        _releaseDedupModule = false;
+    } else if (config.proxyDedupEnabled()) {
+        _dedup = new DedupFixedBlock(_metastore);
+    } else {
+      LOG(INFO) << "No dedup mod provided";
+      _dedup = new DedupNone();
+    }
 
     // set as running
     _running = true;
@@ -80,6 +87,13 @@ Proxy::Proxy(ProxyCoordinator *coordinator, std::map<int, std::string> *map, BgC
     // incomplete request check
     pthread_create(&_irct, NULL, Proxy::journalCheck, this);
 
+    // garbage collection of deduplicated blocks
+    _dedupGcTotal = 0;
+    _dedupGcChecked = 0;
+    _dedupGcEnabled = config.proxyDedupEnabled() && config.getProxyDedupGcInterval() > 0;
+    if (_dedupGcEnabled)
+        pthread_create(&_dgct, NULL, Proxy::backgroundDedupGc, this);
+
     /* staging init */
     _staging = 0;
     _stagingEnabled = config.proxyStagingEnabled();
@@ -111,6 +125,8 @@ Proxy::~Proxy() {
     if (Config::getInstance().ackRedundancyInBackground())
         pthread_join(_tct, NULL);
     pthread_join(_irct, NULL);
+    if (_dedupGcEnabled)
+        pthread_join(_dgct, NULL);
     delete _repairChunkManager;
     delete _tcChunkManager;
     delete _bgChunkHandler;
@@ -133,7 +149,8 @@ Proxy::~Proxy() {
         delete _coordinator;
         delete _containerToAgentMap;
     }
-    // release metadata store
+    // release metadata store, after completing the pending asynchronous operations
+    delete _asyncMetastore;
     delete _metastore;
 }
 
@@ -154,7 +171,27 @@ void Proxy::getStorageUsage(unsigned long int &usage, unsigned long int &capacit
 }
 
 int Proxy::getBackgroundTaskProgress(std::string *&task, int *&progress) {
-    return _bgChunkHandler->getTaskProgress(task, progress);
+    int numTasks = _bgChunkHandler->getTaskProgress(task, progress);
+
+    // append the progress of the on-going garbage collection pass
+    unsigned long int total = _dedupGcTotal, checked = _dedupGcChecked;
+    if (total == 0)
+        return numTasks;
+
+    std::string *allTasks = new std::string[numTasks + 1];
+    int *allProgress = new int[numTasks + 1];
+    for (int i = 0; i < numTasks; i++) {
+        allTasks[i] = task[i];
+        allProgress[i] = progress[i];
+    }
+    allTasks[numTasks] = DEDUP_GC_TASK_NAME;
+    allProgress[numTasks] = std::min(checked, total) * 100 / total;
+    delete [] task;
+    delete [] progress;
+    task = allTasks;
+    progress = allProgress;
+
+    return numTasks + 1;
 }
 
 void* Proxy::backgroundRepair(void *arg) {
@@ -164,6 +201,7 @@ void* Proxy::backgroundRepair(void *arg) {
     int fileScanIntv = Config::getInstance().getFileScanInterval();
     int chunkScanIntv = Config::getInstance().getChunkScanInterval();
     int batchSize = Config::getInstance().getFileRecoverBatchSize();
+    int metaBatchSize = Config::getInstance().getFileScanMetaBatchSize();
 
     int k = Config::getInstance().getK();
 
@@ -183,40 +221,31 @@ void* Proxy::backgroundRepair(void *arg) {
             FileInfo *list = 0;
             int numFiles = self->getFileList(&list, /* withSize */ true, /* withTime */ true, /* withVersions */ true);
             int batchStartIdx = 0, numChunksInBatch = 0;
-            File file;
-
-#define checkFile(__FL__) do { \
-    DLOG(INFO) << "Check file " << file.name << " version " << file.version << " for missing chunk at " << time(NULL); \
-    if ( \
-        fileScanIntv > 0 && \
-        lastFileScan + fileScanIntv <= curTime && \
-        self->needsRepair(__FL__, /* updateStatusFirst */ i == 0) \
-    ) { \
-        self->_metastore->markFileAsNeedsRepair(__FL__); \
-        DLOG(INFO) << "Add file " << __FL__.name << " of version " << __FL__.version << " for missing chunk at " << time(NULL); \
-    } \
-    /* scan for corrupted chunks */ \
-    if (chunkScanIntv > 0 && lastChunkScan + chunkScanIntv <= curTime) { \
-        self->batchedChunkScan(list, numFiles, i, numChunksInBatch, batchStartIdx); \
-    } \
-} while (0) \
+            bool fileScan = fileScanIntv > 0 && lastFileScan + fileScanIntv <= curTime;
+            bool chunkScan = chunkScanIntv > 0 && lastChunkScan + chunkScanIntv <= curTime;
+            std::vector<File *> filesToCheck;
+            bool updateStatusFirst = true;
 
             for (int i = 0; i < numFiles; i++) {
-                file.name = list[i].name;
-                file.nameLength = list[i].nameLength;
-                file.namespaceId = list[i].namespaceId;
-                file.version = list[i].version;
-                checkFile(file);
-                int numVersions = list[i].numVersions;
-                for (int vi = 0; vi < numVersions; vi++) {
-                    file.version = list[i].versions[vi].version;
-                    checkFile(file);
+                // gather the current version and the other versions of the file to check for missing chunks
+                for (int vi = -1; fileScan && vi < list[i].numVersions; vi++) {
+                    File *f = new File();
+                    f->setName(list[i].name, list[i].nameLength);
+                    f->namespaceId = list[i].namespaceId;
+                    f->version = vi == -1? list[i].version : list[i].versions[vi].version;
+                    filesToCheck.push_back(f);
+                }
+                // check the gathered files in batch
+                if (fileScan && (i + 1 == numFiles || (int) filesToCheck.size() >= metaBatchSize)) {
+                    self->checkFilesForRepair(filesToCheck, updateStatusFirst);
+                    updateStatusFirst = false;
+                }
+                // scan for corrupted chunks
+                if (chunkScan) {
+                    self->batchedChunkScan(list, numFiles, i, numChunksInBatch, batchStartIdx);
                 }
-                file.name = 0;
             }
 
-#undef checkFile
-
             DLOG(INFO) << "Complete scanning at " << time(NULL);
             // update time of last scan
             if (lastFileScan + fileScanIntv <= time(NULL))
@@ -236,12 +265,29 @@ void* Proxy::backgroundRepair(void *arg) {
                     File files[batchSize];
                     numToRepair = self->_metastore->getFilesToRepair(batchSize, files);
                     self->_ongoingRepairCnt += numToRepair;
+                    // lock and get the metadata of the files to repair in batches
+                    std::vector<File *> lockedFiles;
+                    for (int i = 0; i < numToRepair; i++) {
+                        File *f = new File();
+                        f->copyNameAndSize(files[i]);
+                        if (f->namespaceId == INVALID_NAMESPACE_ID)
+                            f->namespaceId = DEFAULT_NAMESPACE_ID;
+                        f->copyVersionControlInfo(files[i]);
+                        lockedFiles.push_back(f);
+                    }
+                    std::vector<bool> ready;
+                    self->lockFilesAndGetMetaMulti(lockedFiles, std::vector<bool>(numToRepair, true), ready, "repair");
                     // repair file
                     for (int i = 0; i < numToRepair; i++) {
                         // if is locked for repair and repair suceed, remove from under repair list; otherwise, put it back to the list for pending repair (retry)
-                        if (self->repairFile(files[i], /* isBg */ true)) {
+                        if (ready.at(i) && self->repairFile(files[i], /* isBg */ true, lockedFiles.at(i))) {
                             DLOG(INFO) << "Repair file " << files[i].name << " at " << time(NULL);
                         } else {
+                            // release the files locked but not repaired
+                            for (int j = i + 1; j < numToRepair; j++) {
+                                if (ready.at(j))
+                                    self->unlockFile(*lockedFiles.at(j));
+                            }
                             //self->_metastore->markFileAsNeedsRepair(files[i]);
                             self->_ongoingRepairCnt -= numToRepair;
                             numToRepair = 0;
@@ -249,6 +295,8 @@ void* Proxy::backgroundRepair(void *arg) {
                         }
                     }
                     self->_ongoingRepairCnt -= numToRepair;
+                    for (File *f : lockedFiles)
+                        delete f;
                 } while (numToRepair > 0);
                 DLOG(INFO) << "End repair at " << time(NULL);
             }
@@ -280,29 +328,35 @@ void* Proxy::backgroundRepair(void *arg) {
     return 0;
 }
 
-bool Proxy::needsRepair(File &f, bool updateStatusFirst) {
-    File rf;
-
-    if (f.namespaceId == INVALID_NAMESPACE_ID)
-        f.namespaceId = DEFAULT_NAMESPACE_ID;
-
-    if (rf.copyNameAndSize(f) == false) {
-        LOG(ERROR) << "Failed to copy file metadata for check repair operaiton";
-        return false;
+void Proxy::checkFilesForRepair(std::vector<File *> &files, bool updateStatusFirst) {
+    for (File *f : files) {
+        if (f->namespaceId == INVALID_NAMESPACE_ID)
+            f->namespaceId = DEFAULT_NAMESPACE_ID;
     }
 
-    rf.copyVersionControlInfo(f);
-
     // get file metadata, no need to read the blocks information
-    if (_metastore->getMeta(rf, /* get blocks */ false) == false) {
-        LOG(WARNING) << "Failed to find file metadata for file " << f.name;
-        return false;
+    std::vector<bool> ready;
+    lockFilesAndGetMetaMulti(files, std::vector<bool>(files.size(), false), ready, "repair check", /* get blocks */ 0);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        File *f = files.at(i);
+        DLOG(INFO) << "Check file " << f->name << " version " << f->version << " for missing chunk at " << time(NULL);
+        if (ready.at(i)) {
+            bool chunkIndices[f->numChunks];
+            // recover if there are chunk failures, and the file has not been modified since last repair check
+            if (
+                _coordinator->checkContainerLiveness(f->containerIds, f->numChunks, chunkIndices, updateStatusFirst, /* checkAllFailures */ false) > 0
+                && f->mtime + Config::getInstance().getFileRecoverInterval() < time(NULL)
+            ) {
+                _metastore->markFileAsNeedsRepair(*f);
+                DLOG(INFO) << "Add file " << f->name << " of version " << f->version << " for missing chunk at " << time(NULL);
+            }
+            updateStatusFirst = false;
+        }
+        delete f;
     }
 
-    bool chunkIndices[rf.numChunks];
-    // recover if there are chunk failures, and the file has not been modified since last repair check
-    return _coordinator->checkContainerLiveness(rf.containerIds, rf.numChunks, chunkIndices, updateStatusFirst, /* checkAllFailures */ false) > 0
-            && rf.mtime + Config::getInstance().getFileRecoverInterval() < time(NULL);
+    files.clear();
 }
 
 bool Proxy::batchedChunkScan(const FileInfo *list, const int numFiles, const int curIdx, int &numChunksInBatch, int &batchStartIdx) {
@@ -336,6 +390,9 @@ bool Proxy::batchedChunkScan(const FileInfo *list, const int numFiles, const int
         double samplingRate = config.getChunkScanSamplingRate();
         int numSampled = 0; // number of chunks/files sampled (chunk-level/file-level sampling)
 
+        std::vector<File *> files; // files (and versions) to check
+        std::vector<bool> lock; // whether to lock each file to check
+
         // batch chunks from files into virtual files according to their container ids
         for (int fidx = batchStartIdx; fidx <= curIdx; fidx++) {
             // skip files that are recently modified
@@ -353,87 +410,14 @@ bool Proxy::batchedChunkScan(const FileInfo *list, const int numFiles, const int
                 }
             }
             
-# define checkChunks(__SKIP_LOCK__) do { \
-            /* lock and get metadata of all files in the batch */ \
-            if ( (__SKIP_LOCK__ && _metastore->getMeta(*f)) || (!__SKIP_LOCK__ && lockFileAndGetMeta(*f, "chunk scan")) ) { \
-                /* save file metadata */ \
-                fileMap.insert(std::make_pair(std::make_pair(f->uuid, f->version), std::make_pair(f, !__SKIP_LOCK__))); \
-                /* gather the chunks into a virtual file */ \
-                for (int cidx = 0; cidx < f->numChunks; cidx++) { \
-                    /* update the number of chunks processed for chunk-level sampling */ \
-                    numChunksProcessed[0]++; \
-                    /* determine whether to scan this chunk for chunk-level sampling */ \
-                    if (samplingPolicy == ChunkScanSamplingPolicy::CHUNK_LEVEL) { \
-                        if (Util::includeSample(numChunksInBatch, samplingRate)) { \
-                            numSampled++; \
-                        } else { /* skip chunk (among all) */ \
-                            DLOG(INFO) << "Sampling: skip 1 chunk in file " << f->name << ", cur sampling rate = " << numSampled << "/" << numChunksInBatch << " vs " << samplingRate; \
-                            continue; \
-                        } \
-                    } \
-                    /* determine whether to scan this chunk for stripe-level sampling */ \
-                    if (samplingPolicy == ChunkScanSamplingPolicy::STRIPE_LEVEL) { \
-                        int chunkInStripeIdx = cidx % f->codingMeta.n; \
-                        /* reset the number of sampled chunks when starting a new stripe */ \
-                        if (chunkInStripeIdx == 0) \
-                            numSampled = 0; \
-                        if (Util::includeSample(f->codingMeta.n, samplingRate)) { \
-                            numSampled++; \
-                        } else { /* skip chunk (in stripe) */ \
-                            DLOG(INFO) << "Sampling: skip 1 chunk in stripe " << cidx / f->codingMeta.n << " of file " << f->name << ", cur sampling rate = " << numSampled << "/" << f->codingMeta.n << " vs " << samplingRate; \
-                            continue; \
-                        } \
-                    } \
-                    int containerId = f->containerIds[cidx]; \
-                    /* get or new the virtual file for this container id */ \
-                    std::map<int, int>::iterator it; \
-                    std::tie(it, std::ignore) = containerId2vfMap.insert(std::make_pair(containerId, containerId2vfMap.size())); \
-                    if (it == containerId2vfMap.end()) { \
-                        LOG(WARNING) << "Failed to process check for chunk " << cidx << " of file " << f->name; \
-                        continue; \
-                    } \
-                    File &cf = vf[it->second]; \
-                    /* determine whether to scan this chunk for container-level sampling */ \
-                    if (samplingPolicy == ChunkScanSamplingPolicy::CONTAINER_LEVEL) { \
-                        numChunksProcessed[it->second]++; \
-                        /* assume the chunks are evenly distributed to all existing containers */ \
-                        /* TODO remove this assumption (num. of containers can be larger than n) */ \
-                        if (!Util::includeSample(numChunksInBatch / _coordinator->getNumAliveContainers(), samplingRate)) { \
-                            DLOG(INFO) << "Sampling: skip 1 chunk in container " << containerId << ", cur sampling rate = " << cf.numChunks << "/" << numChunksInBatch / _coordinator->getNumAliveContainers() << " vs " << samplingRate; \
-                            continue; \
-                        } \
-                    } \
-                    /* init the chunk list and container id on first use */ \
-                    if (cf.numChunks == 0) { \
-                        try { \
-                            cf.chunks = new Chunk[numChunksInBatch]; \
-                            cf.containerIds = new int[1]; \
-                        } catch (std::bad_alloc &e) { \
-                            LOG(ERROR) << "Failed to allocate memory for " << numChunksInBatch << " chunks in batch for checking"; \
-                            f = 0; \
-                            /*return false;*/ \
-                            break; \
-                        } \
-                        cf.containerIds[0] = containerId; \
-                    } \
-                    if (cf.numChunks < numChunksInBatch) { \
-                        /* push a record to the virtual file */ \
-                        cf.chunks[cf.numChunks++] = f->chunks[cidx]; \
-                    } else { \
-                        LOG(WARNING) << "Skipping chunk " << cidx << " of file " << f->name << " as the chunk list of container " << it->second << " is full (" << cf.numChunks << "/" << numChunksInBatch << ")"; \
-                    } \
-                } \
-                f = 0; \
-            } \
-} while (0)
-
             File *f = new File();
             f->setName(list[fidx].name, list[fidx].nameLength);
             f->namespaceId = list[fidx].namespaceId;
             f->version = list[fidx].version;
 
-            // check the current version
-            checkChunks(false);
+            // check the current version, with the file locked
+            files.push_back(f);
+            lock.push_back(true);
 
             // also examine the versions
             int numVersions = list[fidx].numVersions;
@@ -443,10 +427,87 @@ bool Proxy::batchedChunkScan(const FileInfo *list, const int numFiles, const int
                 f->namespaceId = list[fidx].namespaceId;
                 f->version = list[fidx].versions[vi].version;
                 DLOG(INFO) << "Check chunks of file " << f->name << " version " << f->version;
-                checkChunks(true);
+                files.push_back(f);
+                lock.push_back(false);
             }
+        }
 
-#undef checkChunks
+        // lock and get metadata of all files in the batch
+        std::vector<bool> ready;
+        lockFilesAndGetMetaMulti(files, lock, ready, "chunk scan");
+
+        for (size_t fi = 0; fi < files.size(); fi++) {
+            File *f = files.at(fi);
+            if (!ready.at(fi)) {
+                delete f;
+                continue;
+            }
+            // save file metadata
+            fileMap.insert(std::make_pair(std::make_pair(f->uuid, f->version), std::make_pair(f, lock.at(fi))));
+            // gather the chunks into a virtual file
+            for (int cidx = 0; cidx < f->numChunks; cidx++) {
+                // update the number of chunks processed for chunk-level sampling
+                numChunksProcessed[0]++;
+                // determine whether to scan this chunk for chunk-level sampling
+                if (samplingPolicy == ChunkScanSamplingPolicy::CHUNK_LEVEL) {
+                    if (Util::includeSample(numChunksInBatch, samplingRate)) {
+                        numSampled++;
+                    } else { // skip chunk (among all)
+                        DLOG(INFO) << "Sampling: skip 1 chunk in file " << f->name << ", cur sampling rate = " << numSampled << "/" << numChunksInBatch << " vs " << samplingRate;
+                        continue;
+                    }
+                }
+                // determine whether to scan this chunk for stripe-level sampling
+                if (samplingPolicy == ChunkScanSamplingPolicy::STRIPE_LEVEL) {
+                    int chunkInStripeIdx = cidx % f->codingMeta.n;
+                    // reset the number of sampled chunks when starting a new stripe
+                    if (chunkInStripeIdx == 0)
+                        numSampled = 0;
+                    if (Util::includeSample(f->codingMeta.n, samplingRate)) {
+                        numSampled++;
+                    } else { // skip chunk (in stripe)
+                        DLOG(INFO) << "Sampling: skip 1 chunk in stripe " << cidx / f->codingMeta.n << " of file " << f->name << ", cur sampling rate = " << numSampled << "/" << f->codingMeta.n << " vs " << samplingRate;
+                        continue;
+                    }
+                }
+                int containerId = f->containerIds[cidx];
+                // get or new the virtual file for this container id
+                std::map<int, int>::iterator it;
+                std::tie(it, std::ignore) = containerId2vfMap.insert(std::make_pair(containerId, containerId2vfMap.size()));
+                if (it == containerId2vfMap.end()) {
+                    LOG(WARNING) << "Failed to process check for chunk " << cidx << " of file " << f->name;
+                    continue;
+                }
+                File &cf = vf[it->second];
+                // determine whether to scan this chunk for container-level sampling
+                if (samplingPolicy == ChunkScanSamplingPolicy::CONTAINER_LEVEL) {
+                    numChunksProcessed[it->second]++;
+                    // assume the chunks are evenly distributed to all existing containers
+                    // TODO remove this assumption (num. of containers can be larger than n)
+                    if (!Util::includeSample(numChunksInBatch / _coordinator->getNumAliveContainers(), samplingRate)) {
+                        DLOG(INFO) << "Sampling: skip 1 chunk in container " << containerId << ", cur sampling rate = " << cf.numChunks << "/" << numChunksInBatch / _coordinator->getNumAliveContainers() << " vs " << samplingRate;
+                        continue;
+                    }
+                }
+                // init the chunk list and container id on first use
+                if (cf.numChunks == 0) {
+                    try {
+                        cf.chunks = new Chunk[numChunksInBatch];
+                        cf.containerIds = new int[1];
+                    } catch (std::bad_alloc &e) {
+                        LOG(ERROR) << "Failed to allocate memory for " << numChunksInBatch << " chunks in batch for checking";
+                        //return false;
+                        break;
+                    }
+                    cf.containerIds[0] = containerId;
+                }
+                if (cf.numChunks < numChunksInBatch) {
+                    // push a record to the virtual file
+                    cf.chunks[cf.numChunks++] = f->chunks[cidx];
+                } else {
+                    LOG(WARNING) << "Skipping chunk " << cidx << " of file " << f->name << " as the chunk list of container " << it->second << " is full (" << cf.numChunks << "/" << numChunksInBatch << ")";
+                }
+            }
         }
 
         // issue batched chunk request (of virtual files) and update metadata of files to repair
@@ -611,6 +672,63 @@ void* Proxy::backgroundTaskCheck(void *arg) {
     return 0;
 }
 
+void* Proxy::backgroundDedupGc(void *arg) {
+    Proxy *self = (Proxy *) arg;
+
+    int gcIntv = Config::getInstance().getProxyDedupGcInterval();
+    int batchSize = Config::getInstance().getProxyDedupGcBatchSize();
+
+    time_t lastRunTime = time(NULL);
+
+    std::string cursor = "0";
+    File *files = new File[batchSize];
+
+    while (self->_running) {
+        // sleep-wait until next interval, but stop promptly on termination
+        if (time(NULL) < lastRunTime + gcIntv) {
+            sleep(1);
+            continue;
+        }
+
+        // start a new pass over all retired files
+        if (cursor == "0") {
+            self->_dedupGcTotal = self->_metastore->getNumRetiredFiles();
+            self->_dedupGcChecked = 0;
+        }
+
+        // check one batch of retired files per interval to throttle the background I/O
+        int numFiles = self->_dedupGcTotal > 0? self->_metastore->getRetiredFiles(cursor, batchSize, files) : 0;
+        if (numFiles < 0) {
+            cursor = "0";
+        }
+        for (int i = 0; i < numFiles && self->_running; i++) {
+            if (!self->collectRetiredFile(files[i])) {
+                LOG(WARNING) << "Failed to collect garbage of retired file " << files[i].name << " version " << files[i].version << ", retry in the next pass";
+            }
+            self->_dedupGcChecked++;
+        }
+
+        // the pass completes
+        if (cursor == "0") {
+            if (self->_dedupGcTotal > 0)
+                LOG(INFO) << "Deduplication garbage collection checked " << self->_dedupGcChecked << " retired files";
+            self->_dedupGcTotal = 0;
+            self->_dedupGcChecked = 0;
+        } else if (numFiles == 0) {
+            // move on to the next batch if this one is empty
+            continue;
+        }
+
+        lastRunTime = time(NULL);
+    }
+
+    delete [] files;
+
+    LOG(WARNING) << "Stop deduplication garbage collection";
+
+    return 0;
+}
+
 void* Proxy::journalCheck(void *arg) {
     Proxy *self = (Proxy *) arg;
 
@@ -648,6 +766,10 @@ void* Proxy::journalCheck(void *arg) {
             std::vector<std::tuple<Chunk, int /* container id*/, bool /* isWrite */, bool /* isPre */>> records;
             self->_metastore->getFileJournal(file, records);
 
+            // records to remove from the journal together after checking
+            std::vector<Chunk> doneChunks;
+            std::vector<int> doneContainerIds;
+
             int numRecords = records.size();
             for (int ridx = 0; ridx < numRecords; ridx++) {
                 Chunk &chunk = std::get<0>(records[ridx]);
@@ -706,12 +828,15 @@ void* Proxy::journalCheck(void *arg) {
 
                 // remove the journal record once verified the chunk integrity or successfully removed the invalid chunk
                 if (removeJournal) {
-                    if (!self->_metastore->updateChunkInJournal(fileMeta, chunk, isWrite, /* deleteRecord */ removeJournal, containerId)) {
-                        LOG(WARNING) << "Failed to remove the chunk journal of file " << file.name << " chunk " << chunkId << " in namespace " << file.namespaceId << " version " << file.version << ".";
-                    }
+                    doneChunks.push_back(chunk);
+                    doneContainerIds.push_back(containerId);
                 }
             }
 
+            if (!doneChunks.empty() && !self->_metastore->updateChunksInJournal(fileMeta, doneChunks, doneContainerIds, /* isWrite */ true, /* deleteRecord */ true)) {
+                LOG(WARNING) << "Failed to remove " << doneChunks.size() << " chunk journal records of file " << file.name << " in namespace " << file.namespaceId << " version " << file.version << ".";
+            }
+
             // release file lock after checking
             self->unlockFile(fileMeta);
         }
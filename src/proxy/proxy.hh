@@ -212,6 +212,20 @@ public:
      **/
     virtual unsigned int getFileList(FileInfo **list, bool withSize = true, bool withVersions = false, unsigned char namespaceId = INVALID_NAMESPACE_ID, std::string prefix = "");
 
+    /**
+     * Get a page of the list of files
+     *
+     * @param[out] list        pointer to the list of files
+     * @param[in,out] cursor   continuation token, start with "0" and the listing completes when "0" is returned
+     * @param[in] pageSize     hint on the number of files to return
+     * @param[in] withSize     whether to include file size
+     * @param[in] namespaceId  namespace id of files to list
+     * @param[in] prefix       prefix of files to list
+     *
+     * @return number of files in the list
+     **/
+    virtual unsigned int getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, bool withSize = true, unsigned char namespaceId = INVALID_NAMESPACE_ID, std::string prefix = "");
+
     /**
      * Get the list of folders
      *
@@ -312,6 +326,19 @@ protected:
         }
     };
 
+    struct ExternalStripeReadContext {
+        Proxy *proxy;                                                       /**< proxy which reads the stripes */
+        std::vector<std::pair<StripeLocation, File*> > stripes;             /**< external stripes to read, and the metadata of their files */
+        const std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > > *blockLocs; /**< duplicate blocks to copy out of each external stripe */
+        unsigned char *data;                                                /**< (virtual) start of the file data buffer */
+        unsigned long int dataEnd;                                          /**< end offset of the read range */
+        std::atomic<size_t> next;                                           /**< index of the next stripe to read */
+        std::atomic<unsigned long int> bytesCopied;                         /**< number of bytes copied into the file data buffer */
+        std::atomic<bool> okay;                                             /**< whether all stripes are read successfully so far */
+
+        ExternalStripeReadContext() : proxy(0), blockLocs(0), data(0), dataEnd(0), next(0), bytesCopied(0), okay(true) {}
+    };
+
     /*************************************/
     /* [Internal] File Operation Helpers */
     /*************************************/
@@ -324,10 +351,11 @@ protected:
      * @param[in,out] wf                 file containing stripes to write
      * @param[in] spareContainers        id of containers which are spared/selected for write
      * @param[in] numSelected            number of containers in spareContainers
+     * @param[in] dedup                  whether to deduplicate the stripes; if not, the stripes are written as is
      *
      * @return whether the stripes in wf are written sucessfully
      **/
-    bool writeFileStripes(File &f, File &wf, int spareContainers[], int numSelected );
+    bool writeFileStripes(File &f, File &wf, int spareContainers[], int numSelected, bool dedup = true);
 
     bool copyFileStripeMeta(File &dst, File &src, int stripeId, const char *op);
     void unsetCopyFileStripeMeta(File &copy);
@@ -344,10 +372,22 @@ protected:
 
     virtual unsigned long int getExpectedAppendSize(int codingScheme, int n, int k, int maxChunkSize);
 
-    // file locking
-    bool lockFile(const File &f);
-    bool unlockFile(const File &f);
-    bool lockFileAndGetMeta(File &f, const char *op);
+    // file locking, exclusive by default, or shared with other readers
+    bool lockFile(const File &f, bool shared = false);
+    bool unlockFile(const File &f, bool shared = false);
+    bool lockFileAndGetMeta(File &f, const char *op, bool shared = false);
+    /**
+     * Lock files and get their metadata, with multiple files per round trip to the metadata store
+     *
+     * @param[in,out] files  files containing the names, namespace ids and versions; metadata is filled on return
+     * @param[in] lock       whether to lock each file
+     * @param[out] ready     whether each file is locked (if requested) and has its metadata retrieved
+     * @param[in] op         name of the operation for logging
+     * @param[in] getBlocks  type of blocks to get, see MetaStore::getMeta()
+     *
+     * @return number of files ready
+     **/
+    int lockFilesAndGetMetaMulti(const std::vector<File *> &files, const std::vector<bool> &lock, std::vector<bool> &ready, const char *op, int getBlocks = 3);
 
     // staging
     bool pinStagedFile(const File &f);
@@ -357,14 +397,14 @@ protected:
     static void *stagingBGCacheReads(void *param);
     
     // dedup
-    bool dedupStripe(File &swf, std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> > &uniqueFps, std::map<BlockLocation::InObjectLocation, Fingerprint> &duplicateFps, std::string &commitId);
+    bool dedupStripe(File &swf, File::UniqueBlockMap &uniqueFps, File::DuplicateBlockMap &duplicateFps, std::string &commitId);
     bool sortStripesAndBlocks(
             const unsigned char namespaceId,
             const char *name,
-            const std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueStartFp,
-            const std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueEndFp,
-            const std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateStartFp,
-            const std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateEndFp,
+            const File::UniqueBlockMap::iterator uniqueStartFp,
+            const File::UniqueBlockMap::iterator uniqueEndFp,
+            const File::DuplicateBlockMap::iterator duplicateStartFp,
+            const File::DuplicateBlockMap::iterator duplicateEndFp,
             std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > > *externalBlockLocs,
             std::map<unsigned long int, BlockLocation::InObjectLocation> *internalBlockLocs,
             std::map<StripeLocation, std::set<int> > &externalStripes,
@@ -372,6 +412,78 @@ protected:
             std::vector<Fingerprint> &duplicateBlockFps,
             int dataStripeSize = -1
     );
+    /**
+     * Read and decode an external stripe once, and copy the duplicate blocks referencing it into the file data buffer
+     *
+     * @param[in] stripe                  external stripe to read
+     * @param[in] ef                      metadata of the external file
+     * @param[in] blocks                  list of (in-stripe physical offset, <logical offset, length> in the file) of blocks to copy
+     * @param[in] data                    (virtual) start of the file data buffer
+     * @param[in] dataEnd                 end offset of the read range
+     * @param[out] bytesCopied            number of bytes copied
+     *
+     * @return whether the stripe is read and the blocks are copied
+     **/
+    bool readExternalStripe(const StripeLocation &stripe, File &ef, const std::vector<std::pair<int, BlockLocation::InObjectLocation> > &blocks, unsigned char *data, unsigned long int dataEnd, unsigned long int &bytesCopied);
+    static void *readExternalStripes(void *arg);
+
+    /**
+     * Collect the fingerprints of deduplicated blocks
+     *
+     * @param[in] uniqueBlocks            unique blocks
+     * @param[in] duplicateBlocks         duplicate blocks
+     * @param[out] fps                    fingerprints to append to
+     **/
+    static void collectBlockFingerprints(const File::UniqueBlockMap &uniqueBlocks, const File::DuplicateBlockMap &duplicateBlocks, std::vector<Fingerprint> &fps);
+
+    /**
+     * Add the references of a file to the fingerprints of its blocks
+     *
+     * @param[in] f                       file with the block lists
+     *
+     * @return whether the references are recorded
+     **/
+    bool addBlockReferences(const File &f);
+
+    /**
+     * Remove the references of a removed file version to the fingerprints of its blocks, and retire the file version if any of its unique blocks is still referenced by other files
+     *
+     * @param[in] f                       metadata of the removed file version
+     *
+     * @return whether the data of the file version can be removed immediately; otherwise, the data is left for garbage collection
+     **/
+    bool releaseBlockReferences(const File &f);
+
+    /**
+     * Find the unique blocks of a file which are still referenced, i.e., still the indexed copy of a referenced fingerprint
+     *
+     * @param[in] f                       file with the block lists
+     * @param[in] blocks                  unique blocks of the file to check
+     * @param[out] liveBlocks             unique blocks still referenced
+     * @param[in] excludeOwnReferences    whether to discount the references from the blocks of the file itself
+     *
+     * @return number of unique blocks still referenced, or -1 on error
+     **/
+    int findLiveUniqueBlocks(const File &f, const File::UniqueBlockMap &blocks, File::UniqueBlockMap &liveBlocks, bool excludeOwnReferences = false);
+
+    /**
+     * Copy unique blocks of a file into a new retired object, and point the fingerprint index to the copies
+     *
+     * @param[in] sf                      metadata of the file holding the blocks
+     * @param[in] blocks                  unique blocks to copy
+     *
+     * @return whether the blocks are copied and the index is updated
+     **/
+    bool relocateUniqueBlocks(File &sf, const File::UniqueBlockMap &blocks);
+
+    /**
+     * Reclaim the space of a retired file version, after copying out its live blocks if the ratio of live blocks is below the compaction threshold
+     *
+     * @param[in] rf                      retired file version, containing the name, namespace id and version
+     *
+     * @return whether the retired file version is checked successfully
+     **/
+    bool collectRetiredFile(const File &rf);
 
 
     /********************************/
@@ -383,7 +495,14 @@ protected:
 
     // repair
     static void *backgroundRepair(void *arg);
-    bool needsRepair(File &f, bool updateStatusFirst);
+    /**
+     * Check files for chunk failures and mark those to repair
+     *
+     * @param[in,out] files             files containing the names, namespace ids and versions; all are released and the list is cleared on return
+     * @param[in] updateStatusFirst     whether to update the container status before checking the first file
+     **/
+    void checkFilesForRepair(std::vector<File *> &files, bool updateStatusFirst);
+    bool repairFile(const File &f, bool isBg, File *lockedFile);
     /**
      * Check and perform batched chunk checksum scan
      *
@@ -411,6 +530,7 @@ protected:
     // background tasks
     static void *backgroundTaskCheck(void *arg);
     static void *journalCheck(void *arg);
+    static void *backgroundDedupGc(void *arg);
     bool needsCheckBgChunkTasks(File &f);
 
     // statistics collection
@@ -438,6 +558,7 @@ protected:
 
     // metadata
     MetaStore *_metastore;                                        /**< metadata store */
+    AsyncMetaStore *_asyncMetastore;                              /**< asynchronous interface of the metadata store */
 
     // coordinator
     std::map<int, std::string> *_containerToAgentMap;             /**< map of containers [container id]->agent socket*/
@@ -451,12 +572,16 @@ protected:
     pthread_t _rt;                                                /**< thread for (auto) background repair */
     pthread_t _tct;                                               /**< thread for background task checking */
     pthread_t _irct;                                              /**< thread for incomplete request checking */
+    pthread_t _dgct;                                              /**< thread for deduplication garbage collection */
 
     // system status
     bool _running;                                                /**< status of the Proxy */
     bool _releaseCoordinator;                                     /**< whether to release coordinator */
     bool _releaseDedupModule;                                     /**< whether to release deduplication module */
     std::atomic<int> _ongoingRepairCnt;                           /**< number of on-going repair task */
+    bool _dedupGcEnabled;                                         /**< whether deduplication garbage collection runs in background */
+    std::atomic<unsigned long int> _dedupGcTotal;                 /**< number of retired files in the current garbage collection pass */
+    std::atomic<unsigned long int> _dedupGcChecked;               /**< number of retired files checked in the current garbage collection pass */
 
     // staging
     bool _stagingEnabled;                                         /**< staging enabled */
@@ -1,10 +1,14 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <boost/uuid/uuid_generators.hpp>
+
 #include "proxy.hh"
 
 #include "../common/config.hh"
 #include "../common/define.hh"
 
+#define DEDUP_GC_OBJECT_PREFIX "//dedup_gc/"
+
 bool Proxy::writeFile(File &f) {
 
     boost::timer::cpu_timer all, getMeta, writeData, computeChecksum, removeOldData, commitfp, putMeta;
@@ -57,6 +61,11 @@ bool Proxy::writeFile(File &f) {
     } else if (f.ctime == 0) {
         wf.setTimeStamps(now, now, now);
     }
+    // chunk names depend on the version, so skip the versions still kept for their deduplicated blocks
+    int lastRetiredVersion = -1;
+    if (of.version == -1 && Config::getInstance().proxyDedupEnabled()) {
+        lastRetiredVersion = _metastore->getLastRetiredVersion(of);
+    }
     getMeta.stop();
 
     writeData.start();
@@ -94,7 +103,7 @@ bool Proxy::writeFile(File &f) {
         }
         // fall back if needed
         if (!writtenToStaging) {
-            wf.version = of.version + 1;
+            wf.version = std::max(of.version, lastRetiredVersion) + 1;
             wf.storageClass = f.storageClass.empty()? Config::getInstance().getDefaultStorageClass() : f.storageClass;
             writtenToBackend = writeFileStripes(f, wf, spareContainers, numSelected);
         }
@@ -149,6 +158,9 @@ bool Proxy::writeFile(File &f) {
     for (size_t i = 0; i < numCommits; i++) {
         _dedup->commit(wf.commitIds.at(i));
     }
+    if (writtenToBackend && !addBlockReferences(wf)) {
+        LOG(WARNING) << "Failed to add block references of file " << f.name << ", its blocks may be kept after deletion";
+    }
     commitfp.stop();
 
     boost::timer::cpu_times duration = writeData.elapsed();
@@ -164,8 +176,8 @@ bool Proxy::writeFile(File &f) {
     //}
     
     removeOldData.start();
-    // if the new data is written to backend (not staging), one can safely remove the old data from backend
-    if (deleteOldFile && !writtenToStaging) {
+    // if the new data is written to backend (not staging), one can safely remove the old data from backend, unless other files still reference its blocks
+    if (deleteOldFile && !writtenToStaging && releaseBlockReferences(of)) {
         bool chunkIndices[of.numChunks];
         _coordinator->checkContainerLiveness(of.containerIds, of.numChunks, chunkIndices);
         if (_chunkManager->deleteFile(of, chunkIndices) == false) {
@@ -368,6 +380,33 @@ bool Proxy::modifyFile(File &f, bool isAppend) {
         }
         return false;
     }
+    // stripes in the range are rewritten in place, so their blocks are replaced
+    unsigned long int modifiedStart = f.offset / alignment * alignment;
+    unsigned long int modifiedEnd = (f.offset + f.length + alignment - 1) / alignment * alignment;
+    File::UniqueBlockMap keptUniqueBlocks, replacedUniqueBlocks;
+    File::DuplicateBlockMap keptDuplicateBlocks, replacedDuplicateBlocks;
+    for (auto it = of.uniqueBlocks.begin(); it != of.uniqueBlocks.end(); it++) {
+        bool isReplaced = it->first._offset >= modifiedStart && it->first._offset < modifiedEnd;
+        (isReplaced? replacedUniqueBlocks : keptUniqueBlocks).insert(*it);
+    }
+    for (auto it = of.duplicateBlocks.begin(); it != of.duplicateBlocks.end(); it++) {
+        bool isReplaced = it->first._offset >= modifiedStart && it->first._offset < modifiedEnd;
+        (isReplaced? replacedDuplicateBlocks : keptDuplicateBlocks).insert(*it);
+    }
+    // copy out the replaced blocks that other files still reference before the stripes are rewritten
+    File::UniqueBlockMap liveBlocks;
+    if (!replacedUniqueBlocks.empty() && (findLiveUniqueBlocks(of, replacedUniqueBlocks, liveBlocks, /* excludeOwnReferences */ true) < 0 || !relocateUniqueBlocks(of, liveBlocks))) {
+        LOG(ERROR) << "Failed to relocate the blocks referenced by other files before " << (isAppend? "append" : "overwrite") << " file " << f.name;
+        unlockFile(of);
+        of.name = 0;
+        // swap the information back
+        if (rf.data) {
+            std::swap(f.data, rf.data);
+            f.offset = ooffset;
+            f.length = olength;
+        }
+        return false;
+    }
     // update the new file size
     if (isAppend)
         of.size += f.length;
@@ -442,7 +481,13 @@ bool Proxy::modifyFile(File &f, bool isAppend) {
         if (wf.codingMeta.codingStateSize > 0 && of.codingMeta.codingStateSize > 0)
             memcpy(wf.codingMeta.codingState + codingStateSize * endIdx, of.codingMeta.codingState + codingStateSize * endIdx, codingStateSize * numRearStripes);
     }
-    // accumulated fingerprints
+    // blocks written in this operation
+    std::vector<Fingerprint> newFps, replacedFps;
+    collectBlockFingerprints(wf.uniqueBlocks, wf.duplicateBlocks, newFps);
+    collectBlockFingerprints(replacedUniqueBlocks, replacedDuplicateBlocks, replacedFps);
+    // accumulated fingerprints, excluding the replaced ones
+    std::swap(of.uniqueBlocks, keptUniqueBlocks);
+    std::swap(of.duplicateBlocks, keptDuplicateBlocks);
     if (wf.uniqueBlocks.size() < of.uniqueBlocks.size())
         std::swap(wf.uniqueBlocks, of.uniqueBlocks);
     if (wf.duplicateBlocks.size() < of.duplicateBlocks.size())
@@ -481,6 +526,11 @@ bool Proxy::modifyFile(File &f, bool isAppend) {
     for (size_t i = 0; i < numCommits; i++) {
         _dedup->commit(wf.commitIds.at(i));
     }
+    // move the references from the replaced blocks to the new ones
+    std::vector<long long> counts;
+    if (!_dedup->addReferences(wf.namespaceId, newFps) || !_dedup->removeReferences(wf.namespaceId, replacedFps, counts)) {
+        LOG(WARNING) << "Failed to update block references of file " << f.name << ", its blocks may be kept after deletion";
+    }
     commitfp.stop();
     
     unlockFile(of);
@@ -518,7 +568,7 @@ bool Proxy::modifyFile(File &f, bool isAppend) {
     return true;
 }
 
-bool Proxy::writeFileStripes(File &f, File &wf, int spareContainers[], int numSelected) {
+bool Proxy::writeFileStripes(File &f, File &wf, int spareContainers[], int numSelected, bool dedup) {
     int numContainers = _chunkManager->getNumRequiredContainers(wf.codingMeta.coding, wf.codingMeta.n, wf.codingMeta.k);
     int numChunksPerContainer = _chunkManager->getNumChunksPerContainer(wf.codingMeta.coding, wf.codingMeta.n, wf.codingMeta.k);
     if (numContainers < 0 || numChunksPerContainer < 0) {
@@ -638,7 +688,7 @@ bool Proxy::writeFileStripes(File &f, File &wf, int spareContainers[], int numSe
         // scan for duplicate blocks
         std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> > stripeFps;
         std::string commitId;
-        if (!dedupStripe(swf, wf.uniqueBlocks, wf.duplicateBlocks, commitId)) {
+        if (dedup && !dedupStripe(swf, wf.uniqueBlocks, wf.duplicateBlocks, commitId)) {
             return false;
         }
         dedupScanTime.stop();
@@ -649,7 +699,8 @@ bool Proxy::writeFileStripes(File &f, File &wf, int spareContainers[], int numSe
         // save the fingerprints to file
 
         // add commit id to file (do it here instead of after chunk write, so if returned on error, the current commit id can also be aborted)
-        wf.commitIds.push_back(commitId);
+        if (dedup)
+            wf.commitIds.push_back(commitId);
         dedupPostProcessTime.stop();
 
         dataWriteTime.resume();
@@ -727,7 +778,7 @@ bool Proxy::writeFileStripes(File &f, File &wf, int spareContainers[], int numSe
     return true;
 }
 
-bool Proxy::dedupStripe(File &swf, std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> > &uniqueFps, std::map<BlockLocation::InObjectLocation, Fingerprint> &duplicateFps, std::string &commitId) {
+bool Proxy::dedupStripe(File &swf, File::UniqueBlockMap &uniqueFps, File::DuplicateBlockMap &duplicateFps, std::string &commitId) {
     boost::timer::cpu_timer copyTime, buildListTime, scanTime;
     copyTime.stop();
     buildListTime.stop();
@@ -954,14 +1005,14 @@ bool Proxy::readFile(File &f, bool isPartial) {
      * then merge with existing mapping of  '' <local offset, legnth> -> <fp> ''
      * to form a mapping  '' <local offset, length> -> <external physical in-strip offset, external object name, external logical offset> ''
      *
-     * After that, read all the duplicate blocks from the external objects as
-     * stripes and copy duplicated data back, followed the internal object 
-     * stripes.
+     * After that, read the internal object stripes, while reading the
+     * external stripes (each once) in parallel and copying the duplicated
+     * data back.
      **/
-    std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueStartFp = rf.uniqueBlocks.lower_bound(BlockLocation::InObjectLocation(f.offset, 0));
-    std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueEndFp = rf.uniqueBlocks.upper_bound(BlockLocation::InObjectLocation(f.offset + f.length - 1, 0));
-    std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateStartFp = rf.duplicateBlocks.lower_bound(BlockLocation::InObjectLocation(f.offset, 0));
-    std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateEndFp = rf.duplicateBlocks.upper_bound(BlockLocation::InObjectLocation(f.offset + f.length - 1, 0));
+    File::UniqueBlockMap::iterator uniqueStartFp = rf.uniqueBlocks.lower_bound(BlockLocation::InObjectLocation(f.offset, 0));
+    File::UniqueBlockMap::iterator uniqueEndFp = rf.uniqueBlocks.upper_bound(BlockLocation::InObjectLocation(f.offset + f.length - 1, 0));
+    File::DuplicateBlockMap::iterator duplicateStartFp = rf.duplicateBlocks.lower_bound(BlockLocation::InObjectLocation(f.offset, 0));
+    File::DuplicateBlockMap::iterator duplicateEndFp = rf.duplicateBlocks.upper_bound(BlockLocation::InObjectLocation(f.offset + f.length - 1, 0));
 
     std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > > externalBlockLocs; // <ext object, ext logical offset> -> <ext physical offset, [<internal logical offset, length>]
     std::map<unsigned long int, BlockLocation::InObjectLocation> internalBlockLocs; // logical offset -> <physical offset, length>
@@ -1007,91 +1058,47 @@ bool Proxy::readFile(File &f, bool isPartial) {
     rf.data -= f.offset;
 
     readData.resume();
-    // read the duplicate data in other objects
+    // read the duplicate data in other objects, concurrently with the stripes of this file
+    ExternalStripeReadContext extReads;
+    extReads.proxy = this;
+    extReads.blockLocs = &externalBlockLocs;
+    extReads.data = rf.data;
+    extReads.dataEnd = f.offset + f.length;
     for (auto it = externalStripes.begin(); it != externalStripes.end(); it++) {
         // obtain the saved object metadata
-        File *ef = 0;
-        try {
-            ef = externalFiles.at(it->first._objectName);
-        } catch (std::out_of_range &e) {
+        auto fit = externalFiles.find(it->first._objectName);
+        if (fit == externalFiles.end()) {
             LOG(ERROR) << "Cannot find any saved external file metadata of referenced file " << it->first._objectName << ", abort reading duplicate blocks for file " << f.name;
             rf.data += f.offset;
             if (preallocated) { rf.data = 0; }
             clean_external_filemeta();
             return false;
         }
-
-        // set the stripe offset
-        ef->offset = it->first._offset;
-
-        // figure out the stripe length
-        CodingMeta &cmeta = ef->codingMeta;
-        unsigned long int maxDataSizePerStripe = _chunkManager->getMaxDataSizePerStripe(cmeta.coding, cmeta.n, cmeta.k, cmeta.maxChunkSize, /* is full chunk */ true);
-        ef->length = std::min(maxDataSizePerStripe, ef->size - ef->offset);
-        DLOG(INFO) << "Read stripe from external object " << ef->name << " in range (" << ef->offset << ", " << ef->length << ")";
-
-        // figure out the number of chunks and the container liveness
-        int numRequiredContainers = _chunkManager->getNumRequiredContainers(cmeta.coding, cmeta.n, cmeta.k);
-        int numChunksPerContainer = _chunkManager->getNumChunksPerContainer(cmeta.coding, cmeta.n, cmeta.k);
-        int numChunksPerStripe = numRequiredContainers * numChunksPerContainer;
-        int stripeId = ef->offset / maxDataSizePerStripe;
-        bool chunkIndices[numChunksPerStripe];
-        _coordinator->checkContainerLiveness(ef->containerIds + stripeId * numChunksPerStripe, numChunksPerStripe, chunkIndices);
-
-        File erf;
-        if (copyFileStripeMeta(erf, *ef, stripeId, "read") == false) {
-            rf.data += f.offset;
-            if (preallocated) { rf.data = 0; }
-            clean_external_filemeta();
-            return false;
-        }
-
-        // read the stripe
-        if (!_chunkManager->readFileStripe(erf, chunkIndices)) {
-            // TODO clean up
-            LOG(ERROR) << "Failed to read file " << f.name << " from backend";
-            rf.data += f.offset;
-            if (preallocated) { rf.data = 0; }
-            clean_external_filemeta();
-            unsetCopyFileStripeMeta(erf);
-            return false;
-        }
-
-        // find the logical address range of duplicate blocks referenced in this external stripe
-        auto startIt = externalBlockLocs.lower_bound(it->first);
-        if (startIt == externalBlockLocs.end()) {
-            LOG(WARNING) << "Read stripe at " << ef->offset << " from referenced file " << ef->name << " but no physical blocks are copied.";
+        extReads.stripes.push_back(std::make_pair(it->first, fit->second));
+    }
+    int maxExtReaders = std::min(extReads.stripes.size(), (size_t) Config::getInstance().getProxyDedupNumExternalStripeReaders());
+    pthread_t extReaders[maxExtReaders > 0? maxExtReaders : 1];
+    int numExtReaders = 0;
+    for (int i = 0; i < maxExtReaders; i++) {
+        if (pthread_create(&extReaders[numExtReaders], NULL, Proxy::readExternalStripes, &extReads) != 0) {
+            LOG(WARNING) << "Failed to start reader " << i << " of duplicate blocks for file " << f.name;
             continue;
         }
-        StripeLocation endLoc = it->first;
-        endLoc._offset += ef->length - 1;
-        auto endIt = externalBlockLocs.upper_bound(endLoc);
-
-        // copy the data from this external stripe back to the original data buffer
-        for (auto vit = startIt; vit != endIt; vit++) { // block location vector
-            for (auto bit = vit->second.begin(); bit != vit->second.end(); bit++) { // block location
-                unsigned long int objOffset = bit->second._offset;
-                unsigned int length = std::min(f.offset + f.length - objOffset, static_cast<unsigned long int>(bit->second._length));
-                int stripeOffset = bit->first;
-
-                memoryCopy.resume();
-                //DLOG(INFO) << "Copy external block at (" << stripeOffset << ") to (" << objOffset << ", " << length << ")";
-                memcpy(rf.data + objOffset, erf.data + stripeOffset, length);
-                memoryCopy.stop();
-                bytesRead += length;
-            }
-        }
-
-        unsetCopyFileStripeMeta(erf);
+        numExtReaders++;
     }
+    // read the duplicate data before the stripes of this file if no reader is started
+    if (numExtReaders == 0 && !extReads.stripes.empty())
+        Proxy::readExternalStripes(&extReads);
 
-    // make it back to the actual data buffer starting address
-    rf.data += f.offset;
+#define join_external_readers() do { \
+    for (int ri = 0; ri < numExtReaders; ri++) { \
+        pthread_join(extReaders[ri], NULL); \
+    } \
+    numExtReaders = 0; \
+} while (0)
 
     // read the unique data in the range
     bool chunkIndices[numChunksPerStripe];
-    // adjust such that rf.data always points to the (virtual) start of file
-    rf.data -= f.offset;
     // decode stripe by stripe
     bool okay = true;
     int startStripe = isPartial? f.offset / maxDataStripeSize : 0;
@@ -1100,14 +1107,13 @@ bool Proxy::readFile(File &f, bool isPartial) {
     unsigned char *tmpBuffer = 0;
     unsigned long int bufferSize = 0;
 
-    for (int i = startStripe; i < endStripe; i++, currStripeId++) {
+    for (int i = startStripe; i < endStripe && okay; i++, currStripeId++) {
         File srf;
 
         // copy the stripe metadata
         if (copyFileStripeMeta(srf, rf, i, "read") == false) {
-            if (preallocated) { rf.data = 0; }
-            clean_external_filemeta();
-            return false;
+            okay = false;
+            break;
         }
         srf.blockId = f.blockId;
         srf.stripeId = currStripeId;
@@ -1117,16 +1123,19 @@ bool Proxy::readFile(File &f, bool isPartial) {
         srf.length = srf.size;
         // skip empty (i.e., fully deduplicated) stripes
         if (srf.chunks[0].size == 0) {
-            if (preallocated) { rf.data = 0; }
             unsetCopyFileStripeMeta(srf);
             continue;
         }
         // check for alive containers
         _coordinator->checkContainerLiveness(srf.containerIds, srf.numChunks, chunkIndices);
         // read the data from stripe
+        unsigned long int stripeStart = i * maxDataStripeSize, stripeEnd = stripeStart + maxDataStripeSize;
         unsigned long int actualDataStripeSize = _chunkManager->getDataStripeSize(cmeta.coding, cmeta.n, cmeta.k, srf.size);
         bool unalignedStripe = i + 1 == rf.numStripes && (rf.size % maxDataStripeSize != 0); // last stripe may be unaligned
-        bool useTempBuffer = unalignedStripe || actualDataStripeSize > maxDataStripeSize;
+        // unique blocks of stripes with duplicate blocks are packed, and need to be moved back to their logical offsets
+        auto dupIt = rf.duplicateBlocks.lower_bound(BlockLocation::InObjectLocation(stripeStart, 0));
+        bool packedStripe = dupIt != rf.duplicateBlocks.end() && dupIt->first._offset < stripeEnd;
+        bool useTempBuffer = unalignedStripe || packedStripe || actualDataStripeSize > maxDataStripeSize;
         if (useTempBuffer) {
             // allocate buffer on first use, or when the size is not sufficiently large
             if (tmpBuffer == 0 || bufferSize < actualDataStripeSize || bufferSize < maxDataStripeSize) {
@@ -1136,10 +1145,9 @@ bool Proxy::readFile(File &f, bool isPartial) {
                 tmpBuffer = static_cast<unsigned char *>(calloc (bufferSize, 1));
                 if (tmpBuffer == 0) {
                     LOG(ERROR) << "Out of memory for reading stripes for file " << f.name;
-                    unlockFile(rf);
-                    clean_external_filemeta();
                     unsetCopyFileStripeMeta(srf);
-                    return false;
+                    okay = false;
+                    break;
                 }
             }
             // zero out the zone to use
@@ -1147,40 +1155,60 @@ bool Proxy::readFile(File &f, bool isPartial) {
             // assigned it to the stripe
             srf.data = tmpBuffer;
         } else { // aligned stripes
-            srf.data = rf.data + i * maxDataStripeSize;
+            srf.data = rf.data + stripeStart;
         }
         if (_chunkManager->readFileStripe(srf, chunkIndices) == false) {
             LOG(ERROR) << "Failed to read file " << f.name << " from backend (stripe " << i << ")";
             okay = false;
         }
-        if (useTempBuffer) { // copy data back to the original file data buffer
+        if (okay && packedStripe) { // copy the unique blocks back to their logical offsets
+            memoryCopy.resume();
+            auto endIt = internalBlockLocs.lower_bound(stripeEnd);
+            for (auto bit = internalBlockLocs.lower_bound(stripeStart); bit != endIt; bit++) {
+                unsigned long int objOffset = bit->first;
+                unsigned int length = std::min(f.offset + f.length - objOffset, static_cast<unsigned long int>(bit->second._length));
+                memcpy(rf.data + objOffset, srf.data + bit->second._offset, length);
+                bytesRead += length;
+            }
+            memoryCopy.stop();
+        } else if (okay && useTempBuffer) { // copy data back to the original file data buffer
             // directly copy all data read
-            memcpy(rf.data + i * maxDataStripeSize, srf.data, srf.size);
+            memcpy(rf.data + stripeStart, srf.data, srf.size);
             bytesRead += srf.size;
-            // if buffer is replaced by lower level functions, free the new buffer and reset to tmp buffer pointer to avoid double free
-            if (srf.data != tmpBuffer) {
-                tmpBuffer = 0;
-                bufferSize = 0;
-                free(srf.data);
-            }
-        } else {
+        } else if (okay) {
             bytesRead += srf.size;
-	}
+        }
+        // if buffer is replaced by lower level functions, free the new buffer and reset to tmp buffer pointer to avoid double free
+        if (useTempBuffer && srf.data != tmpBuffer) {
+            tmpBuffer = 0;
+            bufferSize = 0;
+            free(srf.data);
+        }
         // unset the data reference to the original file data buffer or the temp buffer
         srf.data = 0;
         // clean up (avoid double free)
         unsetCopyFileStripeMeta(srf);
-        // skip once read failed
-        if (!okay) {
-            if (preallocated) {
-                rf.data = 0;
-            } else {
-                rf.data += f.offset;
-            }
-            clean_external_filemeta();
-            return false;
+    }
+
+    // wait for the duplicate data from other objects
+    extReads.okay = extReads.okay && okay;
+    join_external_readers();
+    bytesRead += extReads.bytesCopied;
+
+    // skip once read failed
+    if (!okay || !extReads.okay) {
+        if (preallocated) {
+            rf.data = 0;
+        } else {
+            rf.data += f.offset;
         }
+        free(tmpBuffer);
+        clean_external_filemeta();
+        return false;
     }
+
+#undef join_external_readers
+
     // make it back to the actual data buffer starting address
     rf.data += f.offset;
     readData.stop();
@@ -1198,9 +1226,8 @@ bool Proxy::readFile(File &f, bool isPartial) {
     // report data read speed
 
     updateMeta.start();
-    if (_metastore->updateTimestamps(rf) == false) {
-        LOG(WARNING) << "Failed to update timestamp of file " << f.name << " after read";
-    }
+    // no need to wait for the access time update
+    _asyncMetastore->updateTimestamps(rf);
     updateMeta.stop();
 
     overallT.markEnd();
@@ -1240,10 +1267,10 @@ bool Proxy::readFile(File &f, bool isPartial) {
 bool Proxy::sortStripesAndBlocks(
         const unsigned char namespaceId,
         const char *name,
-        const std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueStartFp,
-        const std::map<BlockLocation::InObjectLocation, std::pair<Fingerprint, int> >::iterator uniqueEndFp,
-        const std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateStartFp,
-        const std::map<BlockLocation::InObjectLocation, Fingerprint>::iterator duplicateEndFp,
+        const File::UniqueBlockMap::iterator uniqueStartFp,
+        const File::UniqueBlockMap::iterator uniqueEndFp,
+        const File::DuplicateBlockMap::iterator duplicateStartFp,
+        const File::DuplicateBlockMap::iterator duplicateEndFp,
         std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > > *externalBlockLocs,
         std::map<unsigned long int, BlockLocation::InObjectLocation> *internalBlockLocs,
         std::map<StripeLocation, std::set<int> > &externalStripes,
@@ -1296,9 +1323,38 @@ bool Proxy::sortStripesAndBlocks(
     }
     queryLoc.stop();
 
+    size_t numDuplicateBlocks = duplicateBlockFps.size();
+
+    getExtFileMeta.start();
+    // query the metadata of all newly referenced files together
+    std::vector<std::pair<File *, std::future<bool> > > pendingExtFiles;
+    for (size_t i = 0; i < numDuplicateBlocks; i++) {
+        const BlockLocation &blockLoc = duplicateBlockLoc.at(i);
+        const std::string &extFilename = blockLoc.getObjectID();
+        if (externalFiles.count(extFilename) > 0)
+            continue;
+        File *ef = new File();
+        ef->setVersion(blockLoc.getObjectVersion());
+        std::string objectName = blockLoc.getObjectName();
+        ef->setName(objectName.data(), objectName.size());
+        ef->namespaceId = blockLoc.getObjectNamespaceId();
+        // the caller releases the file metadata
+        externalFiles.emplace(std::make_pair(extFilename, ef));
+        pendingExtFiles.emplace_back(ef, _asyncMetastore->getMeta(*ef, /* get blocks type (unqiue) */ 1));
+    }
+    bool extFilesFound = true;
+    for (size_t i = 0; i < pendingExtFiles.size(); i++) {
+        if (!pendingExtFiles.at(i).second.get()) {
+            LOG(ERROR) << "Failed to find the physical location of the duplicated block for file " << name << " referencing a non-existing file " << pendingExtFiles.at(i).first->name;
+            extFilesFound = false;
+        }
+    }
+    getExtFileMeta.stop();
+    if (!extFilesFound)
+        return false;
+
     // complexity: scan all duplicate block once O(num duplicate blocks)
     // process the block locations
-    size_t numDuplicateBlocks = duplicateBlockFps.size();
     auto dit = duplicateStartFp;
     for (size_t i = 0; i < numDuplicateBlocks; i++, dit++) {
 
@@ -1306,31 +1362,9 @@ bool Proxy::sortStripesAndBlocks(
 
         stripeIdx = stripeSizeProvided? dit->first._offset / dataStripeSize - startingStripeIdx : 0;
 
-        getExtFileMeta.resume();
         // find the file metadata for the duplicate block
-        File *ef = 0;
         const std::string &extFilename = blockLoc.getObjectID();
-        auto fit = externalFiles.find(extFilename);
-        if (fit == externalFiles.end()) {
-            // query the file metadata from metastore
-            ef = new File();
-            ef->setVersion(blockLoc.getObjectVersion());
-            std::string objectName = blockLoc.getObjectName();
-            ef->setName(objectName.data(), objectName.size());
-            ef->namespaceId = blockLoc.getObjectNamespaceId();
-            if (!_metastore->getMeta(*ef, /* get blocks type (unqiue) */ 1)) {
-                LOG(ERROR) << "Failed to find the physical location of the duplicated block for file " << name << " referencing a non-existing file " << extFilename;
-                delete ef;
-                return false;
-            }
-            // save the queried file metadata for future use
-            externalFiles.emplace(std::make_pair(extFilename, ef));
-            //DLOG(INFO) << "Duplicated block(s) to be read from an external object " << extFilename << " in namespace " << (int) blockLoc.getObjectNamespaceId() << " version " << ef->version;
-        } else {
-            // reuse saved file metadata
-            ef = fit->second;
-        }
-        getExtFileMeta.stop();
+        File *ef = externalFiles.at(extFilename);
 
         // figure out the target stripe (starting offset and length) to read
         CodingMeta &cmeta = ef->codingMeta;
@@ -1342,13 +1376,8 @@ bool Proxy::sortStripesAndBlocks(
         StripeLocation stripe(extFilename, extStripeAlignedOffset);
 
         accuExtStripe.resume();
-        // mark the stripe as pending to read
-        bool marked = false;
-        std::tie(std::ignore, marked) = externalStripes.emplace(std::make_pair(stripe, std::set<int>()));
-        if (!marked) {
-            // TODO may init async read here and wait for the results
-        }
-        externalStripes.at(stripe).insert(stripeIdx);
+        // mark the stripe as pending to read, each external stripe is read and decoded once per request
+        externalStripes[stripe].insert(stripeIdx);
 
         // figure out the physical offset of the block in the stripe
         try {
@@ -1358,15 +1387,16 @@ bool Proxy::sortStripesAndBlocks(
                 LOG(ERROR) << "Fingerprint record mismatch for block location " << blockLoc.print() << ", expect " << duplicateBlockFps.at(i).toHex() << " got " << bit.first.toHex();
                 throw std::out_of_range("Fingerprint mismatch error");
             }
-            // update the mapping of internal logical address to external stripe mapping (object name, logical offset, physical in-stripe offset)
-            stripe._offset = extStripeOffset;
-            // TODO: coalesce adjacent blocks (1) batch memcpy() and (2) reduce the number of records, especially for small block sizes
-            std::vector<std::pair<int, BlockLocation::InObjectLocation> > locs (1, std::make_pair(bit.second, dit->first));
-            std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > >::iterator esIt;
-            bool inserted = false;
-            std::tie(esIt, inserted) = externalBlockLocs[stripeIdx].emplace(std::make_pair(stripe, locs));
-            if (!inserted) {
-                esIt->second.emplace_back(std::make_pair(bit.second, dit->first));
+            // update the mapping of internal logical address to external stripe mapping (object name, stripe logical offset) -> [physical in-stripe offset, internal logical address]
+            std::vector<std::pair<int, BlockLocation::InObjectLocation> > &locs = externalBlockLocs[stripeIdx][stripe];
+            if (!locs.empty()
+                    && locs.back().first + locs.back().second._length == (size_t) bit.second
+                    && locs.back().second._offset + locs.back().second._length == dit->first._offset
+            ) {
+                // coalesce with the previous block which is adjacent in both the external stripe and the file, to batch memcpy()
+                locs.back().second._length += dit->first._length;
+            } else {
+                locs.emplace_back(std::make_pair(bit.second, dit->first));
             }
         } catch (std::out_of_range &e) {
             LOG(ERROR) << "Cannot find the physcial location of a duplicated block in the source file " << extFilename << " at offset " << extStripeOffset;
@@ -1387,6 +1417,333 @@ bool Proxy::sortStripesAndBlocks(
 }
 
 
+bool Proxy::readExternalStripe(const StripeLocation &stripe, File &ef, const std::vector<std::pair<int, BlockLocation::InObjectLocation> > &blocks, unsigned char *data, unsigned long int dataEnd, unsigned long int &bytesCopied) {
+    // figure out the stripe to read
+    CodingMeta &cmeta = ef.codingMeta;
+    unsigned long int maxDataSizePerStripe = _chunkManager->getMaxDataSizePerStripe(cmeta.coding, cmeta.n, cmeta.k, cmeta.maxChunkSize, /* is full chunk */ true);
+    int stripeId = stripe._offset / maxDataSizePerStripe;
+    DLOG(INFO) << "Read stripe from external object " << ef.name << " in range (" << stripe._offset << ", " << std::min(maxDataSizePerStripe, ef.size - stripe._offset) << ")";
+
+    // figure out the number of chunks and the container liveness
+    int numRequiredContainers = _chunkManager->getNumRequiredContainers(cmeta.coding, cmeta.n, cmeta.k);
+    int numChunksPerContainer = _chunkManager->getNumChunksPerContainer(cmeta.coding, cmeta.n, cmeta.k);
+    int numChunksPerStripe = numRequiredContainers * numChunksPerContainer;
+    bool chunkIndices[numChunksPerStripe];
+    _coordinator->checkContainerLiveness(ef.containerIds + stripeId * numChunksPerStripe, numChunksPerStripe, chunkIndices);
+
+    File erf;
+    if (copyFileStripeMeta(erf, ef, stripeId, "read") == false) {
+        return false;
+    }
+
+    // read the stripe
+    if (!_chunkManager->readFileStripe(erf, chunkIndices)) {
+        LOG(ERROR) << "Failed to read stripe " << stripeId << " of referenced file " << ef.name << " from backend";
+        unsetCopyFileStripeMeta(erf);
+        return false;
+    }
+
+    // copy the (coalesced) duplicate blocks from this external stripe to the file data buffer
+    bytesCopied = 0;
+    for (auto bit = blocks.begin(); bit != blocks.end(); bit++) {
+        unsigned long int objOffset = bit->second._offset;
+        unsigned int length = std::min(dataEnd - objOffset, static_cast<unsigned long int>(bit->second._length));
+        memcpy(data + objOffset, erf.data + bit->first, length);
+        bytesCopied += length;
+    }
+
+    unsetCopyFileStripeMeta(erf);
+
+    return true;
+}
+
+void *Proxy::readExternalStripes(void *arg) {
+    ExternalStripeReadContext *cxt = (ExternalStripeReadContext *) arg;
+
+    // take the stripes one by one until all are read, or any read fails
+    for (size_t i = cxt->next++; i < cxt->stripes.size() && cxt->okay; i = cxt->next++) {
+        const StripeLocation &stripe = cxt->stripes.at(i).first;
+        auto bit = cxt->blockLocs->find(stripe);
+        if (bit == cxt->blockLocs->end()) {
+            LOG(WARNING) << "Skip reading stripe at " << stripe._offset << " from referenced file " << stripe._objectName << " as no blocks are copied from it.";
+            continue;
+        }
+        unsigned long int bytesCopied = 0;
+        if (!cxt->proxy->readExternalStripe(stripe, *cxt->stripes.at(i).second, bit->second, cxt->data, cxt->dataEnd, bytesCopied)) {
+            cxt->okay = false;
+            break;
+        }
+        cxt->bytesCopied += bytesCopied;
+    }
+
+    return NULL;
+}
+
+void Proxy::collectBlockFingerprints(const File::UniqueBlockMap &uniqueBlocks, const File::DuplicateBlockMap &duplicateBlocks, std::vector<Fingerprint> &fps) {
+    fps.reserve(fps.size() + uniqueBlocks.size() + duplicateBlocks.size());
+    // blocks without fingerprints are not deduplicated
+    for (auto it = uniqueBlocks.begin(); it != uniqueBlocks.end(); it++) {
+        if (it->second.first.size() > 0)
+            fps.emplace_back(it->second.first);
+    }
+    for (auto it = duplicateBlocks.begin(); it != duplicateBlocks.end(); it++) {
+        if (it->second.size() > 0)
+            fps.emplace_back(it->second);
+    }
+}
+
+bool Proxy::addBlockReferences(const File &f) {
+    std::vector<Fingerprint> fps;
+    collectBlockFingerprints(f.uniqueBlocks, f.duplicateBlocks, fps);
+    if (fps.empty())
+        return true;
+
+    if (!_dedup->addReferences(f.namespaceId, fps)) {
+        LOG(ERROR) << "Failed to add references of file " << f.name << " version " << f.version << " to " << fps.size() << " blocks";
+        return false;
+    }
+    return true;
+}
+
+bool Proxy::releaseBlockReferences(const File &f) {
+    std::vector<Fingerprint> fps;
+    collectBlockFingerprints(f.uniqueBlocks, f.duplicateBlocks, fps);
+    if (fps.empty())
+        return true;
+
+    std::vector<long long> counts;
+    File::UniqueBlockMap liveBlocks;
+    int numLiveBlocks = -1;
+    if (!_dedup->removeReferences(f.namespaceId, fps, counts)) {
+        LOG(ERROR) << "Failed to remove references of file " << f.name << " version " << f.version << " to " << fps.size() << " blocks";
+    } else {
+        numLiveBlocks = findLiveUniqueBlocks(f, f.uniqueBlocks, liveBlocks);
+    }
+    if (numLiveBlocks == 0)
+        return true;
+
+    // keep the data (also when unsure) until garbage collection finds no more references to its blocks
+    if (!_metastore->putRetiredMeta(f)) {
+        LOG(ERROR) << "Failed to retire file " << f.name << " version " << f.version << ", its data is kept without garbage collection";
+    } else {
+        LOG(INFO) << "Retire file " << f.name << " version " << f.version << " with " << numLiveBlocks << " blocks still referenced";
+    }
+    return false;
+}
+
+int Proxy::findLiveUniqueBlocks(const File &f, const File::UniqueBlockMap &blocks, File::UniqueBlockMap &liveBlocks, bool excludeOwnReferences) {
+    liveBlocks.clear();
+
+    std::vector<Fingerprint> fps;
+    std::vector<File::UniqueBlockMap::const_iterator> fpBlocks;
+    fps.reserve(blocks.size());
+    fpBlocks.reserve(blocks.size());
+    for (auto it = blocks.begin(); it != blocks.end(); it++) {
+        if (it->second.first.size() == 0)
+            continue;
+        fps.emplace_back(it->second.first);
+        fpBlocks.emplace_back(it);
+    }
+    if (fps.empty())
+        return 0;
+
+    // number of references and the indexed copy of each fingerprint
+    std::vector<long long> counts;
+    if (!_dedup->getReferences(f.namespaceId, fps, counts) || counts.size() != fps.size()) {
+        LOG(ERROR) << "Failed to get the references to blocks of file " << f.name << " version " << f.version;
+        return -1;
+    }
+    std::vector<BlockLocation> locations = _dedup->query(f.namespaceId, fps);
+    if (locations.size() != fps.size()) {
+        LOG(ERROR) << "Failed to query the locations of blocks of file " << f.name << " version " << f.version;
+        return -1;
+    }
+
+    // references held by the file itself
+    std::map<Fingerprint, long long> ownReferences;
+    if (excludeOwnReferences) {
+        std::vector<Fingerprint> ownFps;
+        collectBlockFingerprints(f.uniqueBlocks, f.duplicateBlocks, ownFps);
+        for (size_t i = 0; i < ownFps.size(); i++) {
+            ownReferences[ownFps.at(i)]++;
+        }
+    }
+
+    std::string name(f.name, f.nameLength);
+    for (size_t i = 0; i < fps.size(); i++) {
+        long long numReferences = counts.at(i);
+        if (excludeOwnReferences) {
+            auto rit = ownReferences.find(fps.at(i));
+            numReferences -= rit == ownReferences.end()? 0 : rit->second;
+        }
+        if (numReferences <= 0)
+            continue;
+        // other files read the block from the indexed copy only
+        const BlockLocation::InObjectLocation &range = fpBlocks.at(i)->first;
+        if (!(locations.at(i) == BlockLocation(f.namespaceId, name, f.version, range._offset, range._length)))
+            continue;
+        liveBlocks.insert(*fpBlocks.at(i));
+    }
+
+    return liveBlocks.size();
+}
+
+bool Proxy::relocateUniqueBlocks(File &sf, const File::UniqueBlockMap &blocks) {
+    if (blocks.empty())
+        return true;
+
+    File gf;
+    std::string srcName(sf.name, sf.nameLength);
+    std::string dstName = std::string(DEDUP_GC_OBJECT_PREFIX).append(boost::uuids::to_string(boost::uuids::random_generator()()));
+    if (!gf.setName(dstName.c_str(), dstName.size())) {
+        return false;
+    }
+    gf.namespaceId = sf.namespaceId;
+    gf.genUUID();
+    gf.version = 0;
+    gf.storageClass = sf.storageClass;
+    if (!_chunkManager->setCodingMeta(gf.storageClass, gf.codingMeta)) {
+        LOG(ERROR) << "Failed to find the coding metadata of class " << gf.storageClass << " to relocate blocks of file " << sf.name;
+        return false;
+    }
+
+    CodingMeta &scmeta = sf.codingMeta, &gcmeta = gf.codingMeta;
+    unsigned long int srcStripeSize = _chunkManager->getMaxDataSizePerStripe(scmeta.coding, scmeta.n, scmeta.k, scmeta.maxChunkSize);
+    unsigned long int dstStripeSize = _chunkManager->getMaxDataSizePerStripe(gcmeta.coding, gcmeta.n, gcmeta.k, gcmeta.maxChunkSize);
+    if (srcStripeSize == 0 || srcStripeSize == INVALID_FILE_OFFSET || dstStripeSize == 0 || dstStripeSize == INVALID_FILE_OFFSET) {
+        LOG(ERROR) << "Failed to get the stripe size to relocate blocks of file " << sf.name;
+        return false;
+    }
+
+    // pack the blocks one after another without crossing stripe boundaries, as the read path expects each block within a stripe
+    std::map<StripeLocation, std::vector<std::pair<int, BlockLocation::InObjectLocation> > > stripeBlocks;
+    std::vector<Fingerprint> fps;
+    std::vector<BlockLocation> oldLocations, newLocations;
+    unsigned long int size = 0;
+    for (auto it = blocks.begin(); it != blocks.end(); it++) {
+        unsigned int length = it->first._length;
+        if (length > dstStripeSize) {
+            LOG(ERROR) << "Failed to relocate block (" << it->first._offset << ", " << length << ") of file " << sf.name << ", larger than a stripe of " << dstStripeSize << " bytes";
+            return false;
+        }
+        if (size % dstStripeSize + length > dstStripeSize)
+            size = (size / dstStripeSize + 1) * dstStripeSize;
+        BlockLocation::InObjectLocation range(size, length);
+        stripeBlocks[StripeLocation(srcName, it->first._offset / srcStripeSize * srcStripeSize)].emplace_back(it->second.second, range);
+        gf.uniqueBlocks.insert(std::make_pair(range, std::make_pair(it->second.first, (int) (size % dstStripeSize))));
+        fps.emplace_back(it->second.first);
+        oldLocations.emplace_back(sf.namespaceId, srcName, sf.version, it->first._offset, length);
+        newLocations.emplace_back(gf.namespaceId, dstName, gf.version, size, length);
+        size += length;
+    }
+
+    // read the blocks from the source stripes
+    gf.data = (unsigned char *) calloc(size, 1);
+    if (gf.data == 0) {
+        LOG(ERROR) << "Failed to allocate a buffer of " << size << " bytes to relocate blocks of file " << sf.name;
+        return false;
+    }
+    for (auto it = stripeBlocks.begin(); it != stripeBlocks.end(); it++) {
+        unsigned long int bytesCopied = 0;
+        if (!readExternalStripe(it->first, sf, it->second, gf.data, size, bytesCopied)) {
+            LOG(ERROR) << "Failed to read stripe at " << it->first._offset << " of file " << sf.name << " to relocate its blocks";
+            return false;
+        }
+    }
+
+    gf.size = size;
+    gf.offset = 0;
+    gf.length = size;
+    time_t now = time(NULL);
+    gf.setTimeStamps(now, now, now);
+    MD5Calculator md5;
+    md5.appendData(gf.data, size);
+    unsigned int md5len = MD5_DIGEST_LENGTH;
+    md5.finalize(gf.md5, md5len);
+
+    // write the blocks as is into a new object
+    File wf;
+    int *spareContainers = 0;
+    int numSelected = 0;
+    if (!prepareWrite(gf, wf, spareContainers, numSelected, /* needsFindSpareContainers */ false)) {
+        delete [] spareContainers;
+        return false;
+    }
+    wf.data = gf.data;
+    wf.copyVersionControlInfo(gf);
+    bool written = writeFileStripes(gf, wf, spareContainers, numSelected, /* dedup */ false);
+    wf.data = 0;
+    delete [] spareContainers;
+    if (!written) {
+        LOG(ERROR) << "Failed to write " << size << " bytes of blocks relocated from file " << sf.name;
+        return false;
+    }
+    std::swap(wf.uniqueBlocks, gf.uniqueBlocks);
+
+    // keep the object hidden from listing, and for garbage collection once its blocks are no longer referenced
+    if (!_metastore->putRetiredMeta(wf)) {
+        LOG(ERROR) << "Failed to record the object " << dstName << " of blocks relocated from file " << sf.name;
+        bool chunkIndices[wf.numChunks];
+        _coordinator->checkContainerLiveness(wf.containerIds, wf.numChunks, chunkIndices);
+        _chunkManager->deleteFile(wf, chunkIndices);
+        return false;
+    }
+
+    // point the index to the copies, unless the fingerprints are indexed elsewhere in the meantime
+    std::string commitId = _dedup->update(fps, oldLocations, newLocations);
+    if (commitId.empty()) {
+        LOG(ERROR) << "Failed to point the index to the blocks relocated from file " << sf.name;
+        return false;
+    }
+    _dedup->commit(commitId);
+
+    LOG(INFO) << "Relocate " << blocks.size() << " blocks from file " << sf.name << " version " << sf.version << " to " << dstName;
+
+    return true;
+}
+
+bool Proxy::collectRetiredFile(const File &rf) {
+    File f;
+    if (!f.copyName(rf))
+        return false;
+    f.version = rf.version;
+
+    if (!_metastore->getMeta(f)) {
+        LOG(WARNING) << "Failed to find the metadata of retired file " << rf.name << " version " << rf.version << ", drop the record";
+        return _metastore->deleteRetiredMeta(f);
+    }
+
+    File::UniqueBlockMap liveBlocks;
+    int numLiveBlocks = findLiveUniqueBlocks(f, f.uniqueBlocks, liveBlocks);
+    if (numLiveBlocks < 0)
+        return false;
+
+    // keep the data if most of its blocks are still referenced
+    unsigned long int threshold = Config::getInstance().getProxyDedupGcCompactionThreshold();
+    if (numLiveBlocks > 0 && numLiveBlocks * 100UL >= f.uniqueBlocks.size() * threshold)
+        return true;
+
+    // copy out the few blocks still referenced
+    if (numLiveBlocks > 0 && !relocateUniqueBlocks(f, liveBlocks))
+        return false;
+
+    // remove the data and the record
+    if (f.numChunks > 0) {
+        bool chunkIndices[f.numChunks];
+        _coordinator->checkContainerLiveness(f.containerIds, f.numChunks, chunkIndices, /* update first */ true, /* check all */ true, /* UNUSED as not alive */ true);
+        if (!_chunkManager->deleteFile(f, chunkIndices)) {
+            LOG(WARNING) << "Failed to delete retired file " << f.name << " version " << f.version << " from backend";
+            return false;
+        }
+    }
+    if (!_metastore->deleteRetiredMeta(f))
+        return false;
+
+    LOG(INFO) << "Reclaim retired file " << f.name << " version " << f.version << ", " << numLiveBlocks << " blocks relocated";
+
+    return true;
+}
+
 bool Proxy::readPartialFile(File &f) {
     return readFile(f, /* isPartial */ true);
 }
@@ -1465,14 +1822,16 @@ bool Proxy::deleteFile(const File &f) {
         // check chunk availability
         bool chunkIndices[df.numChunks];
         _coordinator->checkContainerLiveness(df.containerIds, df.numChunks, chunkIndices, /* update first */ true, /* check all */ true, /* UNUSED as not alive */ true);
-        // delete the chunks
-        if (_chunkManager->deleteFile(df, chunkIndices) == false) {
+        // delete the chunks, unless other files still reference the blocks (leave them to garbage collection)
+        if (releaseBlockReferences(df) && _chunkManager->deleteFile(df, chunkIndices) == false) {
             LOG(WARNING) << "Failed to delete file " << f.name << " from backend";
             unlockFile(df);
             return false;
         }
-        _metastore->markFileAsRepaired(df);
-        _metastore->markFileAsWrittenToCloud(df, /* removePending */ true);
+        std::future<bool> repaired = _asyncMetastore->markFileAsRepaired(df);
+        std::future<bool> written = _asyncMetastore->markFileAsWrittenToCloud(df, /* removePending */ true);
+        repaired.wait();
+        written.wait();
     }
 
     // also delete from staging
@@ -1642,15 +2001,15 @@ bool Proxy::copyFile(File &sf, File &df) {
     }
 
     copyMeta.start();
-    // lock both the source and destination
-    if (lockFileAndGetMeta(srf, "copy") == false)
+    // lock both the source (shared with readers) and destination
+    if (lockFileAndGetMeta(srf, "copy", /* shared */ true) == false)
         return false;
 
     LOG(INFO) << "Copy file " << sf.name << " to " << df.name << ", source file metadata found";
 
     if (_metastore->lockFile(df) == false) {
         LOG(ERROR) << "Failed to lock destination file " << df.name << " for copying\n";
-        unlockFile(srf);
+        unlockFile(srf, /* shared */ true);
         return false;
     }
     copyMeta.stop();
@@ -1676,7 +2035,7 @@ bool Proxy::copyFile(File &sf, File &df) {
     // only copy chunks if deduplication is disabled
     if (_chunkManager->copyFile(srf, drf, &start, &end) == false) {
         LOG(ERROR) << "Failed to copy file " << sf.name << " to " << df.name << " in backend";
-        unlockFile(srf);
+        unlockFile(srf, /* shared */ true);
         unlockFile(df);
         rf.name = 0;
         return false;
@@ -1723,13 +2082,22 @@ bool Proxy::copyFile(File &sf, File &df) {
     // update metadata
     if (_metastore->putMeta(drf) == false) {
         LOG(ERROR) << "Failed to update file metadata of file " << df.name;
-        unlockFile(srf);
+        unlockFile(srf, /* shared */ true);
         unlockFile(df);
         rf.name = 0;
         return false;
     }
     copyMeta.stop();
 
+    // the copy references all its blocks, and the blocks of the overwritten destination are no longer referenced
+    std::vector<Fingerprint> replacedFps;
+    std::vector<long long> counts;
+    if (destExists)
+        collectBlockFingerprints(rf.uniqueBlocks, rf.duplicateBlocks, replacedFps);
+    if (!addBlockReferences(drf) || !_dedup->removeReferences(rf.namespaceId, replacedFps, counts)) {
+        LOG(WARNING) << "Failed to update block references of file " << df.name << ", its blocks may be kept after deletion";
+    }
+
     // pass the info back to caller
     df.uuid = drf.uuid;
     df.size = drf.size;
@@ -1739,7 +2107,7 @@ bool Proxy::copyFile(File &sf, File &df) {
     memcpy(df.md5, drf.md5, MD5_DIGEST_LENGTH);
 
     // unlock the files
-    unlockFile(srf);
+    unlockFile(srf, /* shared */ true);
     unlockFile(df);
 
     rf.name = 0;
@@ -1761,7 +2129,13 @@ bool Proxy::copyFile(File &sf, File &df) {
 }
 
 bool Proxy::repairFile(const File &f, bool isBg) {
-    File rf;
+    return repairFile(f, isBg, /* locked file */ 0);
+}
+
+bool Proxy::repairFile(const File &f, bool isBg, File *lockedFile) {
+    File lf;
+    // use the file already locked with metadata retrieved, if any
+    File &rf = lockedFile? *lockedFile : lf;
     boost::timer::cpu_timer mytimer;
 
     // Benchmark
@@ -1770,22 +2144,24 @@ bool Proxy::repairFile(const File &f, bool isBg) {
     if (bmRepair)
         bmRepair->proxyOverallTime.markStart();
 
-    if (rf.copyNameAndSize(f) == false) {
-        LOG(ERROR) << "Failed to copy file metadata for delete operaiton";
-        return false;
-    }
-    if (rf.namespaceId == INVALID_NAMESPACE_ID)
-        rf.namespaceId = DEFAULT_NAMESPACE_ID;
-
-    rf.copyVersionControlInfo(f);
-
     // TAGPT (start): getMeta
     if (bmRepair)
         bmRepair->getMeta.setStart(bmRepair->proxyOverallTime.getStart());
 
-    // lock file and get metadata for repair
-    if (lockFileAndGetMeta(rf, "repair") == false)
-        return false;
+    if (lockedFile == 0) {
+        if (rf.copyNameAndSize(f) == false) {
+            LOG(ERROR) << "Failed to copy file metadata for delete operaiton";
+            return false;
+        }
+        if (rf.namespaceId == INVALID_NAMESPACE_ID)
+            rf.namespaceId = DEFAULT_NAMESPACE_ID;
+
+        rf.copyVersionControlInfo(f);
+
+        // lock file and get metadata for repair
+        if (lockFileAndGetMeta(rf, "repair") == false)
+            return false;
+    }
 
     LOG(INFO) << "Repair file " << f.name << ", metadata found";
 
@@ -1916,16 +2292,19 @@ bool Proxy::repairFile(const File &f, bool isBg) {
     }
 
     // remove the journaled chunk record for repaired chunks
-    if (_metastore && _metastore->fileHasJournal(f)) {
+    if (_metastore && !chunksToCheckForJournal.empty() && _metastore->fileHasJournal(f)) {
+        std::vector<Chunk> journaledChunks;
+        std::vector<int> journaledContainerIds;
         for (const int chunkId : chunksToCheckForJournal) {
-            // remove the chunk write journal record
             int containerId = f.containerIds[chunkId];
-            if (
-                containerId != INVALID_CONTAINER_ID 
-                && !_metastore->updateChunkInJournal(f, f.chunks[chunkId], /* isWrite */ true, /* deleteRecord */ true, containerId)
-            ) {
-                LOG(WARNING) << "Failed to remove journal record of chunk " << chunkId << " of file " << f.name << " in namepsace " << f.namespaceId << " version " << f.version << ".";
-            }
+            if (containerId == INVALID_CONTAINER_ID)
+                continue;
+            journaledChunks.push_back(f.chunks[chunkId]);
+            journaledContainerIds.push_back(containerId);
+        }
+        // remove the chunk write journal records together
+        if (!_metastore->updateChunksInJournal(f, journaledChunks, journaledContainerIds, /* isWrite */ true, /* deleteRecord */ true)) {
+            LOG(WARNING) << "Failed to remove journal records of " << journaledChunks.size() << " chunks of file " << f.name << " in namepsace " << f.namespaceId << " version " << f.version << ".";
         }
     }
     
@@ -2054,6 +2433,12 @@ unsigned int Proxy::getFileList(FileInfo **list, bool withSize, bool withVersion
     return _metastore->getFileList(list, namespaceId, withSize, withSize, withVersions, prefix);
 }
 
+unsigned int Proxy::getFileListPage(FileInfo **list, std::string &cursor, unsigned int pageSize, bool withSize, unsigned char namespaceId, std::string prefix) {
+    if (namespaceId == INVALID_NAMESPACE_ID)
+        namespaceId = DEFAULT_NAMESPACE_ID;
+    return _metastore->getFileListPage(list, cursor, pageSize, namespaceId, withSize, withSize, /* withVersions */ false, prefix);
+}
+
 unsigned int Proxy::getFolderList(std::vector<std::string> &list, unsigned char namespaceId, std::string prefix) {
     if (namespaceId == INVALID_NAMESPACE_ID)
         namespaceId = DEFAULT_NAMESPACE_ID;
@@ -2079,7 +2464,7 @@ void Proxy::unsetCopyFileStripeMeta(File &copy) {
     copy.codingMeta.codingState = 0;
 }
 
-bool Proxy::lockFile(const File &f) {
+bool Proxy::lockFile(const File &f, bool shared) {
     int retryIntv = Config::getInstance().getRetryInterval();
     int numRetry = Config::getInstance().getNumRetry();
 
@@ -2087,7 +2472,7 @@ bool Proxy::lockFile(const File &f) {
 
     // try locking the file
     for (int j = 0; j < numRetry; j++) {
-        locked = _metastore->lockFile(f);
+        locked = _metastore->lockFile(f, shared);
         if (locked)
             break;
         // sleep before retry (avoid error when usleep more than 1e6 us)
@@ -2099,25 +2484,77 @@ bool Proxy::lockFile(const File &f) {
     return locked;
 }
 
-bool Proxy::unlockFile(const File &f) {
-    return _metastore->unlockFile(f);
+bool Proxy::unlockFile(const File &f, bool shared) {
+    return _metastore->unlockFile(f, shared);
 }
 
-bool Proxy::lockFileAndGetMeta(File &f, const char *op) {
+bool Proxy::lockFileAndGetMeta(File &f, const char *op, bool shared) {
     // lock file for overwrite
-    if (lockFile(f) == false) {
+    if (lockFile(f, shared) == false) {
         LOG(ERROR) << "Failed to lock file " << f.name << " for " << op;
         return false;
     }
     // get the old file metadata for checking
     if (!_metastore->getMeta(f)) {
         LOG(ERROR) << "Failed to find the metadata of file " << f.name << " for " << op;
-        unlockFile(f);
+        unlockFile(f, shared);
         return false;
     }
     return true;
 }
 
+int Proxy::lockFilesAndGetMetaMulti(const std::vector<File *> &files, const std::vector<bool> &lock, std::vector<bool> &ready, const char *op, int getBlocks) {
+    size_t numFiles = files.size();
+    size_t batchSize = Config::getInstance().getFileScanMetaBatchSize();
+    int numReady = 0;
+
+    ready.assign(numFiles, false);
+
+    for (size_t start = 0; start < numFiles; start += batchSize) {
+        size_t end = std::min(numFiles, start + batchSize);
+        std::vector<File *> filesToLock, filesToGet;
+        std::vector<size_t> lockIdx, getIdx;
+        for (size_t i = start; i < end; i++) {
+            if (lock.at(i)) {
+                filesToLock.push_back(files.at(i));
+                lockIdx.push_back(i);
+            } else {
+                filesToGet.push_back(files.at(i));
+                getIdx.push_back(i);
+            }
+        }
+
+        // lock files in one go, and retry on those being locked by others one by one
+        std::vector<bool> locked;
+        _metastore->lockFilesMulti(filesToLock, locked);
+        for (size_t i = 0; i < filesToLock.size(); i++) {
+            if (!locked.at(i) && lockFile(*filesToLock.at(i)) == false) {
+                LOG(ERROR) << "Failed to lock file " << filesToLock.at(i)->name << " for " << op;
+                continue;
+            }
+            filesToGet.push_back(filesToLock.at(i));
+            getIdx.push_back(lockIdx.at(i));
+        }
+
+        // get the metadata in one go
+        std::vector<bool> found;
+        _metastore->getMetaMulti(filesToGet, found, getBlocks);
+        for (size_t i = 0; i < filesToGet.size(); i++) {
+            size_t idx = getIdx.at(i);
+            if (!found.at(i)) {
+                LOG(ERROR) << "Failed to find the metadata of file " << filesToGet.at(i)->name << " for " << op;
+                if (lock.at(idx))
+                    unlockFile(*filesToGet.at(i));
+                continue;
+            }
+            ready.at(idx) = true;
+            numReady++;
+        }
+    }
+
+    return numReady;
+}
+
 bool Proxy::pinStagedFile(const File &f) {
     return _stagingEnabled &&_staging? _staging->pinFile(f) : true;
 }
@@ -8,7 +8,6 @@
 
 #include "../common/config.hh"
 #include "interfaces/zmq.hh"
-#include "dedup/impl/dedup_all.hh"
 
 Proxy *proxy = 0;
 ProxyZMQIntegration *proxy_zmq = 0;
@@ -104,11 +103,9 @@ int main(int argc, char **argv) {
     BgChunkHandler::TaskQueue queue; // background chunk task queue
     pthread_create(&ct, NULL, ProxyCoordinator::run, coordinator); // proxy coordinator thread
 
-    DeduplicationModule *dedup = new DedupNone();
-
     // always open the zmq interface (for monitoring), and optional interfaces for request processing
     std::string interfaces = config.getProxyInterface();
-    proxy = new Proxy(coordinator, &map, &queue, dedup);
+    proxy = new Proxy(coordinator, &map, &queue);
     proxy_zmq = new ProxyZMQIntegration(proxy);
     
     // wait for enough agents and containers...
@@ -2,6 +2,8 @@
 
 #include <pthread.h> // pthread_*()
 #include <stdio.h> // printf()
+#include <string.h> // memcmp()
+#include <algorithm> // std::min()
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -32,6 +34,7 @@ extern "C" {
  *    - Expect get failures
  * 5. Encode chunks from containers, with correct container IDs specified
  *    - Expect successful encode, with one encoded chunk returned
+ *    - Expect slices of the encoding to match the whole encoded chunk
  * 6. Simulate chunk repair using CAR
  * 7. Check the chunks in containers
  *    - Expect successful check
@@ -260,6 +263,58 @@ int main(int argc, char **argv) {
 
     printf("> Pass generate encoded chunk test\n");
 
+    // --------------------------------------------------------
+    // 5b. encode slices of chunks, against the whole encoding
+    // --------------------------------------------------------
+    for (int i = 0; i < NUM_CHUNKS; i++)
+        event2.codingMeta.codingState[i] = i + 1;
+    event2.id = 19385;
+    event2.sliceOffset = 0;
+    event2.sliceLength = 0;
+    ChunkEvent wholeEvent;
+    IO::sendChunkEventMessage(requester, event2);
+    IO::getChunkEventMessage(requester, wholeEvent);
+
+    if (wholeEvent.opcode != Opcode::ENC_CHUNK_REP_SUCCESS || wholeEvent.numChunks != 1 || wholeEvent.chunks[0].size != CHUNK_SIZE) {
+        printf("> [Encode chunk slice] Failed to encode whole chunks, opcode %d\n", wholeEvent.opcode);
+        return 1;
+    }
+
+    // the last slice goes beyond the end of chunks, and should be empty
+    int sliceLength = CHUNK_SIZE / 4 + 1;
+    for (int offset = 0; offset <= CHUNK_SIZE; offset += sliceLength) {
+        ChunkEvent sliceEvent;
+        int expectedSize = std::min(sliceLength, CHUNK_SIZE - offset);
+        event2.id = 19386 + offset;
+        event2.sliceOffset = offset;
+        event2.sliceLength = sliceLength;
+        IO::sendChunkEventMessage(requester, event2);
+        IO::getChunkEventMessage(requester, sliceEvent);
+
+        if (event2.id != sliceEvent.id) {
+            printf("> [Encode chunk slice] Event id mismatched\n");
+            return 1;
+        }
+        if (sliceEvent.opcode != Opcode::ENC_CHUNK_REP_SUCCESS || sliceEvent.numChunks != 1) {
+            printf("> [Encode chunk slice] Unexpected opcode, expect %d but got %d\n", Opcode::ENC_CHUNK_REP_SUCCESS, sliceEvent.opcode);
+            return 1;
+        }
+        if (sliceEvent.chunks[0].size != expectedSize) {
+            printf("> [Encode chunk slice] Unexpected size of slice at offset %d, expect %d but got %d\n", offset, expectedSize, sliceEvent.chunks[0].size);
+            return 1;
+        }
+        if (expectedSize > 0 && memcmp(sliceEvent.chunks[0].data, wholeEvent.chunks[0].data + offset, expectedSize) != 0) {
+            printf("> [Encode chunk slice] Slice at offset %d differs from the whole encoded chunk\n", offset);
+            return 1;
+        }
+    }
+    event2.sliceOffset = 0;
+    event2.sliceLength = 0;
+
+    agent->printStats();
+
+    printf("> Pass encode chunk slice test\n");
+
     // -------------------------------------
     // 6. simulate repair via chunk encoding
     // -------------------------------------
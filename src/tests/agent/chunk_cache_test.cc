@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdio.h>
+#include <string.h>
+#include <boost/filesystem.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+
+#include <glog/logging.h>
+
+#include "../../ds/chunk.hh"
+#include "../../agent/chunk_cache.hh"
+
+/**
+ * Chunk Cache Test
+ *
+ * Test flow:
+ * 1. Evict the least recently used chunks from a memory-only cache
+ * 2. Spill chunks evicted from memory to the cache directory, and promote them back to memory on hit
+ * 3. Skip chunks read before an invalidation, and drop invalidated chunks from both memory and the directory
+ *
+ * Expect all operations to finish successfully
+ *
+ * Usage: ./chunk_cache_test [chunk size (in bytes)]
+ **/
+
+#define NUM_CHUNK (6)
+#define CHUNK_SIZE (1024)
+#define CONTAINER_ID (1)
+#define CACHE_DIR "./chunk_cache_test_dir"
+
+static unsigned char namespaceId = 1;
+
+/**
+ * Add a chunk to the cache as if it is just read from the container
+ **/
+static void putChunk(ChunkCache &cache, const Chunk &chunk) {
+    cache.put(CONTAINER_ID, chunk, cache.getGeneration(CONTAINER_ID, chunk));
+}
+
+/**
+ * Check if a chunk is found in the cache (with the expected content)
+ **/
+static bool hasChunk(ChunkCache &cache, const Chunk &chunk) {
+    Chunk readChunk;
+    readChunk.setId(namespaceId, chunk.fuuid, chunk.chunkId);
+    return cache.get(CONTAINER_ID, readChunk) && readChunk.size == chunk.size && memcmp(readChunk.data, chunk.data, chunk.size) == 0;
+}
+
+/**
+ * Count the chunk files in the cache directory
+ **/
+static int countCacheFiles() {
+    int count = 0;
+    for (boost::filesystem::directory_iterator it(CACHE_DIR), end; it != end; ++it)
+        count++;
+    return count;
+}
+
+int main(int argc, char **argv) {
+    int chunkSize = CHUNK_SIZE;
+
+    // take manual chunk size input
+    if (argc >= 2) {
+        int chunkSizet = atoi(argv[1]);
+        if (chunkSizet > 0)
+            chunkSize = chunkSizet;
+    }
+
+    FLAGS_logtostderr = true;
+    google::InitGoogleLogging(argv[0]);
+
+    printf("Start Chunk Cache Test\n");
+    printf("====================\n");
+    printf("Chunk size = %dB\n", chunkSize);
+
+    boost::uuids::basic_random_generator<boost::mt19937> gen;
+    boost::uuids::uuid fileuuid = gen();
+    Chunk chunks[NUM_CHUNK];
+    for (int i = 0; i < NUM_CHUNK; i++) {
+        chunks[i].setId(namespaceId, fileuuid, i);
+        chunks[i].size = chunkSize;
+        chunks[i].data = (unsigned char *) malloc (chunkSize * sizeof(unsigned char));
+        memset(chunks[i].data, 'a' + i, chunkSize);
+    }
+
+    bool okay = true;
+    CacheStats stats;
+
+    // evict the least recently used chunks from memory
+    {
+        ChunkCache cache(chunkSize * 3, "", 0);
+        for (int i = 0; i < 3; i++)
+            putChunk(cache, chunks[i]);
+        // use the first chunk, so the second one becomes the least recently used
+        okay = hasChunk(cache, chunks[0]);
+        putChunk(cache, chunks[3]);
+        for (int i = 0; i < 4 && okay; i++) {
+            if (hasChunk(cache, chunks[i]) != (i != 1)) {
+                printf("Failed to %s chunk %d in the memory-only cache\n", i != 1? "find" : "evict", i);
+                okay = false;
+            }
+        }
+        cache.getStats(stats);
+        if (okay && (stats.size != (unsigned long int) chunkSize * 3 || stats.hits != 4 || stats.misses != 1)) {
+            printf("Unexpected cache statistics, size = %lu hits = %lu misses = %lu\n", stats.size, stats.hits, stats.misses);
+            okay = false;
+        }
+        if (okay)
+            printf("> Evict the least recently used chunk from memory\n");
+    }
+
+    // spill chunks to the cache directory, and promote them back to memory
+    if (okay) {
+        boost::filesystem::remove_all(CACHE_DIR);
+        ChunkCache cache(chunkSize * 2, CACHE_DIR, chunkSize * 2);
+        // the first two chunks are evicted to the directory
+        for (int i = 0; i < 4; i++)
+            putChunk(cache, chunks[i]);
+        if (countCacheFiles() != 2) {
+            printf("Expect 2 chunks in the cache directory, but found %d\n", countCacheFiles());
+            okay = false;
+        }
+        // a chunk found in the directory moves back to memory, and pushes the least recently used one in memory out
+        if (okay && !hasChunk(cache, chunks[0])) {
+            printf("Failed to get chunk 0 from the cache directory\n");
+            okay = false;
+        }
+        cache.getStats(stats);
+        if (okay && (countCacheFiles() != 2 || stats.size != (unsigned long int) chunkSize * 2)) {
+            printf("Failed to promote chunk 0 to memory, %d chunks in the cache directory, size = %lu in memory\n", countCacheFiles(), stats.size);
+            okay = false;
+        }
+        // the directory drops its least recently used chunk when full
+        putChunk(cache, chunks[4]);
+        for (int i = 0; i < 5 && okay; i++) {
+            if (hasChunk(cache, chunks[i]) != (i != 1)) {
+                printf("Failed to %s chunk %d in the cache with a directory\n", i != 1? "find" : "evict", i);
+                okay = false;
+            }
+        }
+        if (okay)
+            printf("> Spill chunks to the cache directory, and promote chunks back to memory\n");
+    }
+    // chunks in the directory are removed with the cache
+    if (okay && countCacheFiles() != 0) {
+        printf("Found %d chunks left in the cache directory after the cache is removed\n", countCacheFiles());
+        okay = false;
+    }
+
+    // skip stale chunks, and drop invalidated ones
+    if (okay) {
+        ChunkCache cache(chunkSize * 2, CACHE_DIR, chunkSize * 2);
+        // a chunk read before the invalidation is not cached
+        unsigned long int generation = cache.getGeneration(CONTAINER_ID, chunks[0]);
+        cache.invalidate(CONTAINER_ID, chunks[0]);
+        cache.put(CONTAINER_ID, chunks[0], generation);
+        if (hasChunk(cache, chunks[0])) {
+            printf("Failed to skip chunk 0 read before the invalidation\n");
+            okay = false;
+        }
+        // a chunk read after the invalidation is cached
+        putChunk(cache, chunks[0]);
+        if (okay && !hasChunk(cache, chunks[0])) {
+            printf("Failed to cache chunk 0 read after the invalidation\n");
+            okay = false;
+        }
+        // invalidate a chunk in memory, and one in the directory
+        for (int i = 1; i < 4; i++)
+            putChunk(cache, chunks[i]);
+        cache.invalidate(CONTAINER_ID, chunks[3]);
+        cache.invalidate(CONTAINER_ID, chunks[0]);
+        for (int i = 0; i < 4 && okay; i++) {
+            bool invalidated = i == 0 || i == 3;
+            if (hasChunk(cache, chunks[i]) == invalidated) {
+                printf("Failed to %s chunk %d after invalidations\n", invalidated? "drop" : "find", i);
+                okay = false;
+            }
+        }
+        // the same chunk in another container is another entry
+        putChunk(cache, chunks[5]);
+        Chunk otherChunk;
+        otherChunk.setId(namespaceId, fileuuid, 5);
+        if (okay && cache.get(CONTAINER_ID + 1, otherChunk)) {
+            printf("Found chunk 5 of another container in the cache\n");
+            okay = false;
+        }
+        if (okay)
+            printf("> Skip stale chunks and drop invalidated chunks\n");
+    }
+    boost::filesystem::remove_all(CACHE_DIR);
+
+    printf("End of Chunk Cache Test\n");
+    printf("====================\n");
+
+    // 0 if okay is true, 1 otherwise
+    return !okay;
+}
@@ -2,7 +2,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <linux/limits.h>
+#include <boost/filesystem.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -31,6 +35,9 @@ extern "C" {
  * 8. Move chunks within containers
  * 9. Delete chunks in containers
  * 10. Check chunks existence
+ * 11. Restart a segment container after deletes, and after compaction
+ * 12. Migrate chunks (and old versions) in a flat FS container directory to hashed directories, and read them along the way
+ * 13. Write and sync chunk files of a size not aligned to blocks with direct I/O on each I/O engine
  *
  * Expect all operations to finish successfully
  *
@@ -104,6 +111,9 @@ int main(int argc, char **argv) {
         case ContainerType::AZURE_CONTAINER:
             c[i] = new AzureContainer(cid, cstr, key, capacity, proxyIP, proxyPort);
             break;
+        case ContainerType::SEGMENT_CONTAINER:
+            c[i] = new SegmentContainer(i, cstr.c_str(), capacity);
+            break;
         default:
             printf("> Container type %d not supported!\n", ctype);
             return -1;
@@ -227,10 +237,14 @@ int main(int argc, char **argv) {
     }
 
     for (int i = 0; i < NUM_CONTAINER; i++) {
+        // usage tracked along the chunk operations, and by a full scan
+        unsigned long int tracked = c[i]->getUsage();
         unsigned long int current = c[i]->getUsage(true);
         expected = (NUM_CHUNK / NUM_CONTAINER + (NUM_CHUNK % NUM_CONTAINER? 1 : 0)) * chunkSize;
         if (current != expected)
             printf("Failed to get the expected usage (%lu), but get %lu instead\n", expected, current);
+        if (tracked != current)
+            printf("Tracked usage (%lu) mismatches the usage in container (%lu)\n", tracked, current);
     }
 
     // check integrity of chunks
@@ -341,6 +355,220 @@ int main(int argc, char **argv) {
         delete c[i];
     }
 
+    // restart a segment container after deletes, and after compaction
+    if (okay && chunkSize > 0) {
+        const char *segmentDir = "./container_test_segments";
+        boost::filesystem::remove_all(segmentDir);
+        // fit a few chunks in each segment, so the deletes leave sealed segments mostly garbage
+        unsigned long int segmentSize = (chunkSize + 256) * 4;
+        Chunk segmentChunks[NUM_CHUNK * 2];
+        boost::uuids::uuid segmentFile = gen();
+        SegmentContainer *sc = new SegmentContainer(NUM_CONTAINER, segmentDir, 1 << 30, segmentSize);
+        for (int i = 0; i < NUM_CHUNK * 2 && okay; i++) {
+            segmentChunks[i].setId(namespaceId, segmentFile, i);
+            segmentChunks[i].size = chunkSize;
+            segmentChunks[i].data = (unsigned char *) malloc (chunkSize * sizeof(unsigned char));
+            memset(segmentChunks[i].data, 'A' + i, chunkSize);
+            segmentChunks[i].computeMD5();
+            okay = sc->putChunk(segmentChunks[i]);
+        }
+        // delete the chunks in the first segments
+        for (int i = 0; i < NUM_CHUNK && okay; i++)
+            okay = sc->deleteChunk(segmentChunks[i]);
+        if (!okay)
+            printf("Failed to put and delete chunks in segment container\n");
+
+        for (int round = 0; round < 2 && okay; round++) {
+            // restart the container, after compacting the segments in the second round
+            if (round == 1)
+                sc->compact();
+            delete sc;
+            sc = new SegmentContainer(NUM_CONTAINER, segmentDir, 1 << 30, segmentSize);
+            for (int i = 0; i < NUM_CHUNK * 2 && okay; i++) {
+                bool deleted = i < NUM_CHUNK;
+                if (sc->hasChunk(segmentChunks[i]) == deleted) {
+                    printf("Failed to find %s chunk %s after restart%s\n", deleted? "no deleted" : "the", segmentChunks[i].getChunkName().c_str(), round == 1? " and compaction" : "");
+                    okay = false;
+                    break;
+                }
+                if (deleted)
+                    continue;
+                Chunk readChunk;
+                readChunk.setId(namespaceId, segmentFile, i);
+                readChunk.copyMD5(segmentChunks[i]);
+                if (sc->getChunk(readChunk) == false || readChunk.size != chunkSize || memcmp(readChunk.data, segmentChunks[i].data, chunkSize) != 0) {
+                    printf("Chunk content mismatch after restart%s\n", round == 1? " and compaction" : "");
+                    okay = false;
+                    break;
+                }
+            }
+            printf("> Restart segment container%s\n", round == 1? " after compaction" : "");
+        }
+        delete sc;
+        boost::filesystem::remove_all(segmentDir);
+    }
+
+    // migrate chunks of a flat FS container directory to two levels of hashed directories
+    if (okay && chunkSize > 0) {
+        const char *layoutDir = "./container_test_layout";
+        const int numLayoutChunks = NUM_CHUNK * 8;
+        const char *oldVersion = "1600000000";
+        boost::filesystem::remove_all(layoutDir);
+        boost::filesystem::create_directories(layoutDir);
+
+        // seed the current and an old version of each chunk next to each other, as in the flat layout
+        Chunk layoutChunks[numLayoutChunks];
+        boost::uuids::uuid layoutFiles[NUM_CHUNK];
+        for (int i = 0; i < NUM_CHUNK; i++)
+            layoutFiles[i] = gen();
+        unsigned char *oldData = (unsigned char *) malloc (chunkSize * sizeof(unsigned char));
+        memset(oldData, 'z', chunkSize);
+        for (int i = 0; i < numLayoutChunks && okay; i++) {
+            layoutChunks[i].setId(namespaceId, layoutFiles[i % NUM_CHUNK], i / NUM_CHUNK);
+            layoutChunks[i].size = chunkSize;
+            layoutChunks[i].data = (unsigned char *) malloc (chunkSize * sizeof(unsigned char));
+            memset(layoutChunks[i].data, 'a' + i % 26, chunkSize);
+            layoutChunks[i].computeMD5();
+            std::string fpath = std::string(layoutDir) + "/" + layoutChunks[i].getChunkName();
+            std::string ofpath = fpath + "." + oldVersion;
+            FILE *f = fopen(fpath.c_str(), "w");
+            FILE *of = fopen(ofpath.c_str(), "w");
+            okay = f != NULL && of != NULL
+                    && fwrite(layoutChunks[i].data, 1, chunkSize, f) == (size_t) chunkSize
+                    && fwrite(oldData, 1, chunkSize, of) == (size_t) chunkSize;
+            if (f != NULL)
+                fclose(f);
+            if (of != NULL)
+                fclose(of);
+        }
+        if (!okay)
+            printf("Failed to seed chunks in the flat layout\n");
+
+        FsContainer *fc = okay? new FsContainer(NUM_CONTAINER, layoutDir, 1 << 30, /* dirLevels */ 2) : NULL;
+
+        // read the chunks during, and after the migration
+        for (int round = 0; round < 2 && okay; round++) {
+            if (round == 1) {
+                // wait for the migration to complete, i.e., the layout is saved
+                std::string layoutFile = std::string(layoutDir) + "/.layout";
+                for (int wait = 0; wait < 300 && !boost::filesystem::exists(layoutFile); wait++)
+                    usleep(100000);
+                if (!boost::filesystem::exists(layoutFile)) {
+                    printf("Failed to complete the layout migration\n");
+                    okay = false;
+                    break;
+                }
+            }
+            for (int i = 0; i < numLayoutChunks && okay; i++) {
+                Chunk readChunk;
+                readChunk.setId(namespaceId, layoutFiles[i % NUM_CHUNK], i / NUM_CHUNK);
+                readChunk.copyMD5(layoutChunks[i]);
+                if (fc->getChunk(readChunk) == false || readChunk.size != chunkSize || memcmp(readChunk.data, layoutChunks[i].data, chunkSize) != 0) {
+                    printf("Chunk %s content mismatch %s the layout migration\n", layoutChunks[i].getChunkName().c_str(), round == 0? "during" : "after");
+                    okay = false;
+                }
+            }
+            printf("> Read chunks %s the layout migration\n", round == 0? "during" : "after");
+        }
+
+        // all chunk files are moved two levels down, the old versions under the old chunk directory
+        if (okay) {
+            int numChunkFiles = 0, numOldChunkFiles = 0;
+            boost::filesystem::recursive_directory_iterator end;
+            for (boost::filesystem::recursive_directory_iterator it(layoutDir); it != end; ++it) {
+                std::string name = it->path().filename().string();
+                if (!boost::filesystem::is_regular_file(it->path()) || name[0] == '.')
+                    continue;
+                bool old = name.find('.') != std::string::npos;
+                if (it.depth() != (old? 3 : 2)) {
+                    printf("Chunk file %s is not migrated\n", it->path().c_str());
+                    okay = false;
+                }
+                (old? numOldChunkFiles : numChunkFiles)++;
+            }
+            if (numChunkFiles != numLayoutChunks || numOldChunkFiles != numLayoutChunks) {
+                printf("Found %d chunks and %d old chunks after the layout migration, expect %d of each\n", numChunkFiles, numOldChunkFiles, numLayoutChunks);
+                okay = false;
+            }
+        }
+
+        // old versions are still found for reverts after the migration
+        for (int i = 0; i < NUM_CHUNK && okay; i++) {
+            Chunk revertedChunk;
+            revertedChunk.setId(namespaceId, layoutFiles[i % NUM_CHUNK], i / NUM_CHUNK);
+            snprintf(revertedChunk.chunkVersion, CHUNK_VERSION_MAX_LEN, "%s", oldVersion);
+            Chunk readChunk;
+            readChunk.setId(namespaceId, layoutFiles[i % NUM_CHUNK], i / NUM_CHUNK);
+            if (
+                fc->revertChunk(revertedChunk) == false
+                || fc->getChunk(readChunk, /* skipVerification */ true) == false
+                || readChunk.size != chunkSize
+                || memcmp(readChunk.data, oldData, chunkSize) != 0
+            ) {
+                printf("Failed to revert chunk %s to the old version after the layout migration\n", layoutChunks[i].getChunkName().c_str());
+                okay = false;
+            }
+        }
+        if (okay)
+            printf("> Migrate chunks to the hashed directory layout\n");
+
+        delete fc;
+        free(oldData);
+        boost::filesystem::remove_all(layoutDir);
+    }
+
+    // write and sync chunk files with direct I/O, whose padding to the block size must not remain in the file
+    if (okay) {
+        const char *engineDir = "./container_test_engines";
+        const char *engineNames[2] = { "posix", "io_uring" };
+        const size_t sizes[3] = { 4096 * 3 + 100, (1 << 20) + 7, 1 };
+        boost::filesystem::remove_all(engineDir);
+        boost::filesystem::create_directories(engineDir);
+        for (int e = 0; e < 2 && okay; e++) {
+            FsIoEngine *engine = FsIoEngine::create(engineNames[e]);
+            std::vector<FsIoEngine::WriteTask> tasks;
+            std::vector<std::string> data, paths;
+            for (int i = 0; i < 3; i++) {
+                data.push_back(std::string(sizes[i], 'A' + i));
+                paths.push_back(std::string(engineDir) + "/" + engine->getName() + "_" + std::to_string(i));
+                FsIoEngine::WriteTask task;
+                // the file system may not support direct I/O
+                task.direct = true;
+                task.fd = open(paths.at(i).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+                if (task.fd == -1 && errno == EINVAL) {
+                    task.direct = false;
+                    task.fd = open(paths.at(i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                }
+                task.data = (const unsigned char *) data.at(i).data();
+                task.size = sizes[i];
+                task.sync = true;
+                task.success = false;
+                tasks.push_back(task);
+            }
+            if (!engine->write(tasks)) {
+                printf("Failed to write chunk files with the %s I/O engine\n", engine->getName());
+                okay = false;
+            }
+            for (int i = 0; i < 3; i++) {
+                close(tasks.at(i).fd);
+                // check the size, and the content, of the file written
+                std::string content(sizes[i] + 1, 0);
+                FILE *f = fopen(paths.at(i).c_str(), "r");
+                size_t size = f == NULL? 0 : fread(&content[0], 1, content.size(), f);
+                if (f != NULL)
+                    fclose(f);
+                if (okay && (size != sizes[i] || content.compare(0, size, data.at(i)) != 0)) {
+                    printf("Chunk file of size %lu written with the %s I/O engine (direct = %d) has %lu bytes or mismatched content\n", sizes[i], engine->getName(), tasks.at(i).direct, size);
+                    okay = false;
+                }
+            }
+            if (okay)
+                printf("> Write and sync chunk files with direct I/O on the %s I/O engine\n", engine->getName());
+            delete engine;
+        }
+        boost::filesystem::remove_all(engineDir);
+    }
+
     aos_http_io_deinitialize();
     Aws::ShutdownAPI(options);
 
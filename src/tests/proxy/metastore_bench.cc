@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "../../common/define.hh"
+#include "../../common/config.hh"
+#include "../../proxy/metastore/metastore.hh"
+#include "../../proxy/metastore/redis_metastore.hh"
+#include "../../proxy/metastore/local_metastore.hh"
+
+static int numThreads = 8;
+static int numFiles = 10000;
+static int numChunksPerFile = 0;          // 0 to use n of the default storage class
+static int numUniqueBlocksPerFile = 0;
+static int numDuplicateBlocksPerFile = 0;
+static int listPageSize = 1000;
+static unsigned char namespaceId = 0;
+static std::string phases = "put,get,lock,list,journal,delete";
+
+static File *files = NULL;
+static MetaStore *metastore = NULL;
+
+static MetaStore *newMetaStore();
+static void initFiles();
+static void usage(const char *prog);
+static bool runPhase(const std::string &name, int numOps, const std::function<bool (int)> &op);
+
+int main(int argc, char **argv) {
+
+    /**
+     * Benchmark of metastore throughput and latency
+     *
+     * Each phase runs one type of operation on all files using a number of threads,
+     * and reports the throughput and latency percentiles of the operations.
+     *
+     * 1. put: write the file metadata
+     * 2. get: read the file metadata (with block lists)
+     * 3. lock: lock and unlock a file
+     * 4. list: list the files in pages
+     * 5. journal: add, complete and clear the journal records of all chunks of a file
+     * 6. delete: delete the file metadata
+     *
+     **/
+
+    std::string configPath;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:f:k:u:d:p:s:P:h")) != -1) {
+        switch (opt) {
+        case 'c': configPath = optarg; break;
+        case 't': numThreads = atoi(optarg); break;
+        case 'f': numFiles = atoi(optarg); break;
+        case 'k': numChunksPerFile = atoi(optarg); break;
+        case 'u': numUniqueBlocksPerFile = atoi(optarg); break;
+        case 'd': numDuplicateBlocksPerFile = atoi(optarg); break;
+        case 'p': listPageSize = atoi(optarg); break;
+        case 's': namespaceId = atoi(optarg); break;
+        case 'P': phases = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h'? 0 : 1;
+        }
+    }
+    if (numThreads <= 0 || numFiles <= 0 || numChunksPerFile < 0 || numUniqueBlocksPerFile < 0 || numDuplicateBlocksPerFile < 0 || listPageSize <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // config
+    Config &config = Config::getInstance();
+    if (!configPath.empty()) {
+        config.setConfigPath(configPath);
+    } else {
+        config.setConfigPath();
+    }
+
+    FLAGS_logtostderr = true;
+    FLAGS_minloglevel = google::GLOG_ERROR;
+    google::InitGoogleLogging(argv[0]);
+
+    metastore = newMetaStore();
+
+    initFiles();
+
+    printf("MetaStore Benchmark: %d threads, %d files, %d chunks, %d unique blocks and %d duplicate blocks per file\n", numThreads, numFiles, files[0].numChunks, numUniqueBlocksPerFile, numDuplicateBlocksPerFile);
+    printf("%-10s %10s %8s %10s %12s %10s %10s %10s\n", "phase", "ops", "errors", "time (s)", "ops/s", "p50 (us)", "p99 (us)", "p999 (us)");
+
+    bool okay = true;
+    std::string phase;
+    for (size_t start = 0; start <= phases.size(); ) {
+        size_t end = phases.find(',', start);
+        if (end == std::string::npos)
+            end = phases.size();
+        phase = phases.substr(start, end - start);
+        start = end + 1;
+
+        if (phase == "put") {
+            // writers hold the file lock, as the proxy does
+            okay = runPhase(phase, numFiles, [](int i) {
+                if (!metastore->lockFile(files[i]))
+                    return false;
+                bool written = metastore->putMeta(files[i]);
+                return metastore->unlockFile(files[i]) && written;
+            }) && okay;
+        } else if (phase == "get") {
+            okay = runPhase(phase, numFiles, [](int i) {
+                File f;
+                f.copyName(files[i]);
+                f.version = files[i].version;
+                return metastore->getMeta(f);
+            }) && okay;
+        } else if (phase == "lock") {
+            okay = runPhase(phase, numFiles, [](int i) { return metastore->lockFile(files[i]) && metastore->unlockFile(files[i]); }) && okay;
+        } else if (phase == "list") {
+            // each thread lists all files
+            okay = runPhase(phase, numThreads, [](int) {
+                std::string cursor = "0";
+                unsigned long int numListed = 0;
+                do {
+                    FileInfo *list = NULL;
+                    numListed += metastore->getFileListPage(&list, cursor, listPageSize, namespaceId);
+                    delete [] list;
+                } while (cursor != "0" && !cursor.empty());
+                return numListed >= (unsigned long int) numFiles;
+            }) && okay;
+        } else if (phase == "journal") {
+            okay = runPhase(phase, numFiles, [](int i) {
+                std::vector<Chunk> chunks(files[i].chunks, files[i].chunks + files[i].numChunks);
+                std::vector<int> containerIds(files[i].containerIds, files[i].containerIds + files[i].numChunks);
+                return metastore->addChunksToJournal(files[i], chunks, containerIds, /* isWrite */ true)
+                        && metastore->updateChunksInJournal(files[i], chunks, containerIds, /* isWrite */ true, /* deleteRecord */ false)
+                        && metastore->updateChunksInJournal(files[i], chunks, containerIds, /* isWrite */ true, /* deleteRecord */ true);
+            }) && okay;
+        } else if (phase == "delete") {
+            okay = runPhase(phase, numFiles, [](int i) {
+                if (!metastore->lockFile(files[i]))
+                    return false;
+                bool deleted = metastore->deleteMeta(files[i]);
+                return metastore->unlockFile(files[i]) && deleted;
+            }) && okay;
+        } else if (!phase.empty()) {
+            printf("Unknown phase %s\n", phase.c_str());
+            okay = false;
+        }
+    }
+
+    delete metastore;
+    delete [] files;
+
+    return okay? 0 : 1;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -c <path>      configuration directory\n"
+           "  -t <num>       number of threads (default: %d)\n"
+           "  -f <num>       number of files (default: %d)\n"
+           "  -k <num>       number of chunks per file (default: n of the default storage class)\n"
+           "  -u <num>       number of unique blocks per file (default: %d)\n"
+           "  -d <num>       number of duplicate blocks per file (default: %d)\n"
+           "  -p <num>       page size of file listing (default: %d)\n"
+           "  -s <id>        namespace id of the files (default: %d)\n"
+           "  -P <phases>    comma-separated phases to run, among put,get,lock,list,journal,delete (default: %s)\n"
+           , prog, numThreads, numFiles, numUniqueBlocksPerFile, numDuplicateBlocksPerFile, listPageSize, namespaceId, phases.c_str()
+    );
+}
+
+static bool runPhase(const std::string &name, int numOps, const std::function<bool (int)> &op) {
+    std::vector<std::vector<double> > latencies(numThreads);
+    std::atomic<int> next(0), numErrors(0);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&, t]() {
+            std::vector<double> &lat = latencies.at(t);
+            for (int i = next++; i < numOps; i = next++) {
+                auto opStart = std::chrono::steady_clock::now();
+                if (!op(i))
+                    numErrors++;
+                lat.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - opStart).count());
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto &lat : latencies)
+        all.insert(all.end(), lat.begin(), lat.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all.empty()? 0 : all.at(std::min(all.size() - 1, (size_t) (all.size() * p))); };
+
+    printf("%-10s %10d %8d %10.3lf %12.1lf %10.1lf %10.1lf %10.1lf\n"
+            , name.c_str(), numOps, numErrors.load(), elapsed
+            , elapsed > 0? numOps / elapsed : 0
+            , percentile(0.5), percentile(0.99), percentile(0.999)
+    );
+
+    return numErrors == 0;
+}
+
+static void initFiles() {
+    Config &config = Config::getInstance();
+
+    int n = config.getN();
+    int chunkSize = config.getMaxChunkSize();
+    int numChunks = numChunksPerFile > 0? numChunksPerFile : n;
+    int blockSize = 4096;
+
+    files = new File[numFiles];
+    for (int i = 0; i < numFiles; i++) {
+        File &f = files[i];
+        std::string name = "metastore_bench/file_" + std::to_string(i);
+        f.setName(name.c_str(), name.size());
+        f.genUUID();
+        f.namespaceId = namespaceId;
+        f.version = 0;
+        f.size = (unsigned long int) chunkSize * numChunks;
+        f.ctime = f.atime = f.mtime = f.tctime = time(NULL);
+        memset(f.md5, i % 256, MD5_DIGEST_LENGTH);
+
+        f.codingMeta.coding = config.getCodingScheme();
+        f.codingMeta.k = config.getK();
+        f.codingMeta.n = n;
+        f.storageClass = config.getDefaultStorageClass();
+
+        // chunks
+        f.numStripes = (numChunks + n - 1) / n;
+        f.numChunks = numChunks;
+        f.initChunksAndContainerIds();
+        for (int c = 0; c < numChunks; c++) {
+            f.chunks[c].setId(f.namespaceId, f.uuid, c);
+            f.chunks[c].size = chunkSize;
+            memset(f.chunks[c].md5, c % 256, MD5_DIGEST_LENGTH);
+            f.containerIds[c] = c % 256;
+        }
+
+        // deduplication block lists
+        Fingerprint fp;
+        unsigned long int offset = 0;
+        for (int b = 0; b < numUniqueBlocksPerFile; b++, offset += blockSize) {
+            std::string bytes = name + "_" + std::to_string(b);
+            fp.set(bytes.data(), bytes.size());
+            f.uniqueBlocks.insert(std::make_pair(BlockLocation::InObjectLocation(offset, blockSize), std::make_pair(fp, (int) offset)));
+        }
+        for (int b = 0; b < numDuplicateBlocksPerFile; b++, offset += blockSize) {
+            std::string bytes = name + "_" + std::to_string(b % std::max(numUniqueBlocksPerFile, 1));
+            fp.set(bytes.data(), bytes.size());
+            f.duplicateBlocks.insert(std::make_pair(BlockLocation::InObjectLocation(offset, blockSize), fp));
+        }
+    }
+}
+
+MetaStore *newMetaStore() {
+    Config &config = Config::getInstance();
+
+    switch (config.getProxyMetaStoreType()) {
+    case MetaStoreType::REDIS:
+        return new RedisMetaStore();
+    case MetaStoreType::LOCAL:
+        return new LocalMetaStore();
+    }
+    return new RedisMetaStore();
+}
@@ -10,6 +10,7 @@
 #include "../../common/checksum_calculator.hh"
 #include "../../proxy/metastore/metastore.hh"
 #include "../../proxy/metastore/redis_metastore.hh"
+#include "../../proxy/metastore/local_metastore.hh"
 
 static const size_t numFilesToTest = 1024;
 static const int maxFileNameLength = 1024;
@@ -26,6 +27,8 @@ static void updateFiles();
 static bool compareFile(size_t, const File&, const File&);
 static void exitWithError();
 static void readAndCheckFileMeta();
+static bool putMetaLocked(File &file);
+static bool deleteMetaLocked(File &file);
 
 int main(int argc, char **argv) {
 
@@ -77,9 +80,14 @@ int main(int argc, char **argv) {
     boost::timer::cpu_timer mytimer;
     // test 1: file metadata write
     {
+        // changes to files not locked are fenced off by the Redis metastore
+        if (dynamic_cast<RedisMetaStore *>(metastore) != NULL && metastore->putMeta(f[0])) {
+            printf(">> Failed to reject the metadata write of file 0 without a lock\n");
+            exitWithError();
+        }
         // write file metadata
         for (size_t i = 0; i < numFilesToTest; i++)
-            if (!metastore->putMeta(f[i])) {
+            if (!putMetaLocked(f[i])) {
                 printf(">> Failed to put file %lu metadata\n", i);
                 exitWithError();
             }
@@ -94,7 +102,7 @@ int main(int argc, char **argv) {
         // update file metadata
         updateFiles();
         for (size_t i = 0; i < numFilesToTest; i++)
-            metastore->putMeta(f[i]);
+            putMetaLocked(f[i]);
         // read back and check
         readAndCheckFileMeta();
     }
@@ -147,7 +155,42 @@ int main(int argc, char **argv) {
     }
     printf("> Test %d completes: Unlock %lu files in %.3lf seconds\n", ++testCount, numFilesToTest, mytimer.elapsed().wall / 1e9);
 
-    // test 5: file listing
+    // test 5: shared file lock
+    mytimer.start();
+    {
+        for (size_t i = 0; i < numFilesToTest; i++) {
+            // readers share the lock
+            if (!metastore->lockFile(f[i], /* shared */ true) || !metastore->lockFile(f[i], /* shared */ true)) {
+                printf(">> Failed to share the lock of file %lu\n", i);
+                exitWithError();
+            }
+            // writer waits for all readers
+            if (metastore->lockFile(f[i])) {
+                printf(">> Failed to prevent locking of file %lu under shared locks\n", i);
+                exitWithError();
+            }
+            if (!metastore->unlockFile(f[i], /* shared */ true) || metastore->lockFile(f[i])) {
+                printf(">> Failed to keep the remaining shared lock of file %lu\n", i);
+                exitWithError();
+            }
+            if (!metastore->unlockFile(f[i], /* shared */ true) || !metastore->lockFile(f[i])) {
+                printf(">> Failed to lock file %lu after releasing shared locks\n", i);
+                exitWithError();
+            }
+            // readers wait for the writer, which holds a fencing token
+            if (metastore->lockFile(f[i], /* shared */ true) || metastore->getLockToken(f[i]) == 0) {
+                printf(">> Failed to hold the exclusive lock of file %lu\n", i);
+                exitWithError();
+            }
+            if (!metastore->unlockFile(f[i]) || metastore->getLockToken(f[i]) != 0) {
+                printf(">> Failed to unlock file %lu after shared lock tests\n", i);
+                exitWithError();
+            }
+        }
+    }
+    printf("> Test %d completes: Shared lock of %lu files in %.3lf seconds\n", ++testCount, numFilesToTest, mytimer.elapsed().wall / 1e9);
+
+    // test 6: file listing
     mytimer.start();
     {
         FileInfo *flist;
@@ -227,12 +270,12 @@ int main(int argc, char **argv) {
     }
     printf("> Test %d completes: List %lu files in %.3lf seconds\n", ++testCount, numFilesToTest, mytimer.elapsed().wall / 1e9);
 
-    // test 6: file metadata delete
+    // test 7: file metadata delete
     mytimer.start();
     { 
         // delete file metadata
         for (size_t i = 0; i < numFilesToTest; i++) {
-            if (!metastore->deleteMeta(f[i])) {
+            if (!deleteMetaLocked(f[i])) {
                 printf(">> Failed to delete file %lu\n", i);
                 exitWithError();
             }
@@ -240,7 +283,7 @@ int main(int argc, char **argv) {
     }
     printf("> Test %d completes: Delete %lu files in %.3lf seconds\n", ++testCount, numFilesToTest, mytimer.elapsed().wall / 1e9);
 
-    // test 7: file repair list
+    // test 8: file repair list
     mytimer.start();
     {
         // mark files for repair
@@ -289,6 +332,62 @@ int main(int argc, char **argv) {
     }
     printf("> Test %d completes: Mark and unmark %lu files for repair in %.3lf seconds\n", ++testCount, numFilesToTest, mytimer.elapsed().wall / 1e9);
 
+    // test 9: group-committed chunk journal
+    mytimer.start();
+    const int numJournaledChunks = 8;
+    {
+        std::vector<Chunk> chunks(numJournaledChunks);
+        std::vector<int> containerIds(numJournaledChunks);
+        for (int i = 0; i < numJournaledChunks; i++) {
+            chunks.at(i).setChunkId(i);
+            chunks.at(i).size = chunkSize;
+            memset(chunks.at(i).md5, i, MD5_DIGEST_LENGTH);
+            containerIds.at(i) = i % 3;
+        }
+        FileInfo finfo;
+        finfo.namespaceId = f[0].namespaceId;
+        finfo.name = f[0].name;
+        finfo.nameLength = f[0].nameLength;
+        finfo.version = f[0].version;
+        std::vector<std::tuple<Chunk, int, bool, bool>> records;
+        // add all records at once
+        if (!metastore->addChunksToJournal(f[0], chunks, containerIds, /* isWrite */ true) || !metastore->fileHasJournal(f[0])) {
+            printf(">> Failed to add %d chunks to the journal\n", numJournaledChunks);
+            exitWithError();
+        }
+        metastore->getFileJournal(finfo, records);
+        if (records.size() != (size_t) numJournaledChunks) {
+            printf(">> Number of journal records mismatched (%lu vs %d)\n", records.size(), numJournaledChunks);
+            exitWithError();
+        }
+        for (auto &record : records) {
+            if (!std::get<2>(record) || !std::get<3>(record) || std::get<1>(record) != containerIds.at(std::get<0>(record).getChunkId())) {
+                printf(">> Unexpected journal record of chunk %d\n", std::get<0>(record).getChunkId());
+                exitWithError();
+            }
+        }
+        // mark all records as completed
+        if (!metastore->updateChunksInJournal(f[0], chunks, containerIds, /* isWrite */ true, /* deleteRecord */ false)) {
+            printf(">> Failed to update %d chunks in the journal\n", numJournaledChunks);
+            exitWithError();
+        }
+        records.clear();
+        metastore->getFileJournal(finfo, records);
+        for (auto &record : records) {
+            if (std::get<3>(record)) {
+                printf(">> Journal record of chunk %d is not updated\n", std::get<0>(record).getChunkId());
+                exitWithError();
+            }
+        }
+        // remove all records
+        if (!metastore->updateChunksInJournal(f[0], chunks, containerIds, /* isWrite */ true, /* deleteRecord */ true) || metastore->fileHasJournal(f[0])) {
+            printf(">> Failed to remove %d chunks from the journal\n", numJournaledChunks);
+            exitWithError();
+        }
+        finfo.name = 0;
+    }
+    printf("> Test %d completes: Add, update and remove a journal of %d chunks in %.3lf seconds\n", ++testCount, numJournaledChunks, mytimer.elapsed().wall / 1e9);
+
     printf("End of MetaStore Test\n");
     printf("=====================\n");
 
@@ -301,6 +400,9 @@ MetaStore *newMetaStore() {
     switch (config.getProxyMetaStoreType()) {
     case MetaStoreType::REDIS:
         return new RedisMetaStore();
+    case MetaStoreType::LOCAL:
+        return new LocalMetaStore();
+    }
     return new RedisMetaStore();
 }
 
@@ -609,11 +711,25 @@ static bool compareFile(size_t i, const File &origin, const File &retrieved) {
 static void exitWithError() {
     // clean up files
     for (size_t i = 0; i < numFilesToTest; i++)
-        metastore->deleteMeta(f[i]);
+        deleteMetaLocked(f[i]);
     // exit with non-zero value
     exit(1);
 }
 
+static bool putMetaLocked(File &file) {
+    if (!metastore->lockFile(file))
+        return false;
+    bool okay = metastore->putMeta(file);
+    return metastore->unlockFile(file) && okay;
+}
+
+static bool deleteMetaLocked(File &file) {
+    if (!metastore->lockFile(file))
+        return false;
+    bool okay = metastore->deleteMeta(file);
+    return metastore->unlockFile(file) && okay;
+}
+
 static void readAndCheckFileMeta() {
     for (size_t i = 0; i < numFilesToTest; i++) {
         // get metadata